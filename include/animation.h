@@ -0,0 +1,360 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <assimp/scene.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// SSE on any x86-64 build, scalar otherwise
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ANIMATION_SSE
+#include <emmintrin.h>
+#endif
+
+using std::string, std::vector;
+
+// assimp matrices are row major
+inline glm::mat4 toMat4(const aiMatrix4x4& m)
+{
+	return glm::mat4(
+		m.a1, m.b1, m.c1, m.d1,
+		m.a2, m.b2, m.c2, m.d2,
+		m.a3, m.b3, m.c3, m.d3,
+		m.a4, m.b4, m.c4, m.d4);
+}
+
+// a bone some mesh is skinned to: its index in the bone palette and the matrix from mesh space into its bind space
+struct BoneInfo {
+	int id;
+	glm::mat4 offset;
+};
+
+// The node hierarchy of a model flattened so every parent comes before its children. Joints that skin vertices have
+// a palette index, the others only carry their transform down to their children.
+struct Skeleton {
+	vector<string> names;
+	vector<int> parents;			// -1 for the root
+	vector<glm::mat4> bindLocal;	// aiNode::mTransformation, used where a clip has no track
+	vector<int> paletteIndices;		// BoneInfo::id or -1
+	vector<glm::mat4> offsets;		// BoneInfo::offset of skinning joints
+	glm::mat4 globalInverse = glm::mat4(1.0f);
+	unsigned int boneCount = 0;		// palette matrices per character
+
+	size_t size() const
+	{
+		return names.size();
+	}
+
+	bool empty() const
+	{
+		return boneCount == 0;
+	}
+
+	int find(const string& name) const
+	{
+		for (size_t i = 0; i < names.size(); i++)
+			if (names[i] == name)
+				return static_cast<int>(i);
+		return -1;
+	}
+
+	void addJoint(const string& name, int parent, const glm::mat4& local, const BoneInfo* bone)
+	{
+		names.push_back(name);
+		parents.push_back(parent);
+		bindLocal.push_back(local);
+		paletteIndices.push_back(bone ? bone->id : -1);
+		offsets.push_back(bone ? bone->offset : glm::mat4(1.0f));
+		if (bone)
+			boneCount = std::max(boneCount, static_cast<unsigned int>(bone->id) + 1);
+	}
+
+	// depth first from the root, bones are the ones Model::processMesh collected from aiMesh::mBones
+	static Skeleton fromScene(const aiScene* scene, const std::map<string, BoneInfo>& bones)
+	{
+		Skeleton skeleton;
+		skeleton.globalInverse = glm::inverse(toMat4(scene->mRootNode->mTransformation));
+		skeleton.addNode(scene->mRootNode, -1, bones);
+		return skeleton;
+	}
+
+private:
+	void addNode(const aiNode* node, int parent, const std::map<string, BoneInfo>& bones)
+	{
+		auto bone = bones.find(node->mName.C_Str());
+		addJoint(node->mName.C_Str(), parent, toMat4(node->mTransformation), bone == bones.end() ? nullptr : &bone->second);
+		const int index = static_cast<int>(names.size() - 1);
+		for (unsigned int i = 0; i < node->mNumChildren; i++)
+			addNode(node->mChildren[i], index, bones);
+	}
+};
+
+// the keyframes of one joint, every channel sorted by time in ticks
+struct JointTrack {
+	int joint = -1;
+	vector<float> translationTimes;
+	vector<glm::vec3> translations;
+	vector<float> rotationTimes;
+	vector<glm::quat> rotations;
+	vector<float> scaleTimes;
+	vector<glm::vec3> scales;
+};
+
+struct AnimationClip {
+	string name;
+	float duration = 0.0f;			// in ticks
+	float ticksPerSecond = 25.0f;
+	vector<JointTrack> tracks;
+
+	float seconds() const
+	{
+		return duration / ticksPerSecond;
+	}
+
+	// every aiAnimation of the scene, channels for nodes the skeleton doesn't have are dropped
+	static vector<AnimationClip> fromScene(const aiScene* scene, const Skeleton& skeleton)
+	{
+		vector<AnimationClip> clips;
+		for (unsigned int a = 0; a < scene->mNumAnimations; a++)
+		{
+			const aiAnimation* animation = scene->mAnimations[a];
+			AnimationClip clip;
+			clip.name = animation->mName.C_Str();
+			clip.duration = static_cast<float>(animation->mDuration);
+			clip.ticksPerSecond = animation->mTicksPerSecond > 0.0 ? static_cast<float>(animation->mTicksPerSecond) : 25.0f;
+			for (unsigned int c = 0; c < animation->mNumChannels; c++)
+			{
+				const aiNodeAnim* channel = animation->mChannels[c];
+				JointTrack track;
+				track.joint = skeleton.find(channel->mNodeName.C_Str());
+				if (track.joint < 0)
+					continue;
+				for (unsigned int k = 0; k < channel->mNumPositionKeys; k++)
+				{
+					const aiVectorKey& key = channel->mPositionKeys[k];
+					track.translationTimes.push_back(static_cast<float>(key.mTime));
+					track.translations.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+				}
+				for (unsigned int k = 0; k < channel->mNumRotationKeys; k++)
+				{
+					const aiQuatKey& key = channel->mRotationKeys[k];
+					track.rotationTimes.push_back(static_cast<float>(key.mTime));
+					track.rotations.push_back(glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z));
+				}
+				for (unsigned int k = 0; k < channel->mNumScalingKeys; k++)
+				{
+					const aiVectorKey& key = channel->mScalingKeys[k];
+					track.scaleTimes.push_back(static_cast<float>(key.mTime));
+					track.scales.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+				}
+				clip.tracks.push_back(std::move(track));
+			}
+			clips.push_back(std::move(clip));
+		}
+		return clips;
+	}
+};
+
+// Local joint transforms in structure of arrays form, one lane per joint. The lane count is padded to a multiple of
+// four so the SIMD loops never need a scalar tail.
+struct Pose {
+	vector<float> tx, ty, tz;
+	vector<float> rx, ry, rz, rw;
+	vector<float> sx, sy, sz;
+
+	void resize(size_t joints)
+	{
+		const size_t lanes = (joints + 3) & ~size_t(3);
+		for (vector<float>* channel : { &tx, &ty, &tz, &rx, &ry, &rz, &sx, &sy, &sz })
+			channel->assign(lanes, 0.0f);
+		rw.assign(lanes, 1.0f);
+		std::fill(sx.begin(), sx.end(), 1.0f);
+		std::fill(sy.begin(), sy.end(), 1.0f);
+		std::fill(sz.begin(), sz.end(), 1.0f);
+	}
+
+	size_t lanes() const
+	{
+		return tx.size();
+	}
+
+	void set(size_t joint, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale)
+	{
+		tx[joint] = translation.x; ty[joint] = translation.y; tz[joint] = translation.z;
+		rx[joint] = rotation.x; ry[joint] = rotation.y; rz[joint] = rotation.z; rw[joint] = rotation.w;
+		sx[joint] = scale.x; sy[joint] = scale.y; sz[joint] = scale.z;
+	}
+
+	glm::mat4 localMatrix(size_t joint) const
+	{
+		glm::mat4 matrix = glm::mat4_cast(glm::quat(rw[joint], rx[joint], ry[joint], rz[joint]));
+		matrix[0] *= sx[joint];
+		matrix[1] *= sy[joint];
+		matrix[2] *= sz[joint];
+		matrix[3] = glm::vec4(tx[joint], ty[joint], tz[joint], 1.0f);
+		return matrix;
+	}
+
+	// the skeleton's bind transforms, what joints without a track keep
+	void setBind(const Skeleton& skeleton)
+	{
+		resize(skeleton.size());
+		for (size_t joint = 0; joint < skeleton.size(); joint++)
+		{
+			const glm::mat4& local = skeleton.bindLocal[joint];
+			const glm::vec3 scale(glm::length(glm::vec3(local[0])), glm::length(glm::vec3(local[1])), glm::length(glm::vec3(local[2])));
+			const glm::mat3 rotation(glm::vec3(local[0]) / scale.x, glm::vec3(local[1]) / scale.y, glm::vec3(local[2]) / scale.z);
+			set(joint, glm::vec3(local[3]), glm::quat_cast(rotation), scale);
+		}
+	}
+};
+
+// Where every channel of every track found its key the last time the clip was sampled. Clips are played forward,
+// so the next sample starts from there and usually moves by at most one key instead of searching the whole track.
+struct KeyCache {
+	vector<uint32_t> translation, rotation, scale;
+
+	void reset(const AnimationClip& clip)
+	{
+		translation.assign(clip.tracks.size(), 0);
+		rotation.assign(clip.tracks.size(), 0);
+		scale.assign(clip.tracks.size(), 0);
+	}
+};
+
+// the last key at or before time, starting from the cached one. Going back in time (a loop) restarts at the first key
+inline uint32_t findKey(const vector<float>& times, float time, uint32_t cached)
+{
+	if (cached >= times.size() || times[cached] > time)
+		cached = 0;
+	while (cached + 1 < times.size() && times[cached + 1] <= time)
+		cached++;
+	return cached;
+}
+
+// interpolation factor between key and the next one, 0 past the last key
+inline float keyFactor(const vector<float>& times, uint32_t key, float time)
+{
+	if (key + 1 >= times.size())
+		return 0.0f;
+	const float span = times[key + 1] - times[key];
+	return span > 0.0f ? std::clamp((time - times[key]) / span, 0.0f, 1.0f) : 0.0f;
+}
+
+// writes the clip's transforms at time (ticks) into pose, joints without a track keep what pose already holds
+inline void sampleClip(const AnimationClip& clip, float time, KeyCache& cache, Pose& pose)
+{
+	if (cache.translation.size() != clip.tracks.size())
+		cache.reset(clip);
+
+	for (size_t t = 0; t < clip.tracks.size(); t++)
+	{
+		const JointTrack& track = clip.tracks[t];
+		const size_t joint = static_cast<size_t>(track.joint);
+		if (!track.translations.empty())
+		{
+			const uint32_t key = cache.translation[t] = findKey(track.translationTimes, time, cache.translation[t]);
+			const uint32_t next = std::min<uint32_t>(key + 1, static_cast<uint32_t>(track.translations.size() - 1));
+			const glm::vec3 value = glm::mix(track.translations[key], track.translations[next], keyFactor(track.translationTimes, key, time));
+			pose.tx[joint] = value.x; pose.ty[joint] = value.y; pose.tz[joint] = value.z;
+		}
+		if (!track.rotations.empty())
+		{
+			const uint32_t key = cache.rotation[t] = findKey(track.rotationTimes, time, cache.rotation[t]);
+			const uint32_t next = std::min<uint32_t>(key + 1, static_cast<uint32_t>(track.rotations.size() - 1));
+			const glm::quat value = glm::normalize(glm::slerp(track.rotations[key], track.rotations[next], keyFactor(track.rotationTimes, key, time)));
+			pose.rx[joint] = value.x; pose.ry[joint] = value.y; pose.rz[joint] = value.z; pose.rw[joint] = value.w;
+		}
+		if (!track.scales.empty())
+		{
+			const uint32_t key = cache.scale[t] = findKey(track.scaleTimes, time, cache.scale[t]);
+			const uint32_t next = std::min<uint32_t>(key + 1, static_cast<uint32_t>(track.scales.size() - 1));
+			const glm::vec3 value = glm::mix(track.scales[key], track.scales[next], keyFactor(track.scaleTimes, key, time));
+			pose.sx[joint] = value.x; pose.sy[joint] = value.y; pose.sz[joint] = value.z;
+		}
+	}
+}
+
+// one joint at a time, the reference the SIMD blend must agree with
+inline void blendPosesReference(const Pose& a, const Pose& b, float weight, Pose& out)
+{
+	for (size_t i = 0; i < a.lanes(); i++)
+	{
+		out.tx[i] = a.tx[i] + (b.tx[i] - a.tx[i]) * weight;
+		out.ty[i] = a.ty[i] + (b.ty[i] - a.ty[i]) * weight;
+		out.tz[i] = a.tz[i] + (b.tz[i] - a.tz[i]) * weight;
+		out.sx[i] = a.sx[i] + (b.sx[i] - a.sx[i]) * weight;
+		out.sy[i] = a.sy[i] + (b.sy[i] - a.sy[i]) * weight;
+		out.sz[i] = a.sz[i] + (b.sz[i] - a.sz[i]) * weight;
+
+		// nlerp through the shorter arc
+		const float dot = a.rx[i] * b.rx[i] + a.ry[i] * b.ry[i] + a.rz[i] * b.rz[i] + a.rw[i] * b.rw[i];
+		const float wb = dot < 0.0f ? -weight : weight, wa = 1.0f - weight;
+		const float x = a.rx[i] * wa + b.rx[i] * wb, y = a.ry[i] * wa + b.ry[i] * wb;
+		const float z = a.rz[i] * wa + b.rz[i] * wb, w = a.rw[i] * wa + b.rw[i] * wb;
+		const float length = std::sqrt(x * x + y * y + z * z + w * w);
+		const float scale = length > 0.0f ? 1.0f / length : 0.0f;
+		out.rx[i] = x * scale; out.ry[i] = y * scale; out.rz[i] = z * scale; out.rw[i] = w * scale;
+	}
+}
+
+// out = a blended toward b by weight: translations and scales lerp, rotations nlerp through the shorter arc.
+// Four joints per SSE instruction, out may alias a or b
+inline void blendPoses(const Pose& a, const Pose& b, float weight, Pose& out)
+{
+#if defined(ANIMATION_SSE)
+	const __m128 w = _mm_set1_ps(weight), wa = _mm_set1_ps(1.0f - weight);
+	const __m128 zero = _mm_setzero_ps(), signBit = _mm_set1_ps(-0.0f);
+	auto lerp = [&](const vector<float>& from, const vector<float>& to, vector<float>& result, size_t i) {
+		const __m128 f = _mm_loadu_ps(&from[i]);
+		_mm_storeu_ps(&result[i], _mm_add_ps(f, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&to[i]), f), w)));
+	};
+	for (size_t i = 0; i < a.lanes(); i += 4)
+	{
+		lerp(a.tx, b.tx, out.tx, i); lerp(a.ty, b.ty, out.ty, i); lerp(a.tz, b.tz, out.tz, i);
+		lerp(a.sx, b.sx, out.sx, i); lerp(a.sy, b.sy, out.sy, i); lerp(a.sz, b.sz, out.sz, i);
+
+		const __m128 ax = _mm_loadu_ps(&a.rx[i]), ay = _mm_loadu_ps(&a.ry[i]), az = _mm_loadu_ps(&a.rz[i]), aw = _mm_loadu_ps(&a.rw[i]);
+		const __m128 bx = _mm_loadu_ps(&b.rx[i]), by = _mm_loadu_ps(&b.ry[i]), bz = _mm_loadu_ps(&b.rz[i]), bw = _mm_loadu_ps(&b.rw[i]);
+		const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+		// flip b's weight where the quaternions are in opposite hemispheres
+		const __m128 wb = _mm_xor_ps(w, _mm_and_ps(_mm_cmplt_ps(dot, zero), signBit));
+		const __m128 x = _mm_add_ps(_mm_mul_ps(ax, wa), _mm_mul_ps(bx, wb));
+		const __m128 y = _mm_add_ps(_mm_mul_ps(ay, wa), _mm_mul_ps(by, wb));
+		const __m128 z = _mm_add_ps(_mm_mul_ps(az, wa), _mm_mul_ps(bz, wb));
+		const __m128 qw = _mm_add_ps(_mm_mul_ps(aw, wa), _mm_mul_ps(bw, wb));
+		const __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(qw, qw)));
+		// full precision sqrt and divide, rsqrt's 12 bits would show as jitter on long chains
+		const __m128 length = _mm_sqrt_ps(lengthSquared);
+		const __m128 scale = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), length), _mm_cmpgt_ps(length, zero));
+		_mm_storeu_ps(&out.rx[i], _mm_mul_ps(x, scale));
+		_mm_storeu_ps(&out.ry[i], _mm_mul_ps(y, scale));
+		_mm_storeu_ps(&out.rz[i], _mm_mul_ps(z, scale));
+		_mm_storeu_ps(&out.rw[i], _mm_mul_ps(qw, scale));
+	}
+#else
+	blendPosesReference(a, b, weight, out);
+#endif
+}
+
+// local transforms to skinning matrices, parents come first so one pass resolves the hierarchy.
+// globals is scratch space with a matrix per joint, palette gets skeleton.boneCount matrices
+inline void computePalette(const Skeleton& skeleton, const Pose& pose, glm::mat4* globals, glm::mat4* palette)
+{
+	for (size_t joint = 0; joint < skeleton.size(); joint++)
+	{
+		const int parent = skeleton.parents[joint];
+		globals[joint] = parent < 0 ? pose.localMatrix(joint) : globals[parent] * pose.localMatrix(joint);
+		const int bone = skeleton.paletteIndices[joint];
+		if (bone >= 0)
+			palette[bone] = skeleton.globalInverse * globals[joint] * skeleton.offsets[joint];
+	}
+}
+#endif // !ANIMATION_H
@@ -0,0 +1,241 @@
+#ifndef ANIMATION_SYSTEM_H
+#define ANIMATION_SYSTEM_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <animation.h>
+#include <model.h>
+#include <job_system.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using std::vector;
+
+// shader storage binding of the BonePalette block in model_lighting.vert
+constexpr GLuint BONE_PALETTE_BINDING = 7;
+
+// Plays up to two clips on one skeleton: the base layer and a second one blended over it by weight, for fading
+// between walk and run or into a new clip. Skeleton and clips belong to the Model and must outlive the animator.
+class Animator {
+public:
+	float speed = 1.0f;
+
+	Animator(const Skeleton& skeleton, const vector<AnimationClip>& clips)
+		: skeleton(&skeleton), clips(&clips)
+	{
+		bind.setBind(skeleton);
+		base = blended = bind;
+		globals.resize(skeleton.size());
+	}
+
+	void play(unsigned int clip, float startSeconds = 0.0f)
+	{
+		layers[0].clip = clip < clips->size() ? static_cast<int>(clip) : -1;
+		layers[0].time = startSeconds;
+		layers[0].cache = KeyCache();
+	}
+
+	// weight 0 is only the base clip, 1 only this one
+	void blendTo(unsigned int clip, float weight, float startSeconds = 0.0f)
+	{
+		const int index = clip < clips->size() ? static_cast<int>(clip) : -1;
+		if (layers[1].clip != index)
+		{
+			layers[1].clip = index;
+			layers[1].time = startSeconds;
+			layers[1].cache = KeyCache();
+		}
+		blendWeight = std::clamp(weight, 0.0f, 1.0f);
+	}
+
+	void stopBlend()
+	{
+		layers[1].clip = -1;
+		blendWeight = 0.0f;
+	}
+
+	// advances the clips by deltaTime seconds and writes skeleton.boneCount matrices to palette. Only touches this
+	// animator and palette, so animators of different characters can update on different threads
+	void update(float deltaTime, glm::mat4* palette)
+	{
+		sample(layers[0], deltaTime, base);
+		if (layers[1].clip >= 0 && blendWeight > 0.0f)
+		{
+			sample(layers[1], deltaTime, blended);
+			blendPoses(base, blended, blendWeight, base);
+		}
+		computePalette(*skeleton, base, globals.data(), palette);
+	}
+
+	unsigned int boneCount() const
+	{
+		return skeleton->boneCount;
+	}
+
+private:
+	struct Layer {
+		int clip = -1;
+		float time = 0.0f;		// seconds
+		KeyCache cache;
+	};
+
+	const Skeleton* skeleton;
+	const vector<AnimationClip>* clips;
+	Layer layers[2];
+	float blendWeight = 0.0f;
+	Pose bind, base, blended;
+	vector<glm::mat4> globals;
+
+	// starts from the bind pose so joints without a track stay put, the clip loops
+	void sample(Layer& layer, float deltaTime, Pose& pose)
+	{
+		pose = bind;
+		if (layer.clip < 0)
+			return;
+		const AnimationClip& clip = (*clips)[layer.clip];
+		layer.time += deltaTime * speed;
+		const float seconds = clip.seconds();
+		if (seconds > 0.0f)
+		{
+			layer.time = std::fmod(layer.time, seconds);
+			if (layer.time < 0.0f)
+				layer.time += seconds;
+		}
+		sampleClip(clip, layer.time * clip.ticksPerSecond, layer.cache, pose);
+	}
+};
+
+struct AnimationStats {
+	unsigned int characters = 0;
+	unsigned int bones = 0;			// palette matrices of every character
+	unsigned int jobs = 0;			// pieces of the last update, the calling thread runs the first
+	double updateMilliseconds = 0.0;
+};
+
+// Every animated character of the scene. update() evaluates their poses spread over the job system, each character
+// writing its own slice of one bone palette; upload() copies the palette into a shader storage buffer the vertex
+// shader skins from, the draw of a character passes the first matrix of its slice as ObjectConstants::paletteOffset.
+class AnimationSystem {
+public:
+	AnimationStats stats;
+
+	AnimationSystem() = default;
+
+	~AnimationSystem()
+	{
+		if (buffer)
+			glDeleteBuffers(1, &buffer);
+	}
+
+	AnimationSystem(const AnimationSystem&) = delete;
+	AnimationSystem& operator=(const AnimationSystem&) = delete;
+
+	// returns the character index
+	unsigned int add(const Skeleton& skeleton, const vector<AnimationClip>& clips)
+	{
+		animators.emplace_back(skeleton, clips);
+		offsets.push_back(static_cast<unsigned int>(palette.size()));
+		palette.resize(palette.size() + skeleton.boneCount, glm::mat4(1.0f));
+		stats.characters = static_cast<unsigned int>(animators.size());
+		stats.bones = static_cast<unsigned int>(palette.size());
+		return static_cast<unsigned int>(animators.size() - 1);
+	}
+
+	unsigned int add(const Model& model)
+	{
+		return add(model.skeleton, model.animations);
+	}
+
+	Animator& animator(unsigned int character)
+	{
+		return animators[character];
+	}
+
+	// for Mesh::objectConstants
+	unsigned int paletteOffset(unsigned int character) const
+	{
+		return offsets[character];
+	}
+
+	size_t size() const
+	{
+		return animators.size();
+	}
+
+	const vector<glm::mat4>& bones() const
+	{
+		return palette;
+	}
+
+	// evaluates every character, in pieces on the job system and the calling thread. Without one it all runs here
+	void update(float deltaTime, JobSystem* jobSystem = &JobSystem::shared())
+	{
+		PROFILE_SCOPE("AnimationSystem::update");
+		const auto start = std::chrono::steady_clock::now();
+		const size_t count = animators.size();
+		auto evaluate = [this, deltaTime](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+				animators[i].update(deltaTime, palette.data() + offsets[i]);
+		};
+
+		const size_t workers = jobSystem ? jobSystem->size() : 0;
+		// a few characters per job at least, a job per character costs more in scheduling than it saves
+		const size_t grain = std::max<size_t>(MIN_CHUNK, count / (4 * (workers + 1)));
+		stats.jobs = static_cast<unsigned int>(workers == 0 || count <= grain ? 1 : (count + grain - 1) / grain);
+		if (jobSystem)
+			jobSystem->parallelFor(0, count, evaluate, grain);
+		else
+			evaluate(0, count);
+		stats.updateMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// the palette into the shader storage buffer, which grows when characters were added
+	void upload()
+	{
+		upload(palette);
+	}
+
+	// a copy of the palette taken after update(), for a renderer on another thread than the updates. Only touches
+	// the buffer, so it may run while the next update() writes the palette
+	void upload(const vector<glm::mat4>& matrices)
+	{
+		PROFILE_SCOPE("AnimationSystem::upload");
+		if (matrices.empty())
+			return;
+		const GLsizeiptr size = static_cast<GLsizeiptr>(matrices.size() * sizeof(glm::mat4));
+		if (!buffer)
+			glGenBuffers(1, &buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		if (size > capacity)
+		{
+			glBufferData(GL_SHADER_STORAGE_BUFFER, size, matrices.data(), GL_DYNAMIC_DRAW);
+			capacity = size;
+		}
+		else
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, matrices.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	void bind() const
+	{
+		if (buffer)
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BONE_PALETTE_BINDING, buffer);
+	}
+
+private:
+	static constexpr size_t MIN_CHUNK = 16;
+
+	vector<Animator> animators;
+	vector<unsigned int> offsets;
+	vector<glm::mat4> palette;
+	GLuint buffer = 0;
+	GLsizeiptr capacity = 0;
+};
+#endif // !ANIMATION_SYSTEM_H
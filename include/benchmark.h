@@ -0,0 +1,1940 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <model.h>
+#include <packed_geometry.h>
+#include <instance_manager.h>
+#include <animation_system.h>
+#include <render_queue.h>
+#include <frame_pipeline.h>
+#include <frustum_culling.h>
+#include <bvh.h>
+#include <mesh_optimizer.h>
+#include <mesh_simplifier.h>
+#include <texture_baker.h>
+#include <environment_map.h>
+#include <transform_stage.h>
+#include <light_manager.h>
+#include <shadow_map.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <functional>
+#include <random>
+#include <array>
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <filesystem>
+
+// Benchmarks are run with `TryOpenGL --bench <name>` after the GL context is created,
+// results are printed to stdout and the process exits with the returned status.
+
+class Stopwatch {
+public:
+	Stopwatch() : start(std::chrono::steady_clock::now()) {}
+
+	void reset()
+	{
+		start = std::chrono::steady_clock::now();
+	}
+
+	double milliseconds() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+// Every sampler of model_lighting.frag on the unit main.cpp gives it. Left on unit 0 they share it with the material's
+// sampler2D, and samplers of different types on one unit make every draw invalid. False if the program still doesn't
+// validate
+inline bool setModelSamplerUnits(const Shader& shader)
+{
+	shader.use();
+	shader.setInt("skybox", 10);
+	shader.setInt("prefilteredMap", EnvironmentMap::PREFILTERED_UNIT);
+	shader.setInt("brdfLUT", EnvironmentMap::BRDF_LUT_UNIT);
+	shader.setInt("shadowMap", CascadedShadowMap::SHADOW_UNIT);
+	glValidateProgram(shader.ID);
+	GLint valid = GL_FALSE;
+	glGetProgramiv(shader.ID, GL_VALIDATE_STATUS, &valid);
+	if (!valid)
+	{
+		char log[1024] = {};
+		glGetProgramInfoLog(shader.ID, sizeof(log), nullptr, log);
+		std::cerr << "ERROR::BENCHMARK::PROGRAM_VALIDATION: " << log << "\n";
+	}
+	return valid == GL_TRUE;
+}
+
+// cold (no mesh cache) versus warm (mesh cache present) model load
+inline int benchModelLoad()
+{
+	const std::vector<std::string> paths = {
+		R"(resource/model/nanosuit/nanosuit.obj)",
+		R"(resource/model/zelda/Zelda.dae)"
+	};
+
+	std::cout << "model_load\n";
+	for (const std::string& path : paths)
+	{
+		std::remove(MeshCache::pathFor(path).c_str());
+
+		Model cold(path);
+		Model warm(path);
+
+		std::cout << "    " << path << "\n"
+			<< "        cold: " << cold.loadMilliseconds << " ms (" << (cold.loadedFromCache ? "cache" : "assimp") << ")\n"
+			<< "        warm: " << warm.loadMilliseconds << " ms (" << (warm.loadedFromCache ? "cache" : "assimp") << ")\n";
+
+		if (!warm.loadedFromCache)
+		{
+			std::cerr << "ERROR::BENCHMARK::MODEL_LOAD: warm start did not hit the mesh cache\n";
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// cost of one uniform setter through each lookup path, measured on the real model shader
+inline int benchUniformSetters()
+{
+	Shader shader(R"(resource/shader/model_lighting.vert)", R"(resource/shader/model_lighting.frag)");
+	shader.use();
+
+	constexpr int iterations = 200000;
+	const float value = 64.0f;
+	volatile GLint sink = 0;
+
+	auto report = [](const char* name, double milliseconds) {
+		std::cout << "    " << name << ": " << milliseconds * 1e6 / iterations << " ns/call\n";
+	};
+
+	std::cout << "uniform_setters (" << shader.activeUniforms().size() << " reflected entries)\n";
+
+	// the matrices live in uniform blocks now, material.shininess is the model shader's plain uniform
+	Stopwatch stopwatch;
+	for (int i = 0; i < iterations; i++)
+		glUniform1f(glGetUniformLocation(shader.ID, "material.shininess"), value);
+	report("glGetUniformLocation + glUniform", stopwatch.milliseconds());
+
+	stopwatch.reset();
+	for (int i = 0; i < iterations; i++)
+		shader.setFloat(std::string("material.shininess"), value);
+	report("setFloat(std::string)", stopwatch.milliseconds());
+
+	stopwatch.reset();
+	for (int i = 0; i < iterations; i++)
+		shader.setFloat("material.shininess"_uniform, value);
+	report("setFloat(\"material.shininess\"_uniform)", stopwatch.milliseconds());
+
+	const UniformLocation shininess = shader.location("material.shininess"_uniform);
+	stopwatch.reset();
+	for (int i = 0; i < iterations; i++)
+		shader.setFloat(shininess, value);
+	report("setFloat(UniformLocation)", stopwatch.milliseconds());
+
+	// the lookup alone, without the glUniform call
+	stopwatch.reset();
+	for (int i = 0; i < iterations; i++)
+		sink = glGetUniformLocation(shader.ID, ("material.texture_diffuse[" + std::to_string(i % 6) + "]").c_str());
+	report("sampler name building + glGetUniformLocation", stopwatch.milliseconds());
+
+	stopwatch.reset();
+	for (int i = 0; i < iterations; i++)
+		sink = shader.location("material.texture_diffuse[0]"_uniform).value;
+	report("sampler \"literal\"_uniform lookup", stopwatch.milliseconds());
+
+	(void)sink;
+	return 0;
+}
+
+// per mesh draws versus PackedGeometry on a synthetic scene: 512 meshes of 512 triangles sharing 8 materials
+inline int benchPackedDraw()
+{
+	constexpr int meshCount = 512, materialCount = 8, gridSize = 16, frames = 100, size = 256;
+
+	// offscreen target so the benchmark doesn't depend on the window
+	unsigned int fbo, color, depth;
+	glGenFramebuffers(1, &fbo);
+	glGenRenderbuffers(1, &color);
+	glGenRenderbuffers(1, &depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size, size);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	glViewport(0, 0, size, size);
+
+	unsigned int textureIDs[materialCount];
+	glGenTextures(materialCount, textureIDs);
+	vector<std::shared_ptr<const Material>> materials;
+	vector<vector<Texture>> materialTextures;
+	for (int m = 0; m < materialCount; m++)
+	{
+		const unsigned char pixel[4] = { static_cast<unsigned char>(m * 32), 128, 255, 255 };
+		glBindTexture(GL_TEXTURE_2D, textureIDs[m]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		materialTextures.push_back({ { textureIDs[m], "texture_diffuse", "" } });
+		materials.push_back(std::make_shared<const Material>(materialTextures.back()));
+	}
+
+	// one small grid, copied into every mesh
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	for (int y = 0; y <= gridSize; y++)
+		for (int x = 0; x <= gridSize; x++)
+		{
+			Vertex vertex{};
+			vertex.Position = glm::vec3(x / float(gridSize) - 0.5f, y / float(gridSize) - 0.5f, 0.0f);
+			vertex.Normal = glm::vec3(0.0f, 0.0f, 1.0f);
+			vertex.TexCoords = glm::vec2(x, y) / float(gridSize);
+			vertices.push_back(vertex);
+		}
+	for (int y = 0; y < gridSize; y++)
+		for (int x = 0; x < gridSize; x++)
+		{
+			unsigned int i = y * (gridSize + 1) + x;
+			indices.insert(indices.end(), { i, i + 1, i + gridSize + 1, i + 1, i + gridSize + 2, i + gridSize + 1 });
+		}
+
+	vector<Mesh> meshes;
+	meshes.reserve(meshCount);
+	for (int i = 0; i < meshCount; i++)
+		meshes.push_back(Mesh(vertices, indices, materialTextures[i % materialCount], VertexFormat::Full, materials[i % materialCount]));
+
+	PackedGeometry packed;
+	unsigned int slot = packed.add(meshes);
+	packed.build();
+
+	Shader meshShader(R"(resource/shader/model_lighting.vert)", R"(resource/shader/model_lighting.frag)");
+	Shader packedShader(R"(resource/shader/model_lighting_packed.vert)", R"(resource/shader/model_lighting.frag)");
+
+	// small on screen, so the numbers are about submission rather than fill rate
+	const glm::mat4 transform = glm::scale(glm::mat4(1.0f), glm::vec3(0.05f));
+	packed.setTransform(slot, transform);
+
+	// identity camera, the per mesh path shares one set of Object constants
+	FrameConstants frameConstants{ glm::mat4(1.0f), glm::mat4(1.0f), glm::vec4(0.0f), glm::mat4(1.0f) };
+	ObjectConstants objectConstants{ transform, transform, glm::mat3x4(glm::transpose(glm::inverse(glm::mat3(transform)))), glm::vec4(0.0f), glm::vec3(1.0f) };
+	unsigned int ubo;
+	glGenBuffers(1, &ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, 2 * 256, nullptr, GL_STATIC_DRAW);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frameConstants), &frameConstants);
+	glBufferSubData(GL_UNIFORM_BUFFER, 256, sizeof(objectConstants), &objectConstants);
+	glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, ubo, 0, sizeof(frameConstants));
+	glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_UNIFORM_BINDING, ubo, 256, sizeof(objectConstants));
+
+	auto run = [&](const char* name, unsigned int drawCalls, auto&& drawFrame) {
+		drawFrame();
+		glFinish();
+
+		double submitMilliseconds = 0.0;
+		Stopwatch total;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			Stopwatch submit;
+			drawFrame();
+			submitMilliseconds += submit.milliseconds();
+		}
+		glFinish();
+		std::cout << "    " << name << ": " << drawCalls << " draw calls, "
+			<< submitMilliseconds / frames << " ms submit, " << total.milliseconds() / frames << " ms/frame\n";
+	};
+
+	int status = setModelSamplerUnits(meshShader) && setModelSamplerUnits(packedShader) ? 0 : 1;
+
+	std::cout << "packed_draw (" << meshCount << " meshes, " << materialCount << " materials)\n";
+
+	meshShader.use();
+	run("per mesh", meshCount, [&] {
+		for (const Mesh& mesh : meshes)
+			mesh.Draw(meshShader);
+	});
+
+	packedShader.use();
+	run("packed", packed.multiDrawCount(), [&] {
+		packed.render(packedShader);
+	});
+
+	// a rejected draw costs next to nothing, so an error here means the numbers above are meaningless
+	if (glGetError() != GL_NO_ERROR)
+	{
+		std::cerr << "ERROR::BENCHMARK::PACKED_DRAW: GL error\n";
+		status = 1;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &color);
+	glDeleteRenderbuffers(1, &depth);
+	glDeleteTextures(materialCount, textureIDs);
+	glDeleteBuffers(1, &ubo);
+	return status;
+}
+
+// per draw constants through glBufferSubData into one uniform buffer versus the persistently mapped UniformRing,
+// 4096 small draws a frame with the plane shader
+inline int benchUniformRing()
+{
+	constexpr int drawCount = 4096, frames = 100, size = 256;
+
+	// offscreen target so the benchmark doesn't depend on the window
+	unsigned int fbo, color;
+	glGenFramebuffers(1, &fbo);
+	glGenRenderbuffers(1, &color);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size, size);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	glViewport(0, 0, size, size);
+
+	// one tiny triangle, position and normal like the plane
+	const float vertices[] = {
+		0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+		0.01f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+		0.0f, 0.01f, 0.0f, 0.0f, 0.0f, 1.0f
+	};
+	unsigned int VAO, VBO;
+	glGenVertexArrays(1, &VAO);
+	glGenBuffers(1, &VBO);
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+
+	Shader shader(R"(resource/shader/plane.vert)", R"(resource/shader/plane.frag)");
+	shader.use();
+	shader.setInt("skybox", 10);
+
+	const FrameConstants frameConstants{ glm::mat4(1.0f), glm::mat4(1.0f), glm::vec4(0.0f), glm::mat4(1.0f) };
+	std::vector<ObjectConstants> objects(drawCount);
+	for (int i = 0; i < drawCount; i++)
+	{
+		objects[i].model = glm::translate(glm::mat4(1.0f), glm::vec3((i % 64) / 32.0f - 1.0f, (i / 64) / 32.0f - 1.0f, 0.0f));
+		objects[i].modelViewProjection = objects[i].model;
+		objects[i].normalMatrix = glm::mat3x4(1.0f);
+	}
+
+	auto run = [&](const char* name, auto&& drawFrame) {
+		drawFrame();
+		glFinish();
+
+		double submitMilliseconds = 0.0;
+		Stopwatch total;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			glClear(GL_COLOR_BUFFER_BIT);
+			Stopwatch submit;
+			drawFrame();
+			submitMilliseconds += submit.milliseconds();
+		}
+		glFinish();
+		std::cout << "    " << name << ": " << submitMilliseconds / frames << " ms submit, " << total.milliseconds() / frames << " ms/frame";
+	};
+
+	std::cout << "uniform_ring (" << drawCount << " draws)\n";
+
+	unsigned int ubo;
+	glGenBuffers(1, &ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, 2 * 256, nullptr, GL_DYNAMIC_DRAW);
+	glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, ubo, 0, sizeof(FrameConstants));
+	glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_UNIFORM_BINDING, ubo, 256, sizeof(ObjectConstants));
+	run("glBufferSubData", [&] {
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frameConstants), &frameConstants);
+		for (const ObjectConstants& object : objects)
+		{
+			glBufferSubData(GL_UNIFORM_BUFFER, 256, sizeof(object), &object);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+		}
+	});
+	std::cout << ", " << sizeof(FrameConstants) + drawCount * sizeof(ObjectConstants) << " bytes/frame\n";
+
+	// every allocation is padded to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, typically 256 bytes
+	UniformRing ring(drawCount * 256 + 256);
+	run("UniformRing", [&] {
+		ring.beginFrame();
+		ring.bind(FRAME_UNIFORM_BINDING, frameConstants);
+		for (const ObjectConstants& object : objects)
+		{
+			ring.bind(OBJECT_UNIFORM_BINDING, object);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+		}
+		ring.endFrame();
+	});
+	std::cout << ", " << ring.stats.frameBytes << " bytes/frame, " << ring.stats.waits << " waits (" << ring.stats.waitMilliseconds << " ms), "
+		<< ring.stats.overflows << " overflows\n";
+
+	const int status = ring.stats.overflows == 0 ? 0 : 1;
+	if (status != 0)
+		std::cerr << "ERROR::BENCHMARK::UNIFORM_RING: a frame did not fit the ring\n";
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &color);
+	glDeleteVertexArrays(1, &VAO);
+	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &ubo);
+	return status;
+}
+
+// a million cube instances scattered over a square kilometre: the compute cull against its CPU reference, then cull
+// and draw per frame, with the same handful of GL calls whatever the instance count
+// unit cube, four vertices per face so every face has its own normal
+inline Mesh makeBenchmarkCube()
+{
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	for (int axis = 0; axis < 3; axis++)
+		for (float side : { -1.0f, 1.0f })
+		{
+			glm::vec3 normal(0.0f), u(0.0f), v(0.0f);
+			normal[axis] = side;
+			u[(axis + 1) % 3] = 1.0f;
+			v[(axis + 2) % 3] = 1.0f;
+			const unsigned int first = static_cast<unsigned int>(vertices.size());
+			for (int corner = 0; corner < 4; corner++)
+			{
+				Vertex vertex{};
+				const float a = corner & 1 ? 0.5f : -0.5f, b = corner & 2 ? 0.5f : -0.5f;
+				vertex.Position = normal * 0.5f + u * a + v * b;
+				vertex.Normal = normal;
+				vertex.TexCoords = glm::vec2(a, b) + 0.5f;
+				vertices.push_back(vertex);
+			}
+			// counter clockwise seen from outside
+			if (side > 0.0f)
+				indices.insert(indices.end(), { first, first + 1, first + 3, first, first + 3, first + 2 });
+			else
+				indices.insert(indices.end(), { first, first + 3, first + 1, first, first + 2, first + 3 });
+		}
+	return Mesh(vertices, indices, {});
+}
+
+// a million cube instances culled by InstanceManager's compute pass against the CPU reference cull, then culled and
+// drawn with one indirect draw per mesh, checked to keep the same instances
+inline int benchGPUInstancing()
+{
+	constexpr int instanceCount = 1 << 20, materialCount = 4, frames = 10, size = 256;
+
+	// offscreen target so the benchmark doesn't depend on the window
+	unsigned int fbo, color, depth;
+	glGenFramebuffers(1, &fbo);
+	glGenRenderbuffers(1, &color);
+	glGenRenderbuffers(1, &depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size, size);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	glViewport(0, 0, size, size);
+
+	vector<Mesh> meshes;
+	meshes.push_back(makeBenchmarkCube());
+
+	InstanceManager instances(meshes);
+	unsigned int materials[materialCount] = { 0 };
+	for (int m = 1; m < materialCount; m++)
+		materials[m] = instances.addMaterial(glm::vec4(m == 1, m == 2, m == 3, 1.0f));
+
+	std::mt19937 random(17);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f), angle(0.0f, 6.2831853f), scale(0.2f, 1.0f);
+	instances.reserve(instanceCount);
+	for (int i = 0; i < instanceCount; i++)
+	{
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), 0.0f, position(random)));
+		transform = glm::rotate(transform, angle(random), glm::vec3(0.0f, 1.0f, 0.0f));
+		transform = glm::scale(transform, glm::vec3(scale(random)));
+		instances.add(transform, materials[i % materialCount]);
+	}
+
+	const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+	const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const Frustum frustum = Frustum::fromMatrix(projection * view);
+
+	std::cout << "gpu_instancing (" << instanceCount << " instances)\n";
+
+	Stopwatch cpu;
+	const vector<unsigned int> reference = instances.cullReference(frustum);
+	const double cpuMilliseconds = cpu.milliseconds();
+
+	// the first cull also uploads the instances
+	instances.cull(frustum);
+	glFinish();
+	Stopwatch gpu;
+	for (int frame = 0; frame < frames; frame++)
+		instances.cull(frustum);
+	glFinish();
+	const double gpuMilliseconds = gpu.milliseconds() / frames;
+
+	const vector<unsigned int> visible = instances.visibleInstances();
+	vector<unsigned int> mismatches;
+	std::set_symmetric_difference(reference.begin(), reference.end(), visible.begin(), visible.end(), std::back_inserter(mismatches));
+	std::cout << "    CPU reference cull: " << cpuMilliseconds << " ms, " << reference.size() << " visible\n"
+		<< "    compute cull: " << gpuMilliseconds << " ms, " << visible.size() << " visible, " << mismatches.size() << " mismatches\n";
+
+	Shader shader(R"(resource/shader/model_lighting_instanced.vert)", R"(resource/shader/model_lighting.frag)", nullptr, { "INSTANCED" });
+	const bool samplersValid = setModelSamplerUnits(shader);
+
+	const FrameConstants frameConstants{ projection, view, glm::vec4(0.0f, 2.0f, 0.0f, 1.0f), projection * view };
+	unsigned int ubo;
+	glGenBuffers(1, &ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(frameConstants), &frameConstants, GL_STATIC_DRAW);
+	glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, ubo, 0, sizeof(frameConstants));
+
+	double submitMilliseconds = 0.0;
+	Stopwatch total;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		Stopwatch submit;
+		instances.cull(frustum);
+		shader.use();
+		instances.render(shader);
+		submitMilliseconds += submit.milliseconds();
+	}
+	glFinish();
+	std::cout << "    cull + draw: " << instances.stats.dispatches << " dispatches + " << instances.stats.drawCalls << " draw calls, "
+		<< submitMilliseconds / frames << " ms submit, " << total.milliseconds() / frames << " ms/frame\n";
+
+	// the two culls round differently, so a box exactly on a plane may land on either side
+	int status = mismatches.size() <= reference.size() / 1000 ? 0 : 1;
+	if (status != 0)
+		std::cerr << "ERROR::BENCHMARK::GPU_INSTANCING: the compute cull disagrees with the CPU reference\n";
+	if (!samplersValid || glGetError() != GL_NO_ERROR)
+	{
+		std::cerr << "ERROR::BENCHMARK::GPU_INSTANCING: GL error\n";
+		status = 1;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &color);
+	glDeleteRenderbuffers(1, &depth);
+	glDeleteBuffers(1, &ubo);
+	return status;
+}
+
+// CPU only: 100k random boxes against a perspective frustum, SIMD batches versus one box at a time
+inline int benchFrustumCull()
+{
+	constexpr int boxCount = 100000, iterations = 100;
+
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> position(-100.0f, 100.0f), size(0.1f, 2.0f);
+	FrustumCuller culler;
+	culler.reserve(boxCount);
+	for (int i = 0; i < boxCount; i++)
+	{
+		BoundingBox box;
+		box.min = glm::vec3(position(random), position(random), position(random));
+		box.max = box.min + glm::vec3(size(random), size(random), size(random));
+		culler.add(box);
+	}
+
+	const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+	const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	culler.setFrustum(Frustum::fromMatrix(projection * view));
+
+	const vector<unsigned int> reference = culler.cullReference();
+	if (culler.cull() != reference)
+	{
+		std::cerr << "ERROR::BENCHMARK::FRUSTUM_CULL: SIMD and scalar culling disagree\n";
+		return 1;
+	}
+
+#if defined(FRUSTUM_CULLING_AVX)
+	const char* path = "AVX";
+#elif defined(FRUSTUM_CULLING_SSE)
+	const char* path = "SSE";
+#else
+	const char* path = "scalar";
+#endif
+
+	std::cout << "frustum_cull (" << boxCount << " boxes, " << reference.size() << " visible)\n";
+
+	Stopwatch stopwatch;
+	for (int i = 0; i < iterations; i++)
+		culler.cullReference();
+	double milliseconds = stopwatch.milliseconds() / iterations;
+	std::cout << "    scalar: " << milliseconds << " ms (" << milliseconds * 1e6 / boxCount << " ns/box)\n";
+
+	stopwatch.reset();
+	for (int i = 0; i < iterations; i++)
+		culler.cull();
+	milliseconds = stopwatch.milliseconds() / iterations;
+	std::cout << "    " << path << ": " << milliseconds << " ms (" << milliseconds * 1e6 / boxCount << " ns/box)\n";
+	return 0;
+}
+
+// BVH build, refit, frustum query and raycasts over random instance boxes, queries checked against brute force
+inline int benchBVH()
+{
+	constexpr int rayCount = 10000;
+
+	std::cout << "bvh\n";
+	for (int instanceCount : { 10000, 50000 })
+	{
+		std::mt19937 random(11);
+		std::uniform_real_distribution<float> position(-500.0f, 500.0f), size(0.5f, 5.0f), unit(-1.0f, 1.0f);
+		vector<BoundingBox> boxes(instanceCount);
+		for (BoundingBox& box : boxes)
+		{
+			box.min = glm::vec3(position(random), position(random), position(random));
+			box.max = box.min + glm::vec3(size(random), size(random), size(random));
+		}
+
+		BVH bvh;
+		Stopwatch stopwatch;
+		bvh.build(boxes);
+		const double buildMilliseconds = stopwatch.milliseconds();
+
+		// every instance moves, then one refit
+		for (uint32_t i = 0; i < boxes.size(); i++)
+		{
+			const glm::vec3 offset(unit(random), unit(random), unit(random));
+			boxes[i].min += offset;
+			boxes[i].max += offset;
+		}
+		stopwatch.reset();
+		for (uint32_t i = 0; i < boxes.size(); i++)
+			bvh.update(i, boxes[i]);
+		bvh.refit();
+		const double refitMilliseconds = stopwatch.milliseconds();
+
+		const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 400.0f);
+		const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 500.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		const Frustum frustum = Frustum::fromMatrix(projection * view);
+
+		vector<uint32_t> visible;
+		stopwatch.reset();
+		bvh.queryFrustum(frustum, visible);
+		const double queryMilliseconds = stopwatch.milliseconds();
+
+		vector<uint32_t> expected;
+		stopwatch.reset();
+		for (uint32_t i = 0; i < boxes.size(); i++)
+			if (frustum.intersects(boxes[i]))
+				expected.push_back(i);
+		const double bruteQueryMilliseconds = stopwatch.milliseconds();
+
+		std::sort(visible.begin(), visible.end());
+		if (visible != expected)
+		{
+			std::cerr << "ERROR::BENCHMARK::BVH: frustum query disagrees with brute force\n";
+			return 1;
+		}
+
+		// rays from the camera position, the hit is the entry distance into an item box
+		vector<Ray> rays(rayCount);
+		for (Ray& ray : rays)
+		{
+			ray.origin = glm::vec3(0.0f, 0.0f, 500.0f);
+			ray.direction = glm::normalize(glm::vec3(unit(random) * 0.3f, unit(random) * 0.3f, -1.0f));
+		}
+		auto entryDistance = [&](uint32_t item, const Ray& ray, float maxDistance) {
+			const glm::vec3 t0 = (boxes[item].min - ray.origin) / ray.direction, t1 = (boxes[item].max - ray.origin) / ray.direction;
+			const glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+			const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+			const float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+			return enter <= exit && enter < maxDistance ? enter : -1.0f;
+		};
+
+		vector<uint32_t> hits(rayCount);
+		stopwatch.reset();
+		for (int r = 0; r < rayCount; r++)
+		{
+			float distance;
+			hits[r] = bvh.raycast(rays[r], entryDistance, distance);
+		}
+		const double raycastMilliseconds = stopwatch.milliseconds();
+
+		int mismatches = 0;
+		stopwatch.reset();
+		for (int r = 0; r < rayCount; r++)
+		{
+			float closest = std::numeric_limits<float>::max();
+			uint32_t hit = std::numeric_limits<uint32_t>::max();
+			for (uint32_t i = 0; i < boxes.size(); i++)
+			{
+				const float distance = entryDistance(i, rays[r], closest);
+				if (distance >= 0.0f)
+				{
+					closest = distance;
+					hit = i;
+				}
+			}
+			mismatches += hit != hits[r];
+		}
+		const double bruteRaycastMilliseconds = stopwatch.milliseconds();
+
+		if (mismatches)
+		{
+			std::cerr << "ERROR::BENCHMARK::BVH: " << mismatches << " raycasts disagree with brute force\n";
+			return 1;
+		}
+
+		std::cout << "    " << instanceCount << " instances, " << bvh.hierarchy().size() << " nodes\n"
+			<< "        build: " << buildMilliseconds << " ms\n"
+			<< "        refit: " << refitMilliseconds << " ms\n"
+			<< "        frustum query: " << queryMilliseconds << " ms (brute force " << bruteQueryMilliseconds << " ms, " << visible.size() << " visible)\n"
+			<< "        raycast: " << raycastMilliseconds * 1e3 / rayCount << " us/ray (brute force " << bruteRaycastMilliseconds * 1e3 / rayCount << " us/ray)\n";
+	}
+	return 0;
+}
+
+// LOD chain of a finely tessellated uv sphere: triangles, error and simplification time per LOD
+inline int benchLOD()
+{
+	constexpr int stacks = 256, slices = 512;
+
+	// the u = 1 column and the poles repeat positions with other uvs, a seam like the ones in the models
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	for (int stack = 0; stack <= stacks; stack++)
+		for (int slice = 0; slice <= slices; slice++)
+		{
+			const float u = static_cast<float>(slice) / slices, v = static_cast<float>(stack) / stacks;
+			const float theta = u * 2.0f * glm::pi<float>(), phi = v * glm::pi<float>();
+			Vertex vertex{};
+			vertex.Position = glm::vec3(std::cos(theta) * std::sin(phi), std::cos(phi), std::sin(theta) * std::sin(phi));
+			vertex.Normal = vertex.Position;
+			vertex.TexCoords = glm::vec2(u, v);
+			vertices.push_back(vertex);
+		}
+	for (int stack = 0; stack < stacks; stack++)
+		for (int slice = 0; slice < slices; slice++)
+		{
+			const unsigned int a = stack * (slices + 1) + slice, b = a + slices + 1;
+			const unsigned int quad[6] = { a, a + 1, b, a + 1, b + 1, b };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+
+	const Bounds bounds = boundsOf(&vertices[0].Position, vertices.size(), sizeof(Vertex));
+	Stopwatch stopwatch;
+	const vector<MeshLOD> lods = MeshSimplifier::buildLODs(vertices, indices, bounds);
+	const double milliseconds = stopwatch.milliseconds();
+	if (lods.empty())
+	{
+		std::cerr << "ERROR::BENCHMARK::LOD: no LOD was generated\n";
+		return 1;
+	}
+
+	std::cout << "lod (uv sphere, " << vertices.size() << " vertices)\n"
+		<< "    build: " << milliseconds << " ms\n"
+		<< "    LOD 0: " << indices.size() / 3 << " triangles\n";
+	for (size_t i = 0; i < lods.size(); i++)
+		std::cout << "    LOD " << i + 1 << ": " << lods[i].indices.size() / 3 << " triangles, error " << lods[i].error
+			<< " (" << lods[i].error / bounds.sphere.radius * 100.0f << "% of radius)\n";
+	return 0;
+}
+
+// CompactVertex encoding of random vertices, decoded on the CPU like the shader does and checked against the tolerances
+inline int benchVertexCompression()
+{
+	constexpr int vertexCount = 1 << 18;
+	std::mt19937 random(3);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f), unorm(0.0f, 1.0f), tiling(-8.0f, 8.0f);
+	auto randomDirection = [&]() {
+		glm::vec3 v;
+		do
+			v = glm::vec3(unit(random), unit(random), unit(random));
+		while (glm::length(v) < 0.1f || glm::length(v) > 1.0f);
+		return glm::normalize(v);
+	};
+
+	std::cout << "vertex_compression (" << vertexCount << " vertices, " << sizeof(Vertex) << " -> " << sizeof(CompactVertex) << " bytes)\n";
+	int status = 0;
+	// uvs inside [0, 1] go to unorm16, tiled ones to half floats; a model sized and a large, offset mesh
+	for (const auto& [name, extent, tiled] : { std::tuple{ "unit uvs, 2 m", 2.0f, false }, std::tuple{ "tiled uvs, 500 m", 500.0f, true } })
+	{
+		vector<Vertex> vertices(vertexCount);
+		BoundingBox box;
+		for (Vertex& vertex : vertices)
+		{
+			vertex.Position = glm::vec3(unit(random), unit(random), unit(random)) * extent + glm::vec3(extent * 3.0f, 0.0f, -extent);
+			vertex.Normal = randomDirection();
+			vertex.Tangent = glm::normalize(glm::cross(vertex.Normal, randomDirection()));
+			vertex.Bitangent = glm::cross(vertex.Normal, vertex.Tangent) * (unit(random) < 0.0f ? -1.0f : 1.0f);
+			vertex.TexCoords = tiled ? glm::vec2(tiling(random), tiling(random)) : glm::vec2(unorm(random), unorm(random));
+			// one to four influences, normalized like Model::extractBoneWeights
+			const int influences = 1 + static_cast<int>(random() % MAX_BONE_INFLUENCE);
+			float sum = 0.0f;
+			for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+			{
+				vertex.m_BoneIDs[k] = k < influences ? static_cast<int>(random() % 100) : -1;
+				vertex.m_Weights[k] = k < influences ? unorm(random) + 1e-3f : 0.0f;
+				sum += vertex.m_Weights[k];
+			}
+			for (float& weight : vertex.m_Weights)
+				weight /= sum;
+			box.expand(vertex.Position);
+		}
+		const PositionQuantization quantization = quantizationFor(box.min, box.max);
+
+		Stopwatch stopwatch;
+		const vector<CompactVertex> compact = Mesh::encodeCompact(vertices, quantization, !tiled);
+		const double milliseconds = stopwatch.milliseconds();
+		const CompactDecodeError error = Mesh::compactDecodeError(vertices, compact, quantization, !tiled);
+
+		// the skin matrix is the weighted sum, the unorm8 weights have to add up to exactly 1 to keep its scale
+		const vector<BoneVertex> bones = Mesh::encodeBones(vertices);
+		float weightError = 0.0f;
+		size_t badSums = 0;
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			int sum = 0;
+			for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+			{
+				sum += bones[i].Weights[k];
+				weightError = std::max(weightError, std::abs(bones[i].Weights[k] / 255.0f - vertices[i].m_Weights[k]));
+			}
+			badSums += sum != 255;
+		}
+
+		std::cout << "    " << name << ": encode " << milliseconds << " ms, max error position " << error.position << " (step " << quantization.scale.x / 65535.0f
+			<< "), direction " << error.direction << " rad, uv " << error.texCoord << ", bone weight " << weightError << " (" << badSums << " sums off 255)"
+			<< (error.withinTolerance ? "" : ", OUT OF TOLERANCE") << "\n";
+		if (!error.withinTolerance)
+		{
+			std::cerr << "ERROR::BENCHMARK::VERTEX_COMPRESSION: " << name << " decodes out of tolerance\n";
+			status = 1;
+		}
+		// rounding moves a weight half a step, the remainder at most two steps more on the largest
+		if (badSums != 0 || weightError > 2.5f / 255.0f)
+		{
+			std::cerr << "ERROR::BENCHMARK::VERTEX_COMPRESSION: " << name << " bone weights do not add up to 1\n";
+			status = 1;
+		}
+	}
+	return status;
+}
+
+// MeshOptimizer on a shuffled, unwelded grid (the way assimp hands meshes over), checked to keep every triangle
+inline int benchMeshOptimize()
+{
+	constexpr int size = 256;
+
+	vector<unsigned int> quads(size * size);
+	for (unsigned int i = 0; i < quads.size(); i++)
+		quads[i] = i;
+	std::shuffle(quads.begin(), quads.end(), std::mt19937(3));
+
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	auto corner = [&](int x, int y) {
+		Vertex vertex{};
+		vertex.Position = glm::vec3(static_cast<float>(x), 0.0f, static_cast<float>(y));
+		vertex.Normal = glm::vec3(0.0f, 1.0f, 0.0f);
+		vertex.TexCoords = glm::vec2(x, y) / static_cast<float>(size);
+		indices.push_back(static_cast<unsigned int>(vertices.size()));
+		vertices.push_back(vertex);
+	};
+	for (unsigned int quad : quads)
+	{
+		const int x = quad % size, y = quad / size;
+		corner(x, y); corner(x, y + 1); corner(x + 1, y);
+		corner(x + 1, y); corner(x, y + 1); corner(x + 1, y + 1);
+	}
+
+	// every triangle as its corner positions, starting at the smallest so a rotated triangle compares equal
+	auto triangleSet = [](const vector<Vertex>& vertices, const vector<unsigned int>& indices) {
+		vector<std::array<float, 9>> triangles;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			int first = 0;
+			for (int k = 1; k < 3; k++)
+				if (std::lexicographical_compare(&vertices[indices[i + k]].Position[0], &vertices[indices[i + k]].Position[0] + 3,
+					&vertices[indices[i + first]].Position[0], &vertices[indices[i + first]].Position[0] + 3))
+					first = k;
+			std::array<float, 9> triangle;
+			for (int k = 0; k < 3; k++)
+				for (int c = 0; c < 3; c++)
+					triangle[k * 3 + c] = vertices[indices[i + (first + k) % 3]].Position[c];
+			triangles.push_back(triangle);
+		}
+		std::sort(triangles.begin(), triangles.end());
+		return triangles;
+	};
+	const auto reference = triangleSet(vertices, indices);
+
+	MeshOptimizer::Stats stats;
+	Stopwatch stopwatch;
+	MeshOptimizer::optimize(vertices, indices, &stats);
+	const double milliseconds = stopwatch.milliseconds();
+
+	if (triangleSet(vertices, indices) != reference)
+	{
+		std::cerr << "ERROR::BENCHMARK::MESH_OPTIMIZE: the optimized mesh has different triangles\n";
+		return 1;
+	}
+
+	std::cout << "mesh_optimize (" << size * size * 2 << " triangles, shuffled and unwelded)\n"
+		<< "    optimize: " << milliseconds << " ms\n"
+		<< "    vertices: " << stats.before.vertices << " -> " << stats.after.vertices << "\n"
+		<< "    ACMR: " << stats.before.acmr() << " -> " << stats.after.acmr() << "\n"
+		<< "    ATVR: " << stats.before.atvr() << " -> " << stats.after.atvr() << "\n";
+	return 0;
+}
+
+// startup cost of the app's programs with an empty (cold) and a filled (warm) shader cache. Like main, every program
+// is submitted before the first one is finalized. Drivers keep their own shader caches too (Mesa, NVIDIA), clear those
+// for a truly cold number.
+inline int benchShaderCache()
+{
+	const std::vector<std::array<const char*, 2>> programs = {
+		{ R"(resource/shader/model_lighting.vert)", R"(resource/shader/model_lighting.frag)" },
+		{ R"(resource/shader/model_lighting_compact.vert)", R"(resource/shader/model_lighting.frag)" },
+		{ R"(resource/shader/model_lighting_packed.vert)", R"(resource/shader/model_lighting.frag)" },
+		{ R"(resource/shader/plane.vert)", R"(resource/shader/plane.frag)" },
+		{ R"(resource/shader/skybox.vert)", R"(resource/shader/skybox.frag)" }
+	};
+
+	ShaderCache& cache = ShaderCache::shared();
+	const std::string directory = cache.cacheDirectory();
+	cache.setDirectory("shader_cache_bench");
+	if (!cache.enabled())
+	{
+		std::cerr << "ERROR::BENCHMARK::SHADER_CACHE: the driver has no program binary formats\n";
+		cache.setDirectory(directory);
+		return 1;
+	}
+	cache.clear();
+
+	std::cout << "shader_cache (" << programs.size() << " programs, parallel compile " << (cache.parallelCompile() ? "on" : "off") << ")\n";
+	int status = 0;
+	for (const char* pass : { "cold", "warm" })
+	{
+		const ShaderCacheStats before = cache.stats;
+		Stopwatch stopwatch;
+		std::vector<Shader> shaders;
+		shaders.reserve(programs.size());
+		for (const std::array<const char*, 2>& program : programs)
+			shaders.emplace_back(program[0], program[1]);
+		const double submit = stopwatch.milliseconds();
+		for (const Shader& shader : shaders)
+			shader.finalize();
+		const double total = stopwatch.milliseconds();
+
+		const unsigned int hits = cache.stats.hits - before.hits;
+		std::cout << "    " << pass << ": " << total << " ms (submit " << submit << " ms, finalize " << total - submit << " ms), "
+			<< hits << " hits, " << cache.stats.stored - before.stored << " stored\n";
+		if (std::string(pass) == "warm" && hits != programs.size())
+		{
+			std::cerr << "ERROR::BENCHMARK::SHADER_CACHE: warm start missed the shader cache\n";
+			status = 1;
+		}
+		for (const Shader& shader : shaders)
+			glDeleteProgram(shader.ID);
+	}
+
+	// store() created the directory, only the binaries go with clear()
+	cache.clear();
+	std::error_code error;
+	std::filesystem::remove_all("shader_cache_bench", error);
+	cache.setDirectory(directory);
+	return status;
+}
+
+// bytes the driver reports for every level (and face) of a texture
+inline size_t textureMemory(unsigned int textureID, GLenum bindTarget)
+{
+	const std::vector<GLenum> targets = bindTarget == GL_TEXTURE_CUBE_MAP
+		? std::vector<GLenum>{ GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X, GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
+			GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z }
+		: std::vector<GLenum>{ bindTarget };
+	glBindTexture(bindTarget, textureID);
+	size_t bytes = 0;
+	for (GLenum target : targets)
+		for (GLint level = 0;; level++)
+		{
+			GLint width = 0, height = 0, compressed = GL_FALSE;
+			glGetTexLevelParameteriv(target, level, GL_TEXTURE_WIDTH, &width);
+			glGetTexLevelParameteriv(target, level, GL_TEXTURE_HEIGHT, &height);
+			if (width == 0 || height == 0)
+				break;
+			glGetTexLevelParameteriv(target, level, GL_TEXTURE_COMPRESSED, &compressed);
+			if (compressed)
+			{
+				GLint size = 0;
+				glGetTexLevelParameteriv(target, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+				bytes += size;
+				continue;
+			}
+			GLint bits = 0;
+			for (GLenum channel : { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE })
+			{
+				GLint size = 0;
+				glGetTexLevelParameteriv(target, level, channel, &size);
+				bits += size;
+			}
+			bytes += static_cast<size_t>(width) * height * bits / 8;
+		}
+	glBindTexture(bindTarget, 0);
+	return bytes;
+}
+
+// source images versus baked KTX2 files for every model texture and the skybox: bake time, load time and VRAM.
+// Missing or stale bakes are made first, the cubemap faces are loaded without mips like Skybox does
+inline int benchTextureCompression()
+{
+	struct TextureSet {
+		std::string name;
+		std::vector<std::pair<std::string, TextureRole>> textures;
+		bool cubemap;
+	};
+	std::vector<TextureSet> sets = {
+		{ R"(resource/model/nanosuit/nanosuit.obj)", TextureBaker::modelTextures(R"(resource/model/nanosuit/nanosuit.obj)"), false },
+		{ R"(resource/model/zelda/Zelda.dae)", TextureBaker::modelTextures(R"(resource/model/zelda/Zelda.dae)"), false },
+		{ "skybox", {}, true }
+	};
+	for (const char* face : { "px", "nx", "py", "ny", "pz", "nz" })
+		sets.back().textures.emplace_back(std::string("resource/texture/skybox/") + face + ".png", TextureRole::Diffuse);
+
+	std::cout << "texture_compression\n";
+	int status = 0;
+	for (const TextureSet& set : sets)
+	{
+		Stopwatch stopwatch;
+		TextureBaker baker;
+		for (const std::pair<std::string, TextureRole>& texture : set.textures)
+			if (!Ktx2::hasCurrentBake(texture.first))
+				baker.bake(texture.first, texture.second);
+		if (!baker.finish())
+			status = 1;
+		const double bakeMilliseconds = stopwatch.milliseconds();
+
+		double milliseconds[2] = {};
+		size_t bytes[2] = {};
+		unsigned int baked = 0;
+		for (int pass = 0; pass < 2; pass++)
+		{
+			stopwatch.reset();
+			std::vector<unsigned int> textureIDs;
+			{
+				TextureLoader loader;
+				loader.setUseBaked(pass == 1);
+				if (set.cubemap)
+				{
+					unsigned int textureID;
+					glGenTextures(1, &textureID);
+					textureIDs.push_back(textureID);
+					for (unsigned int i = 0; i < set.textures.size(); i++)
+						loader.loadCubemapFace(textureID, i, set.textures[i].first);
+				}
+				else
+					for (const std::pair<std::string, TextureRole>& texture : set.textures)
+						textureIDs.push_back(loader.load2D(texture.first, texture.second == TextureRole::Diffuse));
+				loader.finish();
+				glFinish();
+				milliseconds[pass] = stopwatch.milliseconds();
+				if (pass == 1)
+					for (const TextureTiming& timing : loader.timings())
+						baked += timing.baked;
+			}
+			for (unsigned int textureID : textureIDs)
+				bytes[pass] += textureMemory(textureID, set.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D);
+			glDeleteTextures(static_cast<GLsizei>(textureIDs.size()), textureIDs.data());
+		}
+
+		std::cout << "    " << set.name << " (" << set.textures.size() << " textures, " << baked << " baked)\n"
+			<< "        bake: " << bakeMilliseconds << " ms\n"
+			<< "        source: " << milliseconds[0] << " ms, " << bytes[0] / 1024 << " KB\n"
+			<< "        baked: " << milliseconds[1] << " ms, " << bytes[1] / 1024 << " KB\n"
+			<< "        savings: " << milliseconds[0] / std::max(milliseconds[1], 0.001) << "x load, "
+			<< static_cast<double>(bytes[0]) / std::max<size_t>(bytes[1], 1) << "x memory\n";
+		if (baked != set.textures.size())
+		{
+			std::cerr << "ERROR::BENCHMARK::TEXTURE_COMPRESSION: " << set.name << " did not load every baked texture\n";
+			status = 1;
+		}
+	}
+	return status;
+}
+
+// a binary tree of joints, every one of them a bone, and clips with random keys on every joint
+inline void makeBenchmarkRig(int jointCount, int keyCount, float ticks, Skeleton& skeleton, vector<AnimationClip>& clips)
+{
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	for (int joint = 0; joint < jointCount; joint++)
+	{
+		const BoneInfo bone{ joint, glm::mat4(1.0f) };
+		skeleton.addJoint("joint" + std::to_string(joint), joint == 0 ? -1 : (joint - 1) / 2, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.1f, 0.0f)), &bone);
+	}
+
+	for (AnimationClip& clip : clips)
+	{
+		clip.duration = ticks;
+		clip.ticksPerSecond = 60.0f;
+		for (int joint = 0; joint < jointCount; joint++)
+		{
+			JointTrack track;
+			track.joint = joint;
+			for (int key = 0; key < keyCount; key++)
+			{
+				const float time = ticks * key / (keyCount - 1);
+				track.translationTimes.push_back(time);
+				track.translations.push_back(glm::vec3(unit(random), 1.0f + unit(random), unit(random)) * 0.1f);
+				track.rotationTimes.push_back(time);
+				track.rotations.push_back(glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random))));
+				track.scaleTimes.push_back(time);
+				track.scales.push_back(glm::vec3(1.0f));
+			}
+			clip.tracks.push_back(std::move(track));
+		}
+	}
+}
+
+// CPU only: a synthetic 64 joint skeleton with two clips played by a crowd of characters. Pose evaluation on one
+// thread versus the pool, the SIMD blend against the scalar one and sampling with and without the key cache
+inline int benchAnimation()
+{
+	constexpr int jointCount = 64, keyCount = 120, characterCount = 1000, frames = 60;
+	constexpr float ticks = 240.0f, deltaTime = 1.0f / 60.0f;
+
+	Skeleton skeleton;
+	vector<AnimationClip> clips(2);
+	makeBenchmarkRig(jointCount, keyCount, ticks, skeleton, clips);
+
+	std::cout << "animation (" << characterCount << " characters, " << jointCount << " joints, " << keyCount << " keys per channel)\n";
+	int status = 0;
+
+	// blend: SIMD against scalar on the same two sampled poses
+	{
+		Pose a, b, simd, reference;
+		for (Pose* pose : { &a, &b, &simd, &reference })
+			pose->setBind(skeleton);
+		KeyCache cacheA, cacheB;
+		sampleClip(clips[0], 37.0f, cacheA, a);
+		sampleClip(clips[1], 37.0f, cacheB, b);
+
+		constexpr int iterations = 100000;
+		Stopwatch stopwatch;
+		for (int i = 0; i < iterations; i++)
+			blendPosesReference(a, b, 0.3f + 0.4f * (i & 1), reference);
+		const double scalarMilliseconds = stopwatch.milliseconds();
+		stopwatch.reset();
+		for (int i = 0; i < iterations; i++)
+			blendPoses(a, b, 0.3f + 0.4f * (i & 1), simd);
+		const double simdMilliseconds = stopwatch.milliseconds();
+
+		float maxError = 0.0f;
+		for (float weight : { 0.0f, 0.25f, 0.5f, 0.9f, 1.0f })
+		{
+			blendPosesReference(a, b, weight, reference);
+			blendPoses(a, b, weight, simd);
+			for (const auto channel : { &Pose::tx, &Pose::ty, &Pose::tz, &Pose::rx, &Pose::ry, &Pose::rz, &Pose::rw, &Pose::sx, &Pose::sy, &Pose::sz })
+				for (size_t i = 0; i < a.lanes(); i++)
+					maxError = std::max(maxError, std::abs((simd.*channel)[i] - (reference.*channel)[i]));
+		}
+#if defined(ANIMATION_SSE)
+		const char* path = "SSE";
+#else
+		const char* path = "scalar";
+#endif
+		std::cout << "    blend scalar: " << scalarMilliseconds * 1e3 / iterations << " us/pose\n"
+			<< "    blend " << path << ": " << simdMilliseconds * 1e3 / iterations << " us/pose (max error " << maxError << ")\n";
+		if (maxError > 1e-5f)
+		{
+			std::cerr << "ERROR::BENCHMARK::ANIMATION: SIMD and scalar blends disagree\n";
+			status = 1;
+		}
+	}
+
+	// key search: the cache carries over from the last sample, a fresh one walks the track from its first key
+	{
+		Pose pose;
+		pose.setBind(skeleton);
+		KeyCache cache;
+		constexpr int samples = 2000;
+		const float step = ticks / samples;
+		Stopwatch stopwatch;
+		for (int i = 0; i < samples; i++)
+			sampleClip(clips[0], i * step, cache, pose);
+		const double cachedMilliseconds = stopwatch.milliseconds();
+		stopwatch.reset();
+		for (int i = 0; i < samples; i++)
+		{
+			KeyCache fresh;
+			sampleClip(clips[0], i * step, fresh, pose);
+		}
+		const double uncachedMilliseconds = stopwatch.milliseconds();
+		std::cout << "    sample cached: " << cachedMilliseconds * 1e3 / samples << " us/clip, uncached: " << uncachedMilliseconds * 1e3 / samples << " us/clip\n";
+	}
+
+	// crowd: half the characters blend the second clip over the first, every one starts at its own time
+	auto makeCrowd = [&](AnimationSystem& system) {
+		for (int i = 0; i < characterCount; i++)
+		{
+			Animator& animator = system.animator(system.add(skeleton, clips));
+			animator.play(0, i * 0.013f);
+			if (i % 2)
+				animator.blendTo(1, 0.5f, i * 0.007f);
+		}
+	};
+	AnimationSystem single, pooled;
+	makeCrowd(single);
+	makeCrowd(pooled);
+
+	Stopwatch stopwatch;
+	for (int frame = 0; frame < frames; frame++)
+		single.update(deltaTime, nullptr);
+	const double singleMilliseconds = stopwatch.milliseconds() / frames;
+	stopwatch.reset();
+	for (int frame = 0; frame < frames; frame++)
+		pooled.update(deltaTime);
+	const double pooledMilliseconds = stopwatch.milliseconds() / frames;
+
+	if (single.bones() != pooled.bones())
+	{
+		std::cerr << "ERROR::BENCHMARK::ANIMATION: pooled and single threaded palettes differ\n";
+		status = 1;
+	}
+
+	std::cout << "    1 thread: " << singleMilliseconds << " ms/frame (" << characterCount / singleMilliseconds << " characters/ms)\n"
+		<< "    jobs (" << JobSystem::shared().size() << " workers + caller, " << pooled.stats.jobs << " jobs): " << pooledMilliseconds
+		<< " ms/frame (" << characterCount / pooledMilliseconds << " characters/ms)\n";
+
+	// the palette upload the renderer does every frame
+	stopwatch.reset();
+	pooled.upload();
+	glFinish();
+	std::cout << "    upload: " << stopwatch.milliseconds() << " ms (" << pooled.bones().size() * sizeof(glm::mat4) << " B)\n";
+	return status;
+}
+
+// CPU only: 50k draw packets over a handful of programs and many materials and meshes, radix sorted against
+// std::stable_sort, and the program, material and vertex array changes a state cache would still submit
+inline int benchRenderQueue()
+{
+	constexpr int packetCount = 50000, programCount = 8, materialCount = 400, meshCount = 2000, iterations = 50;
+
+	struct DrawState {
+		GLuint program;
+		uint64_t material;
+		GLuint vertexArray;
+	};
+	std::mt19937 random(13);
+	std::uniform_int_distribution<int> program(1, programCount), mesh(1, meshCount);
+	std::uniform_real_distribution<float> depth(0.0f, 1.0f);
+	// every mesh keeps its material, like a model's meshes do
+	vector<uint64_t> meshMaterials(meshCount + 1);
+	for (uint64_t& material : meshMaterials)
+		material = random() % materialCount + 1;
+
+	RenderQueue queue;
+	queue.reserve(packetCount);
+	vector<DrawState> states;
+	states.reserve(packetCount);
+	for (int i = 0; i < packetCount; i++)
+	{
+		const GLuint vertexArray = static_cast<GLuint>(mesh(random));
+		states.push_back({ static_cast<GLuint>(program(random)), meshMaterials[vertexArray], vertexArray });
+		const DrawState& state = states.back();
+		queue.push({ RenderQueue::makeKey(RenderPass::Opaque, state.program, state.material, state.vertexArray, depth(random)), nullptr, nullptr, 0, {} });
+	}
+
+	// binds left after filtering the ones that repeat the previous draw's state
+	auto stateChanges = [&](const vector<uint32_t>& order) {
+		unsigned int changes = 0;
+		const DrawState* previous = nullptr;
+		for (uint32_t index : order)
+		{
+			const DrawState& state = states[index];
+			changes += !previous || previous->program != state.program;
+			changes += !previous || previous->material != state.material;
+			changes += !previous || previous->vertexArray != state.vertexArray;
+			previous = &state;
+		}
+		return changes;
+	};
+
+	vector<uint32_t> submitted(packetCount);
+	for (uint32_t i = 0; i < packetCount; i++)
+		submitted[i] = i;
+
+	Stopwatch stopwatch;
+	for (int i = 0; i < iterations; i++)
+		queue.sortReference();
+	const double referenceMilliseconds = stopwatch.milliseconds() / iterations;
+	const vector<uint32_t> reference = queue.sortedIndices();
+
+	stopwatch.reset();
+	for (int i = 0; i < iterations; i++)
+		queue.sort();
+	const double radixMilliseconds = stopwatch.milliseconds() / iterations;
+	const vector<uint32_t> sorted = queue.sortedIndices();
+
+	std::cout << "render_queue (" << packetCount << " packets, " << programCount << " programs, " << materialCount << " materials, " << meshCount << " meshes)\n"
+		<< "    std::stable_sort: " << referenceMilliseconds << " ms\n"
+		<< "    radix sort: " << radixMilliseconds << " ms (" << radixMilliseconds * 1e6 / packetCount << " ns/packet)\n"
+		<< "    state changes submission order: " << stateChanges(submitted) << " of " << packetCount * 3 << "\n"
+		<< "    state changes sorted: " << stateChanges(sorted) << " of " << packetCount * 3 << "\n";
+
+	if (sorted != reference)
+	{
+		std::cerr << "ERROR::BENCHMARK::RENDER_QUEUE: radix sort and std::stable_sort disagree\n";
+		return 1;
+	}
+	return 0;
+}
+
+// CPU only: a frame whose update poses a crowd and whose render side fills and sorts a render queue, run serially
+// and with the update on its own thread one frame ahead. Both runs must end on the same state
+inline int benchFramePipeline()
+{
+	constexpr int characterCount = 300, packetCount = 20000, frames = 120;
+	constexpr float deltaTime = 1.0f / 60.0f;
+
+	Skeleton skeleton;
+	vector<AnimationClip> clips(2);
+	makeBenchmarkRig(64, 120, 240.0f, skeleton, clips);
+
+	struct CrowdState {
+		vector<glm::mat4> bones;
+		uint64_t frame = 0;
+	};
+
+	std::cout << "frame_pipeline (" << characterCount << " characters updated, " << packetCount << " packets sorted per frame, " << frames << " frames)\n";
+
+	float checksums[2] = {};
+	for (const bool threaded : { false, true })
+	{
+		AnimationSystem crowd;
+		for (int i = 0; i < characterCount; i++)
+			crowd.animator(crowd.add(skeleton, clips)).play(i % 2, i * 0.013f);
+
+		uint64_t updates = 0;
+		auto update = [&](const InputState&, float frameDelta, CrowdState& state) {
+			crowd.update(frameDelta, nullptr);
+			state.bones = crowd.bones();
+			state.frame = updates++;
+		};
+
+		// render side stand in: a queue of packets keyed by the snapshot, sorted every frame
+		RenderQueue queue;
+		queue.reserve(packetCount);
+		std::mt19937 random(17);
+		double updateMilliseconds = 0.0, waitMilliseconds = 0.0;
+		float checksum = 0.0f;
+
+		Stopwatch stopwatch;
+		{
+			FramePipeline<CrowdState> pipeline(update, threaded);
+			for (int frame = 0; frame < frames; frame++)
+			{
+				const CrowdState& state = pipeline.acquire();
+				pipeline.kick(InputState(), deltaTime);
+				updateMilliseconds += pipeline.stats.updateMilliseconds;
+				waitMilliseconds += pipeline.stats.waitMilliseconds;
+
+				queue.clear();
+				for (int i = 0; i < packetCount; i++)
+				{
+					const glm::vec3 position(state.bones[i % state.bones.size()][3]);
+					queue.push({ RenderQueue::makeKey(RenderPass::Opaque, random() % 8, random() % 400, random() % 2000, glm::length(position) * 0.01f), nullptr, nullptr, 0, {} });
+				}
+				queue.sort();
+				checksum = state.bones.back()[3].x + static_cast<float>(state.frame);
+			}
+			// the update kicked by the last frame finishes before the pipeline is destroyed
+		}
+		const double milliseconds = stopwatch.milliseconds() / frames;
+		checksums[threaded] = checksum;
+
+		std::cout << "    " << (threaded ? "threaded" : "serial") << ": " << milliseconds << " ms/frame (" << 1000.0 / milliseconds << " frames/s), update "
+			<< updateMilliseconds / frames << " ms, render waited " << waitMilliseconds / frames << " ms\n";
+	}
+
+	std::cout << "    hardware threads: " << std::thread::hardware_concurrency() << "\n";
+	if (checksums[0] != checksums[1])
+	{
+		std::cerr << "ERROR::BENCHMARK::FRAME_PIPELINE: serial and threaded runs ended on different states\n";
+		return 1;
+	}
+	return 0;
+}
+
+// CPU only: the same work on job systems of 1 to N threads (the workers plus the waiting caller): parallelFor over
+// a large array, many small dependent jobs, and the animation crowd. Results must not depend on the thread count
+inline int benchJobSystem()
+{
+	constexpr size_t elementCount = 1 << 21;
+	constexpr int smallJobs = 20000, characterCount = 1000, repeats = 10;
+	constexpr float deltaTime = 1.0f / 60.0f;
+
+	Skeleton skeleton;
+	vector<AnimationClip> clips(2);
+	makeBenchmarkRig(64, 120, 240.0f, skeleton, clips);
+
+	vector<float> input(elementCount), output(elementCount);
+	for (size_t i = 0; i < elementCount; i++)
+		input[i] = static_cast<float>(i % 1000) * 0.001f;
+
+	const unsigned int maxThreads = std::max(2u, std::thread::hardware_concurrency());
+	std::cout << "job_system (" << elementCount << " elements, " << smallJobs << " small jobs, " << characterCount << " characters, up to "
+		<< maxThreads << " threads)\n";
+
+	int status = 0;
+	double firstSum = 0.0;
+	float firstBone = 0.0f;
+	double baseline[3] = {};
+	for (unsigned int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
+	{
+		JobSystem jobs(threads - 1);
+		double milliseconds[3] = {};
+
+		// parallelFor with the automatic grain
+		Stopwatch stopwatch;
+		for (int repeat = 0; repeat < repeats; repeat++)
+			jobs.parallelFor(0, elementCount, [&](size_t first, size_t last) {
+				for (size_t i = first; i < last; i++)
+					output[i] = std::sqrt(input[i]) * std::sin(input[i] * 6.2831853f) + input[i] * input[i];
+			});
+		milliseconds[0] = stopwatch.milliseconds() / repeats;
+		double sum = 0.0;
+		for (float value : output)
+			sum += value;
+
+		// small jobs, each pair of them a dependency: the second one starts once the first has finished
+		std::atomic<uint64_t> total{ 0 };
+		stopwatch.reset();
+		{
+			JobCounter all;
+			vector<JobCounter> firsts(smallJobs / 2);
+			for (int i = 0; i < smallJobs / 2; i++)
+			{
+				jobs.run([&total, i] { total.fetch_add(i, std::memory_order_relaxed); }, &firsts[i]);
+				jobs.runAfter(firsts[i], [&total] { total.fetch_add(1, std::memory_order_relaxed); }, &all);
+			}
+			jobs.wait(all);
+		}
+		milliseconds[1] = stopwatch.milliseconds();
+		const uint64_t expected = uint64_t(smallJobs / 2) * (smallJobs / 2 - 1) / 2 + smallJobs / 2;
+		if (total.load() != expected)
+		{
+			std::cerr << "ERROR::BENCHMARK::JOB_SYSTEM: dependent jobs ran " << total.load() << " instead of " << expected << "\n";
+			status = 1;
+		}
+
+		// the animation crowd, frame work that has to find every job in the free lists the small jobs warmed
+		AnimationSystem crowd;
+		for (int i = 0; i < characterCount; i++)
+			crowd.animator(crowd.add(skeleton, clips)).play(i % 2, i * 0.013f);
+		const uint64_t allocatedBefore = jobs.stats().allocatedJobs;
+		stopwatch.reset();
+		for (int repeat = 0; repeat < repeats; repeat++)
+			crowd.update(deltaTime, &jobs);
+		milliseconds[2] = stopwatch.milliseconds() / repeats;
+		if (jobs.stats().allocatedJobs != allocatedBefore)
+		{
+			std::cerr << "ERROR::BENCHMARK::JOB_SYSTEM: " << jobs.stats().allocatedJobs - allocatedBefore << " jobs allocated by warm frame work\n";
+			status = 1;
+		}
+
+		if (threads == 1)
+		{
+			firstSum = sum;
+			firstBone = crowd.bones().back()[3].x;
+			std::copy(std::begin(milliseconds), std::end(milliseconds), std::begin(baseline));
+		}
+		else if (sum != firstSum || crowd.bones().back()[3].x != firstBone)
+		{
+			std::cerr << "ERROR::BENCHMARK::JOB_SYSTEM: " << threads << " threads computed different results than 1\n";
+			status = 1;
+		}
+
+		const JobSystemStats stats = jobs.stats();
+		std::cout << "    " << threads << " threads: parallelFor " << milliseconds[0] << " ms (x" << baseline[0] / milliseconds[0] << "), small jobs "
+			<< milliseconds[1] * 1e6 / smallJobs << " ns/job (x" << baseline[1] / milliseconds[1] << "), crowd " << milliseconds[2] << " ms (x"
+			<< baseline[2] / milliseconds[2] << "), " << stats.steals << " steals, " << stats.allocatedJobs << " of " << stats.jobs << " jobs allocated\n";
+	}
+	return status;
+}
+
+// the skybox faces convolved for image based lighting: the source decode, the GGX prefilter serial and on the job
+// system, the spherical harmonics irradiance against brute force, the BRDF table and a cache round trip
+inline int benchEnvironmentMap()
+{
+	const vector<std::string> faces = {
+		"resource/texture/skybox/px.png", "resource/texture/skybox/nx.png", "resource/texture/skybox/py.png",
+		"resource/texture/skybox/ny.png", "resource/texture/skybox/pz.png", "resource/texture/skybox/nz.png"
+	};
+	const EnvironmentSettings settings;
+	std::cout << "environment_map (" << settings.sourceSize << " source, " << settings.prefilteredSize << " prefiltered x " << settings.prefilteredLevels
+		<< " levels, " << settings.specularSamples << " samples, " << settings.brdfSize << " BRDF table)\n";
+
+	Stopwatch stopwatch;
+	CubemapImage source;
+	if (!EnvironmentMap::loadSource(faces, settings.sourceSize, source))
+		return 1;
+	std::cout << "    decode and downsample: " << stopwatch.milliseconds() << " ms\n";
+	const vector<CubemapImage> mips = EnvironmentPrecompute::buildMips(std::move(source));
+
+	int status = 0;
+	stopwatch.reset();
+	const vector<CubemapImage> serial = EnvironmentPrecompute::prefilterSpecular(mips, settings.prefilteredSize, settings.prefilteredLevels, settings.specularSamples, nullptr);
+	const double serialMilliseconds = stopwatch.milliseconds();
+	stopwatch.reset();
+	const vector<CubemapImage> parallel = EnvironmentPrecompute::prefilterSpecular(mips, settings.prefilteredSize, settings.prefilteredLevels, settings.specularSamples);
+	const double parallelMilliseconds = stopwatch.milliseconds();
+	std::cout << "    prefilter: 1 thread " << serialMilliseconds << " ms, jobs (" << JobSystem::shared().size() << " workers + caller) " << parallelMilliseconds << " ms\n";
+	for (size_t level = 0; level < serial.size(); level++)
+		if (serial[level].texels != parallel[level].texels)
+		{
+			std::cerr << "ERROR::BENCHMARK::ENVIRONMENT_MAP: serial and parallel prefilter differ at level " << level << "\n";
+			status = 1;
+		}
+
+	// a convolution keeps the mean radiance, every level should stay close to the source's
+	auto mean = [](const CubemapImage& image) {
+		glm::vec3 sum(0.0f);
+		for (const glm::vec3& texel : image.texels)
+			sum += texel;
+		return sum / static_cast<float>(image.texels.size());
+	};
+	const glm::vec3 sourceMean = mean(mips[0]);
+	std::cout << "    mean luminance: source " << glm::dot(sourceMean, glm::vec3(0.2126f, 0.7152f, 0.0722f)) << ", levels";
+	for (const CubemapImage& level : parallel)
+		std::cout << " " << glm::dot(mean(level), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	std::cout << "\n";
+
+	// spherical harmonics irradiance against the cosine weighted sum over every texel of the same mip
+	const CubemapImage* irradianceSource = &mips.back();
+	for (const CubemapImage& mip : mips)
+		if (mip.size <= settings.irradianceSize)
+		{
+			irradianceSource = &mip;
+			break;
+		}
+	stopwatch.reset();
+	const std::array<glm::vec3, 9> sh = EnvironmentPrecompute::projectIrradianceSH(*irradianceSource);
+	const double shMilliseconds = stopwatch.milliseconds();
+	float maxError = 0.0f;
+	std::mt19937 random(5);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	constexpr int directions = 64;
+	stopwatch.reset();
+	for (int i = 0; i < directions; i++)
+	{
+		glm::vec3 normal(unit(random), unit(random), unit(random));
+		normal = glm::length(normal) > 1e-3f ? glm::normalize(normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+		const glm::vec3 reference = EnvironmentPrecompute::irradianceReference(*irradianceSource, normal);
+		const glm::vec3 approximation = EnvironmentPrecompute::evaluateSH(sh, normal);
+		maxError = std::max(maxError, glm::length(approximation - reference) / std::max(glm::length(reference), 1e-4f));
+	}
+	const double referenceMilliseconds = stopwatch.milliseconds() / directions;
+	std::cout << "    irradiance SH: " << shMilliseconds << " ms to project, max relative error " << maxError * 100.0f << "% against brute force ("
+		<< referenceMilliseconds << " ms per direction)\n";
+	if (maxError > 0.25f)
+	{
+		std::cerr << "ERROR::BENCHMARK::ENVIRONMENT_MAP: spherical harmonics irradiance too far from brute force\n";
+		status = 1;
+	}
+
+	stopwatch.reset();
+	const vector<glm::vec2> lut = EnvironmentPrecompute::integrateBRDF(settings.brdfSize, settings.brdfSamples);
+	const double lutMilliseconds = stopwatch.milliseconds();
+	// head on and smooth the whole specular integral is F0, scale 1 and bias 0
+	const glm::vec2 smooth = lut[settings.brdfSize - 1];
+	std::cout << "    BRDF table: " << lutMilliseconds << " ms, NdotV 1 roughness 0: scale " << smooth.x << " bias " << smooth.y << "\n";
+	if (std::abs(smooth.x + smooth.y - 1.0f) > 0.05f)
+	{
+		std::cerr << "ERROR::BENCHMARK::ENVIRONMENT_MAP: BRDF table does not integrate to 1 for a smooth surface\n";
+		status = 1;
+	}
+
+	// cache round trip
+	EnvironmentData data;
+	data.prefiltered = parallel;
+	data.irradianceSH = sh;
+	data.brdfSize = settings.brdfSize;
+	data.brdfLUT = lut;
+	const std::string cachePath = "environment_benchmark.envmap";
+	EnvironmentCache::write(cachePath, 1, data);
+	EnvironmentData cached;
+	stopwatch.reset();
+	const bool read = EnvironmentCache::read(cachePath, 1, cached);
+	const double readMilliseconds = stopwatch.milliseconds();
+	std::remove(cachePath.c_str());
+	if (!read || cached.brdfLUT != data.brdfLUT || cached.irradianceSH != data.irradianceSH || cached.prefiltered.size() != data.prefiltered.size() || cached.prefiltered.back().texels != data.prefiltered.back().texels)
+	{
+		std::cerr << "ERROR::BENCHMARK::ENVIRONMENT_MAP: cache round trip lost data\n";
+		status = 1;
+	}
+	std::cout << "    cache read: " << readMilliseconds << " ms\n";
+
+	// the model shader lights the diffuse maps with the irradiance, the coefficients have to reach it
+	Shader shader(R"(resource/shader/model_lighting.vert)", R"(resource/shader/model_lighting.frag)");
+	if (shader.location("irradianceSH"_uniform).value < 0)
+	{
+		std::cerr << "ERROR::BENCHMARK::ENVIRONMENT_MAP: model_lighting.frag does not use the irradiance\n";
+		status = 1;
+	}
+
+	// the model shader's skybox fetches per fragment with one specular map, the reflection map unchanged
+	std::cout << "    cubemap fetches per specular map: 9 blurred taps -> 1 prefiltered + 1 BRDF table, shared by every map\n";
+	return status;
+}
+
+// the per object matrices of 100k objects: glm one object at a time against the SSE stage on one thread and on the
+// job system, with every transform changed and with a tenth of them moving, and the largest difference between the two
+inline int benchTransformStage()
+{
+	constexpr unsigned int objectCount = 100000;
+	constexpr int repeats = 10;
+
+	std::mt19937 random(23);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f), angle(0.0f, 6.2831853f), scale(0.2f, 4.0f);
+	vector<glm::mat4> worlds(objectCount);
+	for (glm::mat4& world : worlds)
+	{
+		world = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random), position(random)));
+		world = glm::rotate(world, angle(random), glm::normalize(glm::vec3(position(random), position(random), position(random)) + glm::vec3(1e-3f)));
+		world = glm::scale(world, glm::vec3(scale(random), scale(random), scale(random)));
+	}
+	const glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 2000.0f)
+		* glm::lookAt(glm::vec3(0.0f, 50.0f, 700.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	TransformStage reference, stage;
+	reference.reserve(objectCount);
+	stage.reserve(objectCount);
+	for (const glm::mat4& world : worlds)
+	{
+		reference.add(world);
+		stage.add(world);
+	}
+	std::cout << "transform_stage (" << objectCount << " objects, " << JobSystem::shared().size() << " workers)\n";
+
+	Stopwatch stopwatch;
+	for (int repeat = 0; repeat < repeats; repeat++)
+		reference.updateReference(viewProjection);
+	const double referenceMilliseconds = stopwatch.milliseconds() / repeats;
+
+	// every transform set again before each run, so the normals are recomputed too
+	auto measure = [&](JobSystem* jobs, unsigned int moved) {
+		double total = 0.0;
+		for (int repeat = 0; repeat < repeats; repeat++)
+		{
+			for (unsigned int i = 0; i < moved; i++)
+				stage.set(i * (objectCount / moved), worlds[i * (objectCount / moved)]);
+			stopwatch.reset();
+			stage.update(viewProjection, jobs);
+			total += stopwatch.milliseconds();
+		}
+		return total / repeats;
+	};
+	const double serial = measure(nullptr, objectCount);
+	const double parallel = measure(&JobSystem::shared(), objectCount);
+	const double moving = measure(&JobSystem::shared(), objectCount / 10);
+	const unsigned int normalsUpdated = stage.stats.normalsUpdated;
+
+	float normalError = 0.0f, mvpError = 0.0f;
+	for (unsigned int i = 0; i < objectCount; i++)
+		for (int column = 0; column < 4; column++)
+		{
+			const glm::vec4 mvp = stage.modelViewProjection(i)[column] - reference.modelViewProjection(i)[column];
+			mvpError = std::max(mvpError, std::max(std::max(std::abs(mvp.x), std::abs(mvp.y)), std::max(std::abs(mvp.z), std::abs(mvp.w))));
+			if (column == 3)
+				continue;
+			// relative to the column, the normals of small scales are long
+			const glm::vec3 expected(reference.normalMatrix(i)[column]);
+			normalError = std::max(normalError, glm::length(glm::vec3(stage.normalMatrix(i)[column]) - expected) / std::max(glm::length(expected), 1e-6f));
+		}
+
+	std::cout << "    glm per object: " << referenceMilliseconds << " ms\n"
+		<< "    SSE, 1 thread: " << serial << " ms (x" << referenceMilliseconds / serial << ")\n"
+		<< "    SSE, job system: " << parallel << " ms (x" << referenceMilliseconds / parallel << ")\n"
+		<< "    SSE, job system, " << objectCount / 10 << " moved: " << moving << " ms, " << normalsUpdated << " normal matrices recomputed\n"
+		<< "    max error: normal " << normalError << " (relative), mvp " << mvpError << "\n"
+		<< "    Object constants: " << sizeof(ObjectConstants) << " bytes, instance data: " << sizeof(InstanceData) << " bytes, per vertex work left: one mat4 * vec4\n";
+	if (normalError > 1e-4f || mvpError > 1e-3f)
+	{
+		std::cerr << "ERROR::BENCHMARK::TRANSFORM_STAGE: SSE results differ from glm\n";
+		return 1;
+	}
+	return 0;
+}
+
+// light to cluster binning of 1k to 16k point and spot lights scattered through the view: every light against every
+// cluster box, the SSE binning on one thread and on the job system, checked to give the same lists
+inline int benchLightClusters()
+{
+	constexpr unsigned int width = 1600, height = 900;
+	constexpr float fovY = 45.0f, near = 0.1f, far = 100.0f;
+	constexpr int repeats = 10;
+	const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 5.0f, 30.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	std::cout << "light_clusters (" << width << "x" << height << ", " << LightClusters::TILE_SIZE << " px tiles, " << LightClusters::SLICES << " slices, "
+		<< JobSystem::shared().size() << " workers)\n";
+	int status = 0;
+	for (unsigned int lightCount : { 1024u, 4096u, 16384u })
+	{
+		std::mt19937 random(lightCount);
+		std::uniform_real_distribution<float> spread(-40.0f, 40.0f), unit(-1.0f, 1.0f), color(0.2f, 1.0f);
+		LightManager lights;
+		for (unsigned int i = 0; i < lightCount; i++)
+		{
+			const glm::vec3 position(spread(random), spread(random) * 0.25f, spread(random)), tint(color(random), color(random), color(random));
+			// a range 7 to 13 light of LearnOpenGL's attenuation table, every eighth light a spot light
+			if (i % 8 == 7)
+				lights.addSpotLight(position, glm::vec3(unit(random), -1.0f, unit(random)), tint * 0.05f, tint, tint, 1.0f, 0.35f, 0.44f, std::cos(glm::radians(20.0f)), std::cos(glm::radians(30.0f)));
+			else
+				lights.addPointLight(position, tint * 0.05f, tint, tint, 1.0f, 0.7f, 1.8f);
+		}
+
+		LightClusters reference, serial, parallel;
+		for (LightClusters* clusters : { &reference, &serial, &parallel })
+			clusters->setProjection(glm::radians(fovY), static_cast<float>(width) / height, near, far, width, height);
+
+		Stopwatch stopwatch;
+		double referenceMilliseconds = 0.0;
+		if (lightCount <= 4096)
+		{
+			reference.binReference(lights.data(), view);
+			referenceMilliseconds = stopwatch.milliseconds();
+		}
+		double milliseconds[2] = {};
+		for (int repeat = 0; repeat < repeats; repeat++)
+		{
+			serial.bin(lights.data(), view, nullptr);
+			milliseconds[0] += serial.stats.milliseconds / repeats;
+			parallel.bin(lights.data(), view);
+			milliseconds[1] += parallel.stats.milliseconds / repeats;
+		}
+
+		if (serial.grid() != parallel.grid() || serial.indices() != parallel.indices()
+			|| (referenceMilliseconds > 0.0 && (serial.grid() != reference.grid() || serial.indices() != reference.indices())))
+		{
+			std::cerr << "ERROR::BENCHMARK::LIGHT_CLUSTERS: " << lightCount << " lights binned differently\n";
+			status = 1;
+		}
+
+		// what the GPU gets every frame
+		stopwatch.reset();
+		lights.update(view, fovY, static_cast<float>(width) / height, near, far, width, height);
+		glFinish();
+		const double updateMilliseconds = stopwatch.milliseconds();
+
+		const LightClusterStats& stats = parallel.stats;
+		std::cout << "    " << lightCount << " lights, " << stats.visibleLights << " in depth range, " << stats.clusters << " clusters, " << stats.indices
+			<< " indices, " << stats.maxPerCluster << " max per cluster, " << static_cast<double>(stats.indices) / stats.clusters << " average\n";
+		if (referenceMilliseconds > 0.0)
+			std::cout << "        every light x every cluster: " << referenceMilliseconds << " ms\n";
+		std::cout << "        SSE, 1 thread: " << milliseconds[0] << " ms, job system: " << milliseconds[1] << " ms, with upload: " << updateMilliseconds
+			<< " ms, " << lightCount * sizeof(LightData) + stats.clusters * sizeof(glm::uvec2) + stats.indices * sizeof(uint32_t) << " bytes\n";
+	}
+
+	// the shader has to link with the light blocks
+	Shader shader(R"(resource/shader/model_lighting.vert)", R"(resource/shader/model_lighting.frag)");
+	shader.use();
+	if (glGetError() != GL_NO_ERROR)
+	{
+		std::cerr << "ERROR::BENCHMARK::LIGHT_CLUSTERS: GL error\n";
+		status = 1;
+	}
+	return status;
+}
+
+// CascadedShadowMap over a field of static boxes with a few moving ones: frames with and without the static caster
+// cache, a walking camera, a turned light and a moved static caster, checked that the cached depth is what drawing
+// every caster gives
+inline int benchShadowMaps()
+{
+	constexpr int side = 64, dynamicCount = 16, frames = 30;
+	ShadowSettings settings;
+	settings.distance = 40.0f;
+	CascadedShadowMap shadows(settings);
+	const float aspect = 16.0f / 9.0f, fovY = 45.0f, near = 0.1f;
+
+	// a field of static boxes and a few moving ones over it
+	vector<Mesh> cube;
+	cube.push_back(makeBenchmarkCube());
+	std::mt19937 random(25);
+	std::uniform_real_distribution<float> jitter(-0.5f, 0.5f), height(0.5f, 3.0f);
+	shadows.setLight(glm::vec3(-0.4f, -1.0f, -0.3f));
+	unsigned int firstStatic = 0;
+	for (int i = 0; i < side * side; i++)
+	{
+		const glm::vec3 position((i % side - side / 2) * 2.0f + jitter(random), 0.0f, (i / side - side / 2) * 2.0f + jitter(random));
+		const float h = height(random);
+		const unsigned int caster = shadows.addCaster(cube, glm::scale(glm::translate(glm::mat4(1.0f), position + glm::vec3(0.0f, h * 0.5f, 0.0f)), glm::vec3(0.5f, h, 0.5f)), true);
+		if (i == 0)
+			firstStatic = caster;
+	}
+	vector<unsigned int> dynamicCasters;
+	for (int i = 0; i < dynamicCount; i++)
+		dynamicCasters.push_back(shadows.addCaster(cube, glm::mat4(1.0f), false));
+	auto moveDynamic = [&](float time) {
+		for (int i = 0; i < dynamicCount; i++)
+		{
+			const float angle = time + i * 6.2831853f / dynamicCount;
+			shadows.setTransform(dynamicCasters[i], glm::translate(glm::mat4(1.0f), glm::vec3(std::cos(angle) * 6.0f, 1.5f + std::sin(time * 2.0f + i), std::sin(angle) * 6.0f)));
+		}
+	};
+
+	std::cout << "shadow_maps (" << side * side << " static + " << dynamicCount << " dynamic casters, " << shadows.cascadeCount() << " cascades of "
+		<< settings.resolution << "^2, " << settings.distance << " m)\n";
+
+	glm::vec3 eye(0.0f, 2.0f, 10.0f);
+	auto frame = [&](float time, bool uncached) {
+		moveDynamic(time);
+		shadows.update(glm::lookAt(eye, eye + glm::vec3(0.0f, -0.3f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f)), fovY, aspect, near);
+		if (uncached)
+			shadows.invalidate();
+		// inside a profiler GPU zone like main.cpp's shadow pass, the cascade timers must not nest in its query
+		Profiler::instance().beginFrame();
+		Stopwatch stopwatch;
+		{
+			PROFILE_GPU_SCOPE("shadow pass");
+			shadows.render();
+		}
+		glFinish();
+		return stopwatch.milliseconds();
+	};
+	std::array<unsigned int, CascadedShadowMap::MAX_CASCADES> renders{};
+	auto countRenders = [&]() {
+		unsigned int total = 0;
+		for (unsigned int i = 0; i < shadows.cascadeCount(); i++)
+		{
+			total += shadows.stats[i].staticRenders - renders[i];
+			renders[i] = shadows.stats[i].staticRenders;
+		}
+		return total;
+	};
+	auto report = [&](const char* name, int count, double milliseconds) {
+		std::cout << "    " << name << ": " << milliseconds / count << " ms/frame, " << countRenders() << " static cascade renders in " << count << " frames\n";
+		for (unsigned int i = 0; i < shadows.cascadeCount(); i++)
+		{
+			const CascadeStats& stats = shadows.stats[i];
+			std::cout << "        cascade " << i << ": " << stats.staticDraws << " static + " << stats.dynamicDraws << " dynamic draws, " << stats.culled
+				<< " culled, CPU " << stats.milliseconds << " ms, GPU " << stats.gpuMilliseconds << " ms\n";
+		}
+	};
+
+	double milliseconds = frame(0.0f, false);
+	report("first frame", 1, milliseconds);
+
+	// the same frames with and without the cache, the dynamic casters move every frame
+	milliseconds = 0.0;
+	for (int i = 0; i < frames; i++)
+		milliseconds += frame(i * 0.05f, true);
+	report("uncached", frames, milliseconds);
+	milliseconds = 0.0;
+	for (int i = 0; i < frames; i++)
+		milliseconds += frame(i * 0.05f, false);
+	report("cached", frames, milliseconds);
+
+	// the cached depth has to be what drawing everything gives. The texture holds the sampled cascades and then their
+	// static caches, both are read back, hence texels * 2, and the sampled half is compared
+	const size_t texels = static_cast<size_t>(settings.resolution) * settings.resolution * shadows.cascadeCount();
+	vector<float> cached(texels * 2), redrawn(texels * 2);
+	glGetTextureImage(shadows.texture(), 0, GL_DEPTH_COMPONENT, GL_FLOAT, static_cast<GLsizei>(cached.size() * sizeof(float)), cached.data());
+	frame((frames - 1) * 0.05f, true);
+	glGetTextureImage(shadows.texture(), 0, GL_DEPTH_COMPONENT, GL_FLOAT, static_cast<GLsizei>(redrawn.size() * sizeof(float)), redrawn.data());
+	size_t mismatches = 0;
+	for (size_t i = 0; i < texels; i++)
+		mismatches += cached[i] != redrawn[i];
+	countRenders();
+	std::cout << "    cached vs redrawn: " << mismatches << " / " << texels << " texels differ\n";
+
+	// walking forward at 5 m/s, cascades only move once the camera leaves their margin
+	milliseconds = 0.0;
+	for (int i = 0; i < frames * 4; i++)
+	{
+		eye.z -= 5.0f / 60.0f;
+		milliseconds += frame(i * 0.05f, false);
+	}
+	report("camera moving", frames * 4, milliseconds);
+
+	shadows.setLight(glm::vec3(-0.5f, -1.0f, -0.2f));
+	milliseconds = frame(0.0f, false);
+	report("light turned", 1, milliseconds);
+
+	shadows.setTransform(firstStatic, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.5f, 0.0f)));
+	milliseconds = frame(0.0f, false);
+	report("static caster moved", 1, milliseconds);
+
+	int status = 0;
+	if (mismatches != 0)
+	{
+		std::cerr << "ERROR::BENCHMARK::SHADOW_MAPS: cached depth differs\n";
+		status = 1;
+	}
+	// the shader has to link with the shadow block and sampler
+	Shader shader(R"(resource/shader/model_lighting.vert)", R"(resource/shader/model_lighting.frag)");
+	shader.use();
+	shadows.setUniforms(shader);
+	Profiler::instance().shutdown();
+	if (glGetError() != GL_NO_ERROR)
+	{
+		std::cerr << "ERROR::BENCHMARK::SHADOW_MAPS: GL error\n";
+		status = 1;
+	}
+	return status;
+}
+
+inline int runBenchmark(const std::string& name)
+{
+	struct Entry {
+		const char* name;
+		std::function<int()> run;
+	};
+	const std::vector<Entry> benchmarks = {
+		{ "model_load", benchModelLoad },
+		{ "uniform_setters", benchUniformSetters },
+		{ "packed_draw", benchPackedDraw },
+		{ "uniform_ring", benchUniformRing },
+		{ "gpu_instancing", benchGPUInstancing },
+		{ "frustum_cull", benchFrustumCull },
+		{ "bvh", benchBVH },
+		{ "lod", benchLOD },
+		{ "mesh_optimize", benchMeshOptimize },
+		{ "vertex_compression", benchVertexCompression },
+		{ "shader_cache", benchShaderCache },
+		{ "texture_compression", benchTextureCompression },
+		{ "animation", benchAnimation },
+		{ "render_queue", benchRenderQueue },
+		{ "frame_pipeline", benchFramePipeline },
+		{ "job_system", benchJobSystem },
+		{ "environment_map", benchEnvironmentMap },
+		{ "transform_stage", benchTransformStage },
+		{ "light_clusters", benchLightClusters },
+		{ "shadow_maps", benchShadowMaps },
+	};
+
+	for (const Entry& benchmark : benchmarks)
+		if (name == benchmark.name || name == "all")
+		{
+			int status = benchmark.run();
+			if (status != 0 || name != "all")
+				return status;
+		}
+
+	if (name == "all")
+		return 0;
+
+	std::cerr << "ERROR::BENCHMARK::UNKNOWN_BENCHMARK: " << name << "\n";
+	return 1;
+}
+#endif // !BENCHMARK_H
@@ -0,0 +1,571 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// CPU encoders and decoders for the block formats the texture baker writes. A block covers 4x4 texels, texels go in
+// and come out as RGBA8. The encoders fit the endpoints along the principal axis of the block and refine them with a
+// least squares pass, which is plenty for offline baking and needs no GPU.
+//   BC1  RGB, 8 bytes      four color mode only, the baker never needs punch-through alpha
+//   BC3  RGBA, 16 bytes    a BC4 block for alpha followed by a BC1 block for color
+//   BC4  one channel, 8 bytes, the building block of BC3 alpha and BC5
+//   BC5  RG, 16 bytes      two BC4 blocks, for tangent space normals (z is reconstructed when sampling)
+//   BC7  RGBA, 16 bytes    mode 6 only: one subset, 7 bit endpoints with a shared low bit each, 4 bit indices
+
+enum class BlockFormat : uint32_t {
+	BC1,
+	BC3,
+	BC5,
+	BC7
+};
+
+inline unsigned int blockBytes(BlockFormat format)
+{
+	return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+inline const char* blockFormatName(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1:
+		return "BC1";
+	case BlockFormat::BC3:
+		return "BC3";
+	case BlockFormat::BC5:
+		return "BC5";
+	default:
+		return "BC7";
+	}
+}
+
+class BlockCompressor {
+public:
+	// compresses a width x height RGBA8 image, edge blocks repeat the last row and column
+	static std::vector<uint8_t> compress(BlockFormat format, const uint8_t* rgba, int width, int height)
+	{
+		const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+		const unsigned int size = blockBytes(format);
+		std::vector<uint8_t> blocks(static_cast<size_t>(blocksX) * blocksY * size);
+		uint8_t texels[64];
+		for (int by = 0; by < blocksY; by++)
+			for (int bx = 0; bx < blocksX; bx++)
+			{
+				for (int y = 0; y < 4; y++)
+					for (int x = 0; x < 4; x++)
+					{
+						const int sx = std::min(bx * 4 + x, width - 1), sy = std::min(by * 4 + y, height - 1);
+						std::memcpy(texels + (y * 4 + x) * 4, rgba + (static_cast<size_t>(sy) * width + sx) * 4, 4);
+					}
+				encodeBlock(format, texels, blocks.data() + (static_cast<size_t>(by) * blocksX + bx) * size);
+			}
+		return blocks;
+	}
+
+	static std::vector<uint8_t> decompress(BlockFormat format, const uint8_t* blocks, int width, int height)
+	{
+		const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+		const unsigned int size = blockBytes(format);
+		std::vector<uint8_t> rgba(static_cast<size_t>(width) * height * 4);
+		uint8_t texels[64];
+		for (int by = 0; by < blocksY; by++)
+			for (int bx = 0; bx < blocksX; bx++)
+			{
+				decodeBlock(format, blocks + (static_cast<size_t>(by) * blocksX + bx) * size, texels);
+				for (int y = 0; y < 4 && by * 4 + y < height; y++)
+					for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+						std::memcpy(rgba.data() + (static_cast<size_t>(by * 4 + y) * width + bx * 4 + x) * 4, texels + (y * 4 + x) * 4, 4);
+			}
+		return rgba;
+	}
+
+	// peak signal to noise ratio in dB over the first channels of every RGBA8 texel
+	static double psnr(const uint8_t* a, const uint8_t* b, size_t texelCount, unsigned int channels)
+	{
+		double squared = 0.0;
+		for (size_t i = 0; i < texelCount; i++)
+			for (unsigned int c = 0; c < channels; c++)
+			{
+				const double d = static_cast<double>(a[i * 4 + c]) - b[i * 4 + c];
+				squared += d * d;
+			}
+		const double mse = squared / (static_cast<double>(texelCount) * channels);
+		return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+	}
+
+	// texels are 16 RGBA8 texels in row major order
+	static void encodeBlock(BlockFormat format, const uint8_t* texels, uint8_t* block)
+	{
+		switch (format)
+		{
+		case BlockFormat::BC1:
+			encodeBC1(texels, block);
+			break;
+		case BlockFormat::BC3:
+			encodeBC4(texels, 3, block);
+			encodeBC1(texels, block + 8);
+			break;
+		case BlockFormat::BC5:
+			encodeBC4(texels, 0, block);
+			encodeBC4(texels, 1, block + 8);
+			break;
+		case BlockFormat::BC7:
+			encodeBC7(texels, block);
+			break;
+		}
+	}
+
+	static void decodeBlock(BlockFormat format, const uint8_t* block, uint8_t* texels)
+	{
+		switch (format)
+		{
+		case BlockFormat::BC1:
+			decodeBC1(block, texels, true);
+			break;
+		case BlockFormat::BC3:
+			decodeBC1(block + 8, texels, false);
+			decodeBC4(block, 3, texels);
+			break;
+		case BlockFormat::BC5:
+			decodeBC4(block, 0, texels);
+			decodeBC4(block + 8, 1, texels);
+			for (int i = 0; i < 16; i++)
+			{
+				texels[i * 4 + 2] = 0;
+				texels[i * 4 + 3] = 255;
+			}
+			break;
+		case BlockFormat::BC7:
+			decodeBC7(block, texels);
+			break;
+		}
+	}
+
+	static void encodeBC1(const uint8_t* texels, uint8_t* block)
+	{
+		float colors[16][4];
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 4; c++)
+				colors[i][c] = c < 3 ? texels[i * 4 + c] : 0.0f;
+
+		float endpoints[2][4];
+		principalEndpoints(colors, 3, endpoints);
+
+		uint16_t best[2] = {};
+		uint8_t bestIndices[16] = {};
+		float bestError = FLT_MAX;
+		for (int pass = 0; pass < 3; pass++)
+		{
+			const uint16_t packed[2] = { packRGB565(endpoints[0]), packRGB565(endpoints[1]) };
+			uint8_t palette[4][4];
+			bc1Palette(packed[0], packed[1], true, palette);
+			uint8_t indices[16];
+			const float error = assignIndices(colors, 3, palette, 4, indices);
+			if (error < bestError)
+			{
+				bestError = error;
+				best[0] = packed[0];
+				best[1] = packed[1];
+				std::memcpy(bestIndices, indices, 16);
+			}
+			// index i sits at weight {0, 1, 1/3, 2/3}[i] between endpoint 0 and endpoint 1
+			static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+			if (!leastSquaresEndpoints(colors, 3, indices, weights, endpoints))
+				break;
+		}
+
+		// four color mode needs color0 > color1
+		if (best[0] < best[1])
+		{
+			std::swap(best[0], best[1]);
+			for (uint8_t& index : bestIndices)
+				index = static_cast<uint8_t>(index ^ 1);
+		}
+		else if (best[0] == best[1])
+			std::fill(std::begin(bestIndices), std::end(bestIndices), uint8_t(0));
+
+		uint32_t bits = 0;
+		for (int i = 0; i < 16; i++)
+			bits |= static_cast<uint32_t>(bestIndices[i]) << (2 * i);
+		writeLE(block, best[0], 2);
+		writeLE(block + 2, best[1], 2);
+		writeLE(block + 4, bits, 4);
+	}
+
+	// BC3 color blocks always decode in four color mode
+	static void decodeBC1(const uint8_t* block, uint8_t* texels, bool allowThreeColor)
+	{
+		const uint16_t color0 = static_cast<uint16_t>(readLE(block, 2)), color1 = static_cast<uint16_t>(readLE(block + 2, 2));
+		uint8_t palette[4][4];
+		bc1Palette(color0, color1, !allowThreeColor || color0 > color1, palette);
+		const uint32_t bits = static_cast<uint32_t>(readLE(block + 4, 4));
+		for (int i = 0; i < 16; i++)
+			std::memcpy(texels + i * 4, palette[(bits >> (2 * i)) & 3], 4);
+	}
+
+	static void encodeBC4(const uint8_t* texels, unsigned int channel, uint8_t* block)
+	{
+		uint8_t low = 255, high = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			low = std::min(low, texels[i * 4 + channel]);
+			high = std::max(high, texels[i * 4 + channel]);
+		}
+
+		// eight value mode (red0 > red1), a flat block is stored as red0 == red1 and decodes from index 0
+		uint8_t palette[8];
+		bc4Palette(high, low, palette);
+		uint64_t bits = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			const int value = texels[i * 4 + channel];
+			int bestIndex = 0, bestError = 256;
+			for (int index = 0; index < 8 && high != low; index++)
+			{
+				const int error = std::abs(value - palette[index]);
+				if (error < bestError)
+				{
+					bestError = error;
+					bestIndex = index;
+				}
+			}
+			bits |= static_cast<uint64_t>(bestIndex) << (3 * i);
+		}
+		block[0] = high;
+		block[1] = low;
+		writeLE(block + 2, bits, 6);
+	}
+
+	static void decodeBC4(const uint8_t* block, unsigned int channel, uint8_t* texels)
+	{
+		uint8_t palette[8];
+		bc4Palette(block[0], block[1], palette);
+		const uint64_t bits = readLE(block + 2, 6);
+		for (int i = 0; i < 16; i++)
+			texels[i * 4 + channel] = palette[(bits >> (3 * i)) & 7];
+	}
+
+	static void encodeBC7(const uint8_t* texels, uint8_t* block)
+	{
+		float colors[16][4];
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 4; c++)
+				colors[i][c] = texels[i * 4 + c];
+
+		float endpoints[2][4];
+		principalEndpoints(colors, 4, endpoints);
+		// opaque blocks keep the low bit set so alpha stays exactly 255
+		bool opaque = true;
+		for (int i = 0; i < 16; i++)
+			opaque = opaque && texels[i * 4 + 3] == 255;
+
+		uint8_t best[2][4] = {};
+		uint8_t bestIndices[16] = {};
+		float bestError = FLT_MAX;
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = BC7_WEIGHTS[i] / 64.0f;
+		for (int pass = 0; pass < 3; pass++)
+		{
+			uint8_t quantized[2][4];
+			quantizeBC7Endpoint(endpoints[0], opaque, quantized[0]);
+			quantizeBC7Endpoint(endpoints[1], opaque, quantized[1]);
+			uint8_t palette[16][4];
+			bc7Palette(quantized, palette);
+			uint8_t indices[16];
+			const float error = assignIndices(colors, 4, palette, 16, indices);
+			if (error < bestError)
+			{
+				bestError = error;
+				std::memcpy(best, quantized, sizeof(best));
+				std::memcpy(bestIndices, indices, 16);
+			}
+			if (error == 0.0f || !leastSquaresEndpoints(colors, 4, indices, weights, endpoints))
+				break;
+		}
+
+		// the anchor (first) index is stored without its top bit, so it has to be below 8
+		if (bestIndices[0] >= 8)
+		{
+			std::swap(best[0], best[1]);
+			for (uint8_t& index : bestIndices)
+				index = static_cast<uint8_t>(15 - index);
+		}
+
+		uint64_t words[2] = {};
+		unsigned int position = 0;
+		writeBits(words, position, 1u << 6, 7); // mode 6
+		for (int c = 0; c < 4; c++)
+			for (int e = 0; e < 2; e++)
+				writeBits(words, position, best[e][c] >> 1, 7);
+		writeBits(words, position, best[0][0] & 1, 1);
+		writeBits(words, position, best[1][0] & 1, 1);
+		for (int i = 0; i < 16; i++)
+			writeBits(words, position, bestIndices[i], i == 0 ? 3 : 4);
+		writeLE(block, words[0], 8);
+		writeLE(block + 8, words[1], 8);
+	}
+
+	// only decodes mode 6, the one encodeBC7 writes, other modes come out magenta
+	static void decodeBC7(const uint8_t* block, uint8_t* texels)
+	{
+		const uint64_t words[2] = { readLE(block, 8), readLE(block + 8, 8) };
+		unsigned int position = 0;
+		if (readBits(words, position, 7) != (1u << 6))
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				const uint8_t magenta[4] = { 255, 0, 255, 255 };
+				std::memcpy(texels + i * 4, magenta, 4);
+			}
+			return;
+		}
+		uint8_t endpoints[2][4];
+		for (int c = 0; c < 4; c++)
+			for (int e = 0; e < 2; e++)
+				endpoints[e][c] = static_cast<uint8_t>(readBits(words, position, 7) << 1);
+		for (int e = 0; e < 2; e++)
+		{
+			const uint8_t p = static_cast<uint8_t>(readBits(words, position, 1));
+			for (int c = 0; c < 4; c++)
+				endpoints[e][c] |= p;
+		}
+		uint8_t palette[16][4];
+		bc7Palette(endpoints, palette);
+		for (int i = 0; i < 16; i++)
+			std::memcpy(texels + i * 4, palette[readBits(words, position, i == 0 ? 3 : 4)], 4);
+	}
+
+private:
+	static constexpr int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// endpoints spanning the block along its principal axis (power iteration on the covariance)
+	static void principalEndpoints(const float (*colors)[4], int channels, float (*endpoints)[4])
+	{
+		float mean[4] = {};
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < channels; c++)
+				mean[c] += colors[i][c] / 16.0f;
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++)
+			for (int a = 0; a < channels; a++)
+				for (int b = 0; b < channels; b++)
+					covariance[a][b] += (colors[i][a] - mean[a]) * (colors[i][b] - mean[b]);
+
+		float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = 0; b < channels; b++)
+					next[a] += covariance[a][b] * axis[b];
+				length = std::max(length, std::fabs(next[a]));
+			}
+			if (length < 1e-6f)
+				break;
+			for (int a = 0; a < channels; a++)
+				axis[a] = next[a] / length;
+		}
+		float length = 0.0f;
+		for (int c = 0; c < channels; c++)
+			length += axis[c] * axis[c];
+		length = std::sqrt(length);
+		for (int c = 0; c < channels; c++)
+			axis[c] /= length;
+
+		float low = FLT_MAX, high = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < channels; c++)
+				t += (colors[i][c] - mean[c]) * axis[c];
+			low = std::min(low, t);
+			high = std::max(high, t);
+		}
+		for (int c = 0; c < 4; c++)
+		{
+			endpoints[0][c] = c < channels ? std::clamp(mean[c] + axis[c] * low, 0.0f, 255.0f) : 0.0f;
+			endpoints[1][c] = c < channels ? std::clamp(mean[c] + axis[c] * high, 0.0f, 255.0f) : 0.0f;
+		}
+	}
+
+	// nearest palette entry per texel, returns the summed squared error
+	template <int Channels>
+	static float assignIndicesN(const float (*colors)[4], const uint8_t (*palette)[4], int paletteSize, uint8_t* indices)
+	{
+		float total = 0.0f;
+		for (int i = 0; i < 16; i++)
+		{
+			float bestError = FLT_MAX;
+			for (int p = 0; p < paletteSize; p++)
+			{
+				float error = 0.0f;
+				for (int c = 0; c < Channels; c++)
+				{
+					const float d = colors[i][c] - palette[p][c];
+					error += d * d;
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					indices[i] = static_cast<uint8_t>(p);
+				}
+			}
+			total += bestError;
+		}
+		return total;
+	}
+
+	static float assignIndices(const float (*colors)[4], int channels, const uint8_t (*palette)[4], int paletteSize, uint8_t* indices)
+	{
+		return channels == 3 ? assignIndicesN<3>(colors, palette, paletteSize, indices) : assignIndicesN<4>(colors, palette, paletteSize, indices);
+	}
+
+	// endpoints minimizing the squared error for fixed indices, false if the indices don't pin them down
+	static bool leastSquaresEndpoints(const float (*colors)[4], int channels, const uint8_t* indices, const float* weights, float (*endpoints)[4])
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			const float b = weights[indices[i]], a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channels; c++)
+			{
+				ax[c] += a * colors[i][c];
+				bx[c] += b * colors[i][c];
+			}
+		}
+		const float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+			return false;
+		for (int c = 0; c < channels; c++)
+		{
+			endpoints[0][c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+			endpoints[1][c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+		}
+		return true;
+	}
+
+	static uint16_t packRGB565(const float* color)
+	{
+		const int r = static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f);
+		const int g = static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f);
+		const int b = static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f);
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	static void unpackRGB565(uint16_t packed, uint8_t* color)
+	{
+		const int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+		color[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+		color[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+		color[3] = 255;
+	}
+
+	static void bc1Palette(uint16_t color0, uint16_t color1, bool fourColor, uint8_t (*palette)[4])
+	{
+		unpackRGB565(color0, palette[0]);
+		unpackRGB565(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			if (fourColor)
+			{
+				palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c]) / 3);
+				palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c]) / 3);
+			}
+			else
+			{
+				palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c]) / 2);
+				palette[3][c] = 0;
+			}
+		}
+		palette[2][3] = 255;
+		palette[3][3] = fourColor ? 255 : 0;
+	}
+
+	static void bc4Palette(uint8_t red0, uint8_t red1, uint8_t* palette)
+	{
+		palette[0] = red0;
+		palette[1] = red1;
+		if (red0 > red1)
+			for (int i = 2; i < 8; i++)
+				palette[i] = static_cast<uint8_t>(((8 - i) * red0 + (i - 1) * red1) / 7);
+		else
+		{
+			for (int i = 2; i < 6; i++)
+				palette[i] = static_cast<uint8_t>(((6 - i) * red0 + (i - 1) * red1) / 5);
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	// 7 bits per channel plus one low bit shared by the endpoint, picked for the smallest error
+	static void quantizeBC7Endpoint(const float* color, bool opaque, uint8_t* quantized)
+	{
+		float bestError = FLT_MAX;
+		for (int p = opaque ? 1 : 0; p < 2; p++)
+		{
+			uint8_t candidate[4];
+			float error = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				const int value = std::clamp(static_cast<int>((color[c] - p) / 2.0f + 0.5f), 0, 127);
+				candidate[c] = static_cast<uint8_t>((value << 1) | p);
+				error += (candidate[c] - color[c]) * (candidate[c] - color[c]);
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				std::memcpy(quantized, candidate, 4);
+			}
+		}
+	}
+
+	static void bc7Palette(const uint8_t (*endpoints)[4], uint8_t (*palette)[4])
+	{
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 4; c++)
+				palette[i][c] = static_cast<uint8_t>(((64 - BC7_WEIGHTS[i]) * endpoints[0][c] + BC7_WEIGHTS[i] * endpoints[1][c] + 32) >> 6);
+	}
+
+	static void writeBits(uint64_t* words, unsigned int& position, uint64_t value, unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; i++, position++)
+			words[position >> 6] |= ((value >> i) & 1) << (position & 63);
+	}
+
+	static unsigned int readBits(const uint64_t* words, unsigned int& position, unsigned int count)
+	{
+		unsigned int value = 0;
+		for (unsigned int i = 0; i < count; i++, position++)
+			value |= static_cast<unsigned int>((words[position >> 6] >> (position & 63)) & 1) << i;
+		return value;
+	}
+
+	static void writeLE(uint8_t* bytes, uint64_t value, int count)
+	{
+		for (int i = 0; i < count; i++)
+			bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+	}
+
+	static uint64_t readLE(const uint8_t* bytes, int count)
+	{
+		uint64_t value = 0;
+		for (int i = 0; i < count; i++)
+			value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+		return value;
+	}
+};
+#endif // !BLOCK_COMPRESSION_H
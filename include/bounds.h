@@ -0,0 +1,163 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// axis aligned box, empty until the first point is added
+struct BoundingBox {
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+	bool empty() const
+	{
+		return min.x > max.x;
+	}
+
+	void expand(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void expand(const BoundingBox& box)
+	{
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+
+	glm::vec3 center() const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	glm::vec3 extent() const
+	{
+		return (max - min) * 0.5f;
+	}
+
+	// box of the transformed box (Arvo), still axis aligned so it may grow under rotation
+	BoundingBox transformed(const glm::mat4& transform) const
+	{
+		const glm::vec3 c = glm::vec3(transform * glm::vec4(center(), 1.0f));
+		const glm::vec3 e = extent();
+		const glm::vec3 worldExtent(
+			std::abs(transform[0][0]) * e.x + std::abs(transform[1][0]) * e.y + std::abs(transform[2][0]) * e.z,
+			std::abs(transform[0][1]) * e.x + std::abs(transform[1][1]) * e.y + std::abs(transform[2][1]) * e.z,
+			std::abs(transform[0][2]) * e.x + std::abs(transform[1][2]) * e.y + std::abs(transform[2][2]) * e.z);
+
+		BoundingBox box;
+		box.min = c - worldExtent;
+		box.max = c + worldExtent;
+		return box;
+	}
+};
+
+struct BoundingSphere {
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+
+	// the sphere after transform, the radius grows with the largest axis scale
+	BoundingSphere transformed(const glm::mat4& transform) const
+	{
+		const float scale = std::sqrt(std::max({
+			glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+			glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])),
+			glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])) }));
+
+		BoundingSphere sphere;
+		sphere.center = glm::vec3(transform * glm::vec4(center, 1.0f));
+		sphere.radius = radius * scale;
+		return sphere;
+	}
+};
+
+struct Bounds {
+	BoundingBox box;
+	// centered on the box, radius from the farthest point rather than the box corner
+	BoundingSphere sphere;
+};
+
+struct Ray {
+	glm::vec3 origin = glm::vec3(0.0f);
+	glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+};
+
+// slab test, true if the ray enters the box before maxDistance; inverseDirection is 1 / ray.direction
+inline bool intersects(const Ray& ray, const glm::vec3& inverseDirection, const BoundingBox& box, float maxDistance)
+{
+	const glm::vec3 t0 = (box.min - ray.origin) * inverseDirection;
+	const glm::vec3 t1 = (box.max - ray.origin) * inverseDirection;
+	const glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+	const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+	return enter <= exit;
+}
+
+// Moller-Trumbore, returns the distance along the ray or a negative value on a miss, both faces count
+inline float intersectTriangle(const Ray& ray, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	const glm::vec3 edge1 = b - a, edge2 = c - a;
+	const glm::vec3 p = glm::cross(ray.direction, edge2);
+	const float determinant = glm::dot(edge1, p);
+	if (std::abs(determinant) < 1e-12f)
+		return -1.0f;
+
+	const float inverseDeterminant = 1.0f / determinant;
+	const glm::vec3 s = ray.origin - a;
+	const float u = glm::dot(s, p) * inverseDeterminant;
+	if (u < 0.0f || u > 1.0f)
+		return -1.0f;
+	const glm::vec3 q = glm::cross(s, edge1);
+	const float v = glm::dot(ray.direction, q) * inverseDeterminant;
+	if (v < 0.0f || u + v > 1.0f)
+		return -1.0f;
+	return glm::dot(edge2, q) * inverseDeterminant;
+}
+
+// bounds of every position in [first, first + count), positions are stride bytes apart
+inline Bounds boundsOf(const glm::vec3* first, size_t count, size_t stride = sizeof(glm::vec3))
+{
+	auto at = [first, stride](size_t i) -> const glm::vec3& {
+		return *reinterpret_cast<const glm::vec3*>(reinterpret_cast<const unsigned char*>(first) + i * stride);
+	};
+
+	Bounds bounds;
+	for (size_t i = 0; i < count; i++)
+		bounds.box.expand(at(i));
+	if (bounds.box.empty())
+		return bounds;
+
+	bounds.sphere.center = bounds.box.center();
+	float radiusSquared = 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		const glm::vec3 d = at(i) - bounds.sphere.center;
+		radiusSquared = std::max(radiusSquared, glm::dot(d, d));
+	}
+	bounds.sphere.radius = std::sqrt(radiusSquared);
+	return bounds;
+}
+
+// bounds enclosing other bounds
+inline Bounds merge(const Bounds& a, const Bounds& b)
+{
+	if (a.box.empty())
+		return b;
+	if (b.box.empty())
+		return a;
+
+	Bounds bounds;
+	bounds.box = a.box;
+	bounds.box.expand(b.box);
+	bounds.sphere.center = bounds.box.center();
+	bounds.sphere.radius = std::max(glm::length(a.sphere.center - bounds.sphere.center) + a.sphere.radius,
+		glm::length(b.sphere.center - bounds.sphere.center) + b.sphere.radius);
+	// the sphere through the box corners encloses everything too
+	bounds.sphere.radius = std::min(bounds.sphere.radius, glm::length(bounds.box.extent()));
+	return bounds;
+}
+#endif // !BOUNDS_H
@@ -0,0 +1,273 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <bounds.h>
+#include <frustum_culling.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+using std::vector;
+
+// Bounding volume hierarchy over item boxes (one item per mesh instance in Scene).
+// Nodes are stored depth first: an internal node's left child is the next node, and every node keeps a skip index
+// to the node after its subtree. Traversal is a single loop over the array without a stack: descend on a hit,
+// jump to skip on a miss. Each node also covers a contiguous range of the item order, so a subtree that is
+// fully inside the frustum is accepted without visiting it.
+class BVH {
+public:
+	static constexpr unsigned int BIN_COUNT = 16;
+	static constexpr unsigned int MAX_LEAF_SIZE = 4;
+
+	struct Node {
+		BoundingBox box;
+		uint32_t skip;		// next node when this subtree is skipped or finished, nodes.size() ends the traversal
+		uint32_t first;		// into itemOrder
+		uint32_t count;
+		uint32_t leaf;
+	};
+
+	// binned SAH build over the item boxes, items are identified by their index in boxes
+	void build(const vector<BoundingBox>& boxes)
+	{
+		itemBoxes = boxes;
+		itemOrder.resize(boxes.size());
+		centroids.resize(boxes.size());
+		for (uint32_t i = 0; i < boxes.size(); i++)
+		{
+			itemOrder[i] = i;
+			centroids[i] = boxes[i].center();
+		}
+
+		nodes.clear();
+		nodes.reserve(boxes.size() * 2);
+		if (!boxes.empty())
+			buildNode(0, static_cast<uint32_t>(boxes.size()));
+		dirty = false;
+	}
+
+	// move one item, the hierarchy keeps its topology until refit() is called
+	void update(uint32_t item, const BoundingBox& box)
+	{
+		itemBoxes[item] = box;
+		dirty = true;
+	}
+
+	// recompute every node box bottom up, children always come after their parent
+	void refit()
+	{
+		if (!dirty)
+			return;
+		for (size_t i = nodes.size(); i-- > 0;)
+		{
+			Node& node = nodes[i];
+			node.box = BoundingBox();
+			if (node.leaf)
+				for (uint32_t k = node.first; k < node.first + node.count; k++)
+					node.box.expand(itemBoxes[itemOrder[k]]);
+			else
+			{
+				const Node& left = nodes[i + 1];
+				node.box.expand(left.box);
+				node.box.expand(nodes[left.skip].box);
+			}
+		}
+		dirty = false;
+	}
+
+	// appends every item whose box touches the frustum
+	void queryFrustum(const Frustum& frustum, vector<uint32_t>& items) const
+	{
+		size_t i = 0;
+		while (i < nodes.size())
+		{
+			const Node& node = nodes[i];
+			const Frustum::Containment containment = frustum.classify(node.box);
+			if (containment == Frustum::Containment::Outside)
+			{
+				i = node.skip;
+				continue;
+			}
+			if (containment == Frustum::Containment::Inside)
+			{
+				items.insert(items.end(), itemOrder.begin() + node.first, itemOrder.begin() + node.first + node.count);
+				i = node.skip;
+				continue;
+			}
+			if (node.leaf)
+			{
+				for (uint32_t k = node.first; k < node.first + node.count; k++)
+					if (frustum.intersects(itemBoxes[itemOrder[k]]))
+						items.push_back(itemOrder[k]);
+				i = node.skip;
+				continue;
+			}
+			i++;
+		}
+	}
+
+	// closest hit, intersect(item, ray, maxDistance) returns the hit distance or a negative value on a miss.
+	// Returns the item or UINT32_MAX, distance is only written on a hit
+	template <class Intersect>
+	uint32_t raycast(const Ray& ray, Intersect&& intersect, float& distance, float maxDistance = std::numeric_limits<float>::max()) const
+	{
+		const glm::vec3 inverseDirection = 1.0f / ray.direction;
+		uint32_t closest = std::numeric_limits<uint32_t>::max();
+		size_t i = 0;
+		while (i < nodes.size())
+		{
+			const Node& node = nodes[i];
+			if (!intersects(ray, inverseDirection, node.box, maxDistance))
+			{
+				i = node.skip;
+				continue;
+			}
+			if (node.leaf)
+			{
+				for (uint32_t k = node.first; k < node.first + node.count; k++)
+				{
+					const uint32_t item = itemOrder[k];
+					if (!intersects(ray, inverseDirection, itemBoxes[item], maxDistance))
+						continue;
+					const float hit = intersect(item, ray, maxDistance);
+					if (hit >= 0.0f && hit < maxDistance)
+					{
+						maxDistance = hit;
+						closest = item;
+					}
+				}
+				i = node.skip;
+				continue;
+			}
+			i++;
+		}
+		if (closest != std::numeric_limits<uint32_t>::max())
+			distance = maxDistance;
+		return closest;
+	}
+
+	const vector<Node>& hierarchy() const
+	{
+		return nodes;
+	}
+
+	size_t itemCount() const
+	{
+		return itemBoxes.size();
+	}
+
+private:
+	static float surfaceArea(const BoundingBox& box)
+	{
+		if (box.empty())
+			return 0.0f;
+		const glm::vec3 d = box.max - box.min;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	// builds the subtree over itemOrder[first, first + count) and returns its node index
+	uint32_t buildNode(uint32_t first, uint32_t count)
+	{
+		const uint32_t index = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(Node());
+
+		BoundingBox box, centroidBox;
+		for (uint32_t k = first; k < first + count; k++)
+		{
+			box.expand(itemBoxes[itemOrder[k]]);
+			centroidBox.expand(centroids[itemOrder[k]]);
+		}
+
+		uint32_t split = count > MAX_LEAF_SIZE ? findSplit(first, count, box, centroidBox) : 0;
+		if (split == 0)
+		{
+			nodes[index] = { box, static_cast<uint32_t>(nodes.size()), first, count, 1 };
+			return index;
+		}
+
+		buildNode(first, split - first);
+		buildNode(split, first + count - split);
+		nodes[index] = { box, static_cast<uint32_t>(nodes.size()), first, count, 0 };
+		return index;
+	}
+
+	// partitions the range on the cheapest binned SAH plane, returns the first item of the right half or 0 for a leaf
+	uint32_t findSplit(uint32_t first, uint32_t count, const BoundingBox& box, const BoundingBox& centroidBox)
+	{
+		const glm::vec3 size = centroidBox.max - centroidBox.min;
+		int axis = 0;
+		if (size.y > size[axis])
+			axis = 1;
+		if (size.z > size[axis])
+			axis = 2;
+		if (size[axis] <= 0.0f)
+			return 0;	// every centroid in one spot, nothing to split
+
+		struct Bin {
+			BoundingBox box;
+			uint32_t count = 0;
+		} bins[BIN_COUNT];
+
+		const float binScale = BIN_COUNT / size[axis] * 0.9999f;
+		auto binOf = [&](uint32_t item) {
+			return std::min(BIN_COUNT - 1, static_cast<unsigned int>((centroids[item][axis] - centroidBox.min[axis]) * binScale));
+		};
+		for (uint32_t k = first; k < first + count; k++)
+		{
+			Bin& bin = bins[binOf(itemOrder[k])];
+			bin.box.expand(itemBoxes[itemOrder[k]]);
+			bin.count++;
+		}
+
+		// sweep from the right to get the cost of every right half, then from the left
+		float rightArea[BIN_COUNT];
+		uint32_t rightCount[BIN_COUNT];
+		BoundingBox accumulated;
+		uint32_t accumulatedCount = 0;
+		for (unsigned int b = BIN_COUNT - 1; b > 0; b--)
+		{
+			accumulated.expand(bins[b].box);
+			accumulatedCount += bins[b].count;
+			rightArea[b] = surfaceArea(accumulated);
+			rightCount[b] = accumulatedCount;
+		}
+
+		float bestCost = std::numeric_limits<float>::max();
+		unsigned int bestBin = 0;
+		accumulated = BoundingBox();
+		accumulatedCount = 0;
+		for (unsigned int b = 1; b < BIN_COUNT; b++)
+		{
+			accumulated.expand(bins[b - 1].box);
+			accumulatedCount += bins[b - 1].count;
+			if (accumulatedCount == 0 || rightCount[b] == 0)
+				continue;
+			const float cost = surfaceArea(accumulated) * accumulatedCount + rightArea[b] * rightCount[b];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestBin = b;
+			}
+		}
+
+		// a leaf is cheaper when intersecting every item beats one more level of boxes
+		const float leafCost = surfaceArea(box) * count;
+		if (bestBin == 0 || (bestCost >= leafCost && count <= MAX_LEAF_SIZE * 4))
+			return 0;
+
+		auto middle = std::partition(itemOrder.begin() + first, itemOrder.begin() + first + count,
+			[&](uint32_t item) { return binOf(item) < bestBin; });
+		return static_cast<uint32_t>(middle - itemOrder.begin());
+	}
+
+	vector<Node> nodes;
+	vector<uint32_t> itemOrder;
+	vector<BoundingBox> itemBoxes;
+	vector<glm::vec3> centroids;
+	bool dirty = false;
+};
+#endif // !BVH_H
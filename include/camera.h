@@ -5,6 +5,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <bounds.h>
+
 #include <vector>
 
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
@@ -68,6 +70,16 @@ public:
         return glm::lookAt(Position, Position + Front, Up);
     }
 
+    // returns the world space ray through a point in normalized device coordinates ([-1, 1], y up) for a perspective projection built from Zoom
+    Ray GetPickingRay(float ndcX, float ndcY, float aspect) const
+    {
+        float tanHalfFov = tan(glm::radians(Zoom) * 0.5f);
+        Ray ray;
+        ray.origin = Position;
+        ray.direction = glm::normalize(Front + Right * (ndcX * tanHalfFov * aspect) + Up * (ndcY * tanHalfFov));
+        return ray;
+    }
+
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime)
     {
@@ -118,6 +130,16 @@ public:
         updateCameraVectors();
     }
 
+    // places the camera directly, used to replay recorded camera tracks
+    void SetPose(glm::vec3 position, float yaw, float pitch, float zoom)
+    {
+        Position = position;
+        Yaw = yaw;
+        Pitch = pitch;
+        Zoom = zoom;
+        updateCameraVectors();
+    }
+
     // processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
     void ProcessMouseScroll(float yoffset)
     {
@@ -0,0 +1,376 @@
+#ifndef ENVIRONMENT_MAP_H
+#define ENVIRONMENT_MAP_H
+
+#include <glad/glad.h>
+// main.cpp includes stb_image.h with STB_IMAGE_IMPLEMENTATION, its implementation part has no include guard
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <environment_precompute.h>
+#include <job_system.h>
+#include <mesh_cache.h>
+#include <shader.h>
+#include <profiler.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// how much precompute goes into an environment, part of the cache key
+struct EnvironmentSettings {
+	int sourceSize = 256;				// faces are box filtered down to this before convolving
+	int irradianceSize = 32;			// the source mip projected onto spherical harmonics
+	int prefilteredSize = 128;
+	unsigned int prefilteredLevels = 6;	// roughness 0, 0.2 ... 1
+	unsigned int specularSamples = 64;
+	int brdfSize = 128;
+	unsigned int brdfSamples = 256;
+};
+
+// everything EnvironmentMap uploads, what the cache file holds
+struct EnvironmentData {
+	vector<CubemapImage> prefiltered;
+	std::array<glm::vec3, 9> irradianceSH = {};
+	int brdfSize = 0;
+	vector<glm::vec2> brdfLUT;
+};
+
+// The precomputed environment next to the skybox faces, so only the first start pays for the convolutions.
+// File layout (every section starts on a 16 byte boundary):
+//   EnvironmentCacheHeader
+//   glm::vec3 prefiltered[]   every level's six faces, largest level first
+//   glm::vec2 brdfLUT[]
+constexpr uint32_t ENVIRONMENT_CACHE_MAGIC = 0x45474F54; // "TOGE"
+constexpr uint32_t ENVIRONMENT_CACHE_VERSION = 1;
+
+struct EnvironmentCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;		// the face files and the settings
+	int32_t prefilteredSize;
+	uint32_t prefilteredLevels;
+	int32_t brdfSize;
+	uint32_t padding;
+	float irradianceSH[27];
+	uint32_t padding2;
+	uint64_t prefilteredOffset;
+	uint64_t brdfOffset;
+	uint64_t fileSize;
+};
+
+class EnvironmentCache {
+public:
+	static std::string pathFor(const vector<std::string>& faces)
+	{
+		const std::string& first = faces.empty() ? std::string() : faces[0];
+		const size_t slash = first.find_last_of("/\\");
+		return (slash == std::string::npos ? std::string() : first.substr(0, slash + 1)) + "environment.envmap";
+	}
+
+	// 0 if a face can't be read
+	static uint64_t hashSources(const vector<std::string>& faces, const EnvironmentSettings& settings)
+	{
+		uint64_t hash = fnv1a64(&settings, sizeof(settings));
+		for (const std::string& face : faces)
+		{
+			uint64_t size = 0;
+			const uint64_t faceHash = hashFile(face, &size);
+			if (faceHash == 0)
+				return 0;
+			hash = fnv1a64(&faceHash, sizeof(faceHash), hash);
+			hash = fnv1a64(&size, sizeof(size), hash);
+		}
+		return hash;
+	}
+
+	static bool read(const std::string& cachePath, uint64_t sourceHash, EnvironmentData& data)
+	{
+		MappedFile file(cachePath);
+		if (!file.isOpen() || file.size() < sizeof(EnvironmentCacheHeader))
+			return false;
+
+		EnvironmentCacheHeader header;
+		std::memcpy(&header, file.data(), sizeof(header));
+		if (header.magic != ENVIRONMENT_CACHE_MAGIC || header.version != ENVIRONMENT_CACHE_VERSION
+			|| header.sourceHash != sourceHash || header.fileSize != file.size())
+			return false;
+
+		data.prefiltered.resize(header.prefilteredLevels);
+		const unsigned char* texels = file.data() + header.prefilteredOffset;
+		for (unsigned int level = 0; level < header.prefilteredLevels; level++)
+		{
+			CubemapImage& image = data.prefiltered[level];
+			image.resize(std::max(1, header.prefilteredSize >> level));
+			std::memcpy(image.texels.data(), texels, image.texels.size() * sizeof(glm::vec3));
+			texels += image.texels.size() * sizeof(glm::vec3);
+		}
+		for (int k = 0; k < 9; k++)
+			data.irradianceSH[k] = glm::vec3(header.irradianceSH[k * 3], header.irradianceSH[k * 3 + 1], header.irradianceSH[k * 3 + 2]);
+		data.brdfSize = header.brdfSize;
+		data.brdfLUT.resize(static_cast<size_t>(header.brdfSize) * header.brdfSize);
+		std::memcpy(data.brdfLUT.data(), file.data() + header.brdfOffset, data.brdfLUT.size() * sizeof(glm::vec2));
+		return true;
+	}
+
+	static bool write(const std::string& cachePath, uint64_t sourceHash, const EnvironmentData& data)
+	{
+		EnvironmentCacheHeader header{};
+		header.magic = ENVIRONMENT_CACHE_MAGIC;
+		header.version = ENVIRONMENT_CACHE_VERSION;
+		header.sourceHash = sourceHash;
+		header.prefilteredSize = data.prefiltered.empty() ? 0 : data.prefiltered[0].size;
+		header.prefilteredLevels = static_cast<uint32_t>(data.prefiltered.size());
+		header.brdfSize = data.brdfSize;
+		for (int k = 0; k < 9; k++)
+			for (int c = 0; c < 3; c++)
+				header.irradianceSH[k * 3 + c] = data.irradianceSH[k][c];
+		uint64_t texelCount = 0;
+		for (const CubemapImage& image : data.prefiltered)
+			texelCount += image.texels.size();
+		header.prefilteredOffset = align(sizeof(EnvironmentCacheHeader));
+		header.brdfOffset = align(header.prefilteredOffset + texelCount * sizeof(glm::vec3));
+		header.fileSize = header.brdfOffset + data.brdfLUT.size() * sizeof(glm::vec2);
+
+		// write to a temporary file first so a crash never leaves a half written cache behind
+		const std::string tempPath = cachePath + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file)
+			{
+				std::cerr << "ERROR::ENVIRONMENT_CACHE::FAILED_TO_OPEN_FILE: " << tempPath << "\n";
+				return false;
+			}
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.seekp(static_cast<std::streamoff>(header.prefilteredOffset));
+			for (const CubemapImage& image : data.prefiltered)
+				file.write(reinterpret_cast<const char*>(image.texels.data()), image.texels.size() * sizeof(glm::vec3));
+			file.seekp(static_cast<std::streamoff>(header.brdfOffset));
+			file.write(reinterpret_cast<const char*>(data.brdfLUT.data()), data.brdfLUT.size() * sizeof(glm::vec2));
+			if (!file)
+			{
+				std::cerr << "ERROR::ENVIRONMENT_CACHE::FAILED_TO_WRITE_FILE: " << tempPath << "\n";
+				return false;
+			}
+		}
+
+		std::remove(cachePath.c_str());
+		if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0)
+		{
+			std::cerr << "ERROR::ENVIRONMENT_CACHE::FAILED_TO_RENAME_FILE: " << tempPath << "\n";
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + 15) & ~uint64_t(15);
+	}
+};
+
+// Image based lighting from the skybox faces: a GGX prefiltered specular cubemap with one roughness per mip, the
+// split sum BRDF lookup table and the diffuse irradiance as spherical harmonics. Computed on the job system the first
+// time and read from the EnvironmentCache after that.
+class EnvironmentMap {
+public:
+	// texture units the model shaders sample these from, next to the skybox on 10
+	static constexpr GLuint PREFILTERED_UNIT = 11;
+	static constexpr GLuint BRDF_LUT_UNIT = 12;
+
+	bool loadedFromCache = false;
+	double loadMilliseconds = 0.0;
+
+	explicit EnvironmentMap(const vector<std::string>& faces, const EnvironmentSettings& settings = EnvironmentSettings())
+	{
+		PROFILE_SCOPE("EnvironmentMap::load");
+		const auto start = std::chrono::steady_clock::now();
+		const uint64_t sourceHash = EnvironmentCache::hashSources(faces, settings);
+		const std::string cachePath = EnvironmentCache::pathFor(faces);
+		loadedFromCache = sourceHash != 0 && EnvironmentCache::read(cachePath, sourceHash, data);
+		if (!loadedFromCache && precompute(faces, settings, data) && sourceHash != 0)
+			EnvironmentCache::write(cachePath, sourceHash, data);
+		upload();
+		loadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+#ifdef _DEBUG
+		std::cout << "SUCCESSFULLY::ENVIRONMENT_MAP::" << (loadedFromCache ? "LOADED_FROM_CACHE" : "PRECOMPUTED") << "\n"
+			<< "    MILLISECONDS: " << loadMilliseconds << "\n";
+#endif
+	}
+
+	~EnvironmentMap()
+	{
+		if (prefilteredID)
+			glDeleteTextures(1, &prefilteredID);
+		if (brdfID)
+			glDeleteTextures(1, &brdfID);
+	}
+
+	EnvironmentMap(const EnvironmentMap&) = delete;
+	EnvironmentMap& operator=(const EnvironmentMap&) = delete;
+
+	// the samplers, the roughness to mip mapping and the irradiance of a shader sampling the environment
+	void setUniforms(const Shader& shader) const
+	{
+		shader.setInt("prefilteredMap", PREFILTERED_UNIT);
+		shader.setInt("brdfLUT", BRDF_LUT_UNIT);
+		shader.setFloat("prefilteredMaxLod", static_cast<float>(levels() > 0 ? levels() - 1 : 0));
+		glUniform3fv(shader.location("irradianceSH"_uniform).value, static_cast<GLsizei>(data.irradianceSH.size()), &data.irradianceSH[0][0]);
+	}
+
+	void bind() const
+	{
+		glBindTextureUnit(PREFILTERED_UNIT, prefilteredID);
+		glBindTextureUnit(BRDF_LUT_UNIT, brdfID);
+	}
+
+	unsigned int prefilteredTexture() const
+	{
+		return prefilteredID;
+	}
+
+	unsigned int brdfTexture() const
+	{
+		return brdfID;
+	}
+
+	unsigned int levels() const
+	{
+		return static_cast<unsigned int>(data.prefiltered.size());
+	}
+
+	// over pi, see EnvironmentPrecompute::projectIrradianceSH
+	const std::array<glm::vec3, 9>& irradianceSH() const
+	{
+		return data.irradianceSH;
+	}
+
+	// the faces as linear floats box filtered to settings.sourceSize, decoded in parallel
+	static bool loadSource(const vector<std::string>& faces, int sourceSize, CubemapImage& source, JobSystem* jobs = &JobSystem::shared())
+	{
+		PROFILE_SCOPE("EnvironmentMap::loadSource");
+		if (faces.size() != 6)
+			return false;
+		vector<glm::vec3> pixels[6];
+		int sizes[6] = {};
+		auto decode = [&](size_t first, size_t last) {
+			for (size_t face = first; face < last; face++)
+			{
+				int width, height, components;
+				unsigned char* data = stbi_load(faces[face].c_str(), &width, &height, &components, 3);
+				if (!data)
+					continue;
+				if (width == height)
+				{
+					sizes[face] = width;
+					pixels[face].resize(static_cast<size_t>(width) * width);
+					for (size_t i = 0; i < pixels[face].size(); i++)
+						pixels[face][i] = glm::vec3(data[i * 3], data[i * 3 + 1], data[i * 3 + 2]) * (1.0f / 255.0f);
+				}
+				stbi_image_free(data);
+			}
+		};
+		if (jobs)
+			jobs->parallelFor(0, 6, decode, 1);
+		else
+			decode(0, 6);
+
+		for (int face = 0; face < 6; face++)
+			if (sizes[face] == 0 || sizes[face] != sizes[0])
+			{
+				std::cout << "ERROR::ENVIRONMENT_MAP::FAILED_TO_LOAD_FACE: " << faces[face] << "\n";
+				return false;
+			}
+
+		const int factor = std::max(1, sizes[0] / sourceSize);
+		source.resize(sizes[0] / factor);
+		const float scale = 1.0f / (factor * factor);
+		for (int face = 0; face < 6; face++)
+			for (int y = 0; y < source.size; y++)
+				for (int x = 0; x < source.size; x++)
+				{
+					glm::vec3 sum(0.0f);
+					for (int j = 0; j < factor; j++)
+						for (int i = 0; i < factor; i++)
+							sum += pixels[face][static_cast<size_t>(y * factor + j) * sizes[0] + x * factor + i];
+					source.at(face, x, y) = sum * scale;
+				}
+		return true;
+	}
+
+	// every convolution of the faces, on the job system
+	static bool precompute(const vector<std::string>& faces, const EnvironmentSettings& settings, EnvironmentData& data,
+		JobSystem* jobs = &JobSystem::shared())
+	{
+		PROFILE_SCOPE("EnvironmentMap::precompute");
+		CubemapImage source;
+		if (!loadSource(faces, settings.sourceSize, source, jobs))
+			return false;
+		const vector<CubemapImage> mips = EnvironmentPrecompute::buildMips(std::move(source));
+
+		data.prefiltered = EnvironmentPrecompute::prefilterSpecular(mips, settings.prefilteredSize, settings.prefilteredLevels, settings.specularSamples, jobs);
+		const CubemapImage* irradianceSource = &mips.back();
+		for (const CubemapImage& mip : mips)
+			if (mip.size <= settings.irradianceSize)
+			{
+				irradianceSource = &mip;
+				break;
+			}
+		data.irradianceSH = EnvironmentPrecompute::projectIrradianceSH(*irradianceSource);
+		data.brdfSize = settings.brdfSize;
+		data.brdfLUT = EnvironmentPrecompute::integrateBRDF(settings.brdfSize, settings.brdfSamples, jobs);
+		return true;
+	}
+
+private:
+	EnvironmentData data;
+	unsigned int prefilteredID = 0;
+	unsigned int brdfID = 0;
+
+	void upload()
+	{
+		if (data.prefiltered.empty())
+			return;
+
+		// the prefiltered faces were convolved across their edges, so filter across them too
+		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+		glGenTextures(1, &prefilteredID);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, prefilteredID);
+		for (unsigned int level = 0; level < data.prefiltered.size(); level++)
+		{
+			const CubemapImage& image = data.prefiltered[level];
+			for (int face = 0; face < 6; face++)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB16F, image.size, image.size, 0, GL_RGB, GL_FLOAT, image.face(face));
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(data.prefiltered.size() - 1));
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+		glGenTextures(1, &brdfID);
+		glBindTexture(GL_TEXTURE_2D, brdfID);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, data.brdfSize, data.brdfSize, 0, GL_RG, GL_FLOAT, data.brdfLUT.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	}
+};
+#endif // !ENVIRONMENT_MAP_H
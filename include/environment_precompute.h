@@ -0,0 +1,387 @@
+#ifndef ENVIRONMENT_PRECOMPUTE_H
+#define ENVIRONMENT_PRECOMPUTE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <job_system.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+// Square RGB faces of a cubemap as floats, the six faces back to back in the GL_TEXTURE_CUBE_MAP_POSITIVE_X order
+// and each one row by row like glTexImage2D takes it.
+struct CubemapImage {
+	int size = 0;
+	vector<glm::vec3> texels;
+
+	void resize(int faceSize)
+	{
+		size = faceSize;
+		texels.assign(static_cast<size_t>(6) * faceSize * faceSize, glm::vec3(0.0f));
+	}
+
+	glm::vec3& at(int face, int x, int y)
+	{
+		return texels[(static_cast<size_t>(face) * size + y) * size + x];
+	}
+
+	const glm::vec3& at(int face, int x, int y) const
+	{
+		return texels[(static_cast<size_t>(face) * size + y) * size + x];
+	}
+
+	const glm::vec3* face(int face) const
+	{
+		return texels.data() + static_cast<size_t>(face) * size * size;
+	}
+};
+
+// The CPU side of image based lighting, everything the split sum approximation needs from an environment:
+// - a specular cubemap whose mips are the environment convolved with GGX lobes of rising roughness
+// - the diffuse irradiance as 9 spherical harmonics coefficients
+// - the BRDF lookup table with the Fresnel scale and bias for a view angle and roughness
+// The convolutions run on the job system. They are also the reference the shaders are checked against, so they
+// follow the GL cubemap addressing exactly.
+class EnvironmentPrecompute {
+public:
+	// the direction through the center of texel (x, y) of a face with size x size texels
+	static glm::vec3 texelDirection(int face, int x, int y, int size)
+	{
+		const float s = 2.0f * (x + 0.5f) / size - 1.0f;
+		const float t = 2.0f * (y + 0.5f) / size - 1.0f;
+		return glm::normalize(faceDirection(face, s, t));
+	}
+
+	// the unnormalized direction through face coordinates s, t in [-1, 1], the GL cube map selection table reversed
+	static glm::vec3 faceDirection(int face, float s, float t)
+	{
+		switch (face)
+		{
+		case 0: return glm::vec3(1.0f, -t, -s);
+		case 1: return glm::vec3(-1.0f, -t, s);
+		case 2: return glm::vec3(s, 1.0f, t);
+		case 3: return glm::vec3(s, -1.0f, -t);
+		case 4: return glm::vec3(s, -t, 1.0f);
+		default: return glm::vec3(-s, -t, -1.0f);
+		}
+	}
+
+	// the face a direction hits and its coordinates in [0, 1] there
+	static int faceCoordinates(const glm::vec3& direction, float& u, float& v)
+	{
+		const glm::vec3 a = glm::abs(direction);
+		int face;
+		float sc, tc, ma;
+		if (a.x >= a.y && a.x >= a.z)
+		{
+			face = direction.x > 0.0f ? 0 : 1;
+			sc = direction.x > 0.0f ? -direction.z : direction.z;
+			tc = -direction.y;
+			ma = a.x;
+		}
+		else if (a.y >= a.z)
+		{
+			face = direction.y > 0.0f ? 2 : 3;
+			sc = direction.x;
+			tc = direction.y > 0.0f ? direction.z : -direction.z;
+			ma = a.y;
+		}
+		else
+		{
+			face = direction.z > 0.0f ? 4 : 5;
+			sc = direction.z > 0.0f ? direction.x : -direction.x;
+			tc = -direction.y;
+			ma = a.z;
+		}
+		u = 0.5f * (sc / ma + 1.0f);
+		v = 0.5f * (tc / ma + 1.0f);
+		return face;
+	}
+
+	// bilinear within the face, clamped at its edges like GL_CLAMP_TO_EDGE without seamless filtering
+	static glm::vec3 sample(const CubemapImage& image, const glm::vec3& direction)
+	{
+		float u, v;
+		const int face = faceCoordinates(direction, u, v);
+		const float x = std::clamp(u * image.size - 0.5f, 0.0f, static_cast<float>(image.size - 1));
+		const float y = std::clamp(v * image.size - 0.5f, 0.0f, static_cast<float>(image.size - 1));
+		const int x0 = static_cast<int>(x), y0 = static_cast<int>(y);
+		const int x1 = std::min(x0 + 1, image.size - 1), y1 = std::min(y0 + 1, image.size - 1);
+		const float fx = x - x0, fy = y - y0;
+		const glm::vec3 top = glm::mix(image.at(face, x0, y0), image.at(face, x1, y0), fx);
+		const glm::vec3 bottom = glm::mix(image.at(face, x0, y1), image.at(face, x1, y1), fx);
+		return glm::mix(top, bottom, fy);
+	}
+
+	// trilinear between the two mips around level
+	static glm::vec3 sampleLevel(const vector<CubemapImage>& mips, const glm::vec3& direction, float level)
+	{
+		level = std::clamp(level, 0.0f, static_cast<float>(mips.size() - 1));
+		const int lower = static_cast<int>(level);
+		const int upper = std::min(lower + 1, static_cast<int>(mips.size()) - 1);
+		const glm::vec3 a = sample(mips[lower], direction);
+		if (upper == lower)
+			return a;
+		return glm::mix(a, sample(mips[upper], direction), level - lower);
+	}
+
+	// 2x2 box filtered mips down to 1x1, mips[0] is the image itself
+	static vector<CubemapImage> buildMips(CubemapImage image)
+	{
+		vector<CubemapImage> mips;
+		mips.push_back(std::move(image));
+		while (mips.back().size > 1)
+			mips.push_back(downsample(mips.back(), 2));
+		return mips;
+	}
+
+	// a factor x factor box filter, size must divide by factor
+	static CubemapImage downsample(const CubemapImage& image, int factor)
+	{
+		CubemapImage result;
+		result.resize(image.size / factor);
+		const float scale = 1.0f / (factor * factor);
+		for (int face = 0; face < 6; face++)
+			for (int y = 0; y < result.size; y++)
+				for (int x = 0; x < result.size; x++)
+				{
+					glm::vec3 sum(0.0f);
+					for (int j = 0; j < factor; j++)
+						for (int i = 0; i < factor; i++)
+							sum += image.at(face, x * factor + i, y * factor + j);
+					result.at(face, x, y) = sum * scale;
+				}
+		return result;
+	}
+
+	// the roughness a level of the prefiltered map was convolved for, the shader picks the level the same way back
+	static float levelRoughness(unsigned int level, unsigned int levels)
+	{
+		return levels > 1 ? static_cast<float>(level) / (levels - 1) : 0.0f;
+	}
+
+	// GGX prefiltered specular mips of size, size / 2 ... for levels levels. Every texel takes sampleCount GGX
+	// importance samples around its direction with N = V = R, and reads each one from the source mip whose texels
+	// cover about the solid angle of the sample, so a few dozen samples give a smooth result. Level 0 is a mirror
+	// and only resamples the source
+	static vector<CubemapImage> prefilterSpecular(const vector<CubemapImage>& source, int size, unsigned int levels, unsigned int sampleCount,
+		JobSystem* jobs = &JobSystem::shared())
+	{
+		PROFILE_SCOPE("EnvironmentPrecompute::prefilterSpecular");
+		vector<CubemapImage> result(levels);
+		const float texelSolidAngle = 4.0f * glm::pi<float>() / (6.0f * source[0].size * source[0].size);
+		for (unsigned int level = 0; level < levels; level++)
+		{
+			CubemapImage& image = result[level];
+			image.resize(std::max(1, size >> level));
+			const float roughness = levelRoughness(level, levels);
+			const float mirrorLevel = std::log2(static_cast<float>(source[0].size) / image.size);
+
+			auto filterRows = [&](size_t first, size_t last) {
+				for (size_t row = first; row < last; row++)
+				{
+					const int face = static_cast<int>(row / image.size), y = static_cast<int>(row % image.size);
+					for (int x = 0; x < image.size; x++)
+					{
+						const glm::vec3 normal = texelDirection(face, x, y, image.size);
+						if (roughness == 0.0f)
+						{
+							image.at(face, x, y) = sampleLevel(source, normal, mirrorLevel);
+							continue;
+						}
+						glm::vec3 color(0.0f);
+						float weight = 0.0f;
+						for (unsigned int i = 0; i < sampleCount; i++)
+						{
+							const glm::vec3 halfway = importanceSampleGGX(hammersley(i, sampleCount), normal, roughness);
+							const float cosine = glm::dot(normal, halfway);
+							const glm::vec3 light = 2.0f * cosine * halfway - normal;
+							const float lightCosine = glm::dot(normal, light);
+							if (lightCosine <= 0.0f)
+								continue;
+							// with N = V the pdf of the light direction is D / 4
+							const float pdf = distributionGGX(cosine, roughness) * 0.25f;
+							const float sampleSolidAngle = 1.0f / (sampleCount * pdf + 1e-4f);
+							const float sampleLevelValue = std::max(mirrorLevel, 0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f);
+							color += sampleLevel(source, light, sampleLevelValue) * lightCosine;
+							weight += lightCosine;
+						}
+						image.at(face, x, y) = weight > 0.0f ? color / weight : glm::vec3(0.0f);
+					}
+				}
+			};
+			const size_t rows = static_cast<size_t>(6) * image.size;
+			if (jobs)
+				jobs->parallelFor(0, rows, filterRows);
+			else
+				filterRows(0, rows);
+		}
+		return result;
+	}
+
+	// the environment projected onto the first 9 real spherical harmonics and convolved with the clamped cosine.
+	// evaluateSH() of the result is the irradiance over pi, the light a white Lambertian surface reflects
+	static std::array<glm::vec3, 9> projectIrradianceSH(const CubemapImage& image)
+	{
+		PROFILE_SCOPE("EnvironmentPrecompute::projectIrradianceSH");
+		std::array<glm::vec3, 9> coefficients;
+		coefficients.fill(glm::vec3(0.0f));
+		for (int face = 0; face < 6; face++)
+			for (int y = 0; y < image.size; y++)
+				for (int x = 0; x < image.size; x++)
+				{
+					const glm::vec3 direction = texelDirection(face, x, y, image.size);
+					const float solidAngle = texelSolidAngle(x, y, image.size);
+					float basis[9];
+					shBasis(direction, basis);
+					for (int k = 0; k < 9; k++)
+						coefficients[k] += image.at(face, x, y) * (basis[k] * solidAngle);
+				}
+
+		// the cosine lobe's zonal harmonics over pi, per band
+		const float bands[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+		for (int k = 0; k < 9; k++)
+			coefficients[k] *= bands[k == 0 ? 0 : k < 4 ? 1 : 2];
+		return coefficients;
+	}
+
+	static glm::vec3 evaluateSH(const std::array<glm::vec3, 9>& coefficients, const glm::vec3& direction)
+	{
+		float basis[9];
+		shBasis(direction, basis);
+		glm::vec3 result(0.0f);
+		for (int k = 0; k < 9; k++)
+			result += coefficients[k] * basis[k];
+		return glm::max(result, glm::vec3(0.0f));
+	}
+
+	// brute force cosine weighted sum over every texel, what evaluateSH approximates
+	static glm::vec3 irradianceReference(const CubemapImage& image, const glm::vec3& normal)
+	{
+		glm::vec3 sum(0.0f);
+		for (int face = 0; face < 6; face++)
+			for (int y = 0; y < image.size; y++)
+				for (int x = 0; x < image.size; x++)
+				{
+					const float cosine = glm::dot(normal, texelDirection(face, x, y, image.size));
+					if (cosine > 0.0f)
+						sum += image.at(face, x, y) * (cosine * texelSolidAngle(x, y, image.size));
+				}
+		return sum / glm::pi<float>();
+	}
+
+	// size x size scale (x) and bias (y) to F0 of the specular integral, NdotV along the rows' texels and roughness
+	// down the rows, texel centers at (i + 0.5) / size
+	static vector<glm::vec2> integrateBRDF(int size, unsigned int sampleCount, JobSystem* jobs = &JobSystem::shared())
+	{
+		PROFILE_SCOPE("EnvironmentPrecompute::integrateBRDF");
+		vector<glm::vec2> table(static_cast<size_t>(size) * size);
+		auto integrateRows = [&](size_t first, size_t last) {
+			for (size_t y = first; y < last; y++)
+				for (int x = 0; x < size; x++)
+					table[y * size + x] = integrateBRDF((x + 0.5f) / size, (y + 0.5f) / size, sampleCount);
+		};
+		if (jobs)
+			jobs->parallelFor(0, size, integrateRows);
+		else
+			integrateRows(0, size);
+		return table;
+	}
+
+	static glm::vec2 integrateBRDF(float viewCosine, float roughness, unsigned int sampleCount)
+	{
+		const glm::vec3 view(std::sqrt(1.0f - viewCosine * viewCosine), 0.0f, viewCosine);
+		const glm::vec3 normal(0.0f, 0.0f, 1.0f);
+		float scale = 0.0f, bias = 0.0f;
+		for (unsigned int i = 0; i < sampleCount; i++)
+		{
+			const glm::vec3 halfway = importanceSampleGGX(hammersley(i, sampleCount), normal, roughness);
+			const float viewHalfway = glm::dot(view, halfway);
+			const glm::vec3 light = 2.0f * viewHalfway * halfway - view;
+			const float lightCosine = light.z, halfwayCosine = halfway.z;
+			if (lightCosine <= 0.0f)
+				continue;
+			const float visibility = geometrySmith(viewCosine, lightCosine, roughness) * std::max(viewHalfway, 0.0f) / (halfwayCosine * viewCosine);
+			const float fresnel = std::pow(1.0f - std::max(viewHalfway, 0.0f), 5.0f);
+			scale += (1.0f - fresnel) * visibility;
+			bias += fresnel * visibility;
+		}
+		return glm::vec2(scale, bias) / static_cast<float>(sampleCount);
+	}
+
+private:
+	static glm::vec2 hammersley(unsigned int i, unsigned int count)
+	{
+		uint32_t bits = i;
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return glm::vec2(static_cast<float>(i) / count, bits * 2.3283064365386963e-10f);
+	}
+
+	// a halfway vector around normal, distributed like the GGX normal distribution of roughness (alpha = roughness²)
+	static glm::vec3 importanceSampleGGX(const glm::vec2& xi, const glm::vec3& normal, float roughness)
+	{
+		const float a = roughness * roughness;
+		const float phi = 2.0f * glm::pi<float>() * xi.x;
+		const float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (a * a - 1.0f) * xi.y));
+		const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+		const glm::vec3 tangentSpace(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+
+		const glm::vec3 up = std::abs(normal.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+		const glm::vec3 tangent = glm::normalize(glm::cross(up, normal));
+		const glm::vec3 bitangent = glm::cross(normal, tangent);
+		return glm::normalize(tangent * tangentSpace.x + bitangent * tangentSpace.y + normal * tangentSpace.z);
+	}
+
+	static float distributionGGX(float halfwayCosine, float roughness)
+	{
+		const float a = roughness * roughness, a2 = a * a;
+		const float d = halfwayCosine * halfwayCosine * (a2 - 1.0f) + 1.0f;
+		return a2 / (glm::pi<float>() * d * d);
+	}
+
+	// Schlick-GGX with the k of image based lighting
+	static float geometrySmith(float viewCosine, float lightCosine, float roughness)
+	{
+		const float k = roughness * roughness * 0.5f;
+		return viewCosine / (viewCosine * (1.0f - k) + k) * lightCosine / (lightCosine * (1.0f - k) + k);
+	}
+
+	static void shBasis(const glm::vec3& d, float basis[9])
+	{
+		basis[0] = 0.282095f;
+		basis[1] = 0.488603f * d.y;
+		basis[2] = 0.488603f * d.z;
+		basis[3] = 0.488603f * d.x;
+		basis[4] = 1.092548f * d.x * d.y;
+		basis[5] = 1.092548f * d.y * d.z;
+		basis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+		basis[7] = 1.092548f * d.x * d.z;
+		basis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+	}
+
+	// the solid angle of a cube face texel, from the area of its corners projected onto the unit sphere
+	static float texelSolidAngle(int x, int y, int size)
+	{
+		const float inverse = 1.0f / size;
+		const float x0 = 2.0f * x * inverse - 1.0f, x1 = x0 + 2.0f * inverse;
+		const float y0 = 2.0f * y * inverse - 1.0f, y1 = y0 + 2.0f * inverse;
+		return areaElement(x0, y0) - areaElement(x0, y1) - areaElement(x1, y0) + areaElement(x1, y1);
+	}
+
+	static float areaElement(float x, float y)
+	{
+		return std::atan2(x * y, std::sqrt(x * x + y * y + 1.0f));
+	}
+};
+#endif // !ENVIRONMENT_PRECOMPUTE_H
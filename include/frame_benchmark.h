@@ -0,0 +1,418 @@
+#ifndef FRAME_BENCHMARK_H
+#define FRAME_BENCHMARK_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <nlohmann/json.hpp>
+
+#include <glm/glm.hpp>
+
+#include <camera.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using std::string, std::vector;
+
+// The frame benchmark replays a recorded camera track at a fixed timestep into an offscreen framebuffer and
+// measures every frame: CPU time from the start of the frame to the end of its submission, GPU time between two
+// GL_TIMESTAMP queries (not GL_TIME_ELAPSED, the profiler's GPU zones use those and they can't nest). The summary
+// and the per frame times are written to JSON and compared to a baseline.
+// Run with `TryOpenGL --benchmark [track.json]` or "benchmark": { "enabled": true } in global.json.
+
+// one recorded camera pose
+struct CameraKey {
+	float time;
+	glm::vec3 position;
+	float yaw;
+	float pitch;
+	float zoom;
+};
+
+// camera poses over time, recorded from the interactive camera (F5 starts and stops) and replayed by the benchmark
+class CameraTrack {
+public:
+	vector<CameraKey> keys;
+
+	bool load(const string& path)
+	{
+		std::ifstream file(path);
+		if (!file.is_open())
+		{
+			std::cerr << "ERROR::CAMERA_TRACK::FAILED_TO_OPEN_FILE: " << path << "\n";
+			return false;
+		}
+
+		try
+		{
+			nlohmann::json track = nlohmann::json::parse(file);
+			keys.clear();
+			for (const nlohmann::json& key : track.at("keys"))
+			{
+				const nlohmann::json& position = key.at("position");
+				keys.push_back({ key.at("time").get<float>(), glm::vec3(position.at(0).get<float>(), position.at(1).get<float>(), position.at(2).get<float>()),
+					key.at("yaw").get<float>(), key.at("pitch").get<float>(), key.value("zoom", ZOOM) });
+			}
+		}
+		catch (const nlohmann::json::exception& e)
+		{
+			std::cerr << "ERROR::CAMERA_TRACK::FAILED_TO_PARSE_FILE: " << path << "\n    " << e.what() << "\n";
+			return false;
+		}
+		std::sort(keys.begin(), keys.end(), [](const CameraKey& a, const CameraKey& b) { return a.time < b.time; });
+		return !keys.empty();
+	}
+
+	bool save(const string& path) const
+	{
+		nlohmann::json track;
+		track["keys"] = nlohmann::json::array();
+		for (const CameraKey& key : keys)
+			track["keys"].push_back({ { "time", key.time }, { "position", { key.position.x, key.position.y, key.position.z } },
+				{ "yaw", key.yaw }, { "pitch", key.pitch }, { "zoom", key.zoom } });
+
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			std::cerr << "ERROR::CAMERA_TRACK::FAILED_TO_OPEN_FILE: " << path << "\n";
+			return false;
+		}
+		file << track.dump(1, '\t');
+		return true;
+	}
+
+	// appends the camera pose, at most one key per interval seconds
+	void record(float time, const Camera& camera, float interval = 0.1f)
+	{
+		if (!keys.empty() && time - keys.back().time < interval)
+			return;
+		keys.push_back({ time, camera.Position, camera.Yaw, camera.Pitch, camera.Zoom });
+	}
+
+	float duration() const
+	{
+		return keys.empty() ? 0.0f : keys.back().time;
+	}
+
+	// linear interpolation between the surrounding keys
+	void apply(float time, Camera& camera) const
+	{
+		if (keys.empty())
+			return;
+		auto next = std::upper_bound(keys.begin(), keys.end(), time, [](float t, const CameraKey& key) { return t < key.time; });
+		if (next == keys.begin() || next == keys.end())
+		{
+			const CameraKey& key = next == keys.end() ? keys.back() : keys.front();
+			camera.SetPose(key.position, key.yaw, key.pitch, key.zoom);
+			return;
+		}
+		const CameraKey& a = *(next - 1);
+		const CameraKey& b = *next;
+		const float t = b.time > a.time ? (time - a.time) / (b.time - a.time) : 0.0f;
+		camera.SetPose(glm::mix(a.position, b.position, t), glm::mix(a.yaw, b.yaw, t), glm::mix(a.pitch, b.pitch, t), glm::mix(a.zoom, b.zoom, t));
+	}
+};
+
+// min / median / p95 / p99 / max of a set of frame times
+struct TimingSummary {
+	double min = 0.0;
+	double median = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+	double max = 0.0;
+	double mean = 0.0;
+
+	static TimingSummary of(vector<double> samples)
+	{
+		TimingSummary summary;
+		if (samples.empty())
+			return summary;
+		std::sort(samples.begin(), samples.end());
+		// nearest rank
+		auto percentile = [&](double p) {
+			const size_t rank = static_cast<size_t>(std::ceil(p * samples.size()));
+			return samples[std::min(samples.size() - 1, rank > 0 ? rank - 1 : 0)];
+		};
+		summary.min = samples.front();
+		summary.median = percentile(0.5);
+		summary.p95 = percentile(0.95);
+		summary.p99 = percentile(0.99);
+		summary.max = samples.back();
+		for (double sample : samples)
+			summary.mean += sample;
+		summary.mean /= samples.size();
+		return summary;
+	}
+
+	nlohmann::json toJson() const
+	{
+		return { { "min", min }, { "median", median }, { "p95", p95 }, { "p99", p99 }, { "max", max }, { "mean", mean } };
+	}
+};
+
+struct FrameBenchmarkSettings {
+	bool enabled = false;
+	// hidden window, frames go to an offscreen framebuffer
+	bool headless = true;
+	// "native", "egl" or "osmesa", EGL/OSMesa run on Mesa llvmpipe without a GPU
+	string contextAPI = "native";
+	string track = "resource/benchmark/camera_track.json";
+	string output = "benchmark_result.json";
+	string baseline = "resource/benchmark/baseline.json";
+	// write the result as the new baseline instead of comparing against it
+	bool updateBaseline = false;
+	// allowed slowdown of the median and p95 against the baseline
+	double tolerance = 0.1;
+	unsigned int warmupFrames = 30;
+	float timestep = 1.0f / 60.0f;
+
+	// "benchmark" object of global.json, overridden by --benchmark [track] --output <path> --baseline <path> --update-baseline
+	static FrameBenchmarkSettings from(const nlohmann::json& config, int argc, char* argv[])
+	{
+		FrameBenchmarkSettings settings;
+		if (config.contains("benchmark"))
+		{
+			const nlohmann::json& benchmark = config["benchmark"];
+			settings.enabled = benchmark.value("enabled", settings.enabled);
+			settings.headless = benchmark.value("headless", settings.headless);
+			settings.contextAPI = benchmark.value("context_api", settings.contextAPI);
+			settings.track = benchmark.value("track", settings.track);
+			settings.output = benchmark.value("output", settings.output);
+			settings.baseline = benchmark.value("baseline", settings.baseline);
+			settings.tolerance = benchmark.value("tolerance", settings.tolerance);
+			settings.warmupFrames = benchmark.value("warmup_frames", settings.warmupFrames);
+			settings.timestep = benchmark.value("timestep", settings.timestep);
+		}
+
+		for (int i = 1; i < argc; i++)
+		{
+			const string argument = argv[i];
+			const bool hasValue = i + 1 < argc && argv[i + 1][0] != '-';
+			if (argument == "--benchmark")
+			{
+				settings.enabled = true;
+				if (hasValue)
+					settings.track = argv[++i];
+			}
+			else if (argument == "--output" && hasValue)
+				settings.output = argv[++i];
+			else if (argument == "--baseline" && hasValue)
+				settings.baseline = argv[++i];
+			else if (argument == "--update-baseline")
+				settings.updateBaseline = true;
+			else if (argument == "--context-api" && hasValue)
+				settings.contextAPI = argv[++i];
+		}
+		return settings;
+	}
+
+	int glfwContextAPI() const
+	{
+		if (contextAPI == "egl")
+			return GLFW_EGL_CONTEXT_API;
+		if (contextAPI == "osmesa")
+			return GLFW_OSMESA_CONTEXT_API;
+		return GLFW_NATIVE_CONTEXT_API;
+	}
+};
+
+class FrameBenchmark {
+public:
+	// status returned by finish()
+	static constexpr int STATUS_OK = 0;
+	static constexpr int STATUS_ERROR = 1;
+	static constexpr int STATUS_REGRESSION = 2;
+
+	explicit FrameBenchmark(const FrameBenchmarkSettings& settings) : settings(settings) {}
+	FrameBenchmark(const FrameBenchmark&) = delete;
+	FrameBenchmark& operator=(const FrameBenchmark&) = delete;
+
+	~FrameBenchmark()
+	{
+		if (framebuffer)
+		{
+			glDeleteFramebuffers(1, &framebuffer);
+			glDeleteRenderbuffers(2, renderbuffers);
+		}
+		if (queries[0])
+			glDeleteQueries(QUERY_LATENCY * 2, queries);
+	}
+
+	// loads the track and creates the offscreen target, false on failure
+	bool begin(unsigned int width, unsigned int height)
+	{
+		if (!track.load(settings.track))
+			return false;
+		this->width = width;
+		this->height = height;
+		measuredFrames = static_cast<unsigned int>(std::ceil(track.duration() / settings.timestep)) + 1;
+		cpuMilliseconds.assign(measuredFrames, 0.0);
+		gpuMilliseconds.assign(measuredFrames, 0.0);
+
+		glGenFramebuffers(1, &framebuffer);
+		glGenRenderbuffers(2, renderbuffers);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cerr << "ERROR::FRAME_BENCHMARK::FRAMEBUFFER_INCOMPLETE\n";
+			return false;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glGenQueries(QUERY_LATENCY * 2, queries);
+
+#ifdef _DEBUG
+		std::cout << "SUCCESSFULLY::FRAME_BENCHMARK::SUCCESSFULLY_LOAD_TRACK\n"
+			<< "    TRACK: " << settings.track << "\n"
+			<< "    FRAMES: " << settings.warmupFrames << " + " << measuredFrames << "\n";
+#endif
+		return true;
+	}
+
+	bool running() const
+	{
+		return frame < settings.warmupFrames + measuredFrames;
+	}
+
+	// poses the camera for this frame, binds the offscreen target and starts both timers. Returns the fixed timestep,
+	// the frame's deltaTime. Warmup frames replay the start of the track
+	float beginFrame(Camera& camera)
+	{
+		const unsigned int measured = frame < settings.warmupFrames ? 0 : frame - settings.warmupFrames;
+		track.apply(measured * settings.timestep, camera);
+
+		// the query this frame reuses was issued QUERY_LATENCY frames ago, usually done by now
+		const unsigned int slot = frame % QUERY_LATENCY;
+		if (frame >= QUERY_LATENCY)
+			resolve(frame - QUERY_LATENCY);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, width, height);
+		frameStart = std::chrono::steady_clock::now();
+		glQueryCounter(queries[slot * 2], GL_TIMESTAMP);
+		return settings.timestep;
+	}
+
+	void endFrame()
+	{
+		glQueryCounter(queries[(frame % QUERY_LATENCY) * 2 + 1], GL_TIMESTAMP);
+		if (frame >= settings.warmupFrames)
+			cpuMilliseconds[frame - settings.warmupFrames] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+		frame++;
+	}
+
+	// reads the outstanding queries, writes the JSON result and compares it to the baseline
+	int finish()
+	{
+		for (unsigned int pending = frame > QUERY_LATENCY ? frame - QUERY_LATENCY : 0; pending < frame; pending++)
+			resolve(pending);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		const TimingSummary cpu = TimingSummary::of(cpuMilliseconds);
+		const TimingSummary gpu = TimingSummary::of(gpuMilliseconds);
+
+		nlohmann::json result;
+		result["track"] = settings.track;
+		result["renderer"] = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+		result["resolution"] = { width, height };
+		result["timestep"] = settings.timestep;
+		result["frames"] = measuredFrames;
+		result["cpu_ms"] = cpu.toJson();
+		result["gpu_ms"] = gpu.toJson();
+		result["frame_times"] = { { "cpu_ms", cpuMilliseconds }, { "gpu_ms", gpuMilliseconds } };
+
+		std::cout << "frame benchmark (" << measuredFrames << " frames, " << width << "x" << height << ")\n"
+			<< "    cpu: median " << cpu.median << " ms, p95 " << cpu.p95 << " ms, p99 " << cpu.p99 << " ms\n"
+			<< "    gpu: median " << gpu.median << " ms, p95 " << gpu.p95 << " ms, p99 " << gpu.p99 << " ms\n";
+
+		if (!writeJson(settings.output, result))
+			return STATUS_ERROR;
+		if (settings.updateBaseline)
+			return writeJson(settings.baseline, result) ? STATUS_OK : STATUS_ERROR;
+		return compareToBaseline(result);
+	}
+
+private:
+	// frames in flight before a query result is read back
+	static constexpr unsigned int QUERY_LATENCY = 4;
+
+	FrameBenchmarkSettings settings;
+	CameraTrack track;
+	unsigned int width = 0, height = 0;
+	unsigned int framebuffer = 0;
+	unsigned int renderbuffers[2] = {};
+	// start and end timestamp of every frame in flight
+	unsigned int queries[QUERY_LATENCY * 2] = {};
+	unsigned int frame = 0;
+	unsigned int measuredFrames = 0;
+	std::chrono::steady_clock::time_point frameStart;
+	vector<double> cpuMilliseconds;
+	vector<double> gpuMilliseconds;
+
+	void resolve(unsigned int issuedFrame)
+	{
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(queries[(issuedFrame % QUERY_LATENCY) * 2], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(queries[(issuedFrame % QUERY_LATENCY) * 2 + 1], GL_QUERY_RESULT, &end);
+		if (issuedFrame >= settings.warmupFrames)
+			gpuMilliseconds[issuedFrame - settings.warmupFrames] = (end - start) * 1e-6;
+	}
+
+	static bool writeJson(const string& path, const nlohmann::json& json)
+	{
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			std::cerr << "ERROR::FRAME_BENCHMARK::FAILED_TO_WRITE_FILE: " << path << "\n";
+			return false;
+		}
+		file << json.dump(1, '\t');
+		return true;
+	}
+
+	// a median or p95 more than tolerance above the baseline is a regression, a missing baseline is not
+	int compareToBaseline(const nlohmann::json& result) const
+	{
+		std::ifstream file(settings.baseline);
+		if (!file.is_open())
+		{
+			std::cout << "    no baseline at " << settings.baseline << ", run with --update-baseline to store one\n";
+			return STATUS_OK;
+		}
+
+		int status = STATUS_OK;
+		try
+		{
+			const nlohmann::json baseline = nlohmann::json::parse(file);
+			for (const char* timer : { "cpu_ms", "gpu_ms" })
+				for (const char* statistic : { "median", "p95" })
+				{
+					const double before = baseline.at(timer).at(statistic).get<double>();
+					const double now = result.at(timer).at(statistic).get<double>();
+					if (now > before * (1.0 + settings.tolerance))
+					{
+						std::cerr << "ERROR::FRAME_BENCHMARK::REGRESSION: " << timer << " " << statistic << " " << now
+							<< " ms, baseline " << before << " ms\n";
+						status = STATUS_REGRESSION;
+					}
+				}
+		}
+		catch (const nlohmann::json::exception& e)
+		{
+			std::cerr << "ERROR::FRAME_BENCHMARK::FAILED_TO_PARSE_BASELINE: " << settings.baseline << "\n    " << e.what() << "\n";
+			return STATUS_ERROR;
+		}
+		return status;
+	}
+};
+#endif // !FRAME_BENCHMARK_H
@@ -0,0 +1,190 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <glm/glm.hpp>
+
+#include <profiler.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// Three copies of T passed from one producer thread to one consumer thread without locks. The producer fills back()
+// and publish()es it, the consumer acquire()s the newest published copy and reads front() until its next acquire.
+// The third copy sits between them, so neither side ever waits for the other or touches the copy the other is using.
+template <typename T>
+class TripleBuffer {
+public:
+	T& back()
+	{
+		return slots[backIndex];
+	}
+
+	// hands back() to the consumer, back() then is the copy the consumer dropped or never took
+	void publish()
+	{
+		backIndex = middle.exchange(static_cast<uint8_t>(backIndex | FRESH), std::memory_order_acq_rel) & INDEX;
+	}
+
+	// swaps in the newest published copy, false if nothing was published since the last acquire
+	bool acquire()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & FRESH))
+			return false;
+		frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+
+	const T& front() const
+	{
+		return slots[frontIndex];
+	}
+
+private:
+	static constexpr uint8_t INDEX = 0x3, FRESH = 0x4;
+
+	T slots[3] = {};
+	uint8_t backIndex = 0;
+	uint8_t frontIndex = 1;
+	std::atomic<uint8_t> middle{ 2 };
+};
+
+// What the render thread read from the window for one frame. Mouse and scroll are running totals instead of per
+// frame offsets, so the update side gets every movement even when it picks up only every other input.
+struct InputState {
+	bool forward = false, backward = false, left = false, right = false, up = false, down = false;
+	double mouseX = 0.0, mouseY = 0.0;
+	double scroll = 0.0;
+	// a camera pose that replaces the simulated one, set by track playback
+	bool posed = false;
+	glm::vec3 position = glm::vec3(0.0f);
+	float yaw = 0.0f, pitch = 0.0f, zoom = 0.0f;
+};
+
+struct FramePipelineStats {
+	double updateMilliseconds = 0.0;	// the last finished update, on whichever thread ran it
+	double waitMilliseconds = 0.0;		// the render thread waiting for the update of the frame it is about to draw
+	uint64_t frames = 0;
+};
+
+// Runs the simulation one frame ahead of rendering. Each frame the render thread acquire()s the State the update of
+// the previous frame produced, kick()s the update of the next frame with the latest input and draws from its
+// snapshot while the update thread works. States and input cross between the threads through TripleBuffers, the
+// only waiting is acquire() when the update is slower than the frame. Unthreaded, kick() runs the update in place,
+// with the same one frame of latency.
+template <typename State>
+class FramePipeline {
+public:
+	// reads the input and the seconds since the last update, writes the whole next state. Called on the update thread
+	using UpdateFunction = std::function<void(const InputState& input, float deltaTime, State& state)>;
+
+	FramePipelineStats stats;
+
+	FramePipeline(UpdateFunction update, bool threaded)
+		: update(std::move(update)), threaded(threaded)
+	{
+		// the first frame has a state to draw
+		runUpdate(InputState(), 0.0f);
+		states.acquire();
+		if (threaded)
+			worker = std::thread([this] { workerLoop(); });
+	}
+
+	~FramePipeline()
+	{
+		if (!threaded)
+			return;
+		stopping.store(true, std::memory_order_release);
+		requested.fetch_add(1, std::memory_order_release);
+		requested.notify_one();
+		worker.join();
+	}
+
+	FramePipeline(const FramePipeline&) = delete;
+	FramePipeline& operator=(const FramePipeline&) = delete;
+
+	// the newest finished state, waits for the update kicked last frame
+	const State& acquire()
+	{
+		if (threaded)
+		{
+			PROFILE_SCOPE("FramePipeline::wait");
+			const auto start = std::chrono::steady_clock::now();
+			const uint64_t target = requested.load(std::memory_order_relaxed);
+			for (uint64_t done = completed.load(std::memory_order_acquire); done < target; done = completed.load(std::memory_order_acquire))
+				completed.wait(done, std::memory_order_acquire);
+			stats.waitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		states.acquire();
+		stats.updateMilliseconds = updateMilliseconds.load(std::memory_order_relaxed);
+		stats.frames++;
+		return states.front();
+	}
+
+	// starts the update of the next frame
+	void kick(const InputState& input, float deltaTime)
+	{
+		if (!threaded)
+		{
+			runUpdate(input, deltaTime);
+			return;
+		}
+		inputs.back() = { input, deltaTime };
+		inputs.publish();
+		requested.fetch_add(1, std::memory_order_release);
+		requested.notify_one();
+	}
+
+	bool isThreaded() const
+	{
+		return threaded;
+	}
+
+private:
+	struct Kick {
+		InputState input;
+		float deltaTime = 0.0f;
+	};
+
+	UpdateFunction update;
+	bool threaded;
+	TripleBuffer<State> states;
+	TripleBuffer<Kick> inputs;
+	std::atomic<uint64_t> requested{ 0 };
+	std::atomic<uint64_t> completed{ 0 };
+	std::atomic<bool> stopping{ false };
+	std::atomic<double> updateMilliseconds{ 0.0 };
+	std::thread worker;
+
+	void runUpdate(const InputState& input, float deltaTime)
+	{
+		PROFILE_SCOPE("FramePipeline::update");
+		const auto start = std::chrono::steady_clock::now();
+		update(input, deltaTime, states.back());
+		states.publish();
+		updateMilliseconds.store(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+	}
+
+	void workerLoop()
+	{
+		Profiler::instance().setThreadName("update");
+		uint64_t done = 0;
+		for (;;)
+		{
+			requested.wait(done, std::memory_order_acquire);
+			if (stopping.load(std::memory_order_acquire))
+				return;
+			const uint64_t target = requested.load(std::memory_order_acquire);
+			// a kick always publishes its input before counting, so the newest one is there
+			inputs.acquire();
+			const Kick& kick = inputs.front();
+			runUpdate(kick.input, kick.deltaTime);
+			done = target;
+			completed.store(done, std::memory_order_release);
+			completed.notify_one();
+		}
+	}
+};
+#endif // !FRAME_PIPELINE_H
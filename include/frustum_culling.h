@@ -0,0 +1,265 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <bounds.h>
+#include <profiler.h>
+
+#include <cmath>
+#include <vector>
+
+// AVX when the compiler targets it (/arch:AVX, -mavx), SSE on any x86-64 build, scalar otherwise
+#if defined(__AVX__)
+#define FRUSTUM_CULLING_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLING_SSE
+#include <emmintrin.h>
+#endif
+
+using std::vector;
+
+// six planes, inside where dot(plane.xyz, p) + plane.w >= 0, normals are unit length
+struct Frustum {
+	glm::vec4 planes[6];
+
+	// Gribb-Hartmann extraction from projection * view (or projection * view * model for object space planes), GL clip space
+	static Frustum fromMatrix(const glm::mat4& m)
+	{
+		const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		Frustum frustum;
+		frustum.planes[0] = row3 + row0;	// left
+		frustum.planes[1] = row3 - row0;	// right
+		frustum.planes[2] = row3 + row1;	// bottom
+		frustum.planes[3] = row3 - row1;	// top
+		frustum.planes[4] = row3 + row2;	// near
+		frustum.planes[5] = row3 - row2;	// far
+		for (glm::vec4& plane : frustum.planes)
+			plane /= glm::length(glm::vec3(plane));
+		return frustum;
+	}
+
+	// false only if the box is entirely behind one plane, so boxes near frustum corners can pass
+	bool intersects(const BoundingBox& box) const
+	{
+		const glm::vec3 c = box.center(), e = box.extent();
+		for (const glm::vec4& plane : planes)
+			if (glm::dot(glm::vec3(plane), c) + glm::dot(glm::abs(glm::vec3(plane)), e) + plane.w < 0.0f)
+				return false;
+		return true;
+	}
+
+	enum class Containment { Outside, Intersecting, Inside };
+
+	// Inside when the box is in front of every plane, used to accept whole BVH subtrees without testing them
+	Containment classify(const BoundingBox& box) const
+	{
+		const glm::vec3 c = box.center(), e = box.extent();
+		Containment result = Containment::Inside;
+		for (const glm::vec4& plane : planes)
+		{
+			const float distance = glm::dot(glm::vec3(plane), c) + plane.w;
+			const float radius = glm::dot(glm::abs(glm::vec3(plane)), e);
+			if (distance + radius < 0.0f)
+				return Containment::Outside;
+			if (distance - radius < 0.0f)
+				result = Containment::Intersecting;
+		}
+		return result;
+	}
+
+	bool intersects(const BoundingSphere& sphere) const
+	{
+		for (const glm::vec4& plane : planes)
+			if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius)
+				return false;
+		return true;
+	}
+};
+
+struct CullingStats {
+	unsigned int tested = 0;
+	unsigned int visible = 0;
+	unsigned int culled = 0;
+};
+
+// Collects world space boxes as center/extent in structure of arrays form and tests them against the frustum
+// four (SSE) or eight (AVX) at a time. Typical use, once per batch:
+//   culler.clear(); for each mesh culler.add(worldBox); for (unsigned int i : culler.cull()) draw(i);
+class FrustumCuller {
+public:
+	void setFrustum(const Frustum& frustum)
+	{
+		current = frustum;
+	}
+
+	const Frustum& frustum() const
+	{
+		return current;
+	}
+
+	void clear()
+	{
+		centerX.clear(); centerY.clear(); centerZ.clear();
+		extentX.clear(); extentY.clear(); extentZ.clear();
+	}
+
+	void reserve(size_t count)
+	{
+		for (vector<float>* column : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+			column->reserve(count);
+	}
+
+	void add(const BoundingBox& box)
+	{
+		const glm::vec3 c = box.center(), e = box.extent();
+		centerX.push_back(c.x); centerY.push_back(c.y); centerZ.push_back(c.z);
+		extentX.push_back(e.x); extentY.push_back(e.y); extentZ.push_back(e.z);
+	}
+
+	size_t size() const
+	{
+		return centerX.size();
+	}
+
+	// tests every box added since clear(), returns the indices of the visible ones in ascending order
+	const vector<unsigned int>& cull()
+	{
+		PROFILE_SCOPE("FrustumCuller::cull");
+		visibleIndices.clear();
+		size_t first = 0;
+#if defined(FRUSTUM_CULLING_AVX)
+		first = cullAVX();
+#elif defined(FRUSTUM_CULLING_SSE)
+		first = cullSSE();
+#endif
+		cullScalar(first);
+		count();
+		return visibleIndices;
+	}
+
+	// one box at a time, the reference the SIMD paths must agree with
+	const vector<unsigned int>& cullReference()
+	{
+		visibleIndices.clear();
+		cullScalar(0);
+		count();
+		return visibleIndices;
+	}
+
+	void resetStats()
+	{
+		stats = CullingStats();
+	}
+
+	// accumulated over every cull() since the last resetStats()
+	CullingStats stats;
+
+private:
+	void count()
+	{
+		const unsigned int tested = static_cast<unsigned int>(size());
+		const unsigned int visible = static_cast<unsigned int>(visibleIndices.size());
+		stats.tested += tested;
+		stats.visible += visible;
+		stats.culled += tested - visible;
+	}
+
+	void cullScalar(size_t first)
+	{
+		for (size_t i = first; i < size(); i++)
+		{
+			bool inside = true;
+			for (const glm::vec4& plane : current.planes)
+			{
+				// same operation order as the SIMD paths so the results match bit for bit
+				const float distance = ((plane.x * centerX[i] + plane.y * centerY[i]) + (plane.z * centerZ[i] + plane.w))
+					+ ((std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i]) + std::abs(plane.z) * extentZ[i]);
+				inside &= distance >= 0.0f;
+			}
+			if (inside)
+				visibleIndices.push_back(static_cast<unsigned int>(i));
+		}
+	}
+
+#if defined(FRUSTUM_CULLING_AVX)
+	// returns the first index left for the scalar tail
+	size_t cullAVX()
+	{
+		const size_t batches = size() / 8;
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		const __m256 zero = _mm256_setzero_ps();
+		for (size_t batch = 0; batch < batches; batch++)
+		{
+			const size_t i = batch * 8;
+			const __m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+			const __m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (const glm::vec4& plane : current.planes)
+			{
+				const __m256 nx = _mm256_set1_ps(plane.x), ny = _mm256_set1_ps(plane.y), nz = _mm256_set1_ps(plane.z);
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)), _mm256_add_ps(_mm256_mul_ps(nz, cz), _mm256_set1_ps(plane.w)));
+				const __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(signMask, nx), ex), _mm256_mul_ps(_mm256_andnot_ps(signMask, ny), ey)),
+					_mm256_mul_ps(_mm256_andnot_ps(signMask, nz), ez));
+				distance = _mm256_add_ps(distance, radius);
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+			}
+			appendVisible(i, static_cast<unsigned int>(_mm256_movemask_ps(inside)));
+		}
+		return batches * 8;
+	}
+#endif
+
+#if defined(FRUSTUM_CULLING_SSE)
+	// returns the first index left for the scalar tail
+	size_t cullSSE()
+	{
+		const size_t batches = size() / 4;
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		const __m128 zero = _mm_setzero_ps();
+		for (size_t batch = 0; batch < batches; batch++)
+		{
+			const size_t i = batch * 4;
+			const __m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+			const __m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (const glm::vec4& plane : current.planes)
+			{
+				const __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+				const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), ex), _mm_mul_ps(_mm_andnot_ps(signMask, ny), ey)),
+					_mm_mul_ps(_mm_andnot_ps(signMask, nz), ez));
+				distance = _mm_add_ps(distance, radius);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+			}
+			appendVisible(i, static_cast<unsigned int>(_mm_movemask_ps(inside)));
+		}
+		return batches * 4;
+	}
+#endif
+
+	void appendVisible(size_t first, unsigned int mask)
+	{
+		while (mask)
+		{
+			unsigned int bit = 0;
+			while (!(mask & (1u << bit)))
+				bit++;
+			visibleIndices.push_back(static_cast<unsigned int>(first + bit));
+			mask &= mask - 1;
+		}
+	}
+
+	Frustum current{};
+	vector<float> centerX, centerY, centerZ;
+	vector<float> extentX, extentY, extentZ;
+	vector<unsigned int> visibleIndices;
+};
+#endif // !FRUSTUM_CULLING_H
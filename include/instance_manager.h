@@ -0,0 +1,330 @@
+#ifndef INSTANCE_MANAGER_H
+#define INSTANCE_MANAGER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <mesh.h>
+#include <model.h>
+#include <shader.h>
+#include <bounds.h>
+#include <frustum_culling.h>
+#include <transform_stage.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// shader storage bindings read by instance_cull.comp and model_lighting_instanced.vert
+constexpr unsigned int INSTANCE_DATA_BINDING = 3;
+constexpr unsigned int VISIBLE_INSTANCE_BINDING = 4;	// uint count, then the indices of the instances that survived the cull
+constexpr unsigned int INSTANCE_MATERIAL_BINDING = 5;
+constexpr unsigned int INSTANCE_COMMAND_BINDING = 6;
+
+// one instance, the std430 layout of Instance in the shaders
+struct InstanceData {
+	glm::mat4 model;
+	glm::mat3x4 normalMatrix;		// from the transform stage, so the vertex shader does not invert per vertex
+	unsigned int material;
+	unsigned int padding[3];
+};
+
+// what an instance's material index selects, the fragment shader multiplies the lit color by the tint
+struct InstanceMaterial {
+	glm::vec4 tint;
+};
+
+struct InstancingStats {
+	unsigned int instances = 0;
+	unsigned int dispatches = 0;	// compute dispatches in the last cull
+	unsigned int drawCalls = 0;		// indirect draws in the last render, one per mesh whatever the instance count
+};
+
+// GPU driven instancing of one model. Transforms and material indices live in an SSBO, cull() runs a compute pass
+// that frustum tests every instance against the model's box and compacts the survivors into a visible list, a second
+// tiny dispatch copies their count into one indirect command per mesh. render() then draws the visible list with one
+// glDrawElementsIndirect per mesh, so the CPU cost does not grow with the number of instances and the visible count
+// never comes back to the CPU. The vertex shader reads its instance through visibleInstances[gl_InstanceID].
+// Typical use, once per frame:
+//   instances.cull(frustum); instanceShader.use(); instances.render(instanceShader);
+// Only VertexFormat::Full meshes can be instanced, like PackedGeometry.
+class InstanceManager {
+public:
+	static constexpr unsigned int WORKGROUP_SIZE = 64;	// local_size_x of instance_cull.comp
+
+	InstancingStats stats;
+
+	explicit InstanceManager(const Model& model)
+		: InstanceManager(model.meshes)
+	{
+	}
+
+	explicit InstanceManager(const vector<Mesh>& meshes)
+		: cullShader(Shader::compute(R"(resource/shader/instance_cull.comp)")),
+		commandShader(Shader::compute(R"(resource/shader/instance_cull.comp)", { "WRITE_COMMANDS" }))
+	{
+		for (const Mesh& mesh : meshes)
+		{
+			if (mesh.format != VertexFormat::Full)
+			{
+				std::cout << "ERROR::INSTANCE_MANAGER::UNSUPPORTED_VERTEX_FORMAT: only full vertex meshes can be instanced\n";
+				continue;
+			}
+			this->meshes.push_back({ mesh.VAO, mesh.indexType, mesh.material });
+			commands.push_back({ static_cast<unsigned int>(mesh.indexCount()), 0, 0, 0, 0 });
+			box.expand(mesh.bounds.box);
+		}
+		// material 0 leaves the color alone
+		materials.push_back({ glm::vec4(1.0f) });
+
+		glGenBuffers(1, &instanceBuffer);
+		glGenBuffers(1, &visibleBuffer);
+		glGenBuffers(1, &materialBuffer);
+		glGenBuffers(1, &commandBuffer);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		// just the count until the first instance is added
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(unsigned int), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	InstanceManager(const InstanceManager&) = delete;
+	InstanceManager& operator=(const InstanceManager&) = delete;
+
+	~InstanceManager()
+	{
+		unsigned int buffers[] = { instanceBuffer, visibleBuffer, materialBuffer, commandBuffer };
+		glDeleteBuffers(4, buffers);
+		glDeleteProgram(cullShader.ID);
+		glDeleteProgram(commandShader.ID);
+	}
+
+	// returns the index add and setMaterial take
+	unsigned int addMaterial(const glm::vec4& tint)
+	{
+		materials.push_back({ tint });
+		materialsDirty = true;
+		return static_cast<unsigned int>(materials.size() - 1);
+	}
+
+	void reserve(size_t count)
+	{
+		instances.reserve(count);
+		transforms.reserve(count);
+	}
+
+	// returns the slot for setTransform and setMaterial
+	unsigned int add(const glm::mat4& transform, unsigned int material = 0)
+	{
+		InstanceData instance{};
+		instance.model = transform;
+		instance.material = material;
+		instances.push_back(instance);
+		transforms.add(transform);
+		markDirty(instances.size() - 1);
+		return static_cast<unsigned int>(instances.size() - 1);
+	}
+
+	void setTransform(unsigned int instance, const glm::mat4& transform)
+	{
+		instances[instance].model = transform;
+		transforms.set(instance, transform);
+		markDirty(instance);
+	}
+
+	void setMaterial(unsigned int instance, unsigned int material)
+	{
+		instances[instance].material = material;
+		markDirty(instance);
+	}
+
+	unsigned int size() const
+	{
+		return static_cast<unsigned int>(instances.size());
+	}
+
+	unsigned int meshCount() const
+	{
+		return static_cast<unsigned int>(meshes.size());
+	}
+
+	// object space box of the model, every instance is culled with it
+	const BoundingBox& bounds() const
+	{
+		return box;
+	}
+
+	// uploads what changed, then culls on the GPU: the visible list and the instance counts of the draw commands are
+	// rewritten for the next render
+	void cull(const Frustum& frustum)
+	{
+		PROFILE_SCOPE("InstanceManager::cull");
+		upload();
+
+		// the survivor count is the first word of the visible list
+		const unsigned int zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_DATA_BINDING, instanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBLE_INSTANCE_BINDING, visibleBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_COMMAND_BINDING, commandBuffer);
+
+		stats.instances = size();
+		stats.dispatches = 0;
+		if (!instances.empty())
+		{
+			const glm::vec3 center = box.center(), extent = box.extent();
+			cullShader.use();
+			glUniform1ui(cullShader.location("instanceCount"_uniform).value, size());
+			glUniform4fv(cullShader.location("frustumPlanes"_uniform).value, 6, &frustum.planes[0][0]);
+			cullShader.setVec3("boxCenter"_uniform, center);
+			cullShader.setVec3("boxExtent"_uniform, extent);
+			glDispatchCompute((size() + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+			stats.dispatches++;
+			// the count has to be final before it is copied
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+
+		commandShader.use();
+		glUniform1ui(commandShader.location("commandCount"_uniform).value, meshCount());
+		glDispatchCompute((meshCount() + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+		stats.dispatches++;
+		// the draws read the commands as indirect parameters and the visible list from the vertex shader
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// draws what the last cull kept, expects a shader built from model_lighting_instanced.vert and model_lighting.frag
+	// with the INSTANCED define
+	void render(Shader& shader)
+	{
+		PROFILE_SCOPE("InstanceManager::render");
+		if (materialsDirty)
+			upload();
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_DATA_BINDING, instanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBLE_INSTANCE_BINDING, visibleBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_MATERIAL_BINDING, materialBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			meshes[i].material->bind(shader);
+			glBindVertexArray(meshes[i].VAO);
+			glDrawElementsIndirect(GL_TRIANGLES, meshes[i].indexType, (void*)(i * sizeof(DrawElementsIndirectCommand)));
+		}
+		stats.drawCalls = meshCount();
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// the CPU reference of the compute cull, the indices of the instances whose world box touches the frustum in
+	// ascending order
+	vector<unsigned int> cullReference(const Frustum& frustum) const
+	{
+		vector<unsigned int> visible;
+		for (size_t i = 0; i < instances.size(); i++)
+			if (frustum.intersects(box.transformed(instances[i].model)))
+				visible.push_back(static_cast<unsigned int>(i));
+		return visible;
+	}
+
+	// reads the visible list of the last cull back, sorted so it compares with cullReference. Waits for the GPU
+	vector<unsigned int> visibleInstances() const
+	{
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+		unsigned int count = 0;
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(count), &count);
+		vector<unsigned int> visible(std::min<size_t>(count, instances.size()));
+		if (!visible.empty())
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(count), visible.size() * sizeof(unsigned int), visible.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		std::sort(visible.begin(), visible.end());
+		return visible;
+	}
+
+private:
+	// layout fixed by the GL spec
+	struct DrawElementsIndirectCommand {
+		unsigned int count;
+		unsigned int instanceCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int baseInstance;
+	};
+
+	struct MeshDraw {
+		unsigned int VAO;
+		GLenum indexType;
+		std::shared_ptr<const Material> material;
+	};
+
+	void markDirty(size_t instance)
+	{
+		dirtyBegin = std::min(dirtyBegin, instance);
+		dirtyEnd = std::max(dirtyEnd, instance + 1);
+	}
+
+	// instances grow the buffers to the new count, edits upload only the range between the first and last change.
+	// The normal matrices of the moved instances are recomputed in batches first
+	void upload()
+	{
+		if (dirtyBegin < dirtyEnd)
+		{
+			transforms.updateNormals();
+			for (size_t i = dirtyBegin; i < dirtyEnd; i++)
+				instances[i].normalMatrix = transforms.normalMatrix(static_cast<unsigned int>(i));
+		}
+		if (instances.size() > capacity)
+		{
+			capacity = instances.size();
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(InstanceData), instances.data(), GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, (capacity + 1) * sizeof(unsigned int), nullptr, GL_DYNAMIC_COPY);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		}
+		else if (dirtyBegin < dirtyEnd)
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, dirtyBegin * sizeof(InstanceData), (dirtyEnd - dirtyBegin) * sizeof(InstanceData), instances.data() + dirtyBegin);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		}
+		dirtyBegin = SIZE_MAX;
+		dirtyEnd = 0;
+
+		if (materialsDirty)
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, materials.size() * sizeof(InstanceMaterial), materials.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			materialsDirty = false;
+		}
+	}
+
+	vector<MeshDraw> meshes;
+	vector<DrawElementsIndirectCommand> commands;
+	BoundingBox box;
+
+	vector<InstanceData> instances;
+	TransformStage transforms;
+	size_t capacity = 0;
+	size_t dirtyBegin = SIZE_MAX, dirtyEnd = 0;
+	vector<InstanceMaterial> materials;
+	bool materialsDirty = true;
+
+	Shader cullShader;
+	Shader commandShader;
+	unsigned int instanceBuffer = 0, visibleBuffer = 0, materialBuffer = 0, commandBuffer = 0;
+};
+#endif // !INSTANCE_MANAGER_H
@@ -0,0 +1,585 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <profiler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class JobSystem;
+class JobCounter;
+
+// a task and the counter it keeps busy, owned by whichever queue holds it. Tasks up to INLINE_SIZE bytes, parallelFor's
+// pieces among them, live inside the job and larger ones on the heap; the jobs come from JobSystem's free lists
+struct Job {
+	static constexpr size_t INLINE_SIZE = 48;
+
+	alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+	// runs the task in storage, then destroys it
+	void (*invoke)(Job& job) = nullptr;
+	JobCounter* counter = nullptr;
+	// the next job of the JobList holding this one
+	Job* next = nullptr;
+
+	template <class F>
+	void setTask(F&& task)
+	{
+		using Task = std::decay_t<F>;
+		if constexpr (sizeof(Task) <= INLINE_SIZE && alignof(Task) <= alignof(std::max_align_t))
+		{
+			new (storage) Task(std::forward<F>(task));
+			invoke = [](Job& job) {
+				Task& stored = *std::launder(reinterpret_cast<Task*>(job.storage));
+				stored();
+				stored.~Task();
+			};
+		}
+		else
+		{
+			new (storage) Task*(new Task(std::forward<F>(task)));
+			invoke = [](Job& job) {
+				Task* stored = *std::launder(reinterpret_cast<Task**>(job.storage));
+				(*stored)();
+				delete stored;
+			};
+		}
+	}
+};
+
+// jobs linked through Job::next, used first in first out for queues and last in first out for free lists. Not
+// synchronized
+struct JobList {
+	Job* head = nullptr;
+	Job* tail = nullptr;
+	size_t count = 0;
+
+	bool empty() const
+	{
+		return head == nullptr;
+	}
+
+	void pushBack(Job* job)
+	{
+		job->next = nullptr;
+		if (tail)
+			tail->next = job;
+		else
+			head = job;
+		tail = job;
+		count++;
+	}
+
+	void pushFront(Job* job)
+	{
+		job->next = head;
+		head = job;
+		if (!tail)
+			tail = job;
+		count++;
+	}
+
+	Job* popFront()
+	{
+		Job* job = head;
+		if (!job)
+			return nullptr;
+		head = job->next;
+		if (!head)
+			tail = nullptr;
+		job->next = nullptr;
+		count--;
+		return job;
+	}
+};
+
+// Counts the jobs started with it that have not finished yet. JobSystem::wait() blocks on it, runAfter() starts jobs
+// once it reaches zero. A counter can be reused once it is done.
+class JobCounter {
+public:
+	JobCounter() = default;
+	JobCounter(const JobCounter&) = delete;
+	JobCounter& operator=(const JobCounter&) = delete;
+
+	// also waits out the finish of the last job, so a done counter can be destroyed
+	bool done() const
+	{
+		return pending.load(std::memory_order_seq_cst) == 0 && finishing.load(std::memory_order_seq_cst) == 0;
+	}
+
+private:
+	friend class JobSystem;
+
+	std::atomic<int> pending{ 0 };
+	// jobs between their decrement of pending and their last touch of the counter
+	std::atomic<int> finishing{ 0 };
+	// jobs started by runAfter() while this counter was busy
+	std::mutex mutex;
+	JobList continuations;
+};
+
+// A fixed size Chase-Lev deque of jobs. Its worker pushes and pops at the bottom, last in first out so it stays on
+// data that is still in its cache; other threads steal from the top, the oldest and usually largest pieces of work.
+// Only the steals and the pop of the last job need a compare and swap.
+class WorkStealingDeque {
+public:
+	static constexpr int64_t CAPACITY = 4096;
+
+	// owner only, false when full
+	bool push(Job* job)
+	{
+		const int64_t b = bottom.load(std::memory_order_relaxed);
+		const int64_t t = top.load(std::memory_order_acquire);
+		if (b - t >= CAPACITY)
+			return false;
+		slots[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// owner only
+	Job* pop()
+	{
+		const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+		if (t > b)
+		{
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		Job* job = slots[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			// the last job, a thief may be taking it at the same time
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				job = nullptr;
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	// any thread
+	Job* steal()
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return nullptr;
+		Job* job = slots[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return job;
+	}
+
+private:
+	alignas(64) std::atomic<int64_t> top{ 0 };
+	alignas(64) std::atomic<int64_t> bottom{ 0 };
+	std::atomic<Job*> slots[CAPACITY] = {};
+};
+
+struct JobSystemStats {
+	uint64_t jobs = 0;			// finished on any thread
+	uint64_t steals = 0;		// taken from another worker's deque
+	uint64_t allocatedJobs = 0;	// from the heap because the free lists were empty, stops growing once they are warm
+};
+
+// Worker threads, one per core but the main thread's, each with its own WorkStealingDeque. Jobs started on a worker
+// go to its deque, jobs started elsewhere to a shared queue every worker also takes from. A thread that waits for a
+// counter runs jobs meanwhile instead of blocking, so jobs may start and wait for other jobs.
+// Jobs must not touch OpenGL, the context only lives on the main thread: runOnMainThread() queues work for it,
+// which runs in pumpMainThread() and whenever the main thread waits.
+// Finished jobs go back to a free list of the thread that ran them, the workers and the main thread each have one, so
+// starting jobs every frame doesn't go to the global allocator. Lists trade JOB_BATCH jobs at a time through a shared
+// list, jobs started on one thread and finished on another would otherwise pile up on the second.
+class JobSystem {
+public:
+	static constexpr size_t JOB_BATCH = 64;
+
+	explicit JobSystem(unsigned int threadCount = defaultThreadCount())
+		: mainThread(std::this_thread::get_id()), deques(threadCount), freeLists(threadCount + 1)
+	{
+		for (unsigned int i = 0; i < threadCount; i++)
+			workers.emplace_back([this, i] { workerLoop(i); });
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	~JobSystem()
+	{
+		stopping.store(true, std::memory_order_seq_cst);
+		wake.fetch_add(1, std::memory_order_seq_cst);
+		wake.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+		for (FreeList& list : freeLists)
+			deleteJobs(list.jobs);
+		deleteJobs(sharedFree);
+	}
+
+	// starts task, counter (if any) stays busy until it returns
+	template <class F>
+	void run(F&& task, JobCounter* counter = nullptr)
+	{
+		schedule(makeJob(std::forward<F>(task), counter));
+	}
+
+	// starts task once dependency is done, counter stays busy from now until it returns
+	template <class F>
+	void runAfter(JobCounter& dependency, F&& task, JobCounter* counter = nullptr)
+	{
+		Job* job = makeJob(std::forward<F>(task), counter);
+		{
+			std::lock_guard<std::mutex> lock(dependency.mutex);
+			if (dependency.pending.load(std::memory_order_acquire) != 0)
+			{
+				dependency.continuations.pushBack(job);
+				return;
+			}
+		}
+		schedule(job);
+	}
+
+	// queue a callable, the returned future holds its result
+	template <class F>
+	auto submit(F&& task) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+	{
+		using Result = std::invoke_result_t<std::decay_t<F>>;
+		auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+		std::future<Result> result = packaged->get_future();
+		run([packaged] { (*packaged)(); });
+		return result;
+	}
+
+	// task runs on the main thread, in its next pumpMainThread() or wait()
+	template <class F>
+	void runOnMainThread(F&& task, JobCounter* counter = nullptr)
+	{
+		Job* job = makeJob(std::forward<F>(task), counter);
+		std::lock_guard<std::mutex> lock(mainMutex);
+		mainJobs.pushBack(job);
+	}
+
+	// runs the queued main thread jobs, the main loop calls it once a frame
+	void pumpMainThread()
+	{
+		if (!isMainThread())
+			return;
+		for (;;)
+		{
+			Job* job = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(mainMutex);
+				job = mainJobs.popFront();
+			}
+			if (!job)
+				return;
+			execute(job);
+		}
+	}
+
+	// runs other jobs until counter is done
+	void wait(JobCounter& counter)
+	{
+		PROFILE_SCOPE("JobSystem::wait");
+		const int index = workerIndex();
+		while (!counter.done())
+		{
+			pumpMainThread();
+			if (Job* job = findJob(index))
+				execute(job);
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	// body(first, last) over [begin, end) split into pieces of grain elements, the calling thread takes the first
+	// piece and helps with the others. Grain 0 picks about four pieces per thread
+	template <class F>
+	void parallelFor(size_t begin, size_t end, F&& body, size_t grain = 0)
+	{
+		if (begin >= end)
+			return;
+		const size_t count = end - begin;
+		if (grain == 0)
+			grain = std::max<size_t>(1, count / (4 * (size() + 1)));
+		if (size() == 0 || count <= grain)
+		{
+			body(begin, end);
+			return;
+		}
+
+		JobCounter counter;
+		for (size_t first = begin + grain; first < end; first += grain)
+		{
+			const size_t last = std::min(first + grain, end);
+			run([&body, first, last] { body(first, last); }, &counter);
+		}
+		body(begin, begin + grain);
+		wait(counter);
+	}
+
+	unsigned int size() const
+	{
+		return static_cast<unsigned int>(workers.size());
+	}
+
+	bool isMainThread() const
+	{
+		return std::this_thread::get_id() == mainThread;
+	}
+
+	JobSystemStats stats() const
+	{
+		return { finishedJobs.load(std::memory_order_relaxed), steals.load(std::memory_order_relaxed), allocatedJobs.load(std::memory_order_relaxed) };
+	}
+
+	// shared by the loaders and the frame work, leaves one core to the main thread. The first call has to come from
+	// the main thread
+	static JobSystem& shared()
+	{
+		static JobSystem system;
+		return system;
+	}
+
+	static unsigned int defaultThreadCount()
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		return std::max(1u, cores > 1 ? cores - 1 : 1u);
+	}
+
+private:
+	// only touched by its own thread, on a cache line of its own
+	struct alignas(64) FreeList {
+		JobList jobs;
+	};
+
+	std::thread::id mainThread;
+	std::vector<std::thread> workers;
+	std::vector<WorkStealingDeque> deques;
+	// jobs started outside the workers
+	std::mutex injectedMutex;
+	JobList injected;
+	std::atomic<size_t> injectedCount{ 0 };
+	std::mutex mainMutex;
+	JobList mainJobs;
+	// the workers' free lists, then the main thread's. Other threads use sharedFree directly
+	std::vector<FreeList> freeLists;
+	std::mutex freeMutex;
+	JobList sharedFree;
+	// bumped for every job that may wake a sleeping worker
+	std::atomic<uint32_t> wake{ 0 };
+	std::atomic<unsigned int> sleeping{ 0 };
+	std::atomic<bool> stopping{ false };
+	std::atomic<uint64_t> finishedJobs{ 0 };
+	std::atomic<uint64_t> steals{ 0 };
+	std::atomic<uint64_t> allocatedJobs{ 0 };
+
+	template <class F>
+	Job* makeJob(F&& task, JobCounter* counter)
+	{
+		if (counter)
+			counter->pending.fetch_add(1, std::memory_order_relaxed);
+		Job* job = allocateJob();
+		job->setTask(std::forward<F>(task));
+		job->counter = counter;
+		return job;
+	}
+
+	// the calling thread's free list, nullptr on threads that are neither a worker nor the main thread
+	JobList* freeList()
+	{
+		const int index = workerIndex();
+		if (index >= 0)
+			return &freeLists[index].jobs;
+		return isMainThread() ? &freeLists.back().jobs : nullptr;
+	}
+
+	Job* allocateJob()
+	{
+		JobList* list = freeList();
+		Job* job = nullptr;
+		if (list)
+		{
+			if (list->empty())
+			{
+				std::lock_guard<std::mutex> lock(freeMutex);
+				moveJobs(sharedFree, *list, JOB_BATCH);
+			}
+			job = list->popFront();
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(freeMutex);
+			job = sharedFree.popFront();
+		}
+		if (job)
+			return job;
+		allocatedJobs.fetch_add(1, std::memory_order_relaxed);
+		return new Job;
+	}
+
+	void releaseJob(Job* job)
+	{
+		job->invoke = nullptr;
+		job->counter = nullptr;
+		JobList* list = freeList();
+		if (!list)
+		{
+			std::lock_guard<std::mutex> lock(freeMutex);
+			sharedFree.pushFront(job);
+			return;
+		}
+		list->pushFront(job);
+		if (list->count > 2 * JOB_BATCH)
+		{
+			std::lock_guard<std::mutex> lock(freeMutex);
+			moveJobs(*list, sharedFree, JOB_BATCH);
+		}
+	}
+
+	static void moveJobs(JobList& from, JobList& to, size_t count)
+	{
+		for (size_t i = 0; i < count && !from.empty(); i++)
+			to.pushFront(from.popFront());
+	}
+
+	static void deleteJobs(JobList& list)
+	{
+		while (Job* job = list.popFront())
+			delete job;
+	}
+
+	// the index of the calling worker in this system, -1 on any other thread
+	int workerIndex() const
+	{
+		return currentSystem() == this ? currentWorker() : -1;
+	}
+
+	static const JobSystem*& currentSystem()
+	{
+		static thread_local const JobSystem* system = nullptr;
+		return system;
+	}
+
+	static int& currentWorker()
+	{
+		static thread_local int index = -1;
+		return index;
+	}
+
+	void schedule(Job* job)
+	{
+		const int index = workerIndex();
+		if (index < 0 || !deques[index].push(job))
+		{
+			std::lock_guard<std::mutex> lock(injectedMutex);
+			injected.pushBack(job);
+			injectedCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		// pairs with the fence a worker passes before its last look for jobs, one of the two sees the other
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleeping.load(std::memory_order_relaxed) > 0)
+		{
+			wake.fetch_add(1, std::memory_order_relaxed);
+			wake.notify_one();
+		}
+	}
+
+	Job* findJob(int index)
+	{
+		if (index >= 0)
+			if (Job* job = deques[index].pop())
+				return job;
+
+		if (injectedCount.load(std::memory_order_relaxed) > 0)
+		{
+			std::lock_guard<std::mutex> lock(injectedMutex);
+			if (Job* job = injected.popFront())
+			{
+				injectedCount.fetch_sub(1, std::memory_order_relaxed);
+				return job;
+			}
+		}
+
+		// steal, starting after our own deque so thieves spread over the victims
+		const size_t count = deques.size();
+		for (size_t i = 1; i <= count; i++)
+		{
+			const size_t victim = (static_cast<size_t>(index + 1) + i) % count;
+			if (static_cast<int>(victim) == index)
+				continue;
+			if (Job* job = deques[victim].steal())
+			{
+				steals.fetch_add(1, std::memory_order_relaxed);
+				return job;
+			}
+		}
+		return nullptr;
+	}
+
+	void execute(Job* job)
+	{
+		job->invoke(*job);
+		if (JobCounter* counter = job->counter)
+			finish(*counter);
+		releaseJob(job);
+		finishedJobs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// the last job of a counter starts what runAfter() queued on it
+	void finish(JobCounter& counter)
+	{
+		counter.finishing.fetch_add(1, std::memory_order_seq_cst);
+		JobList continuations;
+		if (counter.pending.fetch_sub(1, std::memory_order_seq_cst) == 1)
+		{
+			std::lock_guard<std::mutex> lock(counter.mutex);
+			std::swap(continuations, counter.continuations);
+		}
+		counter.finishing.fetch_sub(1, std::memory_order_seq_cst);
+		while (Job* job = continuations.popFront())
+			schedule(job);
+	}
+
+	void workerLoop(unsigned int index)
+	{
+		Profiler::instance().setThreadName("worker");
+		currentSystem() = this;
+		currentWorker() = static_cast<int>(index);
+		for (;;)
+		{
+			if (Job* job = findJob(static_cast<int>(index)))
+			{
+				execute(job);
+				continue;
+			}
+
+			// announce the sleep, then look once more so a job scheduled in between is not missed
+			const uint32_t seen = wake.load(std::memory_order_relaxed);
+			sleeping.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			Job* job = findJob(static_cast<int>(index));
+			if (!job && !stopping.load(std::memory_order_seq_cst))
+				wake.wait(seen, std::memory_order_relaxed);
+			sleeping.fetch_sub(1, std::memory_order_relaxed);
+			if (job)
+				execute(job);
+			else if (stopping.load(std::memory_order_seq_cst))
+				return;
+		}
+	}
+};
+#endif // !JOB_SYSTEM_H
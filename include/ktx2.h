@@ -0,0 +1,314 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <glad/glad.h>
+
+#include <block_compression.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// KTX2 (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html) for the block compressed textures the baker
+// writes: no supercompression, no key/value data, a basic data format descriptor. File layout:
+//   identifier, Ktx2Header, Ktx2LevelIndex[levelCount], data format descriptor
+//   level data, smallest mip first as the spec asks, every level holds all faces back to back
+// Baked textures sit next to their source image with the extension replaced by .ktx2.
+
+// the VkFormat values KTX2 identifies formats with
+constexpr uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+constexpr uint32_t VK_FORMAT_BC1_RGB_SRGB_BLOCK = 132;
+constexpr uint32_t VK_FORMAT_BC3_UNORM_BLOCK = 137;
+constexpr uint32_t VK_FORMAT_BC3_SRGB_BLOCK = 138;
+constexpr uint32_t VK_FORMAT_BC5_UNORM_BLOCK = 141;
+constexpr uint32_t VK_FORMAT_BC7_UNORM_BLOCK = 145;
+constexpr uint32_t VK_FORMAT_BC7_SRGB_BLOCK = 146;
+
+// EXT_texture_compression_s3tc and EXT_texture_sRGB, our glad only has core formats
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// the 64 bit fields sit at offset 52, so the header is packed to 4 bytes
+#pragma pack(push, 4)
+struct Ktx2Header {
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+#pragma pack(pop)
+static_assert(sizeof(Ktx2Header) == 68, "KTX2 header must match the file layout");
+
+struct Ktx2LevelIndex {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+// a block compressed texture, levels[0] is the full size image
+struct Ktx2Texture {
+	BlockFormat format = BlockFormat::BC7;
+	bool srgb = false;			// texel values are sRGB encoded
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t faceCount = 1;
+	std::vector<std::vector<uint8_t>> levels;
+
+	uint32_t levelWidth(size_t level) const
+	{
+		return std::max(width >> level, 1u);
+	}
+	uint32_t levelHeight(size_t level) const
+	{
+		return std::max(height >> level, 1u);
+	}
+
+	// the GL internal format, srgbSampling picks the sRGB variant so sampling decodes to linear
+	GLenum glInternalFormat(bool srgbSampling) const
+	{
+		switch (format)
+		{
+		case BlockFormat::BC1:
+			return srgbSampling ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case BlockFormat::BC3:
+			return srgbSampling ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case BlockFormat::BC5:
+			return GL_COMPRESSED_RG_RGTC2;
+		default:
+			return srgbSampling ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+		}
+	}
+};
+
+class Ktx2 {
+public:
+	static std::string bakedPathFor(const std::string& sourcePath)
+	{
+		return std::filesystem::path(sourcePath).replace_extension(".ktx2").string();
+	}
+
+	// true if sourcePath has a baked texture at least as new as itself, or only the baked texture exists
+	static bool hasCurrentBake(const std::string& sourcePath)
+	{
+		std::error_code error;
+		const std::filesystem::file_time_type baked = std::filesystem::last_write_time(bakedPathFor(sourcePath), error);
+		if (error)
+			return false;
+		const std::filesystem::file_time_type source = std::filesystem::last_write_time(sourcePath, error);
+		return error || baked >= source;
+	}
+
+	static bool write(const std::string& path, const Ktx2Texture& texture)
+	{
+		const uint32_t levelCount = static_cast<uint32_t>(texture.levels.size());
+		const uint32_t blockSize = blockBytes(texture.format);
+		const std::vector<uint32_t> dfd = descriptorFor(texture);
+
+		Ktx2Header header{};
+		header.vkFormat = vkFormatOf(texture.format, texture.srgb);
+		header.typeSize = 1;
+		header.pixelWidth = texture.width;
+		header.pixelHeight = texture.height;
+		header.faceCount = texture.faceCount;
+		header.levelCount = levelCount;
+		header.dfdByteOffset = static_cast<uint32_t>(sizeof(IDENTIFIER) + sizeof(Ktx2Header) + levelCount * sizeof(Ktx2LevelIndex));
+		header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+		// level data is aligned to the block size, smallest level first
+		std::vector<Ktx2LevelIndex> index(levelCount);
+		uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+		for (uint32_t level = levelCount; level-- > 0;)
+		{
+			offset = (offset + blockSize - 1) / blockSize * blockSize;
+			index[level].byteOffset = offset;
+			index[level].byteLength = texture.levels[level].size();
+			index[level].uncompressedByteLength = texture.levels[level].size();
+			offset += texture.levels[level].size();
+		}
+
+		// write to a temporary file first so a crash never leaves a half written texture behind
+		const std::string tempPath = path + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file)
+			{
+				std::cerr << "ERROR::KTX2::FAILED_TO_OPEN_FILE: " << tempPath << "\n";
+				return false;
+			}
+			file.write(reinterpret_cast<const char*>(IDENTIFIER), sizeof(IDENTIFIER));
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(Ktx2LevelIndex));
+			file.write(reinterpret_cast<const char*>(dfd.data()), dfd.size() * sizeof(uint32_t));
+			for (uint32_t level = levelCount; level-- > 0;)
+			{
+				file.seekp(static_cast<std::streamoff>(index[level].byteOffset));
+				file.write(reinterpret_cast<const char*>(texture.levels[level].data()), texture.levels[level].size());
+			}
+			if (!file)
+			{
+				std::cerr << "ERROR::KTX2::FAILED_TO_WRITE_FILE: " << tempPath << "\n";
+				return false;
+			}
+		}
+
+		std::remove(path.c_str());
+		if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+		{
+			std::cerr << "ERROR::KTX2::FAILED_TO_RENAME_FILE: " << tempPath << "\n";
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// reads the files write produces: BC1/3/5/7 with every level present and no supercompression. Only the levels
+	// firstLevel to lastLevel are read, the others are left empty
+	static bool read(const std::string& path, Ktx2Texture& texture, uint32_t firstLevel = 0, uint32_t lastLevel = UINT32_MAX)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+
+		uint8_t identifier[sizeof(IDENTIFIER)];
+		Ktx2Header header{};
+		file.read(reinterpret_cast<char*>(identifier), sizeof(identifier));
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!file || std::memcmp(identifier, IDENTIFIER, sizeof(IDENTIFIER)) != 0 || !formatOf(header.vkFormat, texture.format, texture.srgb)
+			|| header.supercompressionScheme != 0 || header.levelCount == 0 || header.pixelDepth != 0 || header.layerCount > 1
+			|| (header.faceCount != 1 && header.faceCount != 6))
+		{
+			std::cerr << "ERROR::KTX2::UNSUPPORTED_FILE: " << path << "\n";
+			return false;
+		}
+		texture.width = header.pixelWidth;
+		texture.height = header.pixelHeight;
+		texture.faceCount = header.faceCount;
+
+		std::vector<Ktx2LevelIndex> index(header.levelCount);
+		file.read(reinterpret_cast<char*>(index.data()), index.size() * sizeof(Ktx2LevelIndex));
+		texture.levels.assign(header.levelCount, {});
+		for (uint32_t level = firstLevel; level < header.levelCount && level <= lastLevel; level++)
+		{
+			const uint64_t expected = static_cast<uint64_t>((texture.levelWidth(level) + 3) / 4) * ((texture.levelHeight(level) + 3) / 4)
+				* blockBytes(texture.format) * texture.faceCount;
+			if (index[level].byteLength != expected)
+			{
+				std::cerr << "ERROR::KTX2::BAD_LEVEL_SIZE: " << path << " level " << level << "\n";
+				return false;
+			}
+			texture.levels[level].resize(expected);
+			file.seekg(static_cast<std::streamoff>(index[level].byteOffset));
+			file.read(reinterpret_cast<char*>(texture.levels[level].data()), expected);
+		}
+		if (!file)
+		{
+			std::cerr << "ERROR::KTX2::FAILED_TO_READ_FILE: " << path << "\n";
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static constexpr uint8_t IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	static uint32_t vkFormatOf(BlockFormat format, bool srgb)
+	{
+		switch (format)
+		{
+		case BlockFormat::BC1:
+			return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		case BlockFormat::BC3:
+			return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+		case BlockFormat::BC5:
+			return VK_FORMAT_BC5_UNORM_BLOCK;
+		default:
+			return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+		}
+	}
+
+	static bool formatOf(uint32_t vkFormat, BlockFormat& format, bool& srgb)
+	{
+		for (BlockFormat candidate : { BlockFormat::BC1, BlockFormat::BC3, BlockFormat::BC5, BlockFormat::BC7 })
+			for (bool candidateSrgb : { false, true })
+				if (vkFormatOf(candidate, candidateSrgb) == vkFormat)
+				{
+					format = candidate;
+					srgb = candidateSrgb && candidate != BlockFormat::BC5;
+					return true;
+				}
+		return false;
+	}
+
+	// the basic data format descriptor for one 4x4 block: dfdTotalSize, then one descriptor block with a sample per
+	// 64 bit half (BC3 alpha + color, BC5 red + green) or a single sample for the whole block
+	static std::vector<uint32_t> descriptorFor(const Ktx2Texture& texture)
+	{
+		constexpr uint32_t MODEL_BC1A = 128, MODEL_BC3 = 130, MODEL_BC5 = 132, MODEL_BC7 = 134;
+		constexpr uint32_t PRIMARIES_BT709 = 1, TRANSFER_LINEAR = 1, TRANSFER_SRGB = 2;
+		constexpr uint32_t CHANNEL_COLOR = 0, CHANNEL_GREEN = 1, CHANNEL_ALPHA = 15, QUALIFIER_LINEAR = 0x10;
+
+		uint32_t model = MODEL_BC7;
+		std::vector<uint32_t> channels = { CHANNEL_COLOR };
+		if (texture.format == BlockFormat::BC1)
+			model = MODEL_BC1A;
+		else if (texture.format == BlockFormat::BC3)
+		{
+			model = MODEL_BC3;
+			channels = { CHANNEL_ALPHA | (texture.srgb ? QUALIFIER_LINEAR : 0), CHANNEL_COLOR };
+		}
+		else if (texture.format == BlockFormat::BC5)
+		{
+			model = MODEL_BC5;
+			channels = { CHANNEL_COLOR, CHANNEL_GREEN };
+		}
+
+		const uint32_t blockSize = blockBytes(texture.format);
+		const uint32_t sampleBits = blockSize * 8 / static_cast<uint32_t>(channels.size());
+		const uint32_t descriptorBlockSize = 24 + 16 * static_cast<uint32_t>(channels.size());
+		std::vector<uint32_t> dfd = {
+			4 + descriptorBlockSize,
+			0,										// vendor id 0 (Khronos), descriptor type 0 (basic)
+			2 | (descriptorBlockSize << 16),		// version 2
+			model | (PRIMARIES_BT709 << 8) | ((texture.srgb ? TRANSFER_SRGB : TRANSFER_LINEAR) << 16),
+			3 | (3 << 8),							// texel block dimensions minus one
+			blockSize,								// bytes in plane 0
+			0
+		};
+		for (size_t i = 0; i < channels.size(); i++)
+		{
+			dfd.push_back(static_cast<uint32_t>(i * sampleBits) | ((sampleBits - 1) << 16) | (channels[i] << 24));
+			dfd.push_back(0);						// sample position
+			dfd.push_back(0);						// sample lower
+			dfd.push_back(0xFFFFFFFFu);				// sample upper
+		}
+		return dfd;
+	}
+};
+#endif // !KTX2_H
@@ -0,0 +1,441 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glm/glm.hpp>
+
+#include <job_system.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// SSE on any x86-64 build, scalar otherwise
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHT_CLUSTERS_SSE
+#include <emmintrin.h>
+#endif
+
+using std::vector;
+
+constexpr unsigned int POINT_LIGHT = 0;
+constexpr unsigned int SPOT_LIGHT = 1;
+
+// one light, the std430 layout of Light in model_lighting.frag. The fields are the ones of Shader::setPointLight
+// and setSpotLight, packed into the w of the vectors
+struct LightData {
+	glm::vec4 position;		// w = radius the light reaches, see lightRadius
+	glm::vec4 direction;	// spot lights only, w = cutOff
+	glm::vec4 ambient;		// w = outerCutOff
+	glm::vec4 diffuse;		// w = constant
+	glm::vec4 specular;		// w = linear
+	float quadratic;
+	unsigned int type;		// POINT_LIGHT or SPOT_LIGHT
+	float padding[2];
+};
+
+// the Clusters block, how a fragment finds its cluster
+struct ClusterConstants {
+	glm::uvec4 grid;		// clusters along x, y and z, w = tile size in pixels
+	glm::vec4 depth;		// slice = log(view depth) * x + y, z = near, w = far
+};
+
+struct LightClusterStats {
+	unsigned int lights = 0;
+	unsigned int visibleLights = 0;	// lights that reach the depth range of the frustum
+	unsigned int clusters = 0;
+	unsigned int indices = 0;		// entries of the light index list
+	unsigned int maxPerCluster = 0;
+	double milliseconds = 0.0;
+};
+
+// distance at which 1 / (constant + linear * d + quadratic * d * d) leaves less than 5/256 of the brightest channel
+// of diffuse, the light volume of LearnOpenGL's deferred shading chapter. The shader fades the last part of it out
+inline float lightRadius(float constant, float linear, float quadratic, const glm::vec3& diffuse)
+{
+	const float brightest = std::max(std::max(diffuse.r, diffuse.g), diffuse.b);
+	const float limit = brightest * 256.0f / 5.0f;
+	if (quadratic > 0.0f)
+		return std::max((-linear + std::sqrt(linear * linear - 4.0f * quadratic * (constant - limit))) / (2.0f * quadratic), 0.0f);
+	if (linear > 0.0f)
+		return std::max((limit - constant) / linear, 0.0f);
+	// no falloff, as far as any camera sees
+	return 1e4f;
+}
+
+// Light to cluster binning on the CPU. The view frustum is cut into screen tiles of TILE_SIZE pixels and SLICES depth
+// slices spaced exponentially from near to far, the fragment shader finds its cluster from gl_FragCoord and its view
+// depth. bin() gives every cluster the list of lights whose bounding sphere touches the cluster's view space box:
+//   - per light, the view space bounding sphere and the slices it can reach; lights outside near and far drop out
+//   - per slice on the job system, every light of the slice only visits the tiles its sphere can project to and tests
+//     the boxes of a row of them four at a time with SSE
+//   - the hits of each slice are counting sorted by cluster and concatenated into one index list, grid() holds the
+//     first index and the count of every cluster
+// Lights stay in ascending order inside a cluster, so the lists are the same whatever the number of threads and the
+// same as binReference(), which tests every light against every box.
+class LightClusters {
+public:
+	static constexpr unsigned int TILE_SIZE = 64;
+	static constexpr unsigned int SLICES = 24;
+
+	LightClusterStats stats;
+
+	// rebuilds the cluster boxes when the projection or the viewport changed, fovY in radians
+	void setProjection(float fovY, float aspect, float near, float far, unsigned int width, unsigned int height)
+	{
+		const float tanY = std::tan(fovY * 0.5f), tanX = tanY * aspect;
+		if (tanY == tanHalfY && tanX == tanHalfX && near == nearPlane && far == farPlane && width == viewportWidth && height == viewportHeight)
+			return;
+		tanHalfX = tanX;
+		tanHalfY = tanY;
+		nearPlane = near;
+		farPlane = far;
+		viewportWidth = std::max(width, 1u);
+		viewportHeight = std::max(height, 1u);
+		tilesX = (viewportWidth + TILE_SIZE - 1) / TILE_SIZE;
+		tilesY = (viewportHeight + TILE_SIZE - 1) / TILE_SIZE;
+		sliceScale = SLICES / std::log(far / near);
+		sliceBias = -static_cast<float>(SLICES) * std::log(near) / std::log(far / near);
+
+		sliceDepths.resize(SLICES + 1);
+		for (unsigned int slice = 0; slice <= SLICES; slice++)
+			sliceDepths[slice] = near * std::pow(far / near, static_cast<float>(slice) / SLICES);
+		sliceDepths[SLICES] = far;
+
+		// the SSE row tests read up to three boxes past the last one
+		const size_t count = clusterCount();
+		for (vector<float>* bounds : { &minX, &minY, &minZ, &maxX, &maxY, &maxZ })
+			bounds->assign(count + 4, 0.0f);
+		for (unsigned int slice = 0; slice < SLICES; slice++)
+		{
+			const float nearDepth = sliceDepths[slice], farDepth = sliceDepths[slice + 1];
+			for (unsigned int y = 0; y < tilesY; y++)
+			{
+				const float bottom = tileNDC(y, viewportHeight) * tanHalfY, top = tileNDC(y + 1, viewportHeight) * tanHalfY;
+				for (unsigned int x = 0; x < tilesX; x++)
+				{
+					const float left = tileNDC(x, viewportWidth) * tanHalfX, right = tileNDC(x + 1, viewportWidth) * tanHalfX;
+					const size_t cluster = clusterIndex(x, y, slice);
+					// the tile's frustum between the two depths, the camera looks down -z
+					minX[cluster] = std::min(left * nearDepth, left * farDepth);
+					maxX[cluster] = std::max(right * nearDepth, right * farDepth);
+					minY[cluster] = std::min(bottom * nearDepth, bottom * farDepth);
+					maxY[cluster] = std::max(top * nearDepth, top * farDepth);
+					minZ[cluster] = -farDepth;
+					maxZ[cluster] = -nearDepth;
+				}
+			}
+		}
+		clusters.assign(count, glm::uvec2(0));
+		sliceHits.resize(SLICES);
+		sliceHitLights.resize(SLICES);
+		sliceIndices.resize(SLICES);
+	}
+
+	void bin(const vector<LightData>& lights, const glm::mat4& view, JobSystem* jobs = &JobSystem::shared())
+	{
+		PROFILE_SCOPE("LightClusters::bin");
+		const auto start = std::chrono::steady_clock::now();
+
+		// view space spheres and the slices they reach
+		spheres.resize(lights.size());
+		auto boundLights = [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+				spheres[i] = bound(lights[i], view);
+		};
+		if (jobs)
+			jobs->parallelFor(0, lights.size(), boundLights, std::max<size_t>(256, lights.size() / (4 * (jobs->size() + 1))));
+		else
+			boundLights(0, lights.size());
+
+		// the lights of every slice, ascending
+		sliceStarts.assign(SLICES + 1, 0);
+		unsigned int visible = 0;
+		for (const Sphere& sphere : spheres)
+			if (sphere.firstSlice <= sphere.lastSlice)
+			{
+				visible++;
+				for (uint32_t slice = sphere.firstSlice; slice <= sphere.lastSlice; slice++)
+					sliceStarts[slice + 1]++;
+			}
+		for (unsigned int slice = 0; slice < SLICES; slice++)
+			sliceStarts[slice + 1] += sliceStarts[slice];
+		sliceLights.resize(sliceStarts[SLICES]);
+		sliceFill.assign(sliceStarts.begin(), sliceStarts.end() - 1);
+		for (uint32_t light = 0; light < spheres.size(); light++)
+		{
+			if (spheres[light].firstSlice > spheres[light].lastSlice)
+				continue;
+			for (uint32_t slice = spheres[light].firstSlice; slice <= spheres[light].lastSlice; slice++)
+				sliceLights[sliceFill[slice]++] = light;
+		}
+
+		// one job per slice, each owns the clusters of its slice
+		auto binSlices = [&](size_t first, size_t last) {
+			for (size_t slice = first; slice < last; slice++)
+				binSlice(static_cast<unsigned int>(slice));
+		};
+		if (jobs)
+			jobs->parallelFor(0, SLICES, binSlices, 1);
+		else
+			binSlices(0, SLICES);
+
+		// the slices' lists one after the other
+		sliceBases.resize(SLICES + 1);
+		sliceBases[0] = 0;
+		for (unsigned int slice = 0; slice < SLICES; slice++)
+			sliceBases[slice + 1] = sliceBases[slice] + static_cast<uint32_t>(sliceIndices[slice].size());
+		lightIndices.resize(sliceBases[SLICES]);
+		std::atomic<unsigned int> maxCount{ 0 };
+		auto concatenate = [&](size_t first, size_t last) {
+			unsigned int largest = 0;
+			for (size_t slice = first; slice < last; slice++)
+			{
+				std::copy(sliceIndices[slice].begin(), sliceIndices[slice].end(), lightIndices.begin() + sliceBases[slice]);
+				const size_t firstCluster = clusterIndex(0, 0, static_cast<unsigned int>(slice));
+				for (size_t cluster = firstCluster; cluster < firstCluster + tilesX * tilesY; cluster++)
+				{
+					clusters[cluster].x += sliceBases[slice];
+					largest = std::max(largest, clusters[cluster].y);
+				}
+			}
+			unsigned int current = maxCount.load(std::memory_order_relaxed);
+			while (largest > current && !maxCount.compare_exchange_weak(current, largest, std::memory_order_relaxed))
+				;
+		};
+		if (jobs)
+			jobs->parallelFor(0, SLICES, concatenate, 1);
+		else
+			concatenate(0, SLICES);
+
+		stats.lights = static_cast<unsigned int>(lights.size());
+		stats.visibleLights = visible;
+		stats.clusters = static_cast<unsigned int>(clusterCount());
+		stats.indices = static_cast<unsigned int>(lightIndices.size());
+		stats.maxPerCluster = maxCount.load(std::memory_order_relaxed);
+		stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// every light against every cluster box one at a time, what bin() is measured and checked against
+	void binReference(const vector<LightData>& lights, const glm::mat4& view)
+	{
+		spheres.resize(lights.size());
+		for (size_t i = 0; i < lights.size(); i++)
+			spheres[i] = bound(lights[i], view);
+		lightIndices.clear();
+		for (size_t cluster = 0; cluster < clusterCount(); cluster++)
+		{
+			clusters[cluster] = glm::uvec2(static_cast<unsigned int>(lightIndices.size()), 0u);
+			for (uint32_t light = 0; light < spheres.size(); light++)
+			{
+				const Sphere& sphere = spheres[light];
+				const float dx = std::max(std::max(minX[cluster] - sphere.x, sphere.x - maxX[cluster]), 0.0f);
+				const float dy = std::max(std::max(minY[cluster] - sphere.y, sphere.y - maxY[cluster]), 0.0f);
+				const float dz = std::max(std::max(minZ[cluster] - sphere.z, sphere.z - maxZ[cluster]), 0.0f);
+				if (dx * dx + dy * dy + dz * dz <= sphere.radius * sphere.radius)
+				{
+					lightIndices.push_back(light);
+					clusters[cluster].y++;
+				}
+			}
+		}
+	}
+
+	size_t clusterCount() const
+	{
+		return static_cast<size_t>(tilesX) * tilesY * SLICES;
+	}
+
+	// first index into indices() and light count of every cluster, x fastest, then y, then the slice
+	const vector<glm::uvec2>& grid() const
+	{
+		return clusters;
+	}
+
+	const vector<uint32_t>& indices() const
+	{
+		return lightIndices;
+	}
+
+	ClusterConstants constants() const
+	{
+		return { glm::uvec4(tilesX, tilesY, SLICES, TILE_SIZE), glm::vec4(sliceScale, sliceBias, nearPlane, farPlane) };
+	}
+
+private:
+	struct Sphere {
+		float x, y, z, radius;		// view space
+		uint32_t firstSlice, lastSlice;	// firstSlice > lastSlice when the light reaches no slice
+		float depth;
+	};
+
+	float tanHalfX = 0.0f, tanHalfY = 0.0f, nearPlane = 0.0f, farPlane = 0.0f;
+	unsigned int viewportWidth = 0, viewportHeight = 0, tilesX = 0, tilesY = 0;
+	float sliceScale = 0.0f, sliceBias = 0.0f;
+	vector<float> sliceDepths;
+	vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+	vector<Sphere> spheres;
+	vector<uint32_t> sliceStarts, sliceFill, sliceLights, sliceBases;
+	// per slice, the cluster and the light of every hit, then the lights sorted by cluster
+	vector<vector<uint32_t>> sliceHits, sliceHitLights, sliceIndices;
+	vector<glm::uvec2> clusters;
+	vector<uint32_t> lightIndices;
+
+	static float tileNDC(unsigned int tile, unsigned int pixels)
+	{
+		return static_cast<float>(tile * TILE_SIZE) / pixels * 2.0f - 1.0f;
+	}
+
+	size_t clusterIndex(unsigned int x, unsigned int y, unsigned int slice) const
+	{
+		return (static_cast<size_t>(slice) * tilesY + y) * tilesX + x;
+	}
+
+	int slice(float depth) const
+	{
+		return static_cast<int>(std::floor(std::log(depth) * sliceScale + sliceBias));
+	}
+
+	// a spot light is bounded by the sphere around its cone, tighter than the one around its position
+	Sphere bound(const LightData& light, const glm::mat4& view) const
+	{
+		glm::vec3 center(light.position);
+		float radius = light.position.w;
+		if (light.type == SPOT_LIGHT)
+		{
+			const float cosine = glm::clamp(light.ambient.w, 0.0f, 1.0f);
+			const glm::vec3 direction = glm::normalize(glm::vec3(light.direction));
+			if (cosine >= 0.70710678f)
+			{
+				radius = light.position.w / (2.0f * cosine);
+				center += direction * radius;
+			}
+			else if (cosine > 0.0f)
+			{
+				center += direction * (light.position.w * cosine);
+				radius = light.position.w * std::sqrt(1.0f - cosine * cosine);
+			}
+		}
+		const glm::vec4 viewCenter = view * glm::vec4(center, 1.0f);
+		Sphere sphere{ viewCenter.x, viewCenter.y, viewCenter.z, radius, 1, 0, -viewCenter.z };
+		if (sphere.depth + radius < nearPlane || sphere.depth - radius > farPlane)
+			return sphere;
+		// one slice more on both sides against rounding, the box tests decide
+		sphere.firstSlice = static_cast<uint32_t>(std::clamp(slice(std::max(sphere.depth - radius, nearPlane)) - 1, 0, static_cast<int>(SLICES) - 1));
+		sphere.lastSlice = static_cast<uint32_t>(std::clamp(slice(std::min(sphere.depth + radius, farPlane)) + 1, 0, static_cast<int>(SLICES) - 1));
+		return sphere;
+	}
+
+	// tiles of a row or column whose boxes in the slice between the two depths can reach center - radius to
+	// center + radius. The box edges grow with the tile, so the range follows from the edges of the first and the last
+	// box, widened by one against rounding
+	bool tileRange(float center, float radius, float nearDepth, float farDepth, float tanHalf, unsigned int pixels, unsigned int tiles, unsigned int& first, unsigned int& last) const
+	{
+		// a box's upper edge is its tile's upper side at the far depth when it is positive, at the near depth otherwise
+		const float low = center - radius, high = center + radius;
+		const float lowestUpper = low / (low >= 0.0f ? farDepth : nearDepth) / tanHalf;
+		const float highestLower = high / (high >= 0.0f ? nearDepth : farDepth) / tanHalf;
+		const int firstTile = static_cast<int>(std::ceil((lowestUpper * 0.5f + 0.5f) * pixels / TILE_SIZE)) - 2;
+		const int lastTile = static_cast<int>(std::floor((highestLower * 0.5f + 0.5f) * pixels / TILE_SIZE)) + 1;
+		if (lastTile < 0 || firstTile >= static_cast<int>(tiles) || firstTile > lastTile)
+			return false;
+		first = static_cast<unsigned int>(std::max(firstTile, 0));
+		last = static_cast<unsigned int>(std::min(lastTile, static_cast<int>(tiles) - 1));
+		return true;
+	}
+
+	void binSlice(unsigned int slice)
+	{
+		const float nearDepth = sliceDepths[slice], farDepth = sliceDepths[slice + 1];
+		const size_t firstCluster = clusterIndex(0, 0, slice), sliceClusters = static_cast<size_t>(tilesX) * tilesY;
+		vector<uint32_t>& hits = sliceHits[slice];
+		vector<uint32_t>& hitLights = sliceHitLights[slice];
+		hits.clear();
+		hitLights.clear();
+
+		for (uint32_t entry = sliceStarts[slice]; entry < sliceStarts[slice + 1]; entry++)
+		{
+			const uint32_t light = sliceLights[entry];
+			const Sphere& sphere = spheres[light];
+			unsigned int x0, x1, y0, y1;
+			if (!tileRange(sphere.x, sphere.radius, nearDepth, farDepth, tanHalfX, viewportWidth, tilesX, x0, x1)
+				|| !tileRange(sphere.y, sphere.radius, nearDepth, farDepth, tanHalfY, viewportHeight, tilesY, y0, y1))
+				continue;
+			for (unsigned int y = y0; y <= y1; y++)
+				testRow(sphere, clusterIndex(0, y, slice), x0, x1, light, firstCluster, hits, hitLights);
+		}
+
+		// counting sort by cluster, the lights of a cluster stay ascending
+		vector<uint32_t>& indices = sliceIndices[slice];
+		indices.resize(hits.size());
+		for (size_t cluster = firstCluster; cluster < firstCluster + sliceClusters; cluster++)
+			clusters[cluster] = glm::uvec2(0);
+		for (uint32_t hit : hits)
+			clusters[firstCluster + hit].y++;
+		uint32_t offset = 0;
+		for (size_t cluster = firstCluster; cluster < firstCluster + sliceClusters; cluster++)
+		{
+			clusters[cluster].x = offset;
+			offset += clusters[cluster].y;
+		}
+		// x is the fill position until concatenation adds the slice's base, after the fill it is back at the start
+		for (size_t i = 0; i < hits.size(); i++)
+			indices[clusters[firstCluster + hits[i]].x++] = hitLights[i];
+		for (size_t cluster = firstCluster; cluster < firstCluster + sliceClusters; cluster++)
+			clusters[cluster].x -= clusters[cluster].y;
+	}
+
+#if defined(LIGHT_CLUSTERS_SSE)
+	// the clusters x0 to x1 of a row, four boxes per test
+	void testRow(const Sphere& sphere, size_t row, unsigned int x0, unsigned int x1, uint32_t light, size_t firstCluster, vector<uint32_t>& hits, vector<uint32_t>& hitLights) const
+	{
+		const __m128 x = _mm_set1_ps(sphere.x), y = _mm_set1_ps(sphere.y), z = _mm_set1_ps(sphere.z);
+		const __m128 radiusSquared = _mm_set1_ps(sphere.radius * sphere.radius), zero = _mm_setzero_ps();
+		for (unsigned int tile = x0; tile <= x1; tile += 4)
+		{
+			const size_t cluster = row + tile;
+			const __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[cluster]), x), _mm_sub_ps(x, _mm_loadu_ps(&maxX[cluster]))), zero);
+			const __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[cluster]), y), _mm_sub_ps(y, _mm_loadu_ps(&maxY[cluster]))), zero);
+			const __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[cluster]), z), _mm_sub_ps(z, _mm_loadu_ps(&maxZ[cluster]))), zero);
+			const __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			int mask = _mm_movemask_ps(_mm_cmple_ps(distanceSquared, radiusSquared));
+			// lanes past x1 belong to the next row or to the padding
+			mask &= (1 << std::min(4u, x1 - tile + 1)) - 1;
+			for (; mask; mask &= mask - 1)
+			{
+				hits.push_back(static_cast<uint32_t>(cluster + countTrailingZeros(mask) - firstCluster));
+				hitLights.push_back(light);
+			}
+		}
+	}
+
+	static unsigned int countTrailingZeros(int mask)
+	{
+		unsigned int bit = 0;
+		while (!(mask & (1 << bit)))
+			bit++;
+		return bit;
+	}
+#else
+	void testRow(const Sphere& sphere, size_t row, unsigned int x0, unsigned int x1, uint32_t light, size_t firstCluster, vector<uint32_t>& hits, vector<uint32_t>& hitLights) const
+	{
+		for (unsigned int tile = x0; tile <= x1; tile++)
+		{
+			const size_t cluster = row + tile;
+			const float dx = std::max(std::max(minX[cluster] - sphere.x, sphere.x - maxX[cluster]), 0.0f);
+			const float dy = std::max(std::max(minY[cluster] - sphere.y, sphere.y - maxY[cluster]), 0.0f);
+			const float dz = std::max(std::max(minZ[cluster] - sphere.z, sphere.z - maxZ[cluster]), 0.0f);
+			if (dx * dx + dy * dy + dz * dz <= sphere.radius * sphere.radius)
+			{
+				hits.push_back(static_cast<uint32_t>(cluster - firstCluster));
+				hitLights.push_back(light);
+			}
+		}
+	}
+#endif
+};
+#endif // !LIGHT_CLUSTERS_H
@@ -0,0 +1,169 @@
+#ifndef LIGHT_MANAGER_H
+#define LIGHT_MANAGER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <shader.h>
+#include <light_clusters.h>
+#include <job_system.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <vector>
+
+// uniform block binding of Clusters, next to Frame and Object in uniform_ring.h
+constexpr GLuint CLUSTER_UNIFORM_BINDING = 2;
+// shader storage bindings read by model_lighting.frag
+constexpr unsigned int LIGHT_DATA_BINDING = 8;
+constexpr unsigned int LIGHT_GRID_BINDING = 9;		// uvec2 per cluster, first index and count in the light index list
+constexpr unsigned int LIGHT_INDEX_BINDING = 10;
+
+// Point and spot lights for clustered forward shading. The lights live in a shader storage buffer instead of one
+// uniform per field, update() bins them into the clusters of the camera frustum on the job system (see LightClusters)
+// and uploads the light list, the cluster grid and the light index list; model_lighting.frag only loops over the
+// lights of its fragment's cluster, so thousands of lights cost what the few near each fragment cost.
+// Typical use, once per frame:
+//   lights.update(view, camera.Zoom, aspect, near, far, width, height); lights.bind();
+// and once per shader: lights.setUniforms(shader).
+class LightManager {
+public:
+	LightClusters clusters;
+
+	LightManager()
+	{
+		glGenBuffers(1, &lightBuffer);
+		glGenBuffers(1, &gridBuffer);
+		glGenBuffers(1, &indexBuffer);
+		glGenBuffers(1, &clusterUBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, clusterUBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterConstants), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	LightManager(const LightManager&) = delete;
+	LightManager& operator=(const LightManager&) = delete;
+
+	~LightManager()
+	{
+		unsigned int buffers[] = { lightBuffer, gridBuffer, indexBuffer, clusterUBO };
+		glDeleteBuffers(4, buffers);
+	}
+
+	// the arguments of Shader::setPointLight, returns the index setPosition takes
+	unsigned int addPointLight(const glm::vec3& position, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular, const float constant, const float linear, const float quadratic)
+	{
+		LightData light{};
+		light.position = glm::vec4(position, lightRadius(constant, linear, quadratic, diffuse));
+		light.direction = glm::vec4(0.0f, -1.0f, 0.0f, -1.0f);
+		light.ambient = glm::vec4(ambient, -1.0f);
+		light.diffuse = glm::vec4(diffuse, constant);
+		light.specular = glm::vec4(specular, linear);
+		light.quadratic = quadratic;
+		light.type = POINT_LIGHT;
+		lights.push_back(light);
+		lightsDirty = true;
+		return static_cast<unsigned int>(lights.size() - 1);
+	}
+
+	// the arguments of Shader::setSpotLight, cutOff and outerCutOff are cosines
+	unsigned int addSpotLight(const glm::vec3& position, const glm::vec3& direction, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular, const float constant, const float linear, const float quadratic, const float cutOff, const float outerCutOff)
+	{
+		const unsigned int index = addPointLight(position, ambient, diffuse, specular, constant, linear, quadratic);
+		lights[index].direction = glm::vec4(glm::normalize(direction), cutOff);
+		lights[index].ambient.w = outerCutOff;
+		lights[index].type = SPOT_LIGHT;
+		return index;
+	}
+
+	void setPosition(unsigned int index, const glm::vec3& position)
+	{
+		lights[index].position = glm::vec4(position, lights[index].position.w);
+		lightsDirty = true;
+	}
+
+	void setDirection(unsigned int index, const glm::vec3& direction)
+	{
+		lights[index].direction = glm::vec4(glm::normalize(direction), lights[index].direction.w);
+		lightsDirty = true;
+	}
+
+	void clear()
+	{
+		lights.clear();
+		lightsDirty = true;
+	}
+
+	size_t size() const
+	{
+		return lights.size();
+	}
+
+	const vector<LightData>& data() const
+	{
+		return lights;
+	}
+
+	// bins the lights into the clusters of a perspective camera, fovY in degrees like Camera::Zoom, and uploads them
+	void update(const glm::mat4& view, float fovY, float aspect, float near, float far, unsigned int width, unsigned int height, JobSystem* jobs = &JobSystem::shared())
+	{
+		PROFILE_SCOPE("LightManager::update");
+		clusters.setProjection(glm::radians(fovY), aspect, near, far, width, height);
+		clusters.bin(lights, view, jobs);
+
+		if (lightsDirty)
+		{
+			upload(GL_SHADER_STORAGE_BUFFER, lightBuffer, lights.size() * sizeof(LightData), lights.data(), lightCapacity);
+			lightsDirty = false;
+		}
+		upload(GL_SHADER_STORAGE_BUFFER, gridBuffer, clusters.grid().size() * sizeof(glm::uvec2), clusters.grid().data(), gridCapacity);
+		upload(GL_SHADER_STORAGE_BUFFER, indexBuffer, clusters.indices().size() * sizeof(uint32_t), clusters.indices().data(), indexCapacity);
+		const ClusterConstants constants = clusters.constants();
+		glBindBuffer(GL_UNIFORM_BUFFER, clusterUBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(constants), &constants);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	void bind() const
+	{
+		glBindBufferBase(GL_UNIFORM_BUFFER, CLUSTER_UNIFORM_BINDING, clusterUBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_DATA_BINDING, lightBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_GRID_BINDING, gridBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_INDEX_BINDING, indexBuffer);
+	}
+
+	// shaders that are never given the lights skip the cluster loop
+	void setUniforms(const Shader& shader) const
+	{
+		shader.setBool("clusteredLighting", true);
+	}
+
+	const LightClusterStats& stats() const
+	{
+		return clusters.stats;
+	}
+
+private:
+	// grows the buffer when the data outgrew it, otherwise rewrites the start. Empty lists still get a buffer, the
+	// shader's unsized arrays need one bound
+	static void upload(GLenum target, unsigned int buffer, size_t size, const void* data, size_t& capacity)
+	{
+		glBindBuffer(target, buffer);
+		if (size > capacity || capacity == 0)
+		{
+			capacity = std::max<size_t>(size + size / 2, 16);
+			glBufferData(target, capacity, nullptr, GL_DYNAMIC_DRAW);
+		}
+		if (size > 0)
+			glBufferSubData(target, 0, size, data);
+		glBindBuffer(target, 0);
+	}
+
+	vector<LightData> lights;
+	bool lightsDirty = true;
+
+	unsigned int lightBuffer = 0, gridBuffer = 0, indexBuffer = 0, clusterUBO = 0;
+	size_t lightCapacity = 0, gridCapacity = 0, indexCapacity = 0;
+};
+#endif // !LIGHT_MANAGER_H
@@ -0,0 +1,64 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <glm/glm.hpp>
+
+#include <bounds.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// LOD 0 is the mesh's own index buffer, the others are simplified index buffers over the same vertices
+constexpr unsigned int MAX_LOD_COUNT = 4;
+
+struct MeshLOD {
+	std::vector<unsigned int> indices;
+	// largest object space distance the simplified surface moved away from the original
+	float error = 0.0f;
+	// first index inside the mesh's element buffer, filled in when the mesh uploads it
+	unsigned int firstIndex = 0;
+};
+
+// picks the coarsest LOD whose error, projected to the screen, stays under pixelError
+struct LODSelection {
+	glm::vec3 cameraPosition = glm::vec3(0.0f);
+	// pixels per world unit at distance 1: viewport height / (2 tan(fov / 2))
+	float projectionScale = 1.0f;
+	float pixelError = 1.0f;
+
+	static LODSelection perspective(const glm::vec3& cameraPosition, float fovDegrees, float viewportHeight, float pixelError = 1.0f)
+	{
+		LODSelection selection;
+		selection.cameraPosition = cameraPosition;
+		selection.projectionScale = viewportHeight / (2.0f * std::tan(glm::radians(fovDegrees) * 0.5f));
+		selection.pixelError = pixelError;
+		return selection;
+	}
+
+	// errors holds the object space error of LOD 1..n (LOD 0 has none), scale is the largest axis scale of the model matrix
+	unsigned int select(const BoundingSphere& worldSphere, float scale, const std::vector<MeshLOD>& lods) const
+	{
+		// nearest point of the sphere, so a large mesh doesn't coarsen while the camera is next to it
+		const float distance = std::max(glm::length(worldSphere.center - cameraPosition) - worldSphere.radius, 1e-3f);
+		unsigned int lod = 0;
+		for (unsigned int i = 0; i < lods.size(); i++)
+			if (lods[i].error * scale * projectionScale / distance <= pixelError)
+				lod = i + 1;
+			else
+				break;
+		return lod;
+	}
+};
+
+// triangles submitted per LOD, LOD 0 first
+struct LODStats {
+	unsigned int meshes[MAX_LOD_COUNT] = {};
+	unsigned int triangles[MAX_LOD_COUNT] = {};
+
+	void reset()
+	{
+		*this = LODStats();
+	}
+};
+#endif // !LOD_H
@@ -0,0 +1,156 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h>
+
+#include <shader.h>
+#include <state_cache.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using std::string;
+
+struct Texture {
+	unsigned int id;
+	string type;
+	string path;
+};
+
+// the texture types loadMaterialTextures produces, in sampler array order
+enum class TextureRole : unsigned int {
+	Diffuse,
+	Specular,
+	Normal,
+	Reflection,
+	Height,
+	Count
+};
+
+inline TextureRole textureRoleOf(const std::string& type)
+{
+	if (type == "texture_diffuse")
+		return TextureRole::Diffuse;
+	if (type == "texture_specular")
+		return TextureRole::Specular;
+	if (type == "texture_normal")
+		return TextureRole::Normal;
+	if (type == "texture_reflection")
+		return TextureRole::Reflection;
+	return TextureRole::Height;
+}
+
+// Everything Mesh::Draw used to work out per draw from the texture list, resolved once at import time.
+// Meshes that use the same aiMaterial share one Material.
+class Material {
+public:
+	// texture i is bound to texture unit i, as Mesh::Draw always did
+	explicit Material(const std::vector<Texture>& textures)
+		: id(nextID())
+	{
+		constexpr const char* samplerArrays[] = {
+			"material.texture_diffuse", "material.texture_specular", "material.texture_normal", "material.texture_reflection", "material.texture_height"
+		};
+
+		unsigned int roleCounts[ROLE_COUNT] = {};
+		for (const Texture& texture : textures)
+		{
+			const unsigned int role = static_cast<unsigned int>(textureRoleOf(texture.type));
+			const unsigned int element = roleCounts[role]++;
+
+			Binding binding;
+			binding.textureID = texture.id;
+			binding.sampler = UniformName(hashName(std::string(samplerArrays[role]) + "[" + std::to_string(element) + "]"));
+			bindings.push_back(binding);
+		}
+		for (unsigned int role = 0; role < ROLE_COUNT; role++)
+			counts[role] = static_cast<int>(roleCounts[role]);
+	}
+
+	// bind the textures and, unless this material is already current on the program, its sampler uniforms
+	void bind(const Shader& shader) const
+	{
+		for (size_t unit = 0; unit < bindings.size(); unit++)
+			glBindTextureUnit(static_cast<GLuint>(unit), bindings[unit].textureID);
+		bindSamplers(shader);
+	}
+
+	// the same through a state cache, which drops texture binds that are already current
+	void bind(const Shader& shader, StateCache& state) const
+	{
+		for (size_t unit = 0; unit < bindings.size(); unit++)
+			state.bindTexture(static_cast<GLuint>(unit), bindings[unit].textureID);
+		bindSamplers(shader);
+	}
+
+	// unique for the material's lifetime, RenderQueue sorts draws by it
+	uint64_t key() const
+	{
+		return id;
+	}
+
+	unsigned int textureCount() const
+	{
+		return static_cast<unsigned int>(bindings.size());
+	}
+
+	int count(TextureRole role) const
+	{
+		return counts[static_cast<unsigned int>(role)];
+	}
+
+private:
+	static constexpr unsigned int ROLE_COUNT = static_cast<unsigned int>(TextureRole::Count);
+
+	struct Binding {
+		unsigned int textureID = 0;
+		UniformName sampler = UniformName(0);
+		UniformLocation location;
+	};
+
+	void bindSamplers(const Shader& shader) const
+	{
+		if (shader.currentMaterial == id)
+			return;
+		shader.currentMaterial = id;
+
+		if (resolvedProgram != shader.ID)
+			resolve(shader);
+
+		for (size_t unit = 0; unit < bindings.size(); unit++)
+			glUniform1i(bindings[unit].location.value, static_cast<GLint>(unit));
+		for (unsigned int role = 0; role < ROLE_COUNT; role++)
+			glUniform1i(countLocations[role].value, counts[role]);
+	}
+
+	// uniform locations are per program, look them up again when drawn with a different shader
+	void resolve(const Shader& shader) const
+	{
+		constexpr UniformName countNames[ROLE_COUNT] = {
+			"material.texture_diffuse_num"_uniform, "material.texture_specular_num"_uniform, "material.texture_normal_num"_uniform,
+			"material.texture_reflection_num"_uniform, "material.texture_height_num"_uniform
+		};
+
+		for (Binding& binding : bindings)
+			binding.location = shader.location(binding.sampler);
+		for (unsigned int role = 0; role < ROLE_COUNT; role++)
+			countLocations[role] = shader.location(countNames[role]);
+		resolvedProgram = shader.ID;
+	}
+
+	// never reused, unlike the address, so a stale Shader::currentMaterial can't match a new material
+	static uint64_t nextID()
+	{
+		static std::atomic<uint64_t> counter{ 0 };
+		return ++counter;
+	}
+
+	uint64_t id;
+	mutable std::vector<Binding> bindings;
+	int counts[ROLE_COUNT] = {};
+	mutable UniformLocation countLocations[ROLE_COUNT];
+	mutable unsigned int resolvedProgram = 0;
+};
+#endif // !MATERIAL_H
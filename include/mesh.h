@@ -7,10 +7,19 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <shader.h>
+#include <material.h>
+#include <bounds.h>
+#include <lod.h>
+#include <vertex_compression.h>
+#include <uniform_ring.h>
 
+#include <cmath>
 #include <string>
+#include <cstdint>
 #include <vector>
 #include <limits>
+#include <memory>
+#include <iostream>
 
 using std::string, std::vector;
 
@@ -33,131 +42,165 @@ struct Vertex {
 	float m_Weights[MAX_BONE_INFLUENCE];
 };
 
-struct Texture {
-	unsigned int id;
-	string type;
-	string path;
-};
-
 class Mesh {
 public:
 	// mesh Data
 	vector<Vertex>       vertices;
 	vector<unsigned int> indices;
 	vector<Texture>      textures;
+	// texture units, counts and sampler locations resolved from textures, shared by meshes with the same aiMaterial
+	std::shared_ptr<const Material> material;
 
 	unsigned int VAO;
-
-	// constructor
-	Mesh(const vector<Vertex>& vertices, const vector<unsigned int>& indices, const vector<Texture>& textures)
-		:vertices(vertices), indices(indices), textures(textures)
+	// GL_UNSIGNED_SHORT when every vertex is reachable with 16 bits, GL_UNSIGNED_INT otherwise
+	GLenum indexType = GL_UNSIGNED_INT;
+
+	// uploaded vertex layout
+	VertexFormat format;
+	// compact layout only: position dequantization and uv encoding
+	PositionQuantization quantization;
+	bool texCoordsNormalized = false;
+	// true if any vertex carries a bone weight
+	bool hasBones = false;
+	// object space box and sphere of the vertices
+	Bounds bounds;
+	// texture coordinate units per object space unit, sqrt of uv area over surface area. Texture streaming turns it
+	// into texels per pixel
+	float uvDensity = 0.0f;
+	// simplified index buffers over the same vertices, lods[0] is LOD 1. Stored after indices in the element buffer
+	vector<MeshLOD> lods;
+
+	// constructor, cachedBounds are the bounds the mesh cache stored for these vertices and skip computing them
+	Mesh(const vector<Vertex>& vertices, const vector<unsigned int>& indices, const vector<Texture>& textures, VertexFormat format = VertexFormat::Full,
+		std::shared_ptr<const Material> material = nullptr, vector<MeshLOD> lods = {}, const Bounds* cachedBounds = nullptr)
+		:vertices(vertices), indices(indices), textures(textures), material(std::move(material)), format(format), lods(std::move(lods))
 	{
+		if (!this->material)
+			this->material = std::make_shared<const Material>(textures);
+
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		setupMesh(cachedBounds);
 	}
 
-	// render the mesh
-	void Draw(Shader& shader) const
+	// render the mesh, lod 0 is the full index buffer and lod i the simplified lods[i - 1]. The caller binds the
+	// Object block, see objectConstants
+	void Draw(Shader& shader, unsigned int lod = 0) const
 	{
-		// bind appropriate textures
-		unsigned int diffuseNr = 0;
-		unsigned int specularNr = 0;
-		// unsigned int normalNr = 0;
-		unsigned int heightNr = 0;
-		unsigned int reflectionNr = 0;
-
-		unsigned int i;
-		for (i = 0; i < textures.size(); i++)
-		{
-			// active proper texture unit before binding
-			// binding multiple textures for a single drawing call
-			glActiveTexture(GL_TEXTURE0 + i);
-			// retrieve texture number (the N in diffuse_textureN)
-			string number;
-			string type = textures[i].type;
-
-			if (type == "texture_diffuse")
-				number = std::to_string(diffuseNr++);
-			else if (type == "texture_specular")
-				number = std::to_string(specularNr++); // transfer unsigned int to string
-			// else if (type == "texture_normal")
-			//	number = std::to_string(normalNr++); // transfer unsigned int to string
-			else if (type == "texture_height")
-				number = std::to_string(heightNr++); // transfer unsigned int to string
-			else if (type == "texture_reflection")	// We'll now also need to add the code to set and bind to reflection textures
-				number = std::to_string(reflectionNr++);
-
-			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, ("material." + type + "[" + number + "]").c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
-		}
-		glUniform1i(glGetUniformLocation(shader.ID, "material.texture_diffuse_num"), diffuseNr);
-		glUniform1i(glGetUniformLocation(shader.ID, "material.texture_specular_num"), specularNr);
-		glUniform1i(glGetUniformLocation(shader.ID, "material.texture_reflection_num"), reflectionNr);
-		glUniform1i(glGetUniformLocation(shader.ID, "material.texture_height_num"), heightNr);
+		material->bind(shader);
 
 		// draw mesh
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
+		glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indexCount(lod)), indexType, (void*)(firstIndex(lod) * indexSize()));
 		glBindVertexArray(0);
+	}
+
+	// the same through a state cache, the VAO stays bound for the next draw that uses it
+	void Draw(Shader& shader, StateCache& state, unsigned int lod = 0) const
+	{
+		material->bind(shader, state);
+		state.bindVertexArray(VAO);
+		glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indexCount(lod)), indexType, (void*)(firstIndex(lod) * indexSize()));
+		state.stats.draws++;
+	}
+
+	// the Object block of a draw with this mesh, the matrices come from a TransformStage and the compact vertex shader
+	// also needs the bounds to dequantize positions. Skinned meshes are posed by the palette matrices starting at paletteOffset
+	ObjectConstants objectConstants(const glm::mat4& model, const glm::mat3x4& normalMatrix, const glm::mat4& modelViewProjection, unsigned int paletteOffset = NO_BONE_PALETTE) const
+	{
+		ObjectConstants constants;
+		constants.model = model;
+		constants.modelViewProjection = modelViewProjection;
+		constants.normalMatrix = normalMatrix;
+		constants.positionOffset = glm::vec4(quantization.offset, 0.0f);
+		constants.positionScale = quantization.scale;
+		constants.paletteOffset = hasBones ? paletteOffset : NO_BONE_PALETTE;
+		return constants;
+	}
+
+	size_t indexCount(unsigned int lod = 0) const
+	{
+		return lod == 0 ? indices.size() : lods[lod - 1].indices.size();
+	}
+
+	unsigned int firstIndex(unsigned int lod = 0) const
+	{
+		return lod == 0 ? 0 : lods[lod - 1].firstIndex;
+	}
 
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
+	size_t indexSize() const
+	{
+		return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
 	}
 
 	void renderInstanced(Shader& shader, const unsigned int count) const
 	{
-		// bind appropriate textures
-		unsigned int diffuseNr = 0;
-		unsigned int specularNr = 0;
-		unsigned int heightNr = 0;
-		unsigned int reflectionNr = 0;
-
-		unsigned int i;
-		for (i = 0; i < textures.size(); i++)
-		{
-			// active proper texture unit before binding
-			// binding multiple textures for a single drawing call
-			glActiveTexture(GL_TEXTURE0 + i);
-			// retrieve texture number (the N in diffuse_textureN)
-			string number;
-			string type = textures[i].type;
-
-			if (type == "texture_diffuse")
-				number = std::to_string(diffuseNr++);
-			else if (type == "texture_specular")
-				number = std::to_string(specularNr++); // transfer unsigned int to string
-			else if (type == "texture_height")
-				number = std::to_string(heightNr++); // transfer unsigned int to string
-			else if (type == "texture_reflection")	// We'll now also need to add the code to set and bind to reflection textures
-				number = std::to_string(reflectionNr++);
-
-			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, ("material." + type + "[" + number + "]").c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
-		}
-		glUniform1i(glGetUniformLocation(shader.ID, "material.texture_diffuse_num"), diffuseNr);
-		glUniform1i(glGetUniformLocation(shader.ID, "material.texture_specular_num"), specularNr);
-		glUniform1i(glGetUniformLocation(shader.ID, "material.texture_reflection_num"), reflectionNr);
-		glUniform1i(glGetUniformLocation(shader.ID, "material.texture_height_num"), heightNr);
+		material->bind(shader);
 
 		// draw mesh
 		glBindVertexArray(VAO);
-		glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0, count);
+		glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), indexType, 0, count);
 		glBindVertexArray(0);
-
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
 	}
 private:
 	// render data 
 	unsigned int VBO, EBO;
+	unsigned int boneVBO = 0;
+
+	static float uvDensityOf(const vector<Vertex>& vertices, const vector<unsigned int>& indices)
+	{
+		double surfaceArea = 0.0, uvArea = 0.0;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			const Vertex& a = vertices[indices[i]];
+			const Vertex& b = vertices[indices[i + 1]];
+			const Vertex& c = vertices[indices[i + 2]];
+			surfaceArea += glm::length(glm::cross(b.Position - a.Position, c.Position - a.Position));
+			const glm::vec2 u = b.TexCoords - a.TexCoords, v = c.TexCoords - a.TexCoords;
+			uvArea += std::abs(u.x * v.y - u.y * v.x);
+		}
+		return surfaceArea > 0.0 ? static_cast<float>(std::sqrt(uvArea / surfaceArea)) : 0.0f;
+	}
+
+	// the full index buffer followed by every LOD, one element buffer bound to the VAO. Narrowed to 16 bits
+	// when the vertex count allows, half the index bandwidth and memory
+	void uploadIndices()
+	{
+		vector<unsigned int> all(indices);
+		for (MeshLOD& lod : lods)
+		{
+			lod.firstIndex = static_cast<unsigned int>(all.size());
+			all.insert(all.end(), lod.indices.begin(), lod.indices.end());
+		}
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		if (vertices.size() <= 65536)
+		{
+			vector<uint16_t> narrow(all.begin(), all.end());
+			indexType = GL_UNSIGNED_SHORT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, narrow.size() * sizeof(uint16_t), narrow.data(), GL_STATIC_DRAW);
+		}
+		else
+		{
+			indexType = GL_UNSIGNED_INT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, all.size() * sizeof(unsigned int), all.data(), GL_STATIC_DRAW);
+		}
+	}
 
 	// initializes all the buffer objects/arrays
-	void setupMesh()
+	void setupMesh(const Bounds* cachedBounds)
 	{
+		bounds = cachedBounds ? *cachedBounds : boundsOf(vertices.empty() ? nullptr : &vertices[0].Position, vertices.size(), sizeof(Vertex));
+		uvDensity = uvDensityOf(vertices, indices);
+		for (const Vertex& vertex : vertices)
+			for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+				hasBones |= vertex.m_Weights[k] > 0.0f;
+
+		if (format == VertexFormat::Compact)
+		{
+			setupCompactMesh();
+			return;
+		}
+
 		// create buffers/arrays
 		glGenVertexArrays(1, &VAO);
 		glGenBuffers(1, &VBO);
@@ -175,8 +218,7 @@ private:
 		// again translates to 3/2 floats which translates to a byte array.
 		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		uploadIndices();
 
 		// set the vertex attribute pointers
 		// vertex Positions
@@ -210,5 +252,152 @@ private:
 		// unbind VAO
 		glEnableVertexAttribArray(0);
 	}
+
+public:
+	// the CompactVertex of every vertex, positions inside quantization and uvs as unorm16 if texCoordsNormalized
+	static vector<CompactVertex> encodeCompact(const vector<Vertex>& vertices, const PositionQuantization& quantization, bool texCoordsNormalized)
+	{
+		vector<CompactVertex> compact(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const Vertex& vertex = vertices[i];
+			CompactVertex& packed = compact[i];
+
+			glm::vec3 unorm = (vertex.Position - quantization.offset) / quantization.scale;
+			float bitangentSign = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+			packed.Position[0] = quantizeUnorm16(unorm.x);
+			packed.Position[1] = quantizeUnorm16(unorm.y);
+			packed.Position[2] = quantizeUnorm16(unorm.z);
+			packed.Position[3] = bitangentSign > 0.0f ? 65535 : 0;
+
+			encodeDirection(vertex.Normal, packed.Normal);
+			encodeDirection(vertex.Tangent, packed.Tangent);
+
+			for (int k = 0; k < 2; k++)
+				packed.TexCoords[k] = texCoordsNormalized ? quantizeUnorm16(vertex.TexCoords[k]) : glm::packHalf1x16(vertex.TexCoords[k]);
+		}
+		return compact;
+	}
+
+	// the bone stream of a skinned mesh in the compact layout, see quantizeBoneWeights
+	static vector<BoneVertex> encodeBones(const vector<Vertex>& vertices)
+	{
+		vector<BoneVertex> bones(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+				bones[i].BoneIDs[k] = static_cast<uint16_t>(std::max(vertices[i].m_BoneIDs[k], 0));
+			quantizeBoneWeights(vertices[i].m_Weights, bones[i].Weights);
+		}
+		return bones;
+	}
+
+	// decodes the compact vertices on the CPU exactly like the shader and measures the error against the originals
+	static CompactDecodeError compactDecodeError(const vector<Vertex>& vertices, const vector<CompactVertex>& compact, const PositionQuantization& quantization, bool texCoordsNormalized)
+	{
+		// half a quantization step for positions plus the float rounding of offset + unorm * scale, 1e-4 radians for
+		// octahedral snorm16, half float precision for uvs
+		const glm::vec3 stepTolerance = quantization.scale * (0.5f / 65535.0f) * 1.001f + glm::vec3(1e-6f);
+		const float directionTolerance = 1e-4f;
+
+		CompactDecodeError result;
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const Vertex& vertex = vertices[i];
+			const CompactVertex& packed = compact[i];
+
+			glm::vec3 position = quantization.offset + glm::vec3(dequantizeUnorm16(packed.Position[0]), dequantizeUnorm16(packed.Position[1]), dequantizeUnorm16(packed.Position[2])) * quantization.scale;
+			glm::vec3 positionError = glm::abs(position - vertex.Position);
+			result.position = std::max(result.position, std::max(positionError.x, std::max(positionError.y, positionError.z)));
+			const glm::vec3 roundingTolerance = (glm::abs(quantization.offset) + quantization.scale) * (4.0f * std::numeric_limits<float>::epsilon());
+			result.withinTolerance &= !glm::any(glm::greaterThan(positionError, stepTolerance + roundingTolerance));
+
+			for (const auto& [direction, encoded] : { std::pair{ vertex.Normal, packed.Normal }, std::pair{ vertex.Tangent, packed.Tangent } })
+			{
+				if (glm::length(direction) == 0.0f)
+					continue;
+				// chord length, equal to the angle in radians at this scale
+				float error = glm::length(decodeDirection(encoded) - glm::normalize(direction));
+				result.direction = std::max(result.direction, error);
+				result.withinTolerance &= error <= directionTolerance;
+			}
+
+			// the sign in position.w has to rebuild the bitangent's side
+			const glm::vec3 bitangent = glm::cross(vertex.Normal, vertex.Tangent) * (packed.Position[3] ? 1.0f : -1.0f);
+			result.withinTolerance &= glm::dot(bitangent, vertex.Bitangent) >= 0.0f;
+
+			for (int k = 0; k < 2; k++)
+			{
+				float value = vertex.TexCoords[k];
+				float decoded = texCoordsNormalized ? dequantizeUnorm16(packed.TexCoords[k]) : glm::unpackHalf1x16(packed.TexCoords[k]);
+				float tolerance = texCoordsNormalized ? 0.5f / 65535.0f + 1e-6f : std::abs(value) * (1.0f / 2048.0f) + 1e-7f;
+				result.texCoord = std::max(result.texCoord, std::abs(decoded - value));
+				result.withinTolerance &= std::abs(decoded - value) <= tolerance;
+			}
+		}
+		return result;
+	}
+
+private:
+	// same attribute locations as setupMesh, but quantized: 20 bytes per vertex plus 12 bytes of bone stream for skinned meshes
+	void setupCompactMesh()
+	{
+		texCoordsNormalized = true;
+		for (const Vertex& vertex : vertices)
+			texCoordsNormalized &= vertex.TexCoords.x >= 0.0f && vertex.TexCoords.x <= 1.0f && vertex.TexCoords.y >= 0.0f && vertex.TexCoords.y <= 1.0f;
+		quantization = quantizationFor(bounds.box.min, bounds.box.max);
+		const vector<CompactVertex> compact = encodeCompact(vertices, quantization, texCoordsNormalized);
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+
+		glBindVertexArray(VAO);
+
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, compact.size() * sizeof(CompactVertex), compact.data(), GL_STATIC_DRAW);
+
+		uploadIndices();
+
+		// quantized position + bitangent sign
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Position));
+
+		// octahedral normal
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Normal));
+
+		// texture coords, either unorm16 or half float, the shader sees a vec2 in both cases
+		glEnableVertexAttribArray(2);
+		if (texCoordsNormalized)
+			glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, TexCoords));
+		else
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, TexCoords));
+
+		// octahedral tangent
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Tangent));
+
+		// bone stream, only for skinned meshes
+		if (hasBones)
+		{
+			const vector<BoneVertex> bones = encodeBones(vertices);
+
+			glGenBuffers(1, &boneVBO);
+			glBindBuffer(GL_ARRAY_BUFFER, boneVBO);
+			glBufferData(GL_ARRAY_BUFFER, bones.size() * sizeof(BoneVertex), bones.data(), GL_STATIC_DRAW);
+
+			// ids
+			glEnableVertexAttribArray(5);
+			glVertexAttribIPointer(5, 4, GL_UNSIGNED_SHORT, sizeof(BoneVertex), (void*)offsetof(BoneVertex, BoneIDs));
+
+			// weights
+			glEnableVertexAttribArray(6);
+			glVertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(BoneVertex), (void*)offsetof(BoneVertex, Weights));
+		}
+
+		glBindVertexArray(0);
+	}
+
 };
 #endif // !MESH_H
@@ -0,0 +1,699 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <mesh.h>
+#include <animation.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The mesh cache stores the post-processed output of Model::loadModel so that warm starts skip Assimp entirely.
+// File layout (offsets are absolute, every section starts on a 16 byte boundary):
+//   MeshCacheHeader
+//   MeshCacheRecord[meshCount]
+//   MeshCacheTextureRef[textureRefCount]
+//   MeshCacheLOD[lodCount]
+//   char strings[]          texture types and paths, not null terminated
+//   char animation[]        skeleton and clips of skinned models, see writeAnimation
+//   Vertex vertices[]       every mesh's vertices, back to back
+//   unsigned int indices[]  every mesh's indices followed by its LOD indices, back to back
+// The blobs are laid out exactly as they are uploaded, so loading is a straight copy out of the mapped file.
+
+constexpr uint32_t MESH_CACHE_MAGIC = 0x4D474F54; // "TOGM"
+constexpr uint32_t MESH_CACHE_VERSION = 8;
+
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexSize;		// sizeof(Vertex) when the cache was written
+	uint32_t importFlags;		// assimp post process flags the meshes were generated with
+	uint64_t sourceHash;		// hashModelSources of the source model file
+	uint64_t sourceSize;
+	uint32_t meshCount;
+	uint32_t textureRefCount;
+	uint32_t lodCount;
+	uint32_t padding;
+	float boundaryMin[3];		// model position boundary
+	float boundaryMax[3];
+	uint64_t recordsOffset;
+	uint64_t textureRefsOffset;
+	uint64_t lodsOffset;
+	uint64_t stringsOffset;
+	uint64_t animationOffset;
+	uint64_t animationSize;		// 0 for models without a skeleton
+	uint64_t verticesOffset;
+	uint64_t indicesOffset;
+	uint64_t fileSize;
+};
+
+struct MeshCacheRecord {
+	uint64_t firstVertex;		// in vertices, relative to verticesOffset
+	uint64_t firstIndex;		// in indices, relative to indicesOffset
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t firstTextureRef;
+	uint32_t textureRefCount;
+	float aabbMin[3];			// Mesh::bounds, the sphere is centered on the box
+	float aabbMax[3];
+	uint32_t materialIndex;		// aiMesh::mMaterialIndex, meshes with the same index share a Material
+	uint32_t firstLOD;
+	uint32_t lodCount;
+	float sphereRadius;
+};
+
+// one simplified index buffer, its indices follow the previous LOD's (or the mesh's own) in the index blob
+struct MeshCacheLOD {
+	uint32_t indexCount;
+	float error;
+};
+
+struct MeshCacheTextureRef {
+	uint32_t typeOffset;		// relative to stringsOffset
+	uint32_t typeLength;
+	uint32_t pathOffset;
+	uint32_t pathLength;
+};
+
+// read-only memory mapping of a whole file
+class MappedFile {
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::string& path) { open(path); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { close(); }
+
+	bool open(const std::string& path)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+		length = static_cast<size_t>(fileSize.QuadPart);
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr)
+		{
+			close();
+			return false;
+		}
+		bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+		fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			close();
+			return false;
+		}
+		length = static_cast<size_t>(st.st_size);
+		void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		bytes = view == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(view);
+#endif
+		if (bytes == nullptr)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (bytes)
+			UnmapViewOfFile(bytes);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (bytes)
+			munmap(const_cast<unsigned char*>(bytes), length);
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+#endif
+		bytes = nullptr;
+		length = 0;
+	}
+
+	const unsigned char* data() const { return bytes; }
+	size_t size() const { return length; }
+	bool isOpen() const { return bytes != nullptr; }
+
+private:
+	const unsigned char* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+inline uint64_t fnv1a64(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= p[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// hash of the file content, 0 if the file can't be read
+inline uint64_t hashFile(const std::string& path, uint64_t* size = nullptr)
+{
+	MappedFile file(path);
+	if (size)
+		*size = file.size();
+	if (!file.isOpen())
+		return 0;
+	return fnv1a64(file.data(), file.size());
+}
+
+// hash of the model file and the material files it pulls in, 0 if the model can't be read. Wavefront .obj files
+// name their .mtl libraries with mtllib lines, those are folded in so editing a material invalidates the cache.
+// Other formats are keyed by the model file alone, their materials live inside it for the models we load
+inline uint64_t hashModelSources(const std::string& path, uint64_t* size = nullptr)
+{
+	MappedFile file(path);
+	if (size)
+		*size = file.size();
+	if (!file.isOpen())
+		return 0;
+	uint64_t hash = fnv1a64(file.data(), file.size());
+
+	const size_t dot = path.find_last_of('.');
+	string extension = dot == string::npos ? string() : path.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	if (extension != "obj")
+		return hash;
+
+	const size_t slash = path.find_last_of("/\\");
+	const string directory = slash == string::npos ? string() : path.substr(0, slash + 1);
+	const char* text = reinterpret_cast<const char*>(file.data());
+	const char* end = text + file.size();
+	for (const char* line = text; line < end;)
+	{
+		const char* lineEnd = std::find(line, end, '\n');
+		if (lineEnd - line > 7 && std::strncmp(line, "mtllib", 6) == 0 && (line[6] == ' ' || line[6] == '\t'))
+		{
+			string library(line + 7, lineEnd);
+			while (!library.empty() && std::isspace(static_cast<unsigned char>(library.back())))
+				library.pop_back();
+			while (!library.empty() && std::isspace(static_cast<unsigned char>(library.front())))
+				library.erase(library.begin());
+			// a missing library still changes the key, so adding it later rebuilds the cache
+			const uint64_t libraryHash = hashFile(directory + library);
+			hash = fnv1a64(library.data(), library.size(), hash);
+			hash = fnv1a64(&libraryHash, sizeof(libraryHash), hash);
+		}
+		line = lineEnd + 1;
+	}
+	return hash;
+}
+
+// a mesh as it is stored in the cache, returned by MeshCache::read
+struct CachedMesh {
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	vector<Texture> textures;		// only type and path are filled, ids are resolved by the model
+	unsigned int materialIndex = 0;
+	vector<MeshLOD> lods;
+	Bounds bounds;
+};
+
+class MeshCache {
+public:
+	static string pathFor(const string& modelPath)
+	{
+		return modelPath + ".meshcache";
+	}
+
+	// returns false (and leaves out untouched) if the cache doesn't exist, doesn't match the source or is corrupt
+	static bool read(const string& cachePath, uint64_t sourceHash, uint64_t sourceSize, unsigned int importFlags,
+		vector<CachedMesh>& out, float boundaryMin[3], float boundaryMax[3], Skeleton& skeleton, vector<AnimationClip>& animations)
+	{
+		MappedFile file(cachePath);
+		if (!file.isOpen() || file.size() < sizeof(MeshCacheHeader))
+			return false;
+
+		const unsigned char* base = file.data();
+		MeshCacheHeader header;
+		std::memcpy(&header, base, sizeof(header));
+
+		if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION
+			|| header.vertexSize != sizeof(Vertex) || header.importFlags != importFlags
+			|| header.sourceHash != sourceHash || header.sourceSize != sourceSize
+			|| header.fileSize != file.size())
+			return false;
+
+		// a cache with a valid header can still be truncated or damaged, every section and record has to lie inside the file
+		if (!sectionFits(header.recordsOffset, header.meshCount, sizeof(MeshCacheRecord), header.textureRefsOffset)
+			|| !sectionFits(header.textureRefsOffset, header.textureRefCount, sizeof(MeshCacheTextureRef), header.lodsOffset)
+			|| !sectionFits(header.lodsOffset, header.lodCount, sizeof(MeshCacheLOD), header.stringsOffset)
+			|| header.stringsOffset > header.animationOffset || !sectionFits(header.animationOffset, header.animationSize, 1, header.verticesOffset)
+			|| header.verticesOffset > header.indicesOffset || header.indicesOffset > header.fileSize
+			|| header.verticesOffset % alignof(Vertex) != 0 || header.indicesOffset % alignof(unsigned int) != 0)
+		{
+			std::cerr << "ERROR::MESH_CACHE::CORRUPT_FILE: " << cachePath << "\n";
+			return false;
+		}
+		const uint64_t stringsSize = header.animationOffset - header.stringsOffset;
+		const uint64_t totalVertices = (header.indicesOffset - header.verticesOffset) / sizeof(Vertex);
+		const uint64_t totalIndices = (header.fileSize - header.indicesOffset) / sizeof(unsigned int);
+
+		const MeshCacheRecord* records = reinterpret_cast<const MeshCacheRecord*>(base + header.recordsOffset);
+		const MeshCacheTextureRef* refs = reinterpret_cast<const MeshCacheTextureRef*>(base + header.textureRefsOffset);
+		const MeshCacheLOD* lods = reinterpret_cast<const MeshCacheLOD*>(base + header.lodsOffset);
+		const char* strings = reinterpret_cast<const char*>(base + header.stringsOffset);
+		const Vertex* vertices = reinterpret_cast<const Vertex*>(base + header.verticesOffset);
+		const unsigned int* indices = reinterpret_cast<const unsigned int*>(base + header.indicesOffset);
+
+		vector<CachedMesh> meshes(header.meshCount);
+		for (uint32_t i = 0; i < header.meshCount; i++)
+		{
+			const MeshCacheRecord& record = records[i];
+			if (!recordFits(header, record, refs, lods, stringsSize, totalVertices, totalIndices))
+			{
+				std::cerr << "ERROR::MESH_CACHE::CORRUPT_FILE: " << cachePath << "\n";
+				return false;
+			}
+			CachedMesh& mesh = meshes[i];
+			mesh.vertices.assign(vertices + record.firstVertex, vertices + record.firstVertex + record.vertexCount);
+			mesh.indices.assign(indices + record.firstIndex, indices + record.firstIndex + record.indexCount);
+			mesh.materialIndex = record.materialIndex;
+			mesh.bounds.box.min = glm::vec3(record.aabbMin[0], record.aabbMin[1], record.aabbMin[2]);
+			mesh.bounds.box.max = glm::vec3(record.aabbMax[0], record.aabbMax[1], record.aabbMax[2]);
+			if (!mesh.bounds.box.empty())
+				mesh.bounds.sphere.center = mesh.bounds.box.center();
+			mesh.bounds.sphere.radius = record.sphereRadius;
+			mesh.lods.resize(record.lodCount);
+			uint64_t firstIndex = record.firstIndex + record.indexCount;
+			for (uint32_t l = 0; l < record.lodCount; l++)
+			{
+				const MeshCacheLOD& lod = lods[record.firstLOD + l];
+				mesh.lods[l].indices.assign(indices + firstIndex, indices + firstIndex + lod.indexCount);
+				mesh.lods[l].error = lod.error;
+				firstIndex += lod.indexCount;
+			}
+			mesh.textures.resize(record.textureRefCount);
+			for (uint32_t t = 0; t < record.textureRefCount; t++)
+			{
+				const MeshCacheTextureRef& ref = refs[record.firstTextureRef + t];
+				mesh.textures[t].id = 0;
+				mesh.textures[t].type.assign(strings + ref.typeOffset, ref.typeLength);
+				mesh.textures[t].path.assign(strings + ref.pathOffset, ref.pathLength);
+			}
+
+			// an index past the mesh's vertices would have the GPU read outside the vertex buffer
+			bool indicesValid = true;
+			for (unsigned int index : mesh.indices)
+				indicesValid &= index < record.vertexCount;
+			for (const MeshLOD& lod : mesh.lods)
+				for (unsigned int index : lod.indices)
+					indicesValid &= index < record.vertexCount;
+			if (!indicesValid)
+			{
+				std::cerr << "ERROR::MESH_CACHE::CORRUPT_FILE: " << cachePath << "\n";
+				return false;
+			}
+		}
+
+		Skeleton cachedSkeleton;
+		vector<AnimationClip> cachedAnimations;
+		if (header.animationSize > 0)
+		{
+			BlobReader blob{ base + header.animationOffset, base + header.animationOffset + header.animationSize };
+			if (!readAnimation(blob, cachedSkeleton, cachedAnimations))
+			{
+				std::cerr << "ERROR::MESH_CACHE::CORRUPT_FILE: " << cachePath << "\n";
+				return false;
+			}
+		}
+		out = std::move(meshes);
+		skeleton = std::move(cachedSkeleton);
+		animations = std::move(cachedAnimations);
+
+		for (int k = 0; k < 3; k++)
+		{
+			boundaryMin[k] = header.boundaryMin[k];
+			boundaryMax[k] = header.boundaryMax[k];
+		}
+		return true;
+	}
+
+	static bool write(const string& cachePath, uint64_t sourceHash, uint64_t sourceSize, unsigned int importFlags,
+		const vector<Mesh>& meshes, const vector<unsigned int>& materialIndices, const float boundaryMin[3], const float boundaryMax[3],
+		const Skeleton& skeleton, const vector<AnimationClip>& animations)
+	{
+		vector<MeshCacheRecord> records(meshes.size());
+		vector<MeshCacheTextureRef> refs;
+		vector<MeshCacheLOD> lods;
+		string strings;
+		uint64_t vertexCount = 0, indexCount = 0;
+
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			const Mesh& mesh = meshes[i];
+			MeshCacheRecord& record = records[i];
+			record.materialIndex = i < materialIndices.size() ? materialIndices[i] : 0;
+			record.firstLOD = static_cast<uint32_t>(lods.size());
+			record.lodCount = static_cast<uint32_t>(mesh.lods.size());
+			record.firstVertex = vertexCount;
+			record.firstIndex = indexCount;
+			record.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+			record.indexCount = static_cast<uint32_t>(mesh.indices.size());
+			record.firstTextureRef = static_cast<uint32_t>(refs.size());
+			record.textureRefCount = static_cast<uint32_t>(mesh.textures.size());
+			vertexCount += mesh.vertices.size();
+			indexCount += mesh.indices.size();
+			for (const MeshLOD& lod : mesh.lods)
+			{
+				lods.push_back({ static_cast<uint32_t>(lod.indices.size()), lod.error });
+				indexCount += lod.indices.size();
+			}
+
+			for (int k = 0; k < 3; k++)
+			{
+				record.aabbMin[k] = mesh.bounds.box.min[k];
+				record.aabbMax[k] = mesh.bounds.box.max[k];
+			}
+			record.sphereRadius = mesh.bounds.sphere.radius;
+
+			for (const Texture& texture : mesh.textures)
+			{
+				MeshCacheTextureRef ref;
+				ref.typeOffset = static_cast<uint32_t>(strings.size());
+				ref.typeLength = static_cast<uint32_t>(texture.type.size());
+				strings += texture.type;
+				ref.pathOffset = static_cast<uint32_t>(strings.size());
+				ref.pathLength = static_cast<uint32_t>(texture.path.size());
+				strings += texture.path;
+				refs.push_back(ref);
+			}
+		}
+
+		MeshCacheHeader header{};
+		header.magic = MESH_CACHE_MAGIC;
+		header.version = MESH_CACHE_VERSION;
+		header.vertexSize = sizeof(Vertex);
+		header.importFlags = importFlags;
+		header.sourceHash = sourceHash;
+		header.sourceSize = sourceSize;
+		header.meshCount = static_cast<uint32_t>(meshes.size());
+		header.textureRefCount = static_cast<uint32_t>(refs.size());
+		header.lodCount = static_cast<uint32_t>(lods.size());
+		for (int k = 0; k < 3; k++)
+		{
+			header.boundaryMin[k] = boundaryMin[k];
+			header.boundaryMax[k] = boundaryMax[k];
+		}
+		header.recordsOffset = align(sizeof(MeshCacheHeader));
+		header.textureRefsOffset = align(header.recordsOffset + records.size() * sizeof(MeshCacheRecord));
+		header.lodsOffset = align(header.textureRefsOffset + refs.size() * sizeof(MeshCacheTextureRef));
+		header.stringsOffset = align(header.lodsOffset + lods.size() * sizeof(MeshCacheLOD));
+		string animation;
+		if (!skeleton.empty())
+			writeAnimation(animation, skeleton, animations);
+		header.animationOffset = align(header.stringsOffset + strings.size());
+		header.animationSize = animation.size();
+		header.verticesOffset = align(header.animationOffset + animation.size());
+		header.indicesOffset = align(header.verticesOffset + vertexCount * sizeof(Vertex));
+		header.fileSize = header.indicesOffset + indexCount * sizeof(unsigned int);
+
+		// write to a temporary file first so a crash never leaves a half written cache behind
+		const string tempPath = cachePath + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file)
+			{
+				std::cerr << "ERROR::MESH_CACHE::FAILED_TO_OPEN_FILE: " << tempPath << "\n";
+				return false;
+			}
+
+			writeAt(file, 0, &header, sizeof(header));
+			writeAt(file, header.recordsOffset, records.data(), records.size() * sizeof(MeshCacheRecord));
+			writeAt(file, header.textureRefsOffset, refs.data(), refs.size() * sizeof(MeshCacheTextureRef));
+			writeAt(file, header.lodsOffset, lods.data(), lods.size() * sizeof(MeshCacheLOD));
+			writeAt(file, header.stringsOffset, strings.data(), strings.size());
+			writeAt(file, header.animationOffset, animation.data(), animation.size());
+			file.seekp(static_cast<std::streamoff>(header.verticesOffset));
+			for (const Mesh& mesh : meshes)
+				file.write(reinterpret_cast<const char*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(Vertex));
+			file.seekp(static_cast<std::streamoff>(header.indicesOffset));
+			for (const Mesh& mesh : meshes)
+			{
+				file.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(unsigned int));
+				for (const MeshLOD& lod : mesh.lods)
+					file.write(reinterpret_cast<const char*>(lod.indices.data()), lod.indices.size() * sizeof(unsigned int));
+			}
+
+			if (!file)
+			{
+				std::cerr << "ERROR::MESH_CACHE::FAILED_TO_WRITE_FILE: " << tempPath << "\n";
+				return false;
+			}
+		}
+
+		std::remove(cachePath.c_str());
+		if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0)
+		{
+			std::cerr << "ERROR::MESH_CACHE::FAILED_TO_RENAME_FILE: " << tempPath << "\n";
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+private:
+	// Skeleton and clips as a stream of little structs, every count before the data it counts:
+	//   uint32 joints, uint32 boneCount, mat4 globalInverse
+	//   per joint: string name, int32 parent, int32 paletteIndex, mat4 bindLocal, mat4 offset
+	//   uint32 clips, per clip: string name, float duration, float ticksPerSecond, uint32 tracks
+	//   per track: int32 joint, then translation, rotation and scale channels as uint32 keys, float times[keys], values[keys]
+	// strings are a uint32 length and the characters, quaternions are stored w, x, y, z
+	static void writeAnimation(string& blob, const Skeleton& skeleton, const vector<AnimationClip>& animations)
+	{
+		auto put = [&blob](const auto& value) {
+			blob.append(reinterpret_cast<const char*>(&value), sizeof(value));
+		};
+		auto putString = [&](const string& text) {
+			put(static_cast<uint32_t>(text.size()));
+			blob += text;
+		};
+		auto putArray = [&blob](const auto& values) {
+			blob.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(values[0]));
+		};
+
+		put(static_cast<uint32_t>(skeleton.size()));
+		put(static_cast<uint32_t>(skeleton.boneCount));
+		put(skeleton.globalInverse);
+		for (size_t i = 0; i < skeleton.size(); i++)
+		{
+			putString(skeleton.names[i]);
+			put(static_cast<int32_t>(skeleton.parents[i]));
+			put(static_cast<int32_t>(skeleton.paletteIndices[i]));
+			put(skeleton.bindLocal[i]);
+			put(skeleton.offsets[i]);
+		}
+
+		put(static_cast<uint32_t>(animations.size()));
+		for (const AnimationClip& clip : animations)
+		{
+			putString(clip.name);
+			put(clip.duration);
+			put(clip.ticksPerSecond);
+			put(static_cast<uint32_t>(clip.tracks.size()));
+			for (const JointTrack& track : clip.tracks)
+			{
+				put(static_cast<int32_t>(track.joint));
+				put(static_cast<uint32_t>(track.translations.size()));
+				putArray(track.translationTimes);
+				putArray(track.translations);
+				put(static_cast<uint32_t>(track.rotations.size()));
+				putArray(track.rotationTimes);
+				for (const glm::quat& rotation : track.rotations)
+					put(glm::vec4(rotation.w, rotation.x, rotation.y, rotation.z));
+				put(static_cast<uint32_t>(track.scales.size()));
+				putArray(track.scaleTimes);
+				putArray(track.scales);
+			}
+		}
+	}
+
+	// reads out of [at, end) and fails instead of reading past it
+	struct BlobReader {
+		const unsigned char* at;
+		const unsigned char* end;
+
+		template <typename T>
+		bool get(T& value)
+		{
+			if (static_cast<size_t>(end - at) < sizeof(T))
+				return false;
+			std::memcpy(&value, at, sizeof(T));
+			at += sizeof(T);
+			return true;
+		}
+
+		template <typename T>
+		bool getArray(vector<T>& values, uint32_t count)
+		{
+			if (static_cast<size_t>(end - at) / sizeof(T) < count)
+				return false;
+			values.resize(count);
+			std::memcpy(values.data(), at, count * sizeof(T));
+			at += count * sizeof(T);
+			return true;
+		}
+
+		bool getString(string& text)
+		{
+			uint32_t length = 0;
+			if (!get(length) || static_cast<size_t>(end - at) < length)
+				return false;
+			text.assign(reinterpret_cast<const char*>(at), length);
+			at += length;
+			return true;
+		}
+	};
+
+	// the inverse of writeAnimation, false if the blob is short or names joints and bones that don't exist
+	static bool readAnimation(BlobReader& blob, Skeleton& skeleton, vector<AnimationClip>& animations)
+	{
+		uint32_t jointCount = 0, boneCount = 0;
+		if (!blob.get(jointCount) || !blob.get(boneCount) || !blob.get(skeleton.globalInverse))
+			return false;
+		for (uint32_t i = 0; i < jointCount; i++)
+		{
+			string name;
+			int32_t parent = 0, paletteIndex = 0;
+			glm::mat4 bindLocal, offset;
+			if (!blob.getString(name) || !blob.get(parent) || !blob.get(paletteIndex) || !blob.get(bindLocal) || !blob.get(offset)
+				|| parent < -1 || parent >= static_cast<int32_t>(i) || paletteIndex < -1 || paletteIndex >= static_cast<int32_t>(boneCount))
+				return false;
+			const BoneInfo bone{ paletteIndex, offset };
+			skeleton.addJoint(name, parent, bindLocal, paletteIndex >= 0 ? &bone : nullptr);
+		}
+		skeleton.boneCount = boneCount;
+
+		uint32_t clipCount = 0;
+		if (!blob.get(clipCount))
+			return false;
+		for (uint32_t c = 0; c < clipCount; c++)
+		{
+			AnimationClip clip;
+			uint32_t trackCount = 0;
+			if (!blob.getString(clip.name) || !blob.get(clip.duration) || !blob.get(clip.ticksPerSecond) || !blob.get(trackCount))
+				return false;
+			for (uint32_t t = 0; t < trackCount; t++)
+			{
+				JointTrack track;
+				int32_t joint = 0;
+				uint32_t keys = 0;
+				if (!blob.get(joint) || joint < 0 || joint >= static_cast<int32_t>(jointCount))
+					return false;
+				track.joint = joint;
+				if (!blob.get(keys) || !blob.getArray(track.translationTimes, keys) || !blob.getArray(track.translations, keys))
+					return false;
+				vector<glm::vec4> rotations;
+				if (!blob.get(keys) || !blob.getArray(track.rotationTimes, keys) || !blob.getArray(rotations, keys))
+					return false;
+				for (const glm::vec4& rotation : rotations)
+					track.rotations.push_back(glm::quat(rotation.x, rotation.y, rotation.z, rotation.w));
+				if (!blob.get(keys) || !blob.getArray(track.scaleTimes, keys) || !blob.getArray(track.scales, keys))
+					return false;
+				clip.tracks.push_back(std::move(track));
+			}
+			animations.push_back(std::move(clip));
+		}
+		return blob.at == blob.end;
+	}
+
+	// count elements of size bytes from offset end at or before limit, without overflowing
+	static bool sectionFits(uint64_t offset, uint64_t count, uint64_t size, uint64_t limit)
+	{
+		return offset <= limit && offset % 8 == 0 && count <= (limit - offset) / size;
+	}
+
+	static bool rangeFits(uint64_t first, uint64_t count, uint64_t total)
+	{
+		return first <= total && count <= total - first;
+	}
+
+	static bool recordFits(const MeshCacheHeader& header, const MeshCacheRecord& record, const MeshCacheTextureRef* refs, const MeshCacheLOD* lods,
+		uint64_t stringsSize, uint64_t totalVertices, uint64_t totalIndices)
+	{
+		if (!rangeFits(record.firstVertex, record.vertexCount, totalVertices) || !rangeFits(record.firstTextureRef, record.textureRefCount, header.textureRefCount)
+			|| !rangeFits(record.firstLOD, record.lodCount, header.lodCount))
+			return false;
+		uint64_t indexCount = record.indexCount;
+		for (uint32_t l = 0; l < record.lodCount; l++)
+			indexCount += lods[record.firstLOD + l].indexCount;
+		if (!rangeFits(record.firstIndex, indexCount, totalIndices))
+			return false;
+		// the bounds go straight into the Mesh, an empty box only for a mesh without vertices
+		if (!(record.sphereRadius >= 0.0f))
+			return false;
+		for (int k = 0; k < 3; k++)
+			if (record.vertexCount > 0 && !(record.aabbMin[k] <= record.aabbMax[k]))
+				return false;
+		for (uint32_t t = 0; t < record.textureRefCount; t++)
+		{
+			const MeshCacheTextureRef& ref = refs[record.firstTextureRef + t];
+			if (!rangeFits(ref.typeOffset, ref.typeLength, stringsSize) || !rangeFits(ref.pathOffset, ref.pathLength, stringsSize))
+				return false;
+		}
+		return true;
+	}
+
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + 15) & ~uint64_t(15);
+	}
+
+	static void writeAt(std::ofstream& file, uint64_t offset, const void* data, size_t size)
+	{
+		file.seekp(static_cast<std::streamoff>(offset));
+		if (size)
+			file.write(static_cast<const char*>(data), size);
+	}
+};
+#endif // !MESH_CACHE_H
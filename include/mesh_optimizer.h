@@ -0,0 +1,338 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include <mesh.h>
+#include <mesh_cache.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using std::vector;
+
+// entries of the simulated post-transform cache, FIFO like most hardware
+constexpr unsigned int VERTEX_CACHE_SIZE = 16;
+
+// post-transform cache behaviour of an index buffer
+struct VertexCacheStats {
+	size_t transforms = 0;		// cache misses, every one runs the vertex shader
+	size_t triangles = 0;
+	size_t vertices = 0;
+
+	// average cache miss ratio, transforms per triangle: 3 without any reuse, around 0.5-0.7 is optimal
+	float acmr() const
+	{
+		return triangles ? static_cast<float>(transforms) / triangles : 0.0f;
+	}
+
+	// average transform to vertex ratio, 1 means every vertex is shaded exactly once
+	float atvr() const
+	{
+		return vertices ? static_cast<float>(transforms) / vertices : 0.0f;
+	}
+
+	VertexCacheStats& operator+=(const VertexCacheStats& other)
+	{
+		transforms += other.transforms;
+		triangles += other.triangles;
+		vertices += other.vertices;
+		return *this;
+	}
+};
+
+// Import time optimization of a mesh's vertex and index buffers, run by Model::processMesh:
+//   1. weld byte-identical vertices (assimp is run without JoinIdenticalVertices)
+//   2. order triangles for the post-transform cache (Tipsify, Sander et al. 2007)
+//   3. order the clusters found by Tipsify front to back from the outside in, against overdraw
+//   4. renumber vertices in first use order, so vertex fetch walks the buffer linearly
+class MeshOptimizer {
+public:
+	// before and after of optimize(), summed over every mesh of a model
+	struct Stats {
+		VertexCacheStats before;
+		VertexCacheStats after;
+	};
+
+	static void optimize(vector<Vertex>& vertices, vector<unsigned int>& indices, Stats* stats = nullptr)
+	{
+		PROFILE_SCOPE("MeshOptimizer::optimize");
+		if (stats)
+			stats->before += analyzeVertexCache(indices, vertices.size());
+
+		weld(vertices, indices);
+		vector<unsigned int> clusters;
+		indices = optimizeVertexCache(indices, vertices.size(), &clusters);
+		optimizeOverdraw(vertices, indices, clusters);
+		optimizeVertexFetch(vertices, indices);
+
+		if (stats)
+			stats->after += analyzeVertexCache(indices, vertices.size());
+	}
+
+	// identical vertices (byte for byte) map to the first of them
+	static vector<unsigned int> weldRemap(const vector<Vertex>& vertices)
+	{
+		std::unordered_map<uint64_t, vector<unsigned int>> buckets;
+		buckets.reserve(vertices.size());
+		vector<unsigned int> canonical(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			canonical[v] = static_cast<unsigned int>(v);
+			vector<unsigned int>& bucket = buckets[fnv1a64(&vertices[v], sizeof(Vertex))];
+			for (unsigned int other : bucket)
+				if (std::memcmp(&vertices[other], &vertices[v], sizeof(Vertex)) == 0)
+				{
+					canonical[v] = other;
+					break;
+				}
+			if (canonical[v] == v)
+				bucket.push_back(static_cast<unsigned int>(v));
+		}
+		return canonical;
+	}
+
+	// points the indices at the canonical vertices, the duplicates are dropped by optimizeVertexFetch
+	static void weld(const vector<Vertex>& vertices, vector<unsigned int>& indices)
+	{
+		const vector<unsigned int> canonical = weldRemap(vertices);
+		for (unsigned int& index : indices)
+			index = canonical[index];
+	}
+
+	// FIFO cache simulation
+	static VertexCacheStats analyzeVertexCache(const vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+	{
+		VertexCacheStats stats;
+		stats.triangles = indices.size() / 3;
+
+		// a vertex is in the cache while fewer than cacheSize misses happened since it was loaded
+		vector<size_t> loadedAt(vertexCount, 0);
+		vector<bool> used(vertexCount, false);
+		for (unsigned int index : indices)
+		{
+			if (!used[index])
+			{
+				used[index] = true;
+				stats.vertices++;
+			}
+			if (loadedAt[index] == 0 || stats.transforms + 1 - loadedAt[index] > cacheSize)
+				loadedAt[index] = ++stats.transforms;
+		}
+		return stats;
+	}
+
+	// Tipsify: fan around one vertex at a time, pick the next fanning vertex among the ones just emitted that will still
+	// be in the cache, fall back to recently used vertices at dead ends. clusters receives the first triangle of every
+	// run that started at a dead end, where the cache is cold anyway
+	static vector<unsigned int> optimizeVertexCache(const vector<unsigned int>& indices, size_t vertexCount, vector<unsigned int>* clusters = nullptr,
+		unsigned int cacheSize = VERTEX_CACHE_SIZE)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		vector<unsigned int> result;
+		result.reserve(triangleCount * 3);
+		if (clusters)
+			clusters->clear();
+		if (triangleCount == 0)
+			return result;
+
+		// triangles around every vertex
+		vector<unsigned int> liveTriangles(vertexCount, 0), offsets(vertexCount + 1, 0), adjacency(triangleCount * 3);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			liveTriangles[indices[i]]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] = offsets[v] + liveTriangles[v];
+		{
+			vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < triangleCount * 3; i++)
+				adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+		}
+
+		vector<unsigned int> cacheTime(vertexCount, 0);
+		vector<bool> emitted(triangleCount, false);
+		vector<unsigned int> deadEnd, candidates;
+		unsigned int time = cacheSize + 1;
+		size_t cursor = 0;
+
+		auto skipDeadEnd = [&]() -> int {
+			while (!deadEnd.empty())
+			{
+				const unsigned int vertex = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveTriangles[vertex] > 0)
+					return static_cast<int>(vertex);
+			}
+			for (; cursor < vertexCount; cursor++)
+				if (liveTriangles[cursor] > 0)
+					return static_cast<int>(cursor);
+			return -1;
+		};
+
+		int fanning = skipDeadEnd();
+		bool newCluster = true;
+		while (fanning >= 0)
+		{
+			candidates.clear();
+			for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++)
+			{
+				const unsigned int triangle = adjacency[a];
+				if (emitted[triangle])
+					continue;
+				if (newCluster && clusters)
+					clusters->push_back(static_cast<unsigned int>(result.size() / 3));
+				newCluster = false;
+				for (int k = 0; k < 3; k++)
+				{
+					const unsigned int vertex = indices[triangle * 3 + k];
+					result.push_back(vertex);
+					deadEnd.push_back(vertex);
+					candidates.push_back(vertex);
+					liveTriangles[vertex]--;
+					if (time - cacheTime[vertex] > cacheSize)
+						cacheTime[vertex] = time++;
+				}
+				emitted[triangle] = true;
+			}
+
+			// the candidate that is still cached after its remaining triangles are emitted, the oldest one wins
+			int next = -1, best = -1;
+			for (unsigned int vertex : candidates)
+			{
+				if (liveTriangles[vertex] == 0)
+					continue;
+				int priority = 0;
+				if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= cacheSize)
+					priority = static_cast<int>(time - cacheTime[vertex]);
+				if (priority > best)
+				{
+					best = priority;
+					next = static_cast<int>(vertex);
+				}
+			}
+			if (next < 0)
+			{
+				next = skipDeadEnd();
+				newCluster = true;
+			}
+			fanning = next;
+		}
+		return result;
+	}
+
+	// Splits the Tipsify clusters further wherever the cache has warmed up again (the running ACMR of the cluster, with
+	// a cold cache at its start, drops under 1.05x the ACMR of the whole mesh), then sorts the clusters so the ones on
+	// the outside facing away from the center come first: they are the likely occluders of the rest
+	static void optimizeOverdraw(const vector<Vertex>& vertices, vector<unsigned int>& indices, const vector<unsigned int>& hardClusters,
+		float threshold = 1.05f, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0 || hardClusters.empty())
+			return;
+
+		const float meshACMR = analyzeVertexCache(indices, vertices.size(), cacheSize).acmr();
+		vector<unsigned int> clusters;
+		vector<size_t> loadedAt(vertices.size(), 0);
+		size_t transforms = 0;
+		size_t clusterStart = 0, clusterTransforms = 0;
+		unsigned int nextHard = 0;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			if (nextHard < hardClusters.size() && hardClusters[nextHard] == t)
+			{
+				nextHard++;
+				clusters.push_back(static_cast<unsigned int>(t));
+				clusterStart = t;
+				clusterTransforms = 0;
+				// cold cache
+				transforms += cacheSize + 1;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				const unsigned int index = indices[t * 3 + k];
+				if (loadedAt[index] == 0 || transforms + 1 - loadedAt[index] > cacheSize)
+				{
+					loadedAt[index] = ++transforms;
+					clusterTransforms++;
+				}
+			}
+			const bool lastTriangle = t + 1 == triangleCount;
+			const bool hardNext = nextHard < hardClusters.size() && hardClusters[nextHard] == t + 1;
+			if (!lastTriangle && !hardNext && static_cast<float>(clusterTransforms) / (t + 1 - clusterStart) <= meshACMR * threshold)
+			{
+				clusters.push_back(static_cast<unsigned int>(t + 1));
+				clusterStart = t + 1;
+				clusterTransforms = 0;
+				transforms += cacheSize + 1;
+			}
+		}
+
+		// area weighted centroid and normal of the mesh and of every cluster
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+		struct Cluster {
+			unsigned int first, count;
+			float sortKey;
+		};
+		vector<Cluster> sorted(clusters.size());
+		vector<glm::vec3> centroids(clusters.size(), glm::vec3(0.0f)), normals(clusters.size(), glm::vec3(0.0f));
+		vector<float> areas(clusters.size(), 0.0f);
+		for (size_t c = 0; c < clusters.size(); c++)
+		{
+			const unsigned int first = clusters[c];
+			const unsigned int last = c + 1 < clusters.size() ? clusters[c + 1] : static_cast<unsigned int>(triangleCount);
+			sorted[c] = { first, last - first, 0.0f };
+			for (unsigned int t = first; t < last; t++)
+			{
+				const glm::vec3& p0 = vertices[indices[t * 3]].Position;
+				const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+				const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+				const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				const float area = glm::length(normal);
+				centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+				normals[c] += normal;
+				areas[c] += area;
+			}
+			meshCentroid += centroids[c];
+			meshArea += areas[c];
+		}
+		if (meshArea > 0.0f)
+			meshCentroid /= meshArea;
+		for (size_t c = 0; c < clusters.size(); c++)
+		{
+			const glm::vec3 centroid = areas[c] > 0.0f ? centroids[c] / areas[c] : meshCentroid;
+			const float length = glm::length(normals[c]);
+			sorted[c].sortKey = length > 0.0f ? glm::dot(centroid - meshCentroid, normals[c] / length) : 0.0f;
+		}
+		std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+		vector<unsigned int> result;
+		result.reserve(indices.size());
+		for (const Cluster& cluster : sorted)
+			result.insert(result.end(), indices.begin() + cluster.first * 3, indices.begin() + (cluster.first + cluster.count) * 3);
+		indices.swap(result);
+	}
+
+	// renumbers the vertices in the order the indices first use them and drops the unused ones
+	static void optimizeVertexFetch(vector<Vertex>& vertices, vector<unsigned int>& indices)
+	{
+		constexpr unsigned int unused = ~0u;
+		vector<unsigned int> remap(vertices.size(), unused);
+		vector<Vertex> result;
+		result.reserve(vertices.size());
+		for (unsigned int& index : indices)
+		{
+			if (remap[index] == unused)
+			{
+				remap[index] = static_cast<unsigned int>(result.size());
+				result.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+		vertices.swap(result);
+	}
+};
+#endif // !MESH_OPTIMIZER_H
@@ -0,0 +1,304 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include <mesh.h>
+#include <mesh_optimizer.h>
+#include <lod.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using std::vector;
+
+// Quadric error edge collapse (Garland-Heckbert) over an index buffer. Vertices are never moved or added,
+// a collapse redirects every use of one vertex to a neighbour, so every LOD can share the mesh's vertex buffer.
+// Vertices on a UV/normal seam (one position, several vertices) or on an open border are locked, the seams and
+// silhouettes of the original mesh survive in every LOD.
+class MeshSimplifier {
+public:
+	// target is an index count, maxError an object space distance. error receives the bound on the distance between
+	// the result and the planes of the source triangles
+	static vector<unsigned int> simplify(const vector<Vertex>& vertices, const vector<unsigned int>& indices, const vector<bool>& locked,
+		size_t targetIndexCount, float maxError, float& error)
+	{
+		const size_t vertexCount = vertices.size();
+
+		// plane quadrics of every source triangle, unweighted so sqrt(cost) stays a distance bound
+		vector<Quadric> quadrics(vertexCount);
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			const glm::vec3& p0 = vertices[indices[i]].Position;
+			const glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - p0, vertices[indices[i + 2]].Position - p0);
+			const float length = glm::length(normal);
+			if (length <= 0.0f)
+				continue;
+			const Quadric plane = Quadric::fromPlane(glm::dvec3(normal / length), -glm::dot(glm::dvec3(normal / length), glm::dvec3(p0)));
+			for (int k = 0; k < 3; k++)
+				quadrics[indices[i + k]].add(plane);
+		}
+
+		vector<unsigned int> current = indices;
+		vector<unsigned int> collapseTo(vertexCount);
+		vector<uint8_t> touched(vertexCount);
+		double worstCost = 0.0;
+		const double maxCost = static_cast<double>(maxError) * maxError;
+
+		while (current.size() > targetIndexCount)
+		{
+			// every directed edge away from a movable vertex is a candidate
+			vector<Collapse> candidates;
+			candidates.reserve(current.size() * 2);
+			for (size_t i = 0; i < current.size(); i += 3)
+				for (int k = 0; k < 3; k++)
+				{
+					const unsigned int a = current[i + k], b = current[i + (k + 1) % 3];
+					if (!locked[a])
+						candidates.push_back({ a, b, collapseCost(quadrics, vertices, a, b) });
+					if (!locked[b])
+						candidates.push_back({ b, a, collapseCost(quadrics, vertices, b, a) });
+				}
+			std::sort(candidates.begin(), candidates.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+			// triangles around every vertex, for the flip test
+			vector<unsigned int> triangleOffsets(vertexCount + 1, 0), triangleList(current.size());
+			for (unsigned int index : current)
+				triangleOffsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++)
+				triangleOffsets[v + 1] += triangleOffsets[v];
+			{
+				vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+				for (size_t i = 0; i < current.size(); i++)
+					triangleList[fill[current[i]]++] = static_cast<unsigned int>(i / 3);
+			}
+
+			for (size_t v = 0; v < vertexCount; v++)
+				collapseTo[v] = static_cast<unsigned int>(v);
+			std::fill(touched.begin(), touched.end(), 0);
+
+			const size_t triangleTarget = targetIndexCount / 3;
+			size_t triangleCount = current.size() / 3;
+			size_t collapses = 0;
+			for (const Collapse& collapse : candidates)
+			{
+				if (collapse.cost > maxCost || triangleCount <= triangleTarget)
+					break;
+				if (touched[collapse.from] || touched[collapse.to])
+					continue;
+				if (flips(vertices, current, triangleOffsets, triangleList, collapse.from, collapse.to))
+					continue;
+
+				// one collapse per neighbourhood and pass, so the costs and flip tests above stay valid
+				size_t removed = 0;
+				for (unsigned int t = triangleOffsets[collapse.from]; t < triangleOffsets[collapse.from + 1]; t++)
+				{
+					const unsigned int* triangle = &current[triangleList[t] * 3];
+					for (int k = 0; k < 3; k++)
+						touched[triangle[k]] = 1;
+					removed += triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to;
+				}
+				collapseTo[collapse.from] = collapse.to;
+				quadrics[collapse.to].add(quadrics[collapse.from]);
+				worstCost = std::max(worstCost, collapse.cost);
+				triangleCount -= removed;
+				collapses++;
+			}
+			if (collapses == 0)
+				break;
+
+			// redirect the collapsed vertices and drop the triangles that became degenerate
+			size_t written = 0;
+			for (size_t i = 0; i < current.size(); i += 3)
+			{
+				const unsigned int a = collapseTo[current[i]], b = collapseTo[current[i + 1]], c = collapseTo[current[i + 2]];
+				if (a == b || b == c || c == a)
+					continue;
+				current[written++] = a;
+				current[written++] = b;
+				current[written++] = c;
+			}
+			current.resize(written);
+		}
+
+		error = static_cast<float>(std::sqrt(worstCost));
+		return current;
+	}
+
+	// distinct vertices sharing a position (UV or normal seams) and vertices on open edges, indices must be canonical
+	static vector<bool> lockedVertices(const vector<Vertex>& vertices, const vector<unsigned int>& canonical, const vector<unsigned int>& indices)
+	{
+		vector<bool> locked(vertices.size(), false);
+
+		// one id per distinct position
+		std::unordered_map<PositionKey, unsigned int, PositionKeyHash> positionIDs;
+		vector<unsigned int> positionOf(vertices.size());
+		vector<unsigned int> verticesAtPosition;
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			auto inserted = positionIDs.emplace(PositionKey::of(vertices[v].Position), static_cast<unsigned int>(verticesAtPosition.size()));
+			if (inserted.second)
+				verticesAtPosition.push_back(0);
+			positionOf[v] = inserted.first->second;
+			if (canonical[v] == v)
+				verticesAtPosition[positionOf[v]]++;
+		}
+		for (size_t v = 0; v < vertices.size(); v++)
+			locked[v] = verticesAtPosition[positionOf[v]] > 1;
+
+		// an edge used by only one triangle (compared by position, so seams don't count) is a border
+		std::unordered_map<uint64_t, unsigned int> edgeUses;
+		auto edgeKey = [&](unsigned int a, unsigned int b) {
+			uint64_t pa = positionOf[a], pb = positionOf[b];
+			return pa < pb ? (pa << 32) | pb : (pb << 32) | pa;
+		};
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			for (int k = 0; k < 3; k++)
+				edgeUses[edgeKey(indices[i + k], indices[i + (k + 1) % 3])]++;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			for (int k = 0; k < 3; k++)
+			{
+				const unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+				if (edgeUses[edgeKey(a, b)] == 1)
+					locked[a] = locked[b] = true;
+			}
+		return locked;
+	}
+
+	// LOD 1..lodCount, each aiming at half the triangles of the previous one. Stops early once halving fails
+	// to remove at least a tenth of the triangles or would exceed maxRelativeError of the mesh radius
+	static vector<MeshLOD> buildLODs(const vector<Vertex>& vertices, const vector<unsigned int>& indices, const Bounds& bounds,
+		unsigned int lodCount = MAX_LOD_COUNT - 1, float maxRelativeError = 0.1f)
+	{
+		PROFILE_SCOPE("MeshSimplifier::buildLODs");
+		vector<MeshLOD> lods;
+		if (indices.size() < 3 * 64)
+			return lods;	// too small to be worth it
+
+		// imported meshes are welded already, this only matters for meshes built elsewhere
+		const vector<unsigned int> canonical = MeshOptimizer::weldRemap(vertices);
+		vector<unsigned int> welded(indices.size());
+		for (size_t i = 0; i < indices.size(); i++)
+			welded[i] = canonical[indices[i]];
+
+		const vector<bool> locked = lockedVertices(vertices, canonical, welded);
+		const float maxError = bounds.sphere.radius * maxRelativeError;
+
+		lods.reserve(lodCount);
+		const vector<unsigned int>* source = &welded;
+		float sourceError = 0.0f;
+		for (unsigned int lod = 0; lod < lodCount; lod++)
+		{
+			const size_t target = (source->size() / 6) * 3;
+			MeshLOD result;
+			float error = 0.0f;
+			result.indices = simplify(vertices, *source, locked, target, maxError, error);
+			if (result.indices.size() * 10 > source->size() * 9)
+				break;
+			// simplified from the previous LOD, so the distances add up
+			result.error = sourceError + error;
+			sourceError = result.error;
+			lods.push_back(std::move(result));
+			source = &lods.back().indices;
+		}
+		return lods;
+	}
+
+private:
+	struct Quadric {
+		// upper triangle of the symmetric 4x4 matrix: aa ab ac ad bb bc bd cc cd dd
+		double q[10] = {};
+
+		static Quadric fromPlane(const glm::dvec3& n, double d)
+		{
+			Quadric quadric;
+			const double plane[4] = { n.x, n.y, n.z, d };
+			int k = 0;
+			for (int i = 0; i < 4; i++)
+				for (int j = i; j < 4; j++)
+					quadric.q[k++] = plane[i] * plane[j];
+			return quadric;
+		}
+
+		void add(const Quadric& other)
+		{
+			for (int k = 0; k < 10; k++)
+				q[k] += other.q[k];
+		}
+
+		double evaluate(const glm::dvec3& p) const
+		{
+			const double x = p.x, y = p.y, z = p.z;
+			return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+				+ q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+				+ q[7] * z * z + 2.0 * q[8] * z
+				+ q[9];
+		}
+	};
+
+	struct Collapse {
+		unsigned int from;
+		unsigned int to;
+		double cost;
+	};
+
+	struct PositionKey {
+		uint32_t bits[3];
+
+		static PositionKey of(const glm::vec3& p)
+		{
+			PositionKey key;
+			std::memcpy(key.bits, &p[0], sizeof(key.bits));
+			return key;
+		}
+
+		bool operator==(const PositionKey& other) const
+		{
+			return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+		}
+	};
+
+	struct PositionKeyHash {
+		size_t operator()(const PositionKey& key) const
+		{
+			return static_cast<size_t>(fnv1a64(key.bits, sizeof(key.bits)));
+		}
+	};
+
+	static double collapseCost(const vector<Quadric>& quadrics, const vector<Vertex>& vertices, unsigned int from, unsigned int to)
+	{
+		Quadric combined = quadrics[from];
+		combined.add(quadrics[to]);
+		return std::max(0.0, combined.evaluate(glm::dvec3(vertices[to].Position)));
+	}
+
+	// true if moving from onto to turns any remaining triangle around from upside down
+	static bool flips(const vector<Vertex>& vertices, const vector<unsigned int>& current,
+		const vector<unsigned int>& triangleOffsets, const vector<unsigned int>& triangleList, unsigned int from, unsigned int to)
+	{
+		for (unsigned int t = triangleOffsets[from]; t < triangleOffsets[from + 1]; t++)
+		{
+			const unsigned int* triangle = &current[triangleList[t] * 3];
+			if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+				continue;	// collapses away
+
+			glm::vec3 before[3], after[3];
+			for (int k = 0; k < 3; k++)
+			{
+				before[k] = vertices[triangle[k]].Position;
+				after[k] = triangle[k] == from ? vertices[to].Position : before[k];
+			}
+			const glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+			const glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+			if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+				return true;
+		}
+		return false;
+	}
+};
+#endif // !MESH_SIMPLIFIER_H
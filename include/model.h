@@ -11,22 +11,33 @@
 #include <assimp/postprocess.h>
 
 #include <mesh.h>
+#include <animation.h>
+#include <mesh_cache.h>
+#include <mesh_optimizer.h>
+#include <mesh_simplifier.h>
+#include <texture_loader.h>
+#include <texture_streamer.h>
+#include <job_system.h>
+#include <frustum_culling.h>
 #include <shader.h>
+#include <profiler.h>
 
 #include <string>
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <optional>
 #include <vector>
 
 using std::vector, std::string, std::cout, std::endl;
 
 struct PositionBoundary
 {
-	float maxX = std::numeric_limits<float>::min();
-	float maxY = std::numeric_limits<float>::min();
-	float maxZ = std::numeric_limits<float>::min();
+	float maxX = std::numeric_limits<float>::lowest();
+	float maxY = std::numeric_limits<float>::lowest();
+	float maxZ = std::numeric_limits<float>::lowest();
 
 	float minX = std::numeric_limits<float>::max();
 	float minY = std::numeric_limits<float>::max();
@@ -41,14 +52,58 @@ public:
 	// model data 
 	vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
 	vector<Mesh>    meshes;
+	vector<std::shared_ptr<const Material>> materials;	// one per aiMaterial, indexed by aiMesh::mMaterialIndex
 	string directory;
 	bool gammaCorrection;
 	PositionBoundary positionBoundary;
+	// object space box and sphere around every mesh
+	Bounds bounds;
+	bool useCache;
+	VertexFormat vertexFormat;
+	bool loadedFromCache = false;
+	double loadMilliseconds = 0.0;
+	// post-transform cache behaviour of the imported index buffers before and after MeshOptimizer, empty when loaded from the cache
+	MeshOptimizer::Stats optimizationStats;
+	// node hierarchy and bones the meshes are skinned to, empty for static models
+	Skeleton skeleton;
+	vector<AnimationClip> animations;
+
+	// assimp post processing steps, part of the mesh cache key
+	static constexpr unsigned int importFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights;
 
 	// constructor, expects a filepath to a 3D model.
-	Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+	Model(string const& path, bool gamma = false, bool useCache = true, VertexFormat vertexFormat = VertexFormat::Full)
+		: gammaCorrection(gamma), useCache(useCache), vertexFormat(vertexFormat)
 	{
+		PROFILE_SCOPE("Model::load");
+		auto start = std::chrono::steady_clock::now();
 		loadModel(path);
+		// textures were decoded in parallel while the meshes were built, wait for the last uploads
+		textureLoader.finish();
+		if (TextureStreamer::shared().enabled())
+			TextureStreamer::shared().finish();
+		for (const Mesh& mesh : meshes)
+			bounds = merge(bounds, mesh.bounds);
+		loadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+#ifdef _DEBUG
+		std::cout << "SUCCESSFULLY::MODEL::SUCCESSFULLY_LOAD_MODEL\n"
+			<< "    MODEL_PATH: " << path << "\n"
+			<< "    SOURCE: " << (loadedFromCache ? "MESH_CACHE" : "ASSIMP") << "\n"
+			<< "    LOAD_TIME: " << loadMilliseconds << " ms\n";
+		unsigned int lodTriangles[MAX_LOD_COUNT] = {};
+		for (const Mesh& mesh : meshes)
+			for (unsigned int lod = 0; lod < MAX_LOD_COUNT; lod++)
+				lodTriangles[lod] += static_cast<unsigned int>(mesh.indexCount(std::min<unsigned int>(lod, static_cast<unsigned int>(mesh.lods.size()))) / 3);
+		std::cout << "    LOD_TRIANGLES:";
+		for (unsigned int lod = 0; lod < MAX_LOD_COUNT; lod++)
+			std::cout << " " << lodTriangles[lod];
+		std::cout << "\n";
+		if (!loadedFromCache)
+			std::cout << "    ACMR: " << optimizationStats.before.acmr() << " -> " << optimizationStats.after.acmr() << "\n"
+				<< "    ATVR: " << optimizationStats.before.atvr() << " -> " << optimizationStats.after.atvr() << "\n"
+				<< "    VERTICES: " << optimizationStats.before.vertices << " -> " << optimizationStats.after.vertices << "\n";
+#endif
 	}
 
 	// draws the model, and thus all its meshes
@@ -58,6 +113,16 @@ public:
 			mesh.Draw(shader);
 	}
 
+	// draws only the meshes whose world space box touches the culler's frustum, transform is the model matrix the shader uses
+	void render(Shader& shader, FrustumCuller& culler, const glm::mat4& transform)
+	{
+		culler.clear();
+		for (const auto& mesh : meshes)
+			culler.add(mesh.bounds.box.transformed(transform));
+		for (unsigned int i : culler.cull())
+			meshes[i].Draw(shader);
+	}
+
 	void renderInstanced(Shader& shader, const unsigned int count)
 	{
 		for (const auto& mesh : meshes)
@@ -80,12 +145,36 @@ public:
 	}
 
 private:
+	TextureLoader textureLoader;
+	// aiMesh::mMaterialIndex of every entry in meshes, stored in the mesh cache
+	vector<unsigned int> meshMaterialIndices;
+	// bone name to palette index and offset matrix, shared by every mesh of the model
+	std::map<string, BoneInfo> boneInfoMap;
+	int boneCounter = 0;
+
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
 	void loadModel(const string& path)
 	{
+		// retrieve the directory path of the filepath
+		directory = path.substr(0, path.find_last_of("/\\"));
+
+		// the cache is keyed by the source file and material library content and the import flags, a mismatch means it is stale
+		uint64_t sourceSize = 0;
+		uint64_t sourceHash = useCache ? hashModelSources(path, &sourceSize) : 0;
+		const string cachePath = MeshCache::pathFor(path);
+		if (sourceHash != 0 && loadFromCache(cachePath, sourceHash, sourceSize))
+		{
+			loadedFromCache = true;
+			return;
+		}
+
 		// read file via ASSIMP
 		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+		const aiScene* scene = nullptr;
+		{
+			PROFILE_SCOPE("Assimp::ReadFile");
+			scene = importer.ReadFile(path, importFlags);
+		}
 
 		// check for errors
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
@@ -94,15 +183,58 @@ private:
 			return;
 		}
 
-		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('\\'));
+		materials.resize(scene->mNumMaterials);
 
 		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		vector<CachedMesh> imported;
+		processNode(scene->mRootNode, scene, imported);
+		buildMeshes(imported);
+
+		if (!boneInfoMap.empty())
+		{
+			skeleton = Skeleton::fromScene(scene, boneInfoMap);
+			animations = AnimationClip::fromScene(scene, skeleton);
+		}
+
+		// rewrite the cache so the next start can skip assimp, skinned models keep their skeleton and clips in it
+		if (sourceHash != 0)
+		{
+			const float boundaryMin[3] = { positionBoundary.minX, positionBoundary.minY, positionBoundary.minZ };
+			const float boundaryMax[3] = { positionBoundary.maxX, positionBoundary.maxY, positionBoundary.maxZ };
+			MeshCache::write(cachePath, sourceHash, sourceSize, importFlags, meshes, meshMaterialIndices, boundaryMin, boundaryMax, skeleton, animations);
+		}
+	}
+
+	// fills the meshes from the mesh cache, returns false if the cache is missing or stale
+	bool loadFromCache(const string& cachePath, uint64_t sourceHash, uint64_t sourceSize)
+	{
+		PROFILE_SCOPE("Model::loadFromCache");
+		vector<CachedMesh> cached;
+		float boundaryMin[3], boundaryMax[3];
+		if (!MeshCache::read(cachePath, sourceHash, sourceSize, importFlags, cached, boundaryMin, boundaryMax, skeleton, animations))
+			return false;
+
+		meshes.reserve(cached.size());
+		for (CachedMesh& mesh : cached)
+		{
+			// the cache only stores texture references, the GL textures are shared through textures_loaded as usual
+			for (Texture& texture : mesh.textures)
+				texture.id = findOrLoadTexture(texture.path.c_str(), texture.type).id;
+			meshes.push_back(Mesh(mesh.vertices, mesh.indices, mesh.textures, vertexFormat, materialFor(mesh.materialIndex, mesh.textures), std::move(mesh.lods), &mesh.bounds));
+			meshMaterialIndices.push_back(mesh.materialIndex);
+		}
+
+		positionBoundary.minX = boundaryMin[0];
+		positionBoundary.minY = boundaryMin[1];
+		positionBoundary.minZ = boundaryMin[2];
+		positionBoundary.maxX = boundaryMax[0];
+		positionBoundary.maxY = boundaryMax[1];
+		positionBoundary.maxZ = boundaryMax[2];
+		return true;
 	}
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode* node, const aiScene* scene)
+	void processNode(aiNode* node, const aiScene* scene, vector<CachedMesh>& imported)
 	{
 		// process each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -110,15 +242,17 @@ private:
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			imported.push_back(processMesh(mesh, scene));
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, imported);
 	}
 
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+	// the vertices, indices and textures of one mesh as assimp has them, optimized later by buildMeshes
+	CachedMesh processMesh(aiMesh* mesh, const aiScene* scene)
 	{
+		PROFILE_SCOPE("Model::processMesh");
 		// data to fill
 		vector<Vertex> vertices;
 		vector<unsigned int> indices;
@@ -127,7 +261,7 @@ private:
 		// walk through each of the mesh's vertices
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
 		{
-			Vertex vertex;
+			Vertex vertex{};
 			glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
 
 			// positions
@@ -137,18 +271,25 @@ private:
 
 			vertex.Position = vector;
 
+			// no bone influences unless skinning data fills them in
+			for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+			{
+				vertex.m_BoneIDs[k] = -1;
+				vertex.m_Weights[k] = 0.0f;
+			}
+
 			// find position boundary
 			if (vector.x > positionBoundary.maxX)
 				positionBoundary.maxX = vector.x;
-			else if (vector.x < positionBoundary.minX)
+			if (vector.x < positionBoundary.minX)
 				positionBoundary.minX = vector.x;
 			if (vector.y > positionBoundary.maxY)
 				positionBoundary.maxY = vector.y;
-			else if (vector.y < positionBoundary.minY)
+			if (vector.y < positionBoundary.minY)
 				positionBoundary.minY = vector.y;
 			if (vector.z > positionBoundary.maxZ)
 				positionBoundary.maxZ = vector.z;
-			else if (vector.z < positionBoundary.minZ)
+			if (vector.z < positionBoundary.minZ)
 				positionBoundary.minZ = vector.z;
 
 
@@ -190,6 +331,9 @@ private:
 			vertices.push_back(vertex);
 		}
 
+		// bone ids and weights
+		extractBoneWeights(vertices, mesh);
+
 		// now walk through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
 		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 		{
@@ -200,6 +344,7 @@ private:
 		}
 
 		// process materials
+		meshMaterialIndices.push_back(mesh->mMaterialIndex);
 		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
 		// we assume a convention for sampler names in the shaders. Each diffuse texture should be named
 		// as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
@@ -228,8 +373,99 @@ private:
 		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
 		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		return { vertices, indices, textures, mesh->mMaterialIndex, {} };
+	}
+
+	// optimizes the imported meshes and builds their LODs on the job system, one job a mesh. A finished job queues the
+	// mesh's GL buffers on the main thread, which creates them while it waits for the other jobs
+	void buildMeshes(vector<CachedMesh>& imported)
+	{
+		PROFILE_SCOPE("Model::buildMeshes");
+		JobSystem& jobs = JobSystem::shared();
+		vector<std::optional<Mesh>> built(imported.size());
+		vector<MeshOptimizer::Stats> stats(imported.size());
+		JobCounter counter;
+		for (size_t i = 0; i < imported.size(); i++)
+		{
+			jobs.run([this, &jobs, &imported, &built, &stats, &counter, i] {
+				CachedMesh& mesh = imported[i];
+				// weld, order for the vertex cache and overdraw, then for vertex fetch
+				MeshOptimizer::optimize(mesh.vertices, mesh.indices, &stats[i]);
+
+				// simplified index buffers for distant draws, built once here and then stored in the mesh cache
+				mesh.lods = MeshSimplifier::buildLODs(mesh.vertices, mesh.indices, boundsOf(mesh.vertices.empty() ? nullptr : &mesh.vertices[0].Position, mesh.vertices.size(), sizeof(Vertex)));
+				for (MeshLOD& lod : mesh.lods)
+					lod.indices = MeshOptimizer::optimizeVertexCache(lod.indices, mesh.vertices.size());
+
+				jobs.runOnMainThread([this, &mesh, &built, i] {
+					built[i].emplace(mesh.vertices, mesh.indices, mesh.textures, vertexFormat, materialFor(mesh.materialIndex, mesh.textures), std::move(mesh.lods));
+				}, &counter);
+			}, &counter);
+		}
+		jobs.wait(counter);
+
+		meshes.reserve(meshes.size() + built.size());
+		for (size_t i = 0; i < built.size(); i++)
+		{
+			meshes.push_back(std::move(*built[i]));
+			optimizationStats.before += stats[i].before;
+			optimizationStats.after += stats[i].after;
+		}
+	}
+
+	// fills the bone slots of the vertices from the mesh's bones, keeping the MAX_BONE_INFLUENCE strongest influences
+	// of every vertex and scaling them so they sum to 1
+	void extractBoneWeights(vector<Vertex>& vertices, const aiMesh* mesh)
+	{
+		for (unsigned int boneIndex = 0; boneIndex < mesh->mNumBones; boneIndex++)
+		{
+			const aiBone* bone = mesh->mBones[boneIndex];
+			const string boneName = bone->mName.C_Str();
+			auto found = boneInfoMap.find(boneName);
+			if (found == boneInfoMap.end())
+				found = boneInfoMap.emplace(boneName, BoneInfo{ boneCounter++, toMat4(bone->mOffsetMatrix) }).first;
+			const int boneID = found->second.id;
+
+			for (unsigned int i = 0; i < bone->mNumWeights; i++)
+			{
+				const aiVertexWeight& weight = bone->mWeights[i];
+				if (weight.mVertexId >= vertices.size() || weight.mWeight <= 0.0f)
+					continue;
+				Vertex& vertex = vertices[weight.mVertexId];
+				// an empty slot, otherwise the weakest one if this influence is stronger
+				int slot = 0;
+				for (int k = 1; k < MAX_BONE_INFLUENCE; k++)
+					if (vertex.m_Weights[k] < vertex.m_Weights[slot])
+						slot = k;
+				if (vertex.m_BoneIDs[slot] < 0 || weight.mWeight > vertex.m_Weights[slot])
+				{
+					vertex.m_BoneIDs[slot] = boneID;
+					vertex.m_Weights[slot] = weight.mWeight;
+				}
+			}
+		}
+
+		if (mesh->mNumBones == 0)
+			return;
+		for (Vertex& vertex : vertices)
+		{
+			float sum = 0.0f;
+			for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+				sum += vertex.m_Weights[k];
+			if (sum > 0.0f)
+				for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+					vertex.m_Weights[k] /= sum;
+		}
+	}
+
+	// the Material for an aiMaterial index, built from the first mesh that uses it
+	std::shared_ptr<const Material> materialFor(unsigned int materialIndex, const vector<Texture>& textures)
+	{
+		if (materialIndex >= materials.size())
+			materials.resize(materialIndex + 1);
+		if (!materials[materialIndex])
+			materials[materialIndex] = std::make_shared<const Material>(textures);
+		return materials[materialIndex];
 	}
 
 	// checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -241,35 +477,38 @@ private:
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
-				}
-			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = loadPicture(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
-			}
+			textures.push_back(findOrLoadTexture(str.C_Str(), typeName));
 		}
 		return textures;
 	}
+
+	// check if texture was loaded before and if so, return it: skip loading a new texture
+	const Texture& findOrLoadTexture(const char* path, const string& typeName)
+	{
+		for (unsigned int j = 0; j < textures_loaded.size(); j++)
+		{
+			if (std::strcmp(textures_loaded[j].path.data(), path) == 0)
+				return textures_loaded[j]; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
+		}
+
+		// if texture hasn't been loaded already, load it
+		Texture texture;
+		// with gamma correction on, diffuse maps are sampled through an sRGB format so the shader sees linear colors.
+		// Streamed textures only get their mip tail here, the finer levels follow as meshes ask for them
+		const bool srgb = gammaCorrection && textureRoleOf(typeName) == TextureRole::Diffuse;
+		TextureStreamer& streamer = TextureStreamer::shared();
+		texture.id = streamer.enabled() ? streamer.add(this->directory + '/' + path, srgb) : textureLoader.load2D(this->directory + '/' + path, srgb);
+		texture.type = typeName;
+		texture.path = path;
+		textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
+		return textures_loaded.back();
+	}
 };
 
 unsigned int loadPicture(const char* path, const string& directory, bool gamma)
 {
 	string filename = string(path);
-	filename = directory + '\\' + filename;
+	filename = directory + '/' + filename;
 
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
@@ -278,25 +517,33 @@ unsigned int loadPicture(const char* path, const string& directory, bool gamma)
 	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
 	if (data)
 	{
-		GLenum format;
+		GLenum format = GL_RGBA;
+		GLenum internalFormat = GL_RGBA8;
 
 		switch (nrComponents)
 		{
 		case 1:
 			format = GL_RED;
+			internalFormat = GL_R8;
+			break;
+		case 2:
+			format = GL_RG;
+			internalFormat = GL_RG8;
 			break;
 		case 3:
 			format = GL_RGB;
+			internalFormat = gamma ? GL_SRGB8 : GL_RGB8;
 			break;
 		case 4:
 			format = GL_RGBA;
+			internalFormat = gamma ? GL_SRGB8_ALPHA8 : GL_RGBA8;
 			break;
 		default:
 			break;
 		}
 
 		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
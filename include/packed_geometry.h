@@ -0,0 +1,311 @@
+#ifndef PACKED_GEOMETRY_H
+#define PACKED_GEOMETRY_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <mesh.h>
+#include <model.h>
+#include <shader.h>
+#include <frustum_culling.h>
+#include <transform_stage.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// shader storage bindings read by model_lighting_packed.vert
+constexpr unsigned int PACKED_DRAW_BINDING = 1;			// uint transform index per draw
+constexpr unsigned int PACKED_TRANSFORM_BINDING = 2;	// ObjectTransform per added model
+
+// Packed mode: the meshes of one or more models are suballocated into one vertex arena and one index arena
+// behind a single VAO, and drawn with one glMultiDrawElementsIndirect per material.
+// Every draw command's baseInstance is its draw index, the vertex shader gets it through an instanced
+// attribute and looks up the model and normal matrices through the draw SSBO.
+// There is no bindless texturing in core GL, so the draws are grouped by Material and each group binds its textures once.
+// Only VertexFormat::Full meshes can be packed.
+class PackedGeometry {
+public:
+	PackedGeometry() = default;
+
+	PackedGeometry(const PackedGeometry&) = delete;
+	PackedGeometry& operator=(const PackedGeometry&) = delete;
+
+	~PackedGeometry()
+	{
+		if (VAO)
+		{
+			glDeleteVertexArrays(1, &VAO);
+			unsigned int buffers[] = { VBO, EBO, drawIDBuffer, indirectBuffer, drawBuffer, transformBuffer };
+			glDeleteBuffers(6, buffers);
+		}
+	}
+
+	// queue every mesh of a model, returns the transform slot for setTransform
+	unsigned int add(const Model& model)
+	{
+		return add(model.meshes);
+	}
+
+	unsigned int add(const vector<Mesh>& meshes)
+	{
+		const unsigned int transform = transforms.add(glm::mat4(1.0f));
+
+		for (const Mesh& mesh : meshes)
+		{
+			if (mesh.format != VertexFormat::Full)
+			{
+				std::cout << "ERROR::PACKED_GEOMETRY::UNSUPPORTED_VERTEX_FORMAT: only full vertex meshes can be packed\n";
+				continue;
+			}
+
+			Draw draw;
+			draw.material = mesh.material;
+			draw.indexCount = static_cast<unsigned int>(mesh.indices.size());
+			draw.firstIndex = static_cast<unsigned int>(indices.size());
+			draw.baseVertex = static_cast<int>(vertices.size());
+			draw.transform = transform;
+			draw.box = mesh.bounds.box;
+			draws.push_back(draw);
+
+			vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+			indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+		}
+		return transform;
+	}
+
+	// upload the arenas and the indirect commands, call once after the last add
+	void build()
+	{
+		// draws sharing a material become one multi draw
+		std::stable_sort(draws.begin(), draws.end(), [](const Draw& a, const Draw& b) { return a.material.get() < b.material.get(); });
+
+		commands.resize(draws.size());
+		vector<unsigned int> drawTransforms(draws.size());
+		vector<unsigned int> drawIDs(draws.size());
+		for (size_t i = 0; i < draws.size(); i++)
+		{
+			Draw& draw = draws[i];
+			commands[i] = { draw.indexCount, 1, draw.firstIndex, draw.baseVertex, static_cast<unsigned int>(i) };
+			drawTransforms[i] = draw.transform;
+			drawIDs[i] = static_cast<unsigned int>(i);
+
+			if (groups.empty() || groups.back().material != draw.material.get())
+				groups.push_back({ draw.material.get(), static_cast<unsigned int>(i), 0, 0 });
+			groups.back().commandCount++;
+			groups.back().visibleCount++;
+			draw.group = static_cast<unsigned int>(groups.size() - 1);
+		}
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+		glGenBuffers(1, &drawIDBuffer);
+		glGenBuffers(1, &indirectBuffer);
+		glGenBuffers(1, &drawBuffer);
+		glGenBuffers(1, &transformBuffer);
+
+		glBindVertexArray(VAO);
+
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+		// same attribute locations as Mesh::setupMesh
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+		glEnableVertexAttribArray(5);
+		glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
+		glEnableVertexAttribArray(6);
+		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
+
+		// draw index, advanced once per instance so baseInstance selects it
+		glBindBuffer(GL_ARRAY_BUFFER, drawIDBuffer);
+		glBufferData(GL_ARRAY_BUFFER, drawIDs.size() * sizeof(unsigned int), drawIDs.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(7);
+		glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(unsigned int), (void*)0);
+		glVertexAttribDivisor(7, 1);
+
+		glBindVertexArray(0);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, drawTransforms.size() * sizeof(unsigned int), drawTransforms.data(), GL_STATIC_DRAW);
+		updateTransforms();
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, transformBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, objectTransforms.size() * sizeof(ObjectTransform), objectTransforms.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		transformsDirty = false;
+
+#ifdef _DEBUG
+		std::cout << "SUCCESSFULLY::PACKED_GEOMETRY::SUCCESSFULLY_BUILD\n"
+			<< "    MESHES: " << draws.size() << "\n"
+			<< "    MULTI_DRAWS: " << groups.size() << "\n"
+			<< "    VERTICES: " << vertices.size() << "\n"
+			<< "    INDICES: " << indices.size() << "\n";
+#endif
+		// the arenas live on the GPU now
+		vertices = vector<Vertex>();
+		indices = vector<unsigned int>();
+	}
+
+	void setTransform(unsigned int slot, const glm::mat4& transform)
+	{
+		transforms.set(slot, transform);
+		transformsDirty = true;
+	}
+
+	// expects a shader built from model_lighting_packed.vert
+	// with a culler, draws outside its frustum get an instance count of 0 and material groups with nothing visible are skipped
+	void render(Shader& shader, FrustumCuller* culler = nullptr)
+	{
+		if (culler)
+		{
+			PROFILE_SCOPE("PackedGeometry::cull");
+			cull(*culler);
+		}
+		else if (commandsCulled)
+			uncull();
+
+		if (transformsDirty)
+		{
+			updateTransforms();
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, transformBuffer);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, objectTransforms.size() * sizeof(ObjectTransform), objectTransforms.data());
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			transformsDirty = false;
+		}
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PACKED_DRAW_BINDING, drawBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PACKED_TRANSFORM_BINDING, transformBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glBindVertexArray(VAO);
+
+		for (const Group& group : groups)
+		{
+			if (group.visibleCount == 0)
+				continue;
+			group.material->bind(shader);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+				(void*)(group.firstCommand * sizeof(DrawElementsIndirectCommand)), static_cast<GLsizei>(group.commandCount), 0);
+		}
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// meshes packed
+	unsigned int drawCount() const
+	{
+		return static_cast<unsigned int>(draws.size());
+	}
+
+	// glMultiDrawElementsIndirect calls per render
+	unsigned int multiDrawCount() const
+	{
+		return static_cast<unsigned int>(groups.size());
+	}
+
+private:
+	// layout fixed by the GL spec
+	struct DrawElementsIndirectCommand {
+		unsigned int count;
+		unsigned int instanceCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int baseInstance;
+	};
+
+	struct Draw {
+		std::shared_ptr<const Material> material;
+		unsigned int indexCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int transform;
+		unsigned int group = 0;
+		BoundingBox box;		// object space
+	};
+
+	struct Group {
+		const Material* material;
+		unsigned int firstCommand;
+		unsigned int commandCount;
+		unsigned int visibleCount;
+	};
+
+	// rewrite the instance counts from the culling result
+	void cull(FrustumCuller& culler)
+	{
+		culler.clear();
+		for (const Draw& draw : draws)
+			culler.add(draw.box.transformed(transforms.world(draw.transform)));
+
+		for (DrawElementsIndirectCommand& command : commands)
+			command.instanceCount = 0;
+		for (Group& group : groups)
+			group.visibleCount = 0;
+		for (unsigned int i : culler.cull())
+		{
+			commands[i].instanceCount = 1;
+			groups[draws[i].group].visibleCount++;
+		}
+		uploadCommands();
+		commandsCulled = true;
+	}
+
+	void uncull()
+	{
+		for (DrawElementsIndirectCommand& command : commands)
+			command.instanceCount = 1;
+		for (Group& group : groups)
+			group.visibleCount = group.commandCount;
+		uploadCommands();
+		commandsCulled = false;
+	}
+
+	// the normal matrices of the moved slots, next to their model matrices for the upload
+	void updateTransforms()
+	{
+		transforms.updateNormals();
+		objectTransforms.resize(transforms.size());
+		for (unsigned int slot = 0; slot < objectTransforms.size(); slot++)
+			objectTransforms[slot] = transforms.objectTransform(slot);
+	}
+
+	void uploadCommands()
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	vector<Draw> draws;
+	vector<Group> groups;
+	vector<DrawElementsIndirectCommand> commands;
+	bool commandsCulled = false;
+	TransformStage transforms;
+	vector<ObjectTransform> objectTransforms;
+	bool transformsDirty = true;
+
+	unsigned int VAO = 0;
+	unsigned int VBO = 0, EBO = 0, drawIDBuffer = 0, indirectBuffer = 0, drawBuffer = 0, transformBuffer = 0;
+};
+#endif // !PACKED_GEOMETRY_H
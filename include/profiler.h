@@ -0,0 +1,329 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped CPU and GPU zones, shown live by drawProfilerOverlay (profiler_overlay.h) and exported as a Chrome trace.
+//   PROFILE_SCOPE("name")       CPU zone until the end of the enclosing block, on any thread
+//   PROFILE_GPU_SCOPE("name")   GPU zone (GL_TIME_ELAPSED) on the main thread, GPU zones can't nest
+// Names must be string literals, only the pointer is stored. Every thread writes its CPU zones into its own ring,
+// allocated the first time the thread opens a zone, so the hot path is two clock reads and a store.
+// Define PROFILER_DISABLED to compile the zones out.
+
+// a finished CPU zone, times in nanoseconds since the profiler epoch
+struct ProfileEvent {
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+	uint32_t depth;
+};
+
+// a finished GPU zone, placed at the CPU time it was issued at
+struct GpuProfileEvent {
+	const char* name;
+	uint64_t issued;
+	uint64_t nanoseconds;
+};
+
+// CPU zones of one thread, written only by that thread. Readers on other threads skip the oldest half of the ring,
+// the part the writer may be overwriting
+class ProfileThreadBuffer {
+public:
+	static constexpr uint32_t CAPACITY = 1 << 14;
+
+	ProfileEvent events[CAPACITY];
+	std::atomic<uint64_t> written{ 0 };
+	uint32_t depth = 0;
+	uint32_t index = 0;
+	std::string name;
+
+	void push(const ProfileEvent& event)
+	{
+		const uint64_t position = written.load(std::memory_order_relaxed);
+		events[position & (CAPACITY - 1)] = event;
+		written.store(position + 1, std::memory_order_release);
+	}
+
+	// visits the readable events ending at or after from, newest first, until visit returns false
+	template <class Visit>
+	void visit(uint64_t from, Visit&& visitor) const
+	{
+		const uint64_t end = written.load(std::memory_order_acquire);
+		const uint64_t begin = end > CAPACITY / 2 ? end - CAPACITY / 2 : 0;
+		// zones are pushed when they end, so end times only grow
+		for (uint64_t position = end; position-- > begin;)
+		{
+			const ProfileEvent& event = events[position & (CAPACITY - 1)];
+			if (event.end < from || !visitor(event))
+				break;
+		}
+	}
+};
+
+class Profiler {
+public:
+	// GPU zones per frame
+	static constexpr unsigned int MAX_GPU_ZONES = 32;
+	// frames kept for the overlay graphs
+	static constexpr unsigned int HISTORY = 240;
+
+	static Profiler& instance()
+	{
+		static Profiler profiler;
+		return profiler;
+	}
+
+	static uint64_t now()
+	{
+		static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+	}
+
+	ProfileThreadBuffer& threadBuffer()
+	{
+		thread_local ProfileThreadBuffer* buffer = registerThread();
+		return *buffer;
+	}
+
+	void setThreadName(const std::string& name)
+	{
+		ProfileThreadBuffer& buffer = threadBuffer();
+		std::lock_guard<std::mutex> lock(mutex);
+		buffer.name = name;
+	}
+
+	// marks a frame boundary on the main thread and reads back the GPU zones of the frame before last. A result
+	// that isn't available yet is dropped instead of waited for
+	void beginFrame()
+	{
+		const uint64_t time = now();
+		frameIndex++;
+		if (frameStart != 0)
+		{
+			lastFrameStart = frameStart;
+			lastFrameEnd = time;
+			cpuFrameMilliseconds[frameIndex % HISTORY] = (time - frameStart) * 1e-6f;
+		}
+		frameStart = time;
+
+		if (gpuEnabled)
+		{
+			if (!gpuFrames[0].queries[0])
+				for (GpuFrame& frame : gpuFrames)
+					glGenQueries(MAX_GPU_ZONES, frame.queries);
+
+			GpuFrame& frame = gpuFrames[frameIndex % 2];
+			if (frame.count > 0)
+			{
+				bool available = true;
+				for (unsigned int i = 0; i < frame.count && available; i++)
+				{
+					GLint ready = 0;
+					glGetQueryObjectiv(frame.queries[i], GL_QUERY_RESULT_AVAILABLE, &ready);
+					available = ready != 0;
+				}
+				if (available)
+				{
+					float total = 0.0f;
+					lastGpuZoneCount = frame.count;
+					for (unsigned int i = 0; i < frame.count; i++)
+					{
+						GLuint64 nanoseconds = 0;
+						glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &nanoseconds);
+						lastGpuZones[i] = { frame.names[i], frame.issued[i], nanoseconds };
+						gpuHistory[gpuHistoryWritten++ % GPU_HISTORY] = lastGpuZones[i];
+						total += nanoseconds * 1e-6f;
+					}
+					gpuFrameMilliseconds[frameIndex % HISTORY] = total;
+				}
+				else
+					droppedGpuFrames++;
+			}
+			frame.count = 0;
+		}
+	}
+
+	// false if the zone can't be recorded (nested in another GPU zone or out of queries), endGpuZone must then be skipped
+	bool beginGpuZone(const char* name)
+	{
+		GpuFrame& frame = gpuFrames[frameIndex % 2];
+		if (!gpuEnabled || gpuZoneOpen || frame.count == MAX_GPU_ZONES || !frame.queries[0])
+			return false;
+		frame.names[frame.count] = name;
+		frame.issued[frame.count] = now();
+		glBeginQuery(GL_TIME_ELAPSED, frame.queries[frame.count]);
+		gpuZoneOpen = true;
+		return true;
+	}
+
+	void endGpuZone()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		gpuFrames[frameIndex % 2].count++;
+		gpuZoneOpen = false;
+	}
+
+	// GPU zones can't overlap other GL_TIME_ELAPSED queries, whoever times whole frames with one turns them off
+	void setGpuEnabled(bool enabled)
+	{
+		gpuEnabled = enabled;
+	}
+
+	// deletes the queries while the context is still current
+	void shutdown()
+	{
+		if (gpuFrames[0].queries[0])
+			for (GpuFrame& frame : gpuFrames)
+			{
+				glDeleteQueries(MAX_GPU_ZONES, frame.queries);
+				std::fill(std::begin(frame.queries), std::end(frame.queries), 0u);
+				frame.count = 0;
+			}
+	}
+
+	// calls visitor(const ProfileThreadBuffer&) for every thread that recorded zones
+	template <class Visit>
+	void forEachThread(Visit&& visitor) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const std::unique_ptr<ProfileThreadBuffer>& buffer : threads)
+			visitor(*buffer);
+	}
+
+	// all CPU zones still in the rings and the recent GPU zones, in the Chrome trace event format (chrome://tracing, Perfetto)
+	bool writeChromeTrace(const std::string& path) const
+	{
+		constexpr int pid = 1;
+		constexpr int gpuThread = 1000;
+		nlohmann::json events = nlohmann::json::array();
+		forEachThread([&](const ProfileThreadBuffer& buffer) {
+			events.push_back({ { "name", "thread_name" }, { "ph", "M" }, { "pid", pid }, { "tid", buffer.index }, { "args", { { "name", buffer.name } } } });
+			buffer.visit(0, [&](const ProfileEvent& event) {
+				events.push_back({ { "name", event.name }, { "ph", "X" }, { "pid", pid }, { "tid", buffer.index },
+					{ "ts", event.start * 1e-3 }, { "dur", (event.end - event.start) * 1e-3 } });
+				return true;
+			});
+		});
+
+		events.push_back({ { "name", "thread_name" }, { "ph", "M" }, { "pid", pid }, { "tid", gpuThread }, { "args", { { "name", "GPU" } } } });
+		const uint64_t begin = gpuHistoryWritten > GPU_HISTORY ? gpuHistoryWritten - GPU_HISTORY : 0;
+		for (uint64_t i = begin; i < gpuHistoryWritten; i++)
+		{
+			const GpuProfileEvent& event = gpuHistory[i % GPU_HISTORY];
+			events.push_back({ { "name", event.name }, { "ph", "X" }, { "pid", pid }, { "tid", gpuThread },
+				{ "ts", event.issued * 1e-3 }, { "dur", event.nanoseconds * 1e-3 } });
+		}
+
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			std::cerr << "ERROR::PROFILER::FAILED_TO_WRITE_FILE: " << path << "\n";
+			return false;
+		}
+		file << nlohmann::json{ { "traceEvents", events }, { "displayTimeUnit", "ms" } }.dump();
+		return true;
+	}
+
+	// the last completed frame on the main thread, in nanoseconds since the epoch
+	uint64_t lastFrameStart = 0;
+	uint64_t lastFrameEnd = 0;
+	// GPU zones of the newest frame whose results came back
+	GpuProfileEvent lastGpuZones[MAX_GPU_ZONES] = {};
+	unsigned int lastGpuZoneCount = 0;
+	// per frame totals for the graphs, indexed by frame % HISTORY
+	float cpuFrameMilliseconds[HISTORY] = {};
+	float gpuFrameMilliseconds[HISTORY] = {};
+	uint64_t frameIndex = 0;
+	unsigned int droppedGpuFrames = 0;
+
+private:
+	static constexpr unsigned int GPU_HISTORY = 4096;
+
+	// double buffered: frame n records into gpuFrames[n % 2] while the GPU finishes frame n - 1
+	struct GpuFrame {
+		GLuint queries[MAX_GPU_ZONES] = {};
+		const char* names[MAX_GPU_ZONES] = {};
+		uint64_t issued[MAX_GPU_ZONES] = {};
+		unsigned int count = 0;
+	};
+
+	Profiler() = default;
+
+	ProfileThreadBuffer* registerThread()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		threads.push_back(std::make_unique<ProfileThreadBuffer>());
+		ProfileThreadBuffer* buffer = threads.back().get();
+		buffer->index = static_cast<uint32_t>(threads.size() - 1);
+		buffer->name = "thread " + std::to_string(buffer->index);
+		return buffer;
+	}
+
+	mutable std::mutex mutex;
+	std::vector<std::unique_ptr<ProfileThreadBuffer>> threads;
+
+	uint64_t frameStart = 0;
+	bool gpuEnabled = true;
+	bool gpuZoneOpen = false;
+	GpuFrame gpuFrames[2];
+	GpuProfileEvent gpuHistory[GPU_HISTORY] = {};
+	uint64_t gpuHistoryWritten = 0;
+};
+
+class ProfileScope {
+public:
+	explicit ProfileScope(const char* name) : buffer(Profiler::instance().threadBuffer()), name(name), depth(buffer.depth++), start(Profiler::now()) {}
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	~ProfileScope()
+	{
+		buffer.depth--;
+		buffer.push({ name, start, Profiler::now(), depth });
+	}
+
+private:
+	ProfileThreadBuffer& buffer;
+	const char* name;
+	uint32_t depth;
+	uint64_t start;
+};
+
+class GpuProfileScope {
+public:
+	explicit GpuProfileScope(const char* name) : open(Profiler::instance().beginGpuZone(name)) {}
+	GpuProfileScope(const GpuProfileScope&) = delete;
+	GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+
+	~GpuProfileScope()
+	{
+		if (open)
+			Profiler::instance().endGpuZone();
+	}
+
+private:
+	bool open;
+};
+
+#ifndef PROFILER_DISABLED
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#endif
+#endif // !PROFILER_H
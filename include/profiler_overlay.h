@@ -0,0 +1,102 @@
+#ifndef PROFILER_OVERLAY_H
+#define PROFILER_OVERLAY_H
+
+#include <imgui.h>
+
+#include <profiler.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstdio>
+
+// ImGui window with the CPU/GPU frame time graphs, a timeline of the last frame's CPU zones (one lane per thread,
+// one row per nesting depth) and the GPU zones that came back most recently. Hover a zone for its time.
+inline void drawProfilerOverlay(const Profiler& profiler)
+{
+	ImGui::SetNextWindowSize(ImVec2(720.0f, 420.0f), ImGuiCond_FirstUseEver);
+	if (!ImGui::Begin("Profiler"))
+	{
+		ImGui::End();
+		return;
+	}
+
+	// graphs, oldest frame first
+	float cpu[Profiler::HISTORY], gpu[Profiler::HISTORY];
+	for (unsigned int i = 0; i < Profiler::HISTORY; i++)
+	{
+		const uint64_t frame = profiler.frameIndex + 1 + i;
+		cpu[i] = profiler.cpuFrameMilliseconds[frame % Profiler::HISTORY];
+		gpu[i] = profiler.gpuFrameMilliseconds[frame % Profiler::HISTORY];
+	}
+	char label[64];
+	std::snprintf(label, sizeof(label), "%.2f ms", cpu[Profiler::HISTORY - 1]);
+	ImGui::PlotLines("CPU frame", cpu, Profiler::HISTORY, 0, label, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+	std::snprintf(label, sizeof(label), "%.2f ms", gpu[Profiler::HISTORY - 1]);
+	ImGui::PlotLines("GPU zones", gpu, Profiler::HISTORY, 0, label, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+	if (profiler.droppedGpuFrames > 0)
+		ImGui::Text("GPU results not ready in time: %u frames dropped", profiler.droppedGpuFrames);
+
+	// timeline of the last frame
+	const uint64_t frameStart = profiler.lastFrameStart, frameEnd = profiler.lastFrameEnd;
+	if (frameEnd > frameStart && ImGui::CollapsingHeader("CPU timeline", ImGuiTreeNodeFlags_DefaultOpen))
+	{
+		const float rowHeight = ImGui::GetTextLineHeight() + 4.0f;
+		const float width = ImGui::GetContentRegionAvail().x;
+		const double scale = width / static_cast<double>(frameEnd - frameStart);
+		ImDrawList* drawList = ImGui::GetWindowDrawList();
+
+		profiler.forEachThread([&](const ProfileThreadBuffer& buffer) {
+			uint32_t rows = 0;
+			buffer.visit(frameStart, [&](const ProfileEvent& event) {
+				if (event.start < frameEnd)
+					rows = std::max(rows, event.depth + 1);
+				return true;
+			});
+			if (rows == 0)
+				return;
+
+			ImGui::TextUnformatted(buffer.name.c_str());
+			const ImVec2 origin = ImGui::GetCursorScreenPos();
+			ImGui::Dummy(ImVec2(width, rows * rowHeight));
+			const ImVec2 mouse = ImGui::GetIO().MousePos;
+
+			buffer.visit(frameStart, [&](const ProfileEvent& event) {
+				if (event.start >= frameEnd)
+					return true;
+				const float x0 = origin.x + static_cast<float>((std::max(event.start, frameStart) - frameStart) * scale);
+				const float x1 = std::max(x0 + 1.0f, origin.x + static_cast<float>((std::min(event.end, frameEnd) - frameStart) * scale));
+				const float y0 = origin.y + event.depth * rowHeight;
+				const float y1 = y0 + rowHeight - 1.0f;
+
+				// stable color per zone name
+				const uint32_t hash = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(event.name) * 2654435761u);
+				const ImU32 color = IM_COL32(80 + (hash & 0x7F), 80 + ((hash >> 8) & 0x7F), 80 + ((hash >> 16) & 0x7F), 255);
+				drawList->AddRectFilled(ImVec2(x0, y0), ImVec2(x1, y1), color);
+
+				const ImVec2 textSize = ImGui::CalcTextSize(event.name);
+				if (textSize.x + 4.0f < x1 - x0)
+					drawList->AddText(ImVec2(x0 + 2.0f, y0 + 2.0f), IM_COL32(0, 0, 0, 255), event.name);
+				if (mouse.x >= x0 && mouse.x < x1 && mouse.y >= y0 && mouse.y < y1)
+					ImGui::SetTooltip("%s: %.3f ms", event.name, (event.end - event.start) * 1e-6);
+				return true;
+			});
+		});
+	}
+
+	if (ImGui::CollapsingHeader("GPU zones", ImGuiTreeNodeFlags_DefaultOpen))
+	{
+		uint64_t total = 0;
+		for (unsigned int i = 0; i < profiler.lastGpuZoneCount; i++)
+			total += profiler.lastGpuZones[i].nanoseconds;
+		for (unsigned int i = 0; i < profiler.lastGpuZoneCount; i++)
+		{
+			const GpuProfileEvent& zone = profiler.lastGpuZones[i];
+			std::snprintf(label, sizeof(label), "%s %.3f ms", zone.name, zone.nanoseconds * 1e-6);
+			ImGui::ProgressBar(total > 0 ? static_cast<float>(zone.nanoseconds) / total : 0.0f, ImVec2(-1.0f, 0.0f), label);
+		}
+	}
+
+	ImGui::End();
+}
+#endif // !PROFILER_OVERLAY_H
@@ -0,0 +1,194 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <mesh.h>
+#include <shader.h>
+#include <state_cache.h>
+#include <uniform_ring.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using std::vector;
+
+// passes are drawn in this order, the highest bits of the sort key
+enum class RenderPass : unsigned int {
+	Opaque,
+	Transparent,		// back to front instead of front to back
+	Count
+};
+
+// one draw: what to draw, with which program and Object constants, and where it sorts
+struct DrawPacket {
+	uint64_t key;
+	Shader* shader;
+	const Mesh* mesh;
+	unsigned int lod;
+	UniformAllocation object;		// the Object block in the frame's UniformRing region
+};
+
+// Draws collected over a frame and submitted in sort key order instead of the order they were found in. The key puts
+// draws of the same program next to each other, then the same material, then the same vertex array, and within those
+// front to back so early depth testing rejects more. Submission goes through a StateCache, so the binds that the
+// sort made redundant never reach the driver.
+class RenderQueue {
+public:
+	// sort key layout, from the most significant bit
+	static constexpr unsigned int PASS_BITS = 4, PROGRAM_BITS = 12, MATERIAL_BITS = 16, VERTEX_ARRAY_BITS = 12, DEPTH_BITS = 20;
+	static constexpr unsigned int DEPTH_SHIFT = 0;
+	static constexpr unsigned int VERTEX_ARRAY_SHIFT = DEPTH_SHIFT + DEPTH_BITS;
+	static constexpr unsigned int MATERIAL_SHIFT = VERTEX_ARRAY_SHIFT + VERTEX_ARRAY_BITS;
+	static constexpr unsigned int PROGRAM_SHIFT = MATERIAL_SHIFT + MATERIAL_BITS;
+	static constexpr unsigned int PASS_SHIFT = PROGRAM_SHIFT + PROGRAM_BITS;
+
+	StateCache state;
+
+	// program names, material keys and VAO names only keep their low bits. Two that share them sort together, which
+	// costs a few binds but never a wrong draw, the packet still carries the real ones
+	static uint64_t makeKey(RenderPass pass, GLuint program, uint64_t material, GLuint vertexArray, float depth)
+	{
+		const uint64_t maxDepth = (uint64_t(1) << DEPTH_BITS) - 1;
+		uint64_t quantized = static_cast<uint64_t>(std::clamp(depth, 0.0f, 1.0f) * maxDepth);
+		if (pass == RenderPass::Transparent)
+			quantized = maxDepth - quantized;
+		return (uint64_t(pass) & field(PASS_BITS)) << PASS_SHIFT
+			| (uint64_t(program) & field(PROGRAM_BITS)) << PROGRAM_SHIFT
+			| (material & field(MATERIAL_BITS)) << MATERIAL_SHIFT
+			| (uint64_t(vertexArray) & field(VERTEX_ARRAY_BITS)) << VERTEX_ARRAY_SHIFT
+			| quantized << DEPTH_SHIFT;
+	}
+
+	// depth in keys is the distance to position over farPlane
+	void setView(const glm::vec3& position, float farPlane)
+	{
+		viewPosition = position;
+		inverseFar = farPlane > 0.0f ? 1.0f / farPlane : 0.0f;
+	}
+
+	void clear()
+	{
+		packets.clear();
+		order.clear();
+	}
+
+	void reserve(size_t count)
+	{
+		packets.reserve(count);
+		order.reserve(count);
+		scratch.reserve(count);
+	}
+
+	// center is the world space point the draw is sorted by, usually its bounding sphere's
+	void push(RenderPass pass, Shader& shader, const Mesh& mesh, unsigned int lod, const UniformAllocation& object, const glm::vec3& center)
+	{
+		const float depth = glm::length(center - viewPosition) * inverseFar;
+		push({ makeKey(pass, shader.ID, mesh.material->key(), mesh.VAO, depth), &shader, &mesh, lod, object });
+	}
+
+	void push(const DrawPacket& packet)
+	{
+		packets.push_back(packet);
+	}
+
+	size_t size() const
+	{
+		return packets.size();
+	}
+
+	// LSD radix sort of the keys, 8 bits a pass. Passes where every key has the same byte are skipped, with few
+	// programs and passes the top bytes usually are. Stable, so equal keys keep the order they were pushed in
+	void sort()
+	{
+		PROFILE_SCOPE("RenderQueue::sort");
+		const size_t count = packets.size();
+		order.resize(count);
+		scratch.resize(count);
+		for (size_t i = 0; i < count; i++)
+			order[i] = { packets[i].key, static_cast<uint32_t>(i) };
+
+		// every histogram in one read of the keys
+		uint32_t histograms[8][256];
+		std::memset(histograms, 0, sizeof(histograms));
+		for (const SortEntry& entry : order)
+			for (unsigned int pass = 0; pass < 8; pass++)
+				histograms[pass][(entry.key >> (pass * 8)) & 0xFF]++;
+
+		for (unsigned int pass = 0; pass < 8; pass++)
+		{
+			uint32_t* histogram = histograms[pass];
+			if (count == 0 || histogram[(order[0].key >> (pass * 8)) & 0xFF] == count)
+				continue;
+
+			uint32_t offset = 0;
+			for (unsigned int bucket = 0; bucket < 256; bucket++)
+			{
+				const uint32_t size = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += size;
+			}
+			for (const SortEntry& entry : order)
+				scratch[histogram[(entry.key >> (pass * 8)) & 0xFF]++] = entry;
+			order.swap(scratch);
+		}
+	}
+
+	// std::stable_sort of the same entries, what sort() is measured and checked against
+	void sortReference()
+	{
+		order.resize(packets.size());
+		for (size_t i = 0; i < packets.size(); i++)
+			order[i] = { packets[i].key, static_cast<uint32_t>(i) };
+		std::stable_sort(order.begin(), order.end(), [](const SortEntry& a, const SortEntry& b) { return a.key < b.key; });
+	}
+
+	// the packet indices in draw order after sort()
+	vector<uint32_t> sortedIndices() const
+	{
+		vector<uint32_t> indices(order.size());
+		for (size_t i = 0; i < order.size(); i++)
+			indices[i] = order[i].index;
+		return indices;
+	}
+
+	// draws every packet in the order of the last sort(). The cache starts from nothing, state set since the last
+	// submit is unknown, and its stats count this submit only. The vertex array is unbound at the end like Mesh::Draw does
+	void submit(const UniformRing& uniforms)
+	{
+		PROFILE_SCOPE("RenderQueue::submit");
+		state.invalidate();
+		state.resetStats();
+		for (const SortEntry& entry : order)
+		{
+			const DrawPacket& packet = packets[entry.index];
+			state.useProgram(*packet.shader);
+			state.bindUniformRange(OBJECT_UNIFORM_BINDING, uniforms.bufferID(), packet.object.offset, packet.object.size);
+			packet.mesh->Draw(*packet.shader, state, packet.lod);
+		}
+		state.bindVertexArray(0);
+	}
+
+private:
+	struct SortEntry {
+		uint64_t key;
+		uint32_t index;
+	};
+
+	static constexpr uint64_t field(unsigned int bits)
+	{
+		return (uint64_t(1) << bits) - 1;
+	}
+
+	vector<DrawPacket> packets;
+	vector<SortEntry> order;
+	vector<SortEntry> scratch;
+	glm::vec3 viewPosition = glm::vec3(0.0f);
+	float inverseFar = 0.01f;
+};
+#endif // !RENDER_QUEUE_H
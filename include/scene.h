@@ -0,0 +1,251 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+
+#include <model.h>
+#include <shader.h>
+#include <bounds.h>
+#include <bvh.h>
+#include <frustum_culling.h>
+#include <lod.h>
+#include <texture_streamer.h>
+#include <uniform_ring.h>
+#include <render_queue.h>
+#include <transform_stage.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+using std::vector;
+
+// closest hit of Scene::pick
+struct ScenePick {
+	unsigned int instance = 0;
+	unsigned int mesh = 0;
+	unsigned int triangle = 0;
+	float distance = 0.0f;
+	glm::vec3 point = glm::vec3(0.0f);
+};
+
+// The models drawn by main.cpp, each placed with a model matrix. Every mesh of every instance is one item
+// of a BVH, which answers frustum culling and picking queries.
+class Scene {
+public:
+	// returns the instance index
+	unsigned int add(Model& model, const glm::mat4& transform)
+	{
+		Instance instance;
+		instance.model = &model;
+		instance.transform = transform;
+		instance.inverseTransform = glm::inverse(transform);
+		instance.scale = maxScale(transform);
+		instance.firstItem = static_cast<uint32_t>(items.size());
+		instances.push_back(instance);
+		transforms.add(transform);
+
+		for (unsigned int mesh = 0; mesh < model.meshes.size(); mesh++)
+			items.push_back({ static_cast<uint32_t>(instances.size() - 1), mesh });
+		rebuild = true;
+		return static_cast<unsigned int>(instances.size() - 1);
+	}
+
+	void setTransform(unsigned int index, const glm::mat4& transform)
+	{
+		Instance& instance = instances[index];
+		instance.transform = transform;
+		instance.inverseTransform = glm::inverse(transform);
+		instance.scale = maxScale(transform);
+		transforms.set(index, transform);
+		if (rebuild)
+			return;
+		for (uint32_t item = instance.firstItem; item < instance.firstItem + instance.model->meshes.size(); item++)
+			bvh.update(item, worldBox(item));
+	}
+
+	// first matrix of the instance's bones in the bone palette, see AnimationSystem::paletteOffset
+	void setBonePalette(unsigned int index, unsigned int paletteOffset)
+	{
+		instances[index].palette = paletteOffset;
+	}
+
+	// full binned SAH build after instances were added, otherwise a refit of the moved items
+	void update()
+	{
+		if (rebuild)
+		{
+			vector<BoundingBox> boxes(items.size());
+			for (uint32_t item = 0; item < items.size(); item++)
+				boxes[item] = worldBox(item);
+			bvh.build(boxes);
+			rebuild = false;
+		}
+		else
+			bvh.refit();
+	}
+
+	// queues a draw for every mesh whose world box touches the culler's frustum, counted in culler.stats. With a
+	// selection every mesh is drawn at the coarsest LOD whose projected error stays under its pixel threshold, counted
+	// in lodStats. The Object constants of the draws are written to uniforms with the matrices the transform stage
+	// computed for every instance under viewProjection, the queue sorts and submits them
+	void enqueue(RenderQueue& queue, Shader& shader, UniformRing& uniforms, FrustumCuller& culler, const glm::mat4& viewProjection, const LODSelection* selection = nullptr, LODStats* lodStats = nullptr)
+	{
+		transforms.update(viewProjection);
+
+		{
+			PROFILE_SCOPE("Scene::cull");
+			update();
+
+			visible.clear();
+			bvh.queryFrustum(culler.frustum(), visible);
+			// back in instance order, so the Object constants are only written once per instance
+			std::sort(visible.begin(), visible.end());
+		}
+
+		PROFILE_SCOPE("Scene::enqueue");
+		uint32_t currentInstance = std::numeric_limits<uint32_t>::max();
+		UniformAllocation object;
+		for (uint32_t item : visible)
+		{
+			const Item& entry = items[item];
+			const Instance& instance = instances[entry.instance];
+			const Mesh& mesh = instance.model->meshes[entry.mesh];
+			// full vertices share the constants of their instance, compact ones also carry their own bounds and skinned ones their palette
+			if (entry.instance != currentInstance || mesh.format == VertexFormat::Compact || mesh.hasBones)
+			{
+				currentInstance = entry.instance;
+				object = uniforms.push(mesh.objectConstants(instance.transform, transforms.normalMatrix(entry.instance), transforms.modelViewProjection(entry.instance), instance.palette));
+			}
+			const BoundingSphere sphere = mesh.bounds.sphere.transformed(instance.transform);
+			const unsigned int lod = selection && !mesh.lods.empty() ? selection->select(sphere, instance.scale, mesh.lods) : 0;
+			queue.push(RenderPass::Opaque, shader, mesh, lod, object, sphere.center);
+			if (lodStats)
+			{
+				lodStats->meshes[lod]++;
+				lodStats->triangles[lod] += static_cast<unsigned int>(mesh.indexCount(lod) / 3);
+			}
+		}
+
+		culler.stats.tested += static_cast<unsigned int>(items.size());
+		culler.stats.visible += static_cast<unsigned int>(visible.size());
+		culler.stats.culled += static_cast<unsigned int>(items.size() - visible.size());
+	}
+
+	// asks the streamer for the mip level each texture of the meshes in the frustum needs, from the mesh's uv density
+	// and how large it is on screen. Runs its own query, so it also serves packed drawing
+	void requestTextures(TextureStreamer& streamer, const Frustum& frustum, const LODSelection& selection)
+	{
+		PROFILE_SCOPE("Scene::requestTextures");
+		update();
+
+		streamed.clear();
+		bvh.queryFrustum(frustum, streamed);
+		for (uint32_t item : streamed)
+		{
+			const Instance& instance = instances[items[item].instance];
+			const Mesh& mesh = instance.model->meshes[items[item].mesh];
+			// nearest point of the sphere, like LOD selection
+			const BoundingSphere sphere = mesh.bounds.sphere.transformed(instance.transform);
+			const float distance = std::max(glm::length(sphere.center - selection.cameraPosition) - sphere.radius, 1e-3f);
+			// uv units per object unit over pixels per object unit
+			const float uvPerPixel = mesh.uvDensity * distance / (instance.scale * selection.projectionScale);
+			for (const Texture& texture : mesh.textures)
+				streamer.request(texture.id, uvPerPixel);
+		}
+	}
+
+	// triangle accurate closest hit along a world space ray, the BVH narrows it down to the candidate meshes
+	bool pick(const Ray& ray, ScenePick& result)
+	{
+		update();
+
+		ScenePick closest;
+		auto intersect = [&](uint32_t item, const Ray& worldRay, float maxDistance) {
+			const Item& entry = items[item];
+			const Instance& instance = instances[entry.instance];
+			const Mesh& mesh = instance.model->meshes[entry.mesh];
+
+			// object space ray with an unnormalized direction, so distances stay in world units
+			Ray local;
+			local.origin = glm::vec3(instance.inverseTransform * glm::vec4(worldRay.origin, 1.0f));
+			local.direction = glm::vec3(instance.inverseTransform * glm::vec4(worldRay.direction, 0.0f));
+
+			float hit = -1.0f;
+			for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+			{
+				const float t = intersectTriangle(local, mesh.vertices[mesh.indices[i]].Position,
+					mesh.vertices[mesh.indices[i + 1]].Position, mesh.vertices[mesh.indices[i + 2]].Position);
+				if (t >= 0.0f && t < maxDistance)
+				{
+					maxDistance = t;
+					hit = t;
+					closest.instance = entry.instance;
+					closest.mesh = entry.mesh;
+					closest.triangle = static_cast<unsigned int>(i / 3);
+				}
+			}
+			return hit;
+		};
+
+		float distance = 0.0f;
+		if (bvh.raycast(ray, intersect, distance) == std::numeric_limits<uint32_t>::max())
+			return false;
+
+		closest.distance = distance;
+		closest.point = ray.origin + ray.direction * distance;
+		result = closest;
+		return true;
+	}
+
+	const BVH& hierarchy() const
+	{
+		return bvh;
+	}
+
+	const TransformStageStats& transformStats() const
+	{
+		return transforms.stats;
+	}
+
+private:
+	struct Instance {
+		Model* model;
+		glm::mat4 transform;
+		glm::mat4 inverseTransform;
+		// largest axis scale of transform, scales the object space LOD errors
+		float scale;
+		uint32_t firstItem;
+		unsigned int palette = NO_BONE_PALETTE;
+	};
+
+	struct Item {
+		uint32_t instance;
+		uint32_t mesh;
+	};
+
+	static float maxScale(const glm::mat4& transform)
+	{
+		return std::sqrt(std::max(glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+			std::max(glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])), glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])))));
+	}
+
+	BoundingBox worldBox(uint32_t item) const
+	{
+		const Instance& instance = instances[items[item].instance];
+		return instance.model->meshes[items[item].mesh].bounds.box.transformed(instance.transform);
+	}
+
+	vector<Instance> instances;
+	vector<Item> items;
+	vector<uint32_t> visible;
+	vector<uint32_t> streamed;
+	// world, normal and model view projection matrices by instance index
+	TransformStage transforms;
+	BVH bvh;
+	bool rebuild = false;
+};
+#endif // !SCENE_H
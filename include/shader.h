@@ -4,20 +4,76 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <shader_cache.h>
+#include <profiler.h>
+
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <source_location>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// FNV-1a, usable at compile time so literal uniform names are hashed by the compiler
+constexpr uint64_t hashName(std::string_view name, uint64_t hash = 14695981039346656037ull)
+{
+	for (char c : name)
+	{
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// a hashed uniform name, write "model"_uniform to hash it at compile time
+struct UniformName {
+	uint64_t hash;
+	constexpr explicit UniformName(uint64_t hash) : hash(hash) {}
+};
+
+consteval UniformName operator""_uniform(const char* name, size_t length)
+{
+	return UniformName(hashName(std::string_view(name, length)));
+}
+
+// a resolved uniform location, setters taking one go straight to glUniform*
+struct UniformLocation {
+	GLint value = -1;
+};
+
+struct UniformInfo {
+	uint64_t hash;
+	GLint location;
+	GLenum type;
+	GLint size;
+};
+
+struct UniformBlockInfo {
+	uint64_t hash;
+	GLuint index;
+	GLint binding;
+	GLint dataSize;
+};
 
 class Shader
 {
 public:
 	unsigned int ID;
+	// the Material whose sampler uniforms are currently set on this program, see Material::bind
+	mutable uint64_t currentMaterial = 0;
 
-	// constructor generates the shader on the fly
-	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+	// constructor generates the shader on the fly. Only the submission happens here: the program comes out of the
+	// shader cache or is handed to the compiler, and errors, reflection and caching wait for the first use (finalize),
+	// so programs created back to back compile in parallel with whatever the caller does next.
+	// Every define is inserted as "#define <define>" right after the #version line of each stage.
+	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::vector<std::string>& defines = {})
+		: vertexPath(vertexPath), fragmentPath(fragmentPath), geometryPath(geometryPath ? geometryPath : "")
 	{
+		PROFILE_SCOPE("Shader::submit");
+
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
 		std::string fragmentCode;
@@ -64,130 +120,227 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
 		}
-		const char* vShaderCode = vertexCode.c_str();
-		const char* fShaderCode = fragmentCode.c_str();
-
-		// 2. compile shaders
-		unsigned int vertex, fragment;
-
-		// vertex shader
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
-		glCompileShader(vertex);
-		checkCompileErrors(vertex, "VERTEX");
-
-		// fragment Shader
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
-		glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
-
-		// if geometry shader is given, compile geometry shader
-		unsigned int geometry;
-		if (geometryPath != nullptr)
+		insertDefines(vertexCode, defines);
+		insertDefines(fragmentCode, defines);
+		insertDefines(geometryCode, defines);
+
+		const std::string codes[STAGE_COUNT] = { vertexCode, fragmentCode, geometryCode, "" };
+		submit(codes);
+	}
+
+	// a compute program, use() it and glDispatchCompute. Goes through the same cache and deferred finalize
+	static Shader compute(const char* computePath, const std::vector<std::string>& defines = {})
+	{
+		PROFILE_SCOPE("Shader::submit");
+		Shader shader;
+		shader.computePath = computePath;
+
+		std::string computeCode;
+		std::ifstream cShaderFile;
+		cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
 		{
-			const char* gShaderCode = geometryCode.c_str();
-			geometry = glCreateShader(GL_GEOMETRY_SHADER);
-			glShaderSource(geometry, 1, &gShaderCode, NULL);
-			glCompileShader(geometry);
-			checkCompileErrors(geometry, "GEOMETRY");
+			cShaderFile.open(computePath);
+			std::stringstream cShaderStream;
+			cShaderStream << cShaderFile.rdbuf();
+			cShaderFile.close();
+			computeCode = cShaderStream.str();
 		}
+		catch (std::ifstream::failure& e)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+		}
+		insertDefines(computeCode, defines);
 
-		// shader Program
-		ID = glCreateProgram();
-		glAttachShader(ID, vertex);
-		glAttachShader(ID, fragment);
-		if (geometryPath != nullptr)
-			glAttachShader(ID, geometry);
+		const std::string codes[STAGE_COUNT] = { "", "", "", computeCode };
+		shader.submit(codes);
+		return shader;
+	}
 
-		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
+	// false while the driver is still compiling or linking, so callers can poll instead of blocking in finalize
+	bool ready() const
+	{
+		return !pending || ShaderCache::shared().completed(ID);
+	}
+
+	// checks the compile and link results, stores a freshly linked binary in the shader cache and reflects the
+	// uniforms. Called by everything that needs the linked program, blocks until the driver is done with it
+	void finalize() const
+	{
+		if (!pending)
+			return;
+		pending = false;
+		PROFILE_SCOPE("Shader::finalize");
+
+		bool linked = true;
+		if (!fromCache)
+		{
+			static const char* const stageNames[STAGE_COUNT] = { "VERTEX", "FRAGMENT", "GEOMETRY", "COMPUTE" };
+			for (unsigned int i = 0; i < STAGE_COUNT; i++)
+				if (stages[i])
+					checkCompileErrors(stages[i], stageNames[i]);
+			linked = checkCompileErrors(ID, "PROGRAM");
+			if (linked && ShaderCache::shared().enabled())
+				ShaderCache::shared().store(cacheKey, ID);
+
+			// delete the shaders as they're linked into our program now and no longer necessary
+			for (GLuint& stage : stages)
+			{
+				if (stage)
+					glDeleteShader(stage);
+				stage = 0;
+			}
+		}
+		if (linked)
+			reflect();
 
 #ifdef _DEBUG
+		if (!computePath.empty())
+		{
+			std::cout << "SUCCESSFULLY::SHADER::SUCCESSFULLY_LINK_AND_COMPILE_SHADER\n"
+				<< "    SHADER_ID: " << ID << (fromCache ? " (shader cache)" : "") << "\n"
+				<< "    COMPUTE_SHADER_PATH: " << computePath << "\n";
+			return;
+		}
 		std::cout << "SUCCESSFULLY::SHADER::SUCCESSFULLY_LINK_AND_COMPILE_SHADER\n"
-			<< "    SHADER_ID: " << ID << "\n"
+			<< "    SHADER_ID: " << ID << (fromCache ? " (shader cache)" : "") << "\n"
 			<< "    VERTEX_SHADER_PATH: " << vertexPath << "\n"
 			<< "    FRAGMENT_SAHDER_PATH: " << fragmentPath << "\n"
-			<< "    GEOMETRY_SHADER_PATH: " << ((geometryPath == nullptr) ? "NULL" : geometryPath) << "\n";
+			<< "    GEOMETRY_SHADER_PATH: " << (geometryPath.empty() ? "NULL" : geometryPath) << "\n";
 #endif
+	}
 
-		// delete the shaders as they're linked into our program now and no longer necessary
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
-		if (geometryPath != nullptr)
-			glDeleteShader(geometry);
+	bool loadedFromCache() const
+	{
+		return fromCache;
 	}
 
 	// activate the shader
 	void use() const
 	{
+		finalize();
 		glUseProgram(ID);
 	}
 
+	// looks a uniform up in the table reflected at link time, -1 (ignored by glUniform*) if it isn't active
+	UniformLocation location(UniformName name) const
+	{
+		finalize();
+		auto it = std::lower_bound(uniforms.begin(), uniforms.end(), name.hash, [](const UniformInfo& info, uint64_t hash) { return info.hash < hash; });
+		if (it == uniforms.end() || it->hash != name.hash)
+			return UniformLocation();
+		return UniformLocation{ it->location };
+	}
+	UniformLocation location(std::string_view name) const
+	{
+		return location(UniformName(hashName(name)));
+	}
+	UniformLocation location(UniformLocation location) const
+	{
+		return location;
+	}
+
+	// the binding point of a uniform block, -1 if the block isn't active
+	GLint uniformBlockBinding(std::string_view name) const
+	{
+		finalize();
+		const uint64_t hash = hashName(name);
+		for (const UniformBlockInfo& block : uniformBlocks)
+			if (block.hash == hash)
+				return block.binding;
+		return -1;
+	}
+
+	const std::vector<UniformInfo>& activeUniforms() const
+	{
+		finalize();
+		return uniforms;
+	}
+
+	const std::vector<UniformBlockInfo>& activeUniformBlocks() const
+	{
+		finalize();
+		return uniformBlocks;
+	}
+
 	// utility uniform functions
-	void setBool(const std::string& name, bool value) const
+	// Name can be a string (hashed at runtime), a "literal"_uniform (hashed at compile time) or a UniformLocation;
+	// none of them ask the driver for the location.
+	template <class Name>
+	void setBool(const Name& name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		glUniform1i(location(name).value, (int)value);
 	}
 
-	void setInt(const std::string& name, int value) const
+	template <class Name>
+	void setInt(const Name& name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1i(location(name).value, value);
 	}
 
-	void setFloat(const std::string& name, float value) const
+	template <class Name>
+	void setFloat(const Name& name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1f(location(name).value, value);
 	}
 
-	void setVec2(const std::string& name, const glm::vec2& value) const
+	template <class Name>
+	void setVec2(const Name& name, const glm::vec2& value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform2fv(location(name).value, 1, &value[0]);
 	}
-	void setVec2(const std::string& name, float x, float y) const
+	template <class Name>
+	void setVec2(const Name& name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		glUniform2f(location(name).value, x, y);
 	}
 
-	void setVec3(const std::string& name, const glm::vec3& value) const
+	template <class Name>
+	void setVec3(const Name& name, const glm::vec3& value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform3fv(location(name).value, 1, &value[0]);
 	}
-	void setVec3(const std::string& name, float x, float y, float z) const
+	template <class Name>
+	void setVec3(const Name& name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform3f(location(name).value, x, y, z);
 	}
 
-	void setVec4(const std::string& name, const glm::vec4& value) const
+	template <class Name>
+	void setVec4(const Name& name, const glm::vec4& value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform4fv(location(name).value, 1, &value[0]);
 	}
-	void setVec4(const std::string& name, float x, float y, float z, float w) const
+	template <class Name>
+	void setVec4(const Name& name, float x, float y, float z, float w) const
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		glUniform4f(location(name).value, x, y, z, w);
 	}
 
-	void setMat2(const std::string& name, const glm::mat2& mat) const
+	template <class Name>
+	void setMat2(const Name& name, const glm::mat2& mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix2fv(location(name).value, 1, GL_FALSE, &mat[0][0]);
 	}
 
-	void setMat3(const std::string& name, const glm::mat3& mat) const
+	template <class Name>
+	void setMat3(const Name& name, const glm::mat3& mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix3fv(location(name).value, 1, GL_FALSE, &mat[0][0]);
 	}
 
-	void setMat4(const std::string& name, const glm::mat4& mat) const
+	template <class Name>
+	void setMat4(const Name& name, const glm::mat4& mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix4fv(location(name).value, 1, GL_FALSE, &mat[0][0]);
 	}
 
 	void setDirLight(const glm::vec3& direction, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular)
 	{
-		setVec3("dirLight.direction", direction);
-		setVec3("dirLight.ambient", ambient);
-		setVec3("dirLight.diffuse", diffuse);
-		setVec3("dirLight.specular", specular);
+		setVec3("dirLight.direction"_uniform, direction);
+		setVec3("dirLight.ambient"_uniform, ambient);
+		setVec3("dirLight.diffuse"_uniform, diffuse);
+		setVec3("dirLight.specular"_uniform, specular);
 	}
 	void setDirLight(const int index, const glm::vec3& direction, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular)
 	{
@@ -200,13 +353,13 @@ public:
 
 	void setPointLight(const glm::vec3& position, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular, const float constant, const float linear, const float quadratic)
 	{
-		setVec3("pointLights.position", position);
-		setVec3("pointLights.ambient", ambient);
-		setVec3("pointLights.diffuse", diffuse);
-		setVec3("pointLights.specular", specular);
-		setFloat("pointLights.constant", constant);
-		setFloat("pointLights.linear", linear);
-		setFloat("pointLights.quadratic", quadratic);
+		setVec3("pointLights.position"_uniform, position);
+		setVec3("pointLights.ambient"_uniform, ambient);
+		setVec3("pointLights.diffuse"_uniform, diffuse);
+		setVec3("pointLights.specular"_uniform, specular);
+		setFloat("pointLights.constant"_uniform, constant);
+		setFloat("pointLights.linear"_uniform, linear);
+		setFloat("pointLights.quadratic"_uniform, quadratic);
 	}
 	void setPointLight(const int index, const glm::vec3& position, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular, const float constant, const float linear, const float quadratic)
 	{
@@ -222,16 +375,16 @@ public:
 
 	void setSpotLight(const glm::vec3& position, const glm::vec3& direction, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular, const float constant, const float linear, const float quadratic, const float cutOff, const float outerCutOff)
 	{
-		setVec3("spotLight.position", position);
-		setVec3("spotLight.direction", direction);
-		setVec3("spotLight.ambient", ambient);
-		setVec3("spotLight.diffuse", diffuse);
-		setVec3("spotLight.specular", specular);
-		setFloat("spotLight.constant", constant);
-		setFloat("spotLight.linear", linear);
-		setFloat("spotLight.quadratic", quadratic);
-		setFloat("spotLight.cutOff", cutOff);
-		setFloat("spotLight.outerCutOff", outerCutOff);
+		setVec3("spotLight.position"_uniform, position);
+		setVec3("spotLight.direction"_uniform, direction);
+		setVec3("spotLight.ambient"_uniform, ambient);
+		setVec3("spotLight.diffuse"_uniform, diffuse);
+		setVec3("spotLight.specular"_uniform, specular);
+		setFloat("spotLight.constant"_uniform, constant);
+		setFloat("spotLight.linear"_uniform, linear);
+		setFloat("spotLight.quadratic"_uniform, quadratic);
+		setFloat("spotLight.cutOff"_uniform, cutOff);
+		setFloat("spotLight.outerCutOff"_uniform, outerCutOff);
 	}
 	void setSpotLight(const int index, const glm::vec3& position, const glm::vec3& direction, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular, const float constant, const float linear, const float quadratic, const float cutOff, const float outerCutOff)
 	{
@@ -248,8 +401,143 @@ public:
 		setFloat(prefix + "].outerCutOff", outerCutOff);
 	}
 private:
+	// vertex, fragment, geometry, compute
+	static constexpr unsigned int STAGE_COUNT = 4;
+	static constexpr unsigned int COMPUTE_STAGE = 3;
+
+	std::string vertexPath, fragmentPath, geometryPath, computePath;
+	uint64_t cacheKey = 0;
+	bool fromCache = false;
+	// filled in by finalize on first use
+	mutable bool pending = true;
+	mutable GLuint stages[STAGE_COUNT] = {};
+	mutable std::vector<UniformInfo> uniforms;			// sorted by hash
+	mutable std::vector<UniformBlockInfo> uniformBlocks;
+
+	Shader() = default;
+
+	// 2. the key covers everything the binary depends on, a driver update gives every program a new key
+	void submit(const std::string (&codes)[STAGE_COUNT])
+	{
+		ShaderCache& cache = ShaderCache::shared();
+		const bool cached = cache.enabled();
+		cacheKey = hashName(cache.driver());
+		// the compute source only joins the key when there is one, so graphics programs keep their cached binaries
+		for (unsigned int i = 0; i < STAGE_COUNT; i++)
+			if (i != COMPUTE_STAGE || !codes[i].empty())
+				cacheKey = hashName(std::string_view(codes[i].c_str(), codes[i].size() + 1), cacheKey);
+
+		ID = glCreateProgram();
+		if (cached && cache.load(cacheKey, ID))
+		{
+			fromCache = true;
+			return;
+		}
+		if (cached)
+		{
+			// a rejected binary leaves the program failed to link, start over with a fresh one
+			glDeleteProgram(ID);
+			ID = glCreateProgram();
+			glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+
+		// 3. compile shaders, the results are only checked in finalize. Vertex and fragment always, geometry and
+		// compute if given
+		static const GLenum stageTypes[STAGE_COUNT] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER, GL_COMPUTE_SHADER };
+		const bool compute = !codes[COMPUTE_STAGE].empty();
+		for (unsigned int i = 0; i < STAGE_COUNT; i++)
+		{
+			const bool present = compute ? i == COMPUTE_STAGE : i < 2 || (i == 2 && !geometryPath.empty());
+			if (!present)
+				continue;
+			const char* code = codes[i].c_str();
+			stages[i] = glCreateShader(stageTypes[i]);
+			glShaderSource(stages[i], 1, &code, NULL);
+			glCompileShader(stages[i]);
+		}
+
+		// shader Program
+		for (GLuint stage : stages)
+			if (stage)
+				glAttachShader(ID, stage);
+		glLinkProgram(ID);
+	}
+
+	// "#define X" lines go after #version, which has to stay the first statement
+	static void insertDefines(std::string& code, const std::vector<std::string>& defines)
+	{
+		if (code.empty() || defines.empty())
+			return;
+		std::string block;
+		for (const std::string& define : defines)
+			block += "#define " + define + "\n";
+		const size_t version = code.find("#version");
+		const size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+		if (version == std::string::npos)
+			code.insert(0, block);
+		else if (lineEnd == std::string::npos)
+			code += "\n" + block;
+		else
+			code.insert(lineEnd + 1, block);
+	}
+
+	// builds the uniform table once after linking, every element of an array gets its own entry
+	void reflect() const
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::string name(std::max(maxLength, 1), '\0');
+
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(ID, i, maxLength, &length, &size, &type, name.data());
+			std::string_view uniformName(name.data(), length);
+
+			// uniforms inside blocks have no location
+			GLint location = glGetUniformLocation(ID, name.c_str());
+			if (location < 0)
+				continue;
+
+			// arrays are reported as "name[0]", register "name" and every element
+			const bool isArray = uniformName.size() > 3 && uniformName.substr(uniformName.size() - 3) == "[0]";
+			if (!isArray)
+			{
+				uniforms.push_back({ hashName(uniformName), location, type, size });
+				continue;
+			}
+			std::string_view baseName = uniformName.substr(0, uniformName.size() - 3);
+			uniforms.push_back({ hashName(baseName), location, type, size });
+			for (GLint element = 0; element < size; element++)
+			{
+				std::string elementName = std::string(baseName) + "[" + std::to_string(element) + "]";
+				uniforms.push_back({ hashName(elementName), glGetUniformLocation(ID, elementName.c_str()), type, 1 });
+			}
+		}
+		std::sort(uniforms.begin(), uniforms.end(), [](const UniformInfo& a, const UniformInfo& b) { return a.hash < b.hash; });
+
+		GLint blockCount = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+		name.assign(std::max(maxLength, 1), '\0');
+		for (GLint i = 0; i < blockCount; i++)
+		{
+			GLsizei length = 0;
+			glGetActiveUniformBlockName(ID, i, maxLength, &length, name.data());
+			UniformBlockInfo block;
+			block.hash = hashName(std::string_view(name.data(), length));
+			block.index = i;
+			glGetActiveUniformBlockiv(ID, i, GL_UNIFORM_BLOCK_BINDING, &block.binding);
+			glGetActiveUniformBlockiv(ID, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize);
+			uniformBlocks.push_back(block);
+		}
+	}
+
 	// utility function for checking shader compilation/linking errors.
-	void checkCompileErrors(GLuint shader, std::string type)
+	static bool checkCompileErrors(GLuint shader, std::string type)
 	{
 		GLint success;
 		GLchar infoLog[1024];
@@ -271,6 +559,7 @@ private:
 				std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
+		return success;
 	}
 };
 #endif
\ No newline at end of file
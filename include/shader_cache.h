@@ -0,0 +1,246 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The shader cache keeps linked program binaries (glGetProgramBinary) on disk so warm starts skip the GLSL compiler.
+// Shader computes the key from the sources, the defines and driver(), every program gets its own file:
+//   ShaderCacheHeader
+//   unsigned char binary[binarySize]   in binaryFormat, only meaningful to the driver that wrote it
+// A binary the driver rejects (driver update, different GPU) is deleted and the program is compiled from source.
+
+constexpr uint32_t SHADER_CACHE_MAGIC = 0x53474F54; // "TOGS"
+constexpr uint32_t SHADER_CACHE_VERSION = 1;
+
+// GL_KHR_parallel_shader_compile and GL_ARB_parallel_shader_compile share the enum, our glad has neither
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+struct ShaderCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t binaryFormat;
+	uint32_t binarySize;
+};
+
+struct ShaderCacheStats {
+	unsigned int hits = 0;
+	unsigned int misses = 0;
+	unsigned int rejected = 0;
+	unsigned int stored = 0;
+};
+
+class ShaderCache {
+public:
+	ShaderCacheStats stats;
+
+	static ShaderCache& shared()
+	{
+		static ShaderCache cache;
+		return cache;
+	}
+
+	// directory the binaries are written to, an empty path turns the cache off
+	void setDirectory(const std::string& path)
+	{
+		directory = path;
+	}
+
+	const std::string& cacheDirectory() const
+	{
+		return directory;
+	}
+
+	// needs a current context, drivers without any binary format can't cache
+	bool enabled() const
+	{
+		if (binaryFormats < 0)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+		return !directory.empty() && binaryFormats > 0;
+	}
+
+	// vendor, renderer and version of the current context, part of every key
+	const std::string& driver() const
+	{
+		if (driverString.empty())
+			for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+				driverString.append(reinterpret_cast<const char*>(glGetString(name))).push_back('\n');
+		return driverString;
+	}
+
+	// lets the driver compile and link on its own threads when GL_KHR_parallel_shader_compile (or the ARB version) is
+	// there. Without it glCompileShader/glLinkProgram may still return early, but there is no way to ask if they're done
+	bool enableParallelCompile(GLADloadproc loader)
+	{
+		typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSPROC)(GLuint count);
+		const char* extension = nullptr;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count && !extension; i++)
+		{
+			const std::string_view name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+			if (name == "GL_KHR_parallel_shader_compile")
+				extension = "glMaxShaderCompilerThreadsKHR";
+			else if (name == "GL_ARB_parallel_shader_compile")
+				extension = "glMaxShaderCompilerThreadsARB";
+		}
+		if (!extension)
+			return false;
+
+		PFNGLMAXSHADERCOMPILERTHREADSPROC maxShaderCompilerThreads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSPROC>(loader(extension));
+		if (maxShaderCompilerThreads)
+			maxShaderCompilerThreads(0xFFFFFFFFu); // as many as the driver wants
+		parallel = true;
+		return true;
+	}
+
+	bool parallelCompile() const
+	{
+		return parallel;
+	}
+
+	// true once a program handed to glLinkProgram can be queried without blocking, always true without the extension
+	bool completed(GLuint program) const
+	{
+		if (!parallel)
+			return true;
+		GLint status = GL_TRUE;
+		glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &status);
+		return status == GL_TRUE;
+	}
+
+	// loads the binary stored under key into program, false if there is none or the driver rejects it
+	bool load(uint64_t key, GLuint program)
+	{
+		const std::string path = pathFor(key);
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+		{
+			stats.misses++;
+			return false;
+		}
+		const std::streamoff fileSize = file.tellg();
+		file.seekg(0);
+
+		ShaderCacheHeader header{};
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!file || header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.key != key)
+		{
+			reject(path);
+			return false;
+		}
+		// the size comes from disk, a damaged file must not make us allocate more than the file holds
+		if (header.binarySize == 0 || fileSize < 0 || static_cast<uint64_t>(fileSize) - sizeof(header) != header.binarySize)
+		{
+			reject(path);
+			return false;
+		}
+		std::vector<char> binary(header.binarySize);
+		file.read(binary.data(), binary.size());
+		if (!file)
+		{
+			reject(path);
+			return false;
+		}
+
+		glProgramBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+		GLint success = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			reject(path);
+			return false;
+		}
+		stats.hits++;
+		return true;
+	}
+
+	// writes the binary of a linked program, which must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+	bool store(uint64_t key, GLuint program)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return false;
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, &length, &format, binary.data());
+
+		ShaderCacheHeader header{};
+		header.magic = SHADER_CACHE_MAGIC;
+		header.version = SHADER_CACHE_VERSION;
+		header.key = key;
+		header.binaryFormat = format;
+		header.binarySize = static_cast<uint32_t>(length);
+
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+
+		// write to a temporary file first so a crash never leaves a half written binary behind
+		const std::string path = pathFor(key);
+		const std::string tempPath = path + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(binary.data(), length);
+			if (!file)
+			{
+				std::cerr << "ERROR::SHADER_CACHE::FAILED_TO_WRITE_FILE: " << tempPath << "\n";
+				return false;
+			}
+		}
+
+		std::remove(path.c_str());
+		if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+		{
+			std::cerr << "ERROR::SHADER_CACHE::FAILED_TO_RENAME_FILE: " << tempPath << "\n";
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		stats.stored++;
+		return true;
+	}
+
+	// removes every binary in the cache directory
+	void clear()
+	{
+		std::error_code error;
+		for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error))
+			if (entry.path().extension() == ".shaderbin")
+				std::filesystem::remove(entry.path(), error);
+	}
+
+private:
+	std::string directory;
+	bool parallel = false;
+	mutable GLint binaryFormats = -1;
+	mutable std::string driverString;
+
+	ShaderCache() = default;
+
+	std::string pathFor(uint64_t key) const
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.shaderbin", static_cast<unsigned long long>(key));
+		return directory + "/" + name;
+	}
+
+	void reject(const std::string& path)
+	{
+		stats.rejected++;
+		std::remove(path.c_str());
+	}
+};
+#endif // !SHADER_CACHE_H
@@ -0,0 +1,457 @@
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <mesh.h>
+#include <model.h>
+#include <shader.h>
+#include <bounds.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// uniform block binding of Shadows, after Frame, Object and Clusters
+constexpr GLuint SHADOW_UNIFORM_BINDING = 3;
+
+struct ShadowSettings {
+	unsigned int resolution = 1024;		// texels per side of every cascade
+	unsigned int cascades = 4;			// up to CascadedShadowMap::MAX_CASCADES
+	float distance = 20.0f;				// view depth the last cascade ends at
+	float splitLambda = 0.75f;			// blend of logarithmic (1) and uniform (0) splits
+	float margin = 0.25f;				// extra size of a cascade, so it only moves when the camera leaves it
+};
+
+// the Shadows block, the std140 layout in model_lighting.frag
+struct ShadowConstants {
+	glm::mat4 lightSpaceMatrices[4];
+	glm::vec4 cascadeSplits;		// view depth every cascade ends at
+	glm::vec4 texelSizes;			// world size of a texel of every cascade, scales the normal offset
+	glm::vec4 params;				// x = cascade count, y = 1 / resolution, z = depth bias
+};
+
+struct CascadeStats {
+	unsigned int staticDraws = 0;	// drawn into the static cache, only in frames that rebuilt it
+	unsigned int dynamicDraws = 0;
+	unsigned int culled = 0;		// casters outside the cascade in the last frame
+	bool staticRendered = false;	// the static cache of the cascade was rebuilt in the last frame
+	unsigned int staticRenders = 0;	// since the start
+	double milliseconds = 0.0;		// CPU, culling and submission
+	double gpuMilliseconds = 0.0;	// from timestamp queries a few frames old
+};
+
+// Cascaded shadow maps for the directional light of Shader::setDirLight. The view from near to settings.distance is
+// split into cascades, each fit to the bounding sphere of its slice of the camera frustum and snapped to whole
+// texels in light space, so the shadows do not shimmer when the camera moves. Casters are meshes of models with
+// their model bounds, culled per cascade in light space.
+// Static casters are drawn into a cache layer per cascade that is only rebuilt when the light turns, the static set
+// changes or the camera leaves the cascade's margin and it has to move; every frame the cache is copied into the
+// sampled layer and only the dynamic casters are drawn on top.
+// Typical use, once per frame before the passes that sample it:
+//   shadows.update(view, camera.Zoom, aspect, near); shadows.render(); shadows.bind();
+// and once per shader: shadows.setUniforms(shader).
+class CascadedShadowMap {
+public:
+	static constexpr unsigned int MAX_CASCADES = 4;
+	static constexpr unsigned int SHADOW_UNIT = 13;
+
+	std::array<CascadeStats, MAX_CASCADES> stats;
+
+	explicit CascadedShadowMap(const ShadowSettings& settings = ShadowSettings())
+		: settings(settings),
+		depthShader(R"(resource/shader/shadow_depth.vert)", R"(resource/shader/shadow_depth.frag)")
+	{
+		this->settings.cascades = std::clamp(settings.cascades, 1u, MAX_CASCADES);
+
+		// layers 0 to cascades - 1 are sampled, the ones after them hold the static casters
+		glGenTextures(1, &depthTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, settings.resolution, settings.resolution, 2 * this->settings.cascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		const float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+		// sampler2DArrayShadow compares in the lookup, linear filtering gives 2x2 PCF per tap
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::SHADOW_MAP::FRAMEBUFFER_INCOMPLETE\n";
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		glGenBuffers(1, &shadowUBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, shadowUBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowConstants), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glGenQueries(static_cast<GLsizei>(queries.size() * (MAX_CASCADES + 1)), &queries[0][0]);
+	}
+
+	CascadedShadowMap(const CascadedShadowMap&) = delete;
+	CascadedShadowMap& operator=(const CascadedShadowMap&) = delete;
+
+	~CascadedShadowMap()
+	{
+		glDeleteTextures(1, &depthTexture);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteBuffers(1, &shadowUBO);
+		glDeleteQueries(static_cast<GLsizei>(queries.size() * (MAX_CASCADES + 1)), &queries[0][0]);
+		glDeleteProgram(depthShader.ID);
+	}
+
+	// the direction the light shines in, like Shader::setDirLight takes it
+	void setLight(const glm::vec3& direction)
+	{
+		const glm::vec3 normalized = glm::normalize(direction);
+		if (normalized == lightDirection)
+			return;
+		lightDirection = normalized;
+		// a fixed light space, so cascades only move when the camera makes them
+		const glm::vec3 up = std::abs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		lightView = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+		for (Cascade& cascade : cascades)
+			cascade.valid = false;
+		staticDepthDirty = true;
+	}
+
+	// every mesh of the model casts, static casters are drawn from the cache. Returns the index setTransform takes
+	unsigned int addCaster(const Model& model, const glm::mat4& transform, bool isStatic)
+	{
+		return addCaster(model.meshes, transform, isStatic);
+	}
+
+	unsigned int addCaster(const vector<Mesh>& meshes, const glm::mat4& transform, bool isStatic)
+	{
+		Caster caster;
+		caster.isStatic = isStatic;
+		for (const Mesh& mesh : meshes)
+			caster.meshes.push_back(&mesh);
+		casters.push_back(caster);
+		place(casters.back(), transform);
+		if (isStatic)
+			invalidateStatic();
+		return static_cast<unsigned int>(casters.size() - 1);
+	}
+
+	// moving a static caster rebuilds every cache, setting the transform it already has does not
+	void setTransform(unsigned int index, const glm::mat4& transform)
+	{
+		Caster& caster = casters[index];
+		if (caster.transform == transform)
+			return;
+		place(caster, transform);
+		if (caster.isStatic)
+			invalidateStatic();
+	}
+
+	// redraws the static casters of every cascade in the next render, for meshes that changed in place
+	void invalidate()
+	{
+		for (Cascade& cascade : cascades)
+			cascade.staticValid = false;
+	}
+
+	// fits the cascades to the camera, fovY in degrees like Camera::Zoom
+	void update(const glm::mat4& view, float fovY, float aspect, float near)
+	{
+		PROFILE_SCOPE("CascadedShadowMap::update");
+		const float far = std::max(settings.distance, near * 2.0f);
+		const glm::mat4 inverseView = glm::inverse(view);
+		if (staticDepthDirty)
+			updateStaticDepth();
+
+		float splitNear = near;
+		for (unsigned int i = 0; i < settings.cascades; i++)
+		{
+			// practical split scheme, logarithmic near the camera and more uniform further out
+			const float t = static_cast<float>(i + 1) / settings.cascades;
+			const float splitFar = glm::mix(near + (far - near) * t, near * std::pow(far / near, t), settings.splitLambda);
+			constants.cascadeSplits[i] = splitFar;
+
+			// bounding sphere of the slice, its radius does not change as the camera turns
+			const glm::mat4 sliceToWorld = inverseView * glm::inverse(glm::perspective(glm::radians(fovY), aspect, splitNear, splitFar));
+			glm::vec3 corners[8];
+			glm::vec3 center(0.0f);
+			for (int corner = 0; corner < 8; corner++)
+			{
+				const glm::vec4 point = sliceToWorld * glm::vec4(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f, 1.0f);
+				corners[corner] = glm::vec3(point) / point.w;
+				center += corners[corner] / 8.0f;
+			}
+			float radius = 0.0f;
+			for (const glm::vec3& corner : corners)
+				radius = std::max(radius, glm::length(corner - center));
+			// rounded up, so tiny float differences do not resize the cascade
+			radius = std::ceil(radius * 16.0f) / 16.0f;
+			fit(cascades[i], glm::vec3(lightView * glm::vec4(center, 1.0f)), radius);
+			splitNear = splitFar;
+		}
+		for (unsigned int i = settings.cascades; i < MAX_CASCADES; i++)
+			constants.cascadeSplits[i] = far;
+
+		constants.params = glm::vec4(static_cast<float>(settings.cascades), 1.0f / settings.resolution, 0.0005f, 0.0f);
+		glBindBuffer(GL_UNIFORM_BUFFER, shadowUBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(constants), &constants);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	// rebuilds the static caches that need it and draws the dynamic casters, leaves the framebuffer and viewport as they were
+	void render()
+	{
+		PROFILE_SCOPE("CascadedShadowMap::render");
+		GLint previousFramebuffer = 0, previousViewport[4] = {};
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+		glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, settings.resolution, settings.resolution);
+		// casters between the light and the near plane are flattened onto it instead of clipped
+		glEnable(GL_DEPTH_CLAMP);
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(2.0f, 4.0f);
+		depthShader.use();
+
+		// timestamps around the cascades rather than GL_TIME_ELAPSED, which can't nest inside a PROFILE_GPU_SCOPE
+		const unsigned int current = frame % QUERY_FRAMES;
+		readTimers();
+		glQueryCounter(queries[current][0], GL_TIMESTAMP);
+		for (unsigned int i = 0; i < settings.cascades; i++)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			Cascade& cascade = cascades[i];
+			CascadeStats& cascadeStats = stats[i];
+			cascadeStats.staticDraws = cascadeStats.dynamicDraws = cascadeStats.culled = 0;
+			cascadeStats.staticRendered = false;
+
+			if (!cascade.staticValid)
+			{
+				attach(settings.cascades + i);
+				glClear(GL_DEPTH_BUFFER_BIT);
+				cascadeStats.staticDraws = drawCasters(cascade, true, cascadeStats.culled);
+				cascade.staticValid = true;
+				cascadeStats.staticRendered = true;
+				cascadeStats.staticRenders++;
+			}
+			// the static depth, then the moving casters on top
+			glCopyImageSubData(depthTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, settings.cascades + i,
+				depthTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, settings.resolution, settings.resolution, 1);
+			attach(i);
+			cascadeStats.dynamicDraws = drawCasters(cascade, false, cascadeStats.culled);
+
+			glQueryCounter(queries[current][i + 1], GL_TIMESTAMP);
+			cascadeStats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		queryIssued[current] = true;
+		frame++;
+
+		glPolygonOffset(0.0f, 0.0f);
+		glDisable(GL_POLYGON_OFFSET_FILL);
+		glDisable(GL_DEPTH_CLAMP);
+		glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+		glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+	}
+
+	void bind() const
+	{
+		glBindTextureUnit(SHADOW_UNIT, depthTexture);
+		glBindBufferBase(GL_UNIFORM_BUFFER, SHADOW_UNIFORM_BINDING, shadowUBO);
+	}
+
+	// shaders that are never given the shadow map light without it
+	void setUniforms(const Shader& shader) const
+	{
+		shader.setInt("shadowMap", SHADOW_UNIT);
+		shader.setBool("shadowsEnabled", true);
+	}
+
+	unsigned int cascadeCount() const
+	{
+		return settings.cascades;
+	}
+
+	const glm::mat4& lightSpaceMatrix(unsigned int cascade) const
+	{
+		return constants.lightSpaceMatrices[cascade];
+	}
+
+	unsigned int texture() const
+	{
+		return depthTexture;
+	}
+
+private:
+	static constexpr unsigned int QUERY_FRAMES = 3;
+
+	struct Caster {
+		vector<const Mesh*> meshes;
+		vector<BoundingBox> boxes;		// light space, one per mesh
+		glm::mat4 transform = glm::mat4(1.0f);
+		bool isStatic = false;
+	};
+
+	struct Cascade {
+		glm::vec2 center = glm::vec2(0.0f);	// light space, on the texel grid
+		float halfSize = 0.0f;
+		float radius = 0.0f;
+		float nearDepth = 0.0f, farDepth = 0.0f;	// along the light direction
+		bool valid = false;				// fit to a camera at least once with this light
+		bool staticValid = false;		// the cache layer holds the static casters of this fit
+	};
+
+	ShadowSettings settings;
+	Shader depthShader;
+	glm::vec3 lightDirection = glm::vec3(0.0f);
+	glm::mat4 lightView = glm::mat4(1.0f);
+	vector<Caster> casters;
+	std::array<Cascade, MAX_CASCADES> cascades;
+	ShadowConstants constants{};
+	// light space depth range of the static casters, fixed so the cache stays comparable
+	float staticNear = 0.0f, staticFar = 1.0f;
+	bool staticDepthDirty = true;
+
+	unsigned int depthTexture = 0, framebuffer = 0, shadowUBO = 0;
+	// a timestamp before the first cascade and one after each
+	std::array<std::array<GLuint, MAX_CASCADES + 1>, QUERY_FRAMES> queries{};
+	std::array<bool, QUERY_FRAMES> queryIssued{};
+	unsigned int frame = 0;
+
+	void invalidateStatic()
+	{
+		for (Cascade& cascade : cascades)
+			cascade.staticValid = false;
+		staticDepthDirty = true;
+	}
+
+	void place(Caster& caster, const glm::mat4& transform)
+	{
+		caster.transform = transform;
+		caster.boxes.resize(caster.meshes.size());
+		for (size_t i = 0; i < caster.meshes.size(); i++)
+			caster.boxes[i] = caster.meshes[i]->bounds.box.transformed(lightView * transform);
+	}
+
+	// boxes are in light space, so a new light moves every one of them
+	void updateStaticDepth()
+	{
+		BoundingBox all;
+		for (Caster& caster : casters)
+		{
+			place(caster, caster.transform);
+			if (caster.isStatic)
+				for (const BoundingBox& box : caster.boxes)
+					all.expand(box);
+		}
+		// the light looks down -z, depth is -z
+		staticNear = all.empty() ? 0.0f : -all.max.z;
+		staticFar = all.empty() ? 1.0f : -all.min.z;
+		staticDepthDirty = false;
+	}
+
+	// moves the cascade only when the slice's sphere left it, on whole texels
+	void fit(Cascade& cascade, const glm::vec3& center, float radius)
+	{
+		const glm::vec2 offset = glm::abs(glm::vec2(center) - cascade.center);
+		if (!cascade.valid || radius != cascade.radius || std::max(offset.x, offset.y) + radius > cascade.halfSize)
+		{
+			cascade.radius = radius;
+			cascade.halfSize = radius * (1.0f + settings.margin);
+			const float texel = 2.0f * cascade.halfSize / settings.resolution;
+			cascade.center = glm::floor(glm::vec2(center) / texel) * texel;
+			cascade.valid = true;
+			cascade.staticValid = false;
+		}
+		const unsigned int index = static_cast<unsigned int>(&cascade - cascades.data());
+		// the receivers' depth range joined with the static casters', dynamic ones outside it are clamped
+		const float nearDepth = std::min(staticNear, -center.z - radius), farDepth = std::max(staticFar, -center.z + radius);
+		if (!cascade.staticValid || nearDepth < cascade.nearDepth || farDepth > cascade.farDepth)
+		{
+			// a different depth range changes what the cache stored, so it grows with the same margin
+			cascade.nearDepth = nearDepth - radius * settings.margin;
+			cascade.farDepth = farDepth + radius * settings.margin;
+			cascade.staticValid = false;
+		}
+		const glm::mat4 projection = glm::ortho(cascade.center.x - cascade.halfSize, cascade.center.x + cascade.halfSize,
+			cascade.center.y - cascade.halfSize, cascade.center.y + cascade.halfSize, cascade.nearDepth, cascade.farDepth);
+		constants.lightSpaceMatrices[index] = projection * lightView;
+		constants.texelSizes[index] = 2.0f * cascade.halfSize / settings.resolution;
+	}
+
+	void attach(unsigned int layer)
+	{
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, static_cast<GLint>(layer));
+	}
+
+	// the casters of one kind whose light space box overlaps the cascade, anything closer to the light still casts
+	unsigned int drawCasters(const Cascade& cascade, bool staticCasters, unsigned int& culled)
+	{
+		const unsigned int index = static_cast<unsigned int>(&cascade - cascades.data());
+		const glm::mat4& lightSpace = constants.lightSpaceMatrices[index];
+		unsigned int draws = 0;
+		for (const Caster& caster : casters)
+		{
+			if (caster.isStatic != staticCasters)
+				continue;
+			for (size_t i = 0; i < caster.meshes.size(); i++)
+			{
+				const BoundingBox& box = caster.boxes[i];
+				if (box.max.x < cascade.center.x - cascade.halfSize || box.min.x > cascade.center.x + cascade.halfSize
+					|| box.max.y < cascade.center.y - cascade.halfSize || box.min.y > cascade.center.y + cascade.halfSize || -box.max.z > cascade.farDepth)
+				{
+					culled++;
+					continue;
+				}
+				const Mesh& mesh = *caster.meshes[i];
+				glm::mat4 model = caster.transform;
+				// compact positions are unorm16 inside the mesh bounds
+				if (mesh.format == VertexFormat::Compact)
+					model = glm::scale(glm::translate(model, mesh.quantization.offset), mesh.quantization.scale);
+				depthShader.setMat4("lightModelViewProjection"_uniform, lightSpace * model);
+				glBindVertexArray(mesh.VAO);
+				glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(mesh.indexCount()), mesh.indexType, (void*)(mesh.firstIndex() * mesh.indexSize()));
+				draws++;
+			}
+		}
+		glBindVertexArray(0);
+		return draws;
+	}
+
+	// the cascade times of the frame QUERY_FRAMES - 1 frames ago, if the GPU has them. Timestamps land in order, so
+	// the last one being available means the others are too
+	void readTimers()
+	{
+		const unsigned int oldest = (frame + 1) % QUERY_FRAMES;
+		if (!queryIssued[oldest])
+			return;
+		GLint available = 0;
+		glGetQueryObjectiv(queries[oldest][settings.cascades], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return;
+		GLuint64 previous = 0;
+		glGetQueryObjectui64v(queries[oldest][0], GL_QUERY_RESULT, &previous);
+		for (unsigned int i = 0; i < settings.cascades; i++)
+		{
+			GLuint64 timestamp = 0;
+			glGetQueryObjectui64v(queries[oldest][i + 1], GL_QUERY_RESULT, &timestamp);
+			stats[i].gpuMilliseconds = (timestamp - previous) / 1e6;
+			previous = timestamp;
+		}
+		queryIssued[oldest] = false;
+	}
+};
+#endif // !SHADOW_MAP_H
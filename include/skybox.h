@@ -4,6 +4,7 @@
 #include <glad/glad.h>
 
 #include <shader.h>
+#include <texture_loader.h>
 
 #include <vector>
 #include <string>
@@ -23,13 +24,12 @@ public:
 		return textureID;
 	}
 
-	void draw(const glm::mat4& projection, const glm::mat4& view) const
+	// the camera comes from the Frame uniform block, see FrameConstants
+	void draw() const
 	{
 		// draw skybox as last
 		glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
 		shader.use();
-		shader.setMat4("view", view);
-		shader.setMat4("projection", projection);
 		
 		// skybox cube
 		glBindVertexArray(VAO);
@@ -59,24 +59,14 @@ private:
 	void loadCubemap(const std::vector<std::string>& faces)
 	{
 		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-		int width, height, nrChannels;
+		// the six faces are decoded in parallel
+		TextureLoader loader;
 		for (unsigned int i = 0; i < faces.size(); i++)
-		{
-			unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-			if (data)
-			{
-				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-				stbi_image_free(data);
-			}
-			else
-			{
-				std::cerr << "ERROR::SKYBOX::LOAD_TEXTURE_FAILED\n"
-					<< "    Cubemap texture failed to load at path : " << faces[i] << "\n";
-				stbi_image_free(data);
-			}
-		}
+			loader.loadCubemapFace(textureID, i, faces[i]);
+		loader.finish();
+
+		glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
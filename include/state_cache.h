@@ -0,0 +1,127 @@
+#ifndef STATE_CACHE_H
+#define STATE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <shader.h>
+
+#include <algorithm>
+#include <iterator>
+
+// binds asked for through the cache: submitted reached the driver, filtered were already current
+struct StateCacheStats {
+	unsigned int programSubmitted = 0, programFiltered = 0;
+	unsigned int textureSubmitted = 0, textureFiltered = 0;
+	unsigned int vertexArraySubmitted = 0, vertexArrayFiltered = 0;
+	unsigned int bufferSubmitted = 0, bufferFiltered = 0;
+	unsigned int draws = 0;
+
+	unsigned int submitted() const
+	{
+		return programSubmitted + textureSubmitted + vertexArraySubmitted + bufferSubmitted;
+	}
+
+	unsigned int filtered() const
+	{
+		return programFiltered + textureFiltered + vertexArrayFiltered + bufferFiltered;
+	}
+};
+
+// Remembers the program, texture units, vertex array and uniform buffer ranges it last bound and drops binds that
+// would not change anything. It only knows about binds made through it, so call invalidate() after other code
+// touched the same state; RenderQueue::submit does at its start.
+class StateCache {
+public:
+	static constexpr unsigned int TEXTURE_UNITS = 32;
+	static constexpr unsigned int BUFFER_BINDINGS = 16;
+
+	StateCacheStats stats;
+
+	StateCache()
+	{
+		invalidate();
+	}
+
+	void invalidate()
+	{
+		program = UNKNOWN;
+		vertexArray = UNKNOWN;
+		std::fill(std::begin(textures), std::end(textures), UNKNOWN);
+		for (BufferRange& range : uniformBuffers)
+			range = BufferRange();
+	}
+
+	void useProgram(const Shader& shader)
+	{
+		if (program == shader.ID)
+		{
+			stats.programFiltered++;
+			return;
+		}
+		shader.use();
+		program = shader.ID;
+		stats.programSubmitted++;
+	}
+
+	void bindTexture(GLuint unit, GLuint texture)
+	{
+		if (unit < TEXTURE_UNITS && textures[unit] == texture)
+		{
+			stats.textureFiltered++;
+			return;
+		}
+		glBindTextureUnit(unit, texture);
+		if (unit < TEXTURE_UNITS)
+			textures[unit] = texture;
+		stats.textureSubmitted++;
+	}
+
+	void bindVertexArray(GLuint vao)
+	{
+		if (vertexArray == vao)
+		{
+			stats.vertexArrayFiltered++;
+			return;
+		}
+		glBindVertexArray(vao);
+		vertexArray = vao;
+		stats.vertexArraySubmitted++;
+	}
+
+	void bindUniformRange(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size)
+	{
+		if (binding < BUFFER_BINDINGS)
+		{
+			BufferRange& range = uniformBuffers[binding];
+			if (range.buffer == buffer && range.offset == offset && range.size == size)
+			{
+				stats.bufferFiltered++;
+				return;
+			}
+			range = { buffer, offset, size };
+		}
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+		stats.bufferSubmitted++;
+	}
+
+	void resetStats()
+	{
+		stats = StateCacheStats();
+	}
+
+private:
+	// a name no GL object has, so the first bind after invalidate() always goes through
+	static constexpr GLuint UNKNOWN = 0xFFFFFFFFu;
+
+	struct BufferRange {
+		GLuint buffer = UNKNOWN;
+		GLintptr offset = 0;
+		GLsizeiptr size = 0;
+	};
+
+	GLuint program = UNKNOWN;
+	GLuint vertexArray = UNKNOWN;
+	GLuint textures[TEXTURE_UNITS];
+	BufferRange uniformBuffers[BUFFER_BINDINGS];
+};
+#endif // !STATE_CACHE_H
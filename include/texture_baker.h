@@ -0,0 +1,277 @@
+#ifndef TEXTURE_BAKER_H
+#define TEXTURE_BAKER_H
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+// main.cpp includes stb_image.h with STB_IMAGE_IMPLEMENTATION, its implementation part has no include guard
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#include <block_compression.h>
+#include <ktx2.h>
+#include <material.h>
+#include <job_system.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct TextureBakeReport {
+	std::string path;
+	BlockFormat format = BlockFormat::BC7;
+	bool srgb = false;
+	int width = 0;
+	int height = 0;
+	unsigned int levels = 0;
+	size_t sourceBytes = 0;		// what glTexImage2D and glGenerateMipmap allocate for the source image
+	size_t bakedBytes = 0;
+	double milliseconds = 0.0;
+	double psnr = 0.0;			// of level 0 after a round trip through the CPU decoder
+	bool succeeded = false;
+};
+
+// Offline texture compression, run with `TryOpenGL --bake`. Every texture becomes a block compressed KTX2 file with
+// its whole mip chain, which TextureLoader then uploads instead of decoding the source image. The format follows the
+// role the texture has in the material:
+//   diffuse (and skybox faces)     BC7, mips filtered in linear space and stored sRGB encoded
+//   specular, reflection, height   BC1, or BC3 when the image has alpha
+//   normal                         BC5, mips averaged as vectors and renormalized
+// Textures are baked in parallel on the job system, the baker needs no GL context.
+class TextureBaker {
+public:
+	explicit TextureBaker(JobSystem& pool = JobSystem::shared()) : pool(pool) {}
+
+	static BlockFormat formatFor(TextureRole role, bool alpha)
+	{
+		switch (role)
+		{
+		case TextureRole::Diffuse:
+			return BlockFormat::BC7;
+		case TextureRole::Normal:
+			return BlockFormat::BC5;
+		default:
+			return alpha ? BlockFormat::BC3 : BlockFormat::BC1;
+		}
+	}
+
+	// the textures loadMaterialTextures loads for a model, with the role of their first use
+	static std::vector<std::pair<std::string, TextureRole>> modelTextures(const std::string& modelPath)
+	{
+		std::vector<std::pair<std::string, TextureRole>> textures;
+		Assimp::Importer importer;
+		const aiScene* scene = importer.ReadFile(modelPath, 0);
+		if (!scene)
+		{
+			std::cerr << "ERROR::TEXTURE_BAKER::ASSIMP::" << importer.GetErrorString() << "\n";
+			return textures;
+		}
+
+		const std::string directory = modelPath.substr(0, modelPath.find_last_of("/\\"));
+		const std::pair<aiTextureType, TextureRole> types[] = {
+			{ aiTextureType_DIFFUSE, TextureRole::Diffuse },
+			{ aiTextureType_SPECULAR, TextureRole::Specular },
+			{ aiTextureType_HEIGHT, TextureRole::Normal },
+			{ aiTextureType_AMBIENT, TextureRole::Reflection }
+		};
+		for (unsigned int m = 0; m < scene->mNumMaterials; m++)
+			for (const std::pair<aiTextureType, TextureRole>& type : types)
+				for (unsigned int i = 0; i < scene->mMaterials[m]->GetTextureCount(type.first); i++)
+				{
+					aiString name;
+					scene->mMaterials[m]->GetTexture(type.first, i, &name);
+					const std::string path = directory + '/' + name.C_Str();
+					if (std::none_of(textures.begin(), textures.end(), [&](const auto& texture) { return texture.first == path; }))
+						textures.emplace_back(path, type.second);
+				}
+		return textures;
+	}
+
+	// queue one texture, a path that is already queued is skipped
+	void bake(const std::string& path, TextureRole role)
+	{
+		if (std::find(queued.begin(), queued.end(), path) != queued.end())
+			return;
+		queued.push_back(path);
+		pending.push_back(pool.submit([path, role] { return bakeTexture(path, role); }));
+	}
+
+	void bakeModel(const std::string& modelPath)
+	{
+		for (const std::pair<std::string, TextureRole>& texture : modelTextures(modelPath))
+			bake(texture.first, texture.second);
+	}
+
+	// waits for everything queued and prints one line per texture, false if any texture failed
+	bool finish()
+	{
+		bool succeeded = true;
+		for (std::future<TextureBakeReport>& future : pending)
+		{
+			const TextureBakeReport report = future.get();
+			succeeded = succeeded && report.succeeded;
+			if (report.succeeded)
+				std::cout << "TEXTURE_BAKER::BAKED: " << report.path << "\n"
+					<< "    " << blockFormatName(report.format) << (report.srgb ? " sRGB " : " ") << report.width << "x" << report.height
+					<< ", " << report.levels << " levels, " << report.sourceBytes / 1024 << " KB -> " << report.bakedBytes / 1024 << " KB, "
+					<< report.psnr << " dB, " << report.milliseconds << " ms\n";
+			reports.push_back(report);
+		}
+		pending.clear();
+		queued.clear();
+		return succeeded;
+	}
+
+	// compresses one image with its mip chain into Ktx2::bakedPathFor(path)
+	static TextureBakeReport bakeTexture(const std::string& path, TextureRole role)
+	{
+		PROFILE_SCOPE("TextureBaker::bakeTexture");
+		const auto start = std::chrono::steady_clock::now();
+		TextureBakeReport report;
+		report.path = path;
+
+		int components = 0;
+		unsigned char* pixels = stbi_load(path.c_str(), &report.width, &report.height, &components, 4);
+		if (!pixels)
+		{
+			std::cerr << "ERROR::TEXTURE_BAKER::LOAD_TEXTURE_FAILED: " << path << "\n";
+			return report;
+		}
+		const size_t texelCount = static_cast<size_t>(report.width) * report.height;
+		bool alpha = false;
+		for (size_t i = 0; i < texelCount && !alpha; i++)
+			alpha = pixels[i * 4 + 3] != 255;
+
+		Ktx2Texture texture;
+		texture.format = formatFor(role, alpha);
+		texture.srgb = role == TextureRole::Diffuse;
+		texture.width = static_cast<uint32_t>(report.width);
+		texture.height = static_cast<uint32_t>(report.height);
+		const MipFilter filter = role == TextureRole::Normal ? MipFilter::Normal : texture.srgb ? MipFilter::SRGB : MipFilter::Linear;
+
+		// mips are filtered from the previous float level, so rounding never accumulates
+		std::vector<float> level = toFloat(pixels, texelCount, filter);
+		int width = report.width, height = report.height;
+		std::vector<uint8_t> rgba;
+		for (;;)
+		{
+			rgba = texture.levels.empty() ? std::vector<uint8_t>(pixels, pixels + texelCount * 4) : toRGBA8(level, filter);
+			texture.levels.push_back(BlockCompressor::compress(texture.format, rgba.data(), width, height));
+			report.sourceBytes += static_cast<size_t>(width) * height * components;
+			report.bakedBytes += texture.levels.back().size();
+			if (texture.levels.size() == 1)
+			{
+				const std::vector<uint8_t> decoded = BlockCompressor::decompress(texture.format, texture.levels[0].data(), width, height);
+				const unsigned int channels = texture.format == BlockFormat::BC5 ? 2 : texture.format == BlockFormat::BC1 ? 3 : 4;
+				report.psnr = BlockCompressor::psnr(pixels, decoded.data(), texelCount, channels);
+			}
+			if (width == 1 && height == 1)
+				break;
+			level = downsample(level, width, height);
+			width = std::max(width / 2, 1);
+			height = std::max(height / 2, 1);
+		}
+		stbi_image_free(pixels);
+
+		report.format = texture.format;
+		report.srgb = texture.srgb;
+		report.levels = static_cast<unsigned int>(texture.levels.size());
+		report.succeeded = Ktx2::write(Ktx2::bakedPathFor(path), texture);
+		report.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return report;
+	}
+
+	const std::vector<TextureBakeReport>& results() const
+	{
+		return reports;
+	}
+
+private:
+	// how texel values are averaged into the next mip
+	enum class MipFilter {
+		Linear,
+		SRGB,		// color channels are decoded to linear light first
+		Normal		// color channels are a unit vector
+	};
+
+	JobSystem& pool;
+	std::vector<std::string> queued;
+	std::vector<std::future<TextureBakeReport>> pending;
+	std::vector<TextureBakeReport> reports;
+
+	static float srgbToLinear(float value)
+	{
+		return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+	}
+
+	static float linearToSrgb(float value)
+	{
+		return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+	}
+
+	static std::vector<float> toFloat(const uint8_t* pixels, size_t texelCount, MipFilter filter)
+	{
+		float srgbTable[256];
+		for (int i = 0; i < 256; i++)
+			srgbTable[i] = srgbToLinear(i / 255.0f);
+
+		std::vector<float> texels(texelCount * 4);
+		for (size_t i = 0; i < texelCount * 4; i++)
+		{
+			const bool color = i % 4 != 3;
+			if (color && filter == MipFilter::SRGB)
+				texels[i] = srgbTable[pixels[i]];
+			else if (color && filter == MipFilter::Normal)
+				texels[i] = pixels[i] / 255.0f * 2.0f - 1.0f;
+			else
+				texels[i] = pixels[i] / 255.0f;
+		}
+		return texels;
+	}
+
+	static std::vector<uint8_t> toRGBA8(const std::vector<float>& texels, MipFilter filter)
+	{
+		std::vector<uint8_t> pixels(texels.size());
+		for (size_t i = 0; i < texels.size(); i += 4)
+		{
+			float color[4] = { texels[i], texels[i + 1], texels[i + 2], texels[i + 3] };
+			if (filter == MipFilter::Normal)
+			{
+				const float length = std::sqrt(color[0] * color[0] + color[1] * color[1] + color[2] * color[2]);
+				for (int c = 0; c < 3; c++)
+					color[c] = (length > 0.0f ? color[c] / length : 0.0f) * 0.5f + 0.5f;
+			}
+			else if (filter == MipFilter::SRGB)
+				for (int c = 0; c < 3; c++)
+					color[c] = linearToSrgb(color[c]);
+			for (int c = 0; c < 4; c++)
+				pixels[i + c] = static_cast<uint8_t>(std::clamp(color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+		return pixels;
+	}
+
+	// 2x2 box filter, odd sizes clamp the last row and column
+	static std::vector<float> downsample(const std::vector<float>& texels, int width, int height)
+	{
+		const int halfWidth = std::max(width / 2, 1), halfHeight = std::max(height / 2, 1);
+		std::vector<float> half(static_cast<size_t>(halfWidth) * halfHeight * 4);
+		for (int y = 0; y < halfHeight; y++)
+			for (int x = 0; x < halfWidth; x++)
+			{
+				const int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+				const int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+				for (int c = 0; c < 4; c++)
+					half[(static_cast<size_t>(y) * halfWidth + x) * 4 + c] = 0.25f * (
+						texels[(static_cast<size_t>(y0) * width + x0) * 4 + c] + texels[(static_cast<size_t>(y0) * width + x1) * 4 + c] +
+						texels[(static_cast<size_t>(y1) * width + x0) * 4 + c] + texels[(static_cast<size_t>(y1) * width + x1) * 4 + c]);
+			}
+		return half;
+	}
+};
+#endif // !TEXTURE_BAKER_H
@@ -0,0 +1,361 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+// main.cpp includes stb_image.h with STB_IMAGE_IMPLEMENTATION, its implementation part has no include guard
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#include <ktx2.h>
+#include <job_system.h>
+#include <profiler.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+struct TextureTiming {
+	std::string path;
+	int width = 0;
+	int height = 0;
+	double decodeMilliseconds = 0.0;	// on a worker thread
+	double uploadMilliseconds = 0.0;	// on the main thread
+	bool baked = false;					// came from a block compressed KTX2 file
+};
+
+// Decodes images on the shared job system and uploads them on the main thread through pixel unpack buffers.
+// Texture ids are handed out immediately, the textures are complete once finish() returns.
+// An image with a current bake (see TextureBaker) is read from its KTX2 file instead and uploaded block compressed
+// with the mips it was baked with.
+class TextureLoader {
+public:
+	// maxDimension > 0 halves images on the worker until they fit
+	explicit TextureLoader(int maxDimension = 0, JobSystem& pool = JobSystem::shared())
+		: maxDimension(maxDimension), pool(pool), state(std::make_shared<State>())
+	{
+	}
+
+	TextureLoader(const TextureLoader&) = delete;
+	TextureLoader& operator=(const TextureLoader&) = delete;
+
+	~TextureLoader()
+	{
+		// never leave workers writing into a dead loader
+		if (!requests.empty())
+			finish();
+	}
+
+	// queue a mipmapped, repeating 2D texture, srgb samples it through an sRGB format (decoded to linear)
+	unsigned int load2D(const std::string& path, bool srgb = false)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		enqueue({ textureID, GL_TEXTURE_2D, GL_TEXTURE_2D, path, true, srgb });
+		return textureID;
+	}
+
+	// queue one face of an existing cubemap, face follows the GL_TEXTURE_CUBE_MAP_POSITIVE_X order
+	void loadCubemapFace(unsigned int textureID, unsigned int face, const std::string& path, bool srgb = false)
+	{
+		enqueue({ textureID, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, path, false, srgb });
+	}
+
+	// false ignores baked KTX2 files and always decodes the source images
+	void setUseBaked(bool use)
+	{
+		useBaked = use;
+	}
+
+	// upload every queued image as soon as its decode finishes, then block until the GPU has consumed them
+	void finish()
+	{
+		if (requests.empty())
+			return;
+		PROFILE_SCOPE("TextureLoader::finish");
+
+		GLint previousAlignment;
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		unsigned int pbos[PBO_COUNT];
+		glGenBuffers(PBO_COUNT, pbos);
+
+		for (size_t uploaded = 0; uploaded < requests.size(); uploaded++)
+		{
+			size_t index;
+			{
+				std::unique_lock<std::mutex> lock(state->mutex);
+				state->condition.wait(lock, [this] { return !state->finished.empty(); });
+				index = state->finished.front();
+				state->finished.pop();
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			Decoded& image = state->decoded[index];
+			if (image.baked)
+				uploadCompressed(requests[index], image.texture, pbos[uploaded % PBO_COUNT]);
+			else if (image.data)
+				upload(requests[index], image, pbos[uploaded % PBO_COUNT]);
+			else
+				std::cerr << "ERROR::TEXTURE_LOADER::LOAD_TEXTURE_FAILED\n"
+					<< "    Texture failed to load at path: " << requests[index].path << "\n";
+			stbi_image_free(image.data);
+			image.data = nullptr;
+			image.texture.levels.clear();
+
+			TextureTiming timing;
+			timing.path = requests[index].path;
+			timing.width = image.width;
+			timing.height = image.height;
+			timing.decodeMilliseconds = image.decodeMilliseconds;
+			timing.uploadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			timing.baked = image.baked;
+			textureTimings.push_back(timing);
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(PBO_COUNT, pbos);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+
+		// the textures are only safe to use from other contexts (and to time honestly) once the GPU is done with them
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+			;
+		glDeleteSync(fence);
+
+#ifdef _DEBUG
+		for (const TextureTiming& timing : textureTimings)
+			std::cout << "SUCCESSFULLY::TEXTURE_LOADER::SUCCESSFULLY_LOAD_TEXTURE\n"
+				<< "    PATH: " << timing.path << " (" << timing.width << "x" << timing.height << (timing.baked ? ", baked" : "") << ")\n"
+				<< "    DECODE_TIME: " << timing.decodeMilliseconds << " ms\n"
+				<< "    UPLOAD_TIME: " << timing.uploadMilliseconds << " ms\n";
+#endif
+
+		requests.clear();
+		state = std::make_shared<State>();
+	}
+
+	const std::vector<TextureTiming>& timings() const
+	{
+		return textureTimings;
+	}
+
+	// the sized internal format, 3 and 4 channel images can be sampled as sRGB
+	static GLenum internalFormatOf(int components, bool srgb)
+	{
+		if (srgb && components == 3)
+			return GL_SRGB8;
+		if (srgb && components == 4)
+			return GL_SRGB8_ALPHA8;
+		switch (components)
+		{
+		case 1:
+			return GL_R8;
+		case 2:
+			return GL_RG8;
+		case 3:
+			return GL_RGB8;
+		default:
+			return GL_RGBA8;
+		}
+	}
+
+	// the client pixel format of a stb_image decode
+	static GLenum formatOf(int components)
+	{
+		switch (components)
+		{
+		case 1:
+			return GL_RED;
+		case 2:
+			return GL_RG;
+		case 3:
+			return GL_RGB;
+		default:
+			return GL_RGBA;
+		}
+	}
+
+private:
+	static constexpr int PBO_COUNT = 3;
+
+	struct Request {
+		unsigned int textureID;
+		GLenum bindTarget;
+		GLenum imageTarget;
+		std::string path;
+		bool mipmaps;
+		bool srgb;
+	};
+
+	struct Decoded {
+		unsigned char* data = nullptr;
+		int width = 0;
+		int height = 0;
+		int components = 0;
+		double decodeMilliseconds = 0.0;
+		bool baked = false;
+		Ktx2Texture texture;	// when baked
+	};
+
+	// shared with the workers so they never outlive what they write into
+	struct State {
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::queue<size_t> finished;
+		std::vector<Decoded> decoded;
+	};
+
+	void enqueue(Request request)
+	{
+		size_t index = requests.size();
+		requests.push_back(request);
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->decoded.resize(requests.size());
+		}
+
+		pool.run([state = state, path = request.path, index, maxDimension = maxDimension, useBaked = useBaked] {
+			PROFILE_SCOPE("TextureLoader::decode");
+			auto start = std::chrono::steady_clock::now();
+			Decoded image;
+			image.baked = useBaked && Ktx2::hasCurrentBake(path) && Ktx2::read(Ktx2::bakedPathFor(path), image.texture);
+			if (image.baked)
+			{
+				// the baked mips replace the maxDimension halving
+				image.width = static_cast<int>(image.texture.width);
+				image.height = static_cast<int>(image.texture.height);
+			}
+			else
+			{
+				image.data = stbi_load(path.c_str(), &image.width, &image.height, &image.components, 0);
+				if (image.data && maxDimension > 0)
+					downsample(image, maxDimension);
+			}
+			image.decodeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->decoded[index] = std::move(image);
+			state->finished.push(index);
+			state->condition.notify_one();
+		});
+	}
+
+	// 2x2 box filter until the image fits in maxDimension
+	static void downsample(Decoded& image, int maxDimension)
+	{
+		while ((image.width > maxDimension || image.height > maxDimension) && image.width > 1 && image.height > 1)
+		{
+			const int width = image.width / 2, height = image.height / 2, c = image.components;
+			unsigned char* half = static_cast<unsigned char*>(std::malloc(static_cast<size_t>(width) * height * c));
+			for (int y = 0; y < height; y++)
+				for (int x = 0; x < width; x++)
+					for (int k = 0; k < c; k++)
+					{
+						const unsigned char* row0 = image.data + (static_cast<size_t>(2 * y) * image.width + 2 * x) * c + k;
+						const unsigned char* row1 = row0 + static_cast<size_t>(image.width) * c;
+						half[(static_cast<size_t>(y) * width + x) * c + k] = static_cast<unsigned char>((row0[0] + row0[c] + row1[0] + row1[c] + 2) / 4);
+					}
+			stbi_image_free(image.data);
+			image.data = half;
+			image.width = width;
+			image.height = height;
+		}
+	}
+
+	static void upload(const Request& request, const Decoded& image, unsigned int pbo)
+	{
+		PROFILE_SCOPE("TextureLoader::upload");
+		const GLenum format = formatOf(image.components);
+		const GLsizeiptr size = static_cast<GLsizeiptr>(image.width) * image.height * image.components;
+
+		// orphan the buffer so we never wait on the previous transfer out of it
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		void* pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (pixels)
+		{
+			std::memcpy(pixels, image.data, static_cast<size_t>(size));
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		else
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // fall back to a plain client memory upload
+
+		glBindTexture(request.bindTarget, request.textureID);
+		glTexImage2D(request.imageTarget, 0, internalFormatOf(image.components, request.srgb), image.width, image.height, 0, format, GL_UNSIGNED_BYTE, pixels ? nullptr : image.data);
+
+		if (request.mipmaps)
+		{
+			glGenerateMipmap(request.bindTarget);
+			setMipmapParameters(request.bindTarget);
+		}
+	}
+
+	// every baked level goes into one pixel unpack buffer, then one glCompressedTexImage2D per level
+	static void uploadCompressed(const Request& request, const Ktx2Texture& texture, unsigned int pbo)
+	{
+		PROFILE_SCOPE("TextureLoader::uploadCompressed");
+		const size_t levelCount = request.mipmaps ? texture.levels.size() : 1;
+		GLsizeiptr size = 0;
+		for (size_t level = 0; level < levelCount; level++)
+			size += static_cast<GLsizeiptr>(texture.levels[level].size());
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		unsigned char* mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+		if (mapped)
+		{
+			size_t offset = 0;
+			for (size_t level = 0; level < levelCount; level++)
+			{
+				std::memcpy(mapped + offset, texture.levels[level].data(), texture.levels[level].size());
+				offset += texture.levels[level].size();
+			}
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		else
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // fall back to a plain client memory upload
+
+		glBindTexture(request.bindTarget, request.textureID);
+		const GLenum internalFormat = texture.glInternalFormat(request.srgb);
+		size_t offset = 0;
+		for (size_t level = 0; level < levelCount; level++)
+		{
+			const GLsizei levelSize = static_cast<GLsizei>(texture.levels[level].size());
+			const void* data = mapped ? reinterpret_cast<const void*>(offset) : texture.levels[level].data();
+			glCompressedTexImage2D(request.imageTarget, static_cast<GLint>(level), internalFormat,
+				texture.levelWidth(level), texture.levelHeight(level), 0, levelSize, data);
+			offset += levelSize;
+		}
+
+		if (request.mipmaps)
+		{
+			glTexParameteri(request.bindTarget, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levelCount - 1));
+			setMipmapParameters(request.bindTarget);
+		}
+	}
+
+	static void setMipmapParameters(GLenum target)
+	{
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	int maxDimension;
+	bool useBaked = true;
+	JobSystem& pool;
+	std::shared_ptr<State> state;
+	std::vector<Request> requests;
+	std::vector<TextureTiming> textureTimings;
+};
+#endif // !TEXTURE_LOADER_H
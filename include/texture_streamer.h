@@ -0,0 +1,440 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+// main.cpp includes stb_image.h with STB_IMAGE_IMPLEMENTATION, its implementation part has no include guard
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#include <ktx2.h>
+#include <texture_loader.h>
+#include <job_system.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct TextureStreamingStats {
+	unsigned int textures = 0;
+	unsigned int fullyResident = 0;		// level 0 resident
+	unsigned int pendingLoads = 0;
+	size_t residentBytes = 0;
+	size_t wantedBytes = 0;				// if every texture had the level it was last asked for
+	size_t budgetBytes = 0;
+	unsigned int uploads = 0;			// levels uploaded since the start
+	unsigned int evictions = 0;			// levels dropped since the start
+};
+
+// Streams the mips of 2D textures under a memory budget. A texture starts with its mip tail (every level of at most
+// TAIL_SIZE texels) and is refined one level at a time towards the finest level any visible mesh asked for this
+// frame. When a load does not fit the budget, levels of the least recently used textures are dropped first.
+//
+// The texture id never changes, only the resident range does: levels are (re)specified on the mutable texture and
+// GL_TEXTURE_BASE_LEVEL moves to the finest complete one, so sampling is correct while loads are in flight.
+// Baked KTX2 files (see TextureBaker) are read one level at a time, source images are decoded and halved.
+class TextureStreamer {
+public:
+	// levels no larger than this are loaded with the texture and never evicted
+	static constexpr unsigned int TAIL_SIZE = 64;
+
+	static TextureStreamer& shared()
+	{
+		static TextureStreamer streamer;
+		return streamer;
+	}
+
+	void setEnabled(bool enable)
+	{
+		streaming = enable;
+	}
+
+	bool enabled() const
+	{
+		return streaming;
+	}
+
+	void setBudget(size_t bytes)
+	{
+		budget = bytes;
+	}
+
+	// the texture id is valid at once, its mip tail is uploaded by update() or finish(). A path that is already
+	// streamed with the same srgb returns the same id
+	unsigned int add(const std::string& path, bool srgb = false)
+	{
+		for (const auto& [id, texture] : textures)
+			if (texture.path == path && texture.srgb == srgb)
+				return id;
+
+		StreamedTexture texture;
+		glGenTextures(1, &texture.id);
+		texture.path = path;
+		texture.srgb = srgb;
+		texture.lastUsed = frame;
+		textures.emplace(texture.id, texture);
+		submit(texture.id, TAIL);
+		return texture.id;
+	}
+
+	// finest level a mesh needs: uvPerPixel is how many texture coordinate units one screen pixel covers
+	void request(unsigned int textureID, float uvPerPixel)
+	{
+		auto found = textures.find(textureID);
+		if (found == textures.end() || !found->second.ready)
+			return;
+		StreamedTexture& texture = found->second;
+		const float texelsPerPixel = uvPerPixel * static_cast<float>(std::max(texture.width, texture.height));
+		const unsigned int level = texelsPerPixel > 1.0f
+			? std::min(static_cast<unsigned int>(std::log2(texelsPerPixel)), texture.tailLevel) : 0;
+		if (texture.lastUsed != frame)
+			texture.wantedLevel = level;
+		else
+			texture.wantedLevel = std::min(texture.wantedLevel, level);
+		texture.lastUsed = frame;
+	}
+
+	// once a frame after the requests: uploads finished loads, then starts the next ones, evicting to make room
+	void update()
+	{
+		PROFILE_SCOPE("TextureStreamer::update");
+		uploadFinished(false);
+
+		// coarsest gap first, so every visible texture gets sharper before any one of them is complete
+		std::vector<StreamedTexture*> candidates;
+		for (auto& [id, texture] : textures)
+			if (texture.ready && !texture.loading && texture.lastUsed == frame && texture.wantedLevel < texture.residentLevel)
+				candidates.push_back(&texture);
+		std::sort(candidates.begin(), candidates.end(), [](const StreamedTexture* a, const StreamedTexture* b) {
+			return a->residentLevel - a->wantedLevel > b->residentLevel - b->wantedLevel;
+		});
+
+		for (StreamedTexture* texture : candidates)
+		{
+			if (jobs.size() >= MAX_LOADS_IN_FLIGHT)
+				break;
+			const unsigned int level = texture->residentLevel - 1;
+			if (!makeRoom(levelBytes(*texture, level), texture->id))
+				break;
+			pendingBytes += levelBytes(*texture, level);
+			submit(texture->id, level);
+		}
+
+		// a lowered budget is honoured even without new loads
+		makeRoom(0, 0);
+		frame++;
+	}
+
+	// blocks until every queued load is uploaded, models call it so they are never drawn without their mip tails
+	void finish()
+	{
+		uploadFinished(true);
+	}
+
+	TextureStreamingStats stats() const
+	{
+		TextureStreamingStats result;
+		result.textures = static_cast<unsigned int>(textures.size());
+		result.pendingLoads = static_cast<unsigned int>(jobs.size());
+		result.residentBytes = residentBytes;
+		result.budgetBytes = budget;
+		result.uploads = uploads;
+		result.evictions = evictions;
+		for (const auto& [id, texture] : textures)
+		{
+			result.fullyResident += texture.ready && texture.residentLevel == 0;
+			for (unsigned int level = texture.wantedLevel; texture.ready && level < texture.levelCount; level++)
+				result.wantedBytes += levelBytes(texture, level);
+		}
+		return result;
+	}
+
+	// finest resident level of a streamed texture, -1 if it has none yet
+	int residentLevel(unsigned int textureID) const
+	{
+		auto found = textures.find(textureID);
+		return found != textures.end() && found->second.ready ? static_cast<int>(found->second.residentLevel) : -1;
+	}
+
+private:
+	static constexpr unsigned int TAIL = UINT32_MAX;
+	static constexpr size_t MAX_LOADS_IN_FLIGHT = 4;
+
+	struct StreamedTexture {
+		unsigned int id = 0;
+		std::string path;
+		bool srgb = false;
+		bool ready = false;			// the mip tail is resident
+		bool loading = false;
+		// filled in by the tail load
+		bool baked = false;
+		BlockFormat format = BlockFormat::BC7;
+		int components = 0;
+		int width = 0;
+		int height = 0;
+		unsigned int levelCount = 0;
+		unsigned int tailLevel = 0;
+		unsigned int residentLevel = 0;
+		unsigned int wantedLevel = 0;
+		uint64_t lastUsed = 0;
+	};
+
+	// what a worker hands back: the texture layout and levels firstLevel onwards
+	struct LoadedLevels {
+		bool succeeded = false;
+		bool baked = false;
+		BlockFormat format = BlockFormat::BC7;
+		int components = 0;
+		int width = 0;
+		int height = 0;
+		unsigned int levelCount = 0;
+		unsigned int firstLevel = 0;
+		std::vector<std::vector<uint8_t>> levels;
+	};
+
+	struct Job {
+		unsigned int textureID;
+		std::future<LoadedLevels> result;
+	};
+
+	JobSystem& pool = JobSystem::shared();
+	std::unordered_map<unsigned int, StreamedTexture> textures;
+	std::vector<Job> jobs;
+	bool streaming = false;
+	size_t budget = 256ull * 1024 * 1024;
+	size_t residentBytes = 0;
+	size_t pendingBytes = 0;
+	uint64_t frame = 0;
+	unsigned int uploads = 0;
+	unsigned int evictions = 0;
+
+	TextureStreamer() = default;
+
+	static unsigned int levelCountOf(int width, int height)
+	{
+		return static_cast<unsigned int>(std::floor(std::log2(std::max(std::max(width, height), 1)))) + 1;
+	}
+
+	static int levelSize(int size, unsigned int level)
+	{
+		return std::max(size >> level, 1);
+	}
+
+	static size_t levelBytes(const StreamedTexture& texture, unsigned int level)
+	{
+		const size_t width = levelSize(texture.width, level), height = levelSize(texture.height, level);
+		if (texture.baked)
+			return (width + 3) / 4 * ((height + 3) / 4) * blockBytes(texture.format);
+		return width * height * texture.components;
+	}
+
+	// level TAIL loads the mip tail, which also tells the layout of the texture
+	void submit(unsigned int textureID, unsigned int level)
+	{
+		StreamedTexture& texture = textures[textureID];
+		texture.loading = true;
+		jobs.push_back({ textureID, pool.submit([path = texture.path, level] { return load(path, level); }) });
+	}
+
+	static LoadedLevels load(const std::string& path, unsigned int level)
+	{
+		PROFILE_SCOPE("TextureStreamer::load");
+		LoadedLevels loaded;
+		if (Ktx2::hasCurrentBake(path))
+		{
+			const std::string bakedPath = Ktx2::bakedPathFor(path);
+			Ktx2Texture texture;
+			if (level == TAIL && !Ktx2::read(bakedPath, texture, UINT32_MAX))
+				return loaded;
+			const unsigned int firstLevel = level == TAIL ? tailLevelOf(texture.width, texture.height, static_cast<unsigned int>(texture.levels.size())) : level;
+			if (!Ktx2::read(bakedPath, texture, firstLevel, level == TAIL ? UINT32_MAX : level) || texture.faceCount != 1)
+				return loaded;
+			loaded.baked = true;
+			loaded.format = texture.format;
+			loaded.width = static_cast<int>(texture.width);
+			loaded.height = static_cast<int>(texture.height);
+			loaded.levelCount = static_cast<unsigned int>(texture.levels.size());
+			loaded.firstLevel = firstLevel;
+			loaded.levels.assign(std::make_move_iterator(texture.levels.begin() + firstLevel),
+				std::make_move_iterator(level == TAIL ? texture.levels.end() : texture.levels.begin() + firstLevel + 1));
+			loaded.succeeded = true;
+			return loaded;
+		}
+
+		unsigned char* data = stbi_load(path.c_str(), &loaded.width, &loaded.height, &loaded.components, 0);
+		if (!data)
+			return loaded;
+		loaded.levelCount = levelCountOf(loaded.width, loaded.height);
+		loaded.firstLevel = level == TAIL ? tailLevelOf(loaded.width, loaded.height, loaded.levelCount) : level;
+		const unsigned int lastLevel = level == TAIL ? loaded.levelCount - 1 : level;
+
+		std::vector<uint8_t> pixels(data, data + static_cast<size_t>(loaded.width) * loaded.height * loaded.components);
+		stbi_image_free(data);
+		int width = loaded.width, height = loaded.height;
+		for (unsigned int i = 0; i <= lastLevel; i++)
+		{
+			if (i >= loaded.firstLevel)
+				loaded.levels.push_back(pixels);
+			if (i < lastLevel)
+				pixels = halve(pixels, width, height, loaded.components);
+		}
+		loaded.succeeded = true;
+		return loaded;
+	}
+
+	static unsigned int tailLevelOf(unsigned int width, unsigned int height, unsigned int levelCount)
+	{
+		unsigned int level = 0;
+		while (level + 1 < levelCount && std::max(width >> level, height >> level) > TAIL_SIZE)
+			level++;
+		return level;
+	}
+
+	// 2x2 box filter, odd sizes clamp the last row and column
+	static std::vector<uint8_t> halve(const std::vector<uint8_t>& pixels, int& width, int& height, int components)
+	{
+		const int halfWidth = std::max(width / 2, 1), halfHeight = std::max(height / 2, 1);
+		std::vector<uint8_t> half(static_cast<size_t>(halfWidth) * halfHeight * components);
+		for (int y = 0; y < halfHeight; y++)
+			for (int x = 0; x < halfWidth; x++)
+			{
+				const size_t x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+				const size_t y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+				for (int c = 0; c < components; c++)
+					half[(static_cast<size_t>(y) * halfWidth + x) * components + c] = static_cast<uint8_t>((
+						pixels[(y0 * width + x0) * components + c] + pixels[(y0 * width + x1) * components + c] +
+						pixels[(y1 * width + x0) * components + c] + pixels[(y1 * width + x1) * components + c] + 2) / 4);
+			}
+		width = halfWidth;
+		height = halfHeight;
+		return half;
+	}
+
+	void uploadFinished(bool wait)
+	{
+		GLint previousAlignment;
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (size_t i = 0; i < jobs.size();)
+		{
+			if (!wait && jobs[i].result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				i++;
+				continue;
+			}
+			const unsigned int textureID = jobs[i].textureID;
+			const LoadedLevels loaded = jobs[i].result.get();
+			jobs.erase(jobs.begin() + i);
+			upload(textures[textureID], loaded);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+	}
+
+	void upload(StreamedTexture& texture, const LoadedLevels& loaded)
+	{
+		PROFILE_SCOPE("TextureStreamer::upload");
+		texture.loading = false;
+		if (texture.ready)
+			pendingBytes -= std::min(pendingBytes, levelBytes(texture, loaded.firstLevel));
+		if (!loaded.succeeded)
+		{
+			std::cerr << "ERROR::TEXTURE_STREAMER::LOAD_TEXTURE_FAILED\n"
+				<< "    Texture failed to load at path: " << texture.path << "\n";
+			return;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, texture.id);
+		if (!texture.ready)
+		{
+			texture.baked = loaded.baked;
+			texture.format = loaded.format;
+			texture.components = loaded.components;
+			texture.width = loaded.width;
+			texture.height = loaded.height;
+			texture.levelCount = loaded.levelCount;
+			texture.tailLevel = loaded.firstLevel;
+			texture.residentLevel = loaded.levelCount;
+			texture.wantedLevel = loaded.firstLevel;
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(loaded.levelCount - 1));
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		}
+		// only the next finer level extends the resident range, anything else was made stale by an eviction
+		else if (loaded.firstLevel + 1 != texture.residentLevel)
+			return;
+
+		// coarsest first, the base level only moves once the finer level is fully specified
+		for (size_t i = loaded.levels.size(); i-- > 0;)
+		{
+			const unsigned int level = loaded.firstLevel + static_cast<unsigned int>(i);
+			specify(texture, level, loaded.levels[i].data());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, static_cast<GLint>(level));
+			texture.residentLevel = level;
+			residentBytes += levelBytes(texture, level);
+			uploads++;
+		}
+		texture.ready = true;
+	}
+
+	// null data with a zero size releases the level's storage
+	static void specify(const StreamedTexture& texture, unsigned int level, const uint8_t* data)
+	{
+		const GLsizei width = data ? levelSize(texture.width, level) : 0;
+		const GLsizei height = data ? levelSize(texture.height, level) : 0;
+		if (texture.baked)
+		{
+			Ktx2Texture layout;
+			layout.format = texture.format;
+			glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), layout.glInternalFormat(texture.srgb), width, height, 0,
+				data ? static_cast<GLsizei>(levelBytes(texture, level)) : 0, data);
+		}
+		else
+			glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), TextureLoader::internalFormatOf(texture.components, texture.srgb),
+				width, height, 0, TextureLoader::formatOf(texture.components), GL_UNSIGNED_BYTE, data);
+	}
+
+	// drops the finest level of the least recently used textures until bytes more fit the budget, keeping
+	// mip tails and every level the requesting texture or this frame's textures still need. False if it can't fit
+	bool makeRoom(size_t bytes, unsigned int requester)
+	{
+		while (residentBytes + pendingBytes + bytes > budget)
+		{
+			StreamedTexture* victim = nullptr;
+			for (auto& [id, texture] : textures)
+			{
+				if (!texture.ready || texture.loading || texture.residentLevel >= texture.tailLevel || id == requester)
+					continue;
+				if (texture.lastUsed == frame && texture.residentLevel >= texture.wantedLevel)
+					continue;
+				if (!victim || texture.lastUsed < victim->lastUsed)
+					victim = &texture;
+			}
+			if (!victim)
+				return false;
+			evict(*victim);
+		}
+		return true;
+	}
+
+	void evict(StreamedTexture& texture)
+	{
+		const unsigned int level = texture.residentLevel;
+		glBindTexture(GL_TEXTURE_2D, texture.id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, static_cast<GLint>(level + 1));
+		specify(texture, level, nullptr);
+		texture.residentLevel = level + 1;
+		residentBytes -= levelBytes(texture, level);
+		evictions++;
+	}
+};
+#endif // !TEXTURE_STREAMER_H
@@ -0,0 +1,259 @@
+#ifndef TRANSFORM_STAGE_H
+#define TRANSFORM_STAGE_H
+
+#include <glm/glm.hpp>
+
+#include <job_system.h>
+#include <profiler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// SSE on any x86-64 build, scalar otherwise
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_SSE
+#include <emmintrin.h>
+#endif
+
+using std::vector;
+
+// what a vertex shader needs of an object's placement, the std430 and std140 layout of the shaders' mat4 and mat3x4
+struct ObjectTransform {
+	glm::mat4 model;
+	glm::mat3x4 normalMatrix;		// transpose(inverse(mat3(model))), the shaders take its mat3
+};
+
+struct TransformStageStats {
+	unsigned int objects = 0;
+	unsigned int normalsUpdated = 0;	// objects whose normal matrix was recomputed in the last update
+	double milliseconds = 0.0;
+};
+
+// The per object matrices of a frame, computed once per object instead of once per vertex: the normal matrix of
+// every object whose transform changed and the model view projection matrix of every object. World transforms are
+// kept as structure of arrays, one array per matrix element, so the math runs on four objects per SSE instruction
+// and each object's result is written out ready to upload. Transforms are affine, their last row is 0 0 0 1.
+class TransformStage {
+public:
+	TransformStageStats stats;
+
+	void reserve(size_t count)
+	{
+		const size_t padded = (count + 3) & ~size_t(3);
+		for (vector<float>& element : elements)
+			element.reserve(padded);
+		normals.reserve(padded);
+		modelViewProjections.reserve(padded);
+	}
+
+	void clear()
+	{
+		for (vector<float>& element : elements)
+			element.clear();
+		dirty.clear();
+		normals.clear();
+		modelViewProjections.clear();
+		count = 0;
+		stats = TransformStageStats();
+	}
+
+	// returns the index set and the results take
+	unsigned int add(const glm::mat4& world)
+	{
+		if (count % 4 == 0)
+		{
+			// a new group of four, padded with identities until filled
+			for (unsigned int element = 0; element < ELEMENTS; element++)
+				elements[element].resize(count + 4, element % 4 == element / 4 ? 1.0f : 0.0f);
+			dirty.push_back(1);
+			normals.resize(count + 4, glm::mat3x4(1.0f));
+			modelViewProjections.resize(count + 4, glm::mat4(1.0f));
+		}
+		count++;
+		set(static_cast<unsigned int>(count - 1), world);
+		return static_cast<unsigned int>(count - 1);
+	}
+
+	void set(unsigned int index, const glm::mat4& world)
+	{
+		for (unsigned int column = 0; column < 4; column++)
+			for (unsigned int row = 0; row < 3; row++)
+				elements[column * 3 + row][index] = world[column][row];
+		dirty[index / 4] = 1;
+	}
+
+	glm::mat4 world(unsigned int index) const
+	{
+		glm::mat4 result(1.0f);
+		for (unsigned int column = 0; column < 4; column++)
+			for (unsigned int row = 0; row < 3; row++)
+				result[column][row] = elements[column * 3 + row][index];
+		return result;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	// normal matrices of the objects set since the last update
+	void updateNormals(JobSystem* jobs = &JobSystem::shared())
+	{
+		run(nullptr, jobs);
+	}
+
+	// normal matrices of the changed objects and the model view projection matrix of every object
+	void update(const glm::mat4& viewProjection, JobSystem* jobs = &JobSystem::shared())
+	{
+		run(&viewProjection, jobs);
+	}
+
+	// glm on every object one at a time, what update() is measured and checked against
+	void updateReference(const glm::mat4& viewProjection)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			const glm::mat4 model = world(static_cast<unsigned int>(i));
+			normals[i] = glm::mat3x4(glm::transpose(glm::inverse(glm::mat3(model))));
+			modelViewProjections[i] = viewProjection * model;
+		}
+		std::fill(dirty.begin(), dirty.end(), 0);
+	}
+
+	const glm::mat3x4& normalMatrix(unsigned int index) const
+	{
+		return normals[index];
+	}
+
+	const glm::mat4& modelViewProjection(unsigned int index) const
+	{
+		return modelViewProjections[index];
+	}
+
+	ObjectTransform objectTransform(unsigned int index) const
+	{
+		return { world(index), normals[index] };
+	}
+
+private:
+	// column major 3x4, elements[column * 3 + row]
+	static constexpr unsigned int ELEMENTS = 12;
+	// groups of four objects per job at least
+	static constexpr size_t MIN_GROUPS = 64;
+
+	vector<float> elements[ELEMENTS];
+	vector<uint8_t> dirty;			// per group of four
+	vector<glm::mat3x4> normals;
+	vector<glm::mat4> modelViewProjections;
+	size_t count = 0;
+
+	void run(const glm::mat4* viewProjection, JobSystem* jobs)
+	{
+		PROFILE_SCOPE("TransformStage::update");
+		const auto start = std::chrono::steady_clock::now();
+		const size_t groups = dirty.size();
+		std::atomic<unsigned int> updated{ 0 };
+		auto transformGroups = [&](size_t first, size_t last) {
+			unsigned int normalsUpdated = 0;
+			for (size_t group = first; group < last; group++)
+			{
+				if (dirty[group])
+				{
+					normalGroup(group * 4);
+					dirty[group] = 0;
+					normalsUpdated += 4;
+				}
+				if (viewProjection)
+					modelViewProjectionGroup(*viewProjection, group * 4);
+			}
+			updated.fetch_add(normalsUpdated, std::memory_order_relaxed);
+		};
+		const size_t grain = std::max(MIN_GROUPS, groups / (4 * ((jobs ? jobs->size() : 0) + 1)));
+		if (jobs)
+			jobs->parallelFor(0, groups, transformGroups, grain);
+		else
+			transformGroups(0, groups);
+
+		stats.objects = static_cast<unsigned int>(count);
+		stats.normalsUpdated = std::min(updated.load(std::memory_order_relaxed), stats.objects);
+		stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+#if defined(TRANSFORM_SSE)
+	__m128 load(unsigned int element, size_t first) const
+	{
+		return _mm_loadu_ps(&elements[element][first]);
+	}
+
+	// the inverse transpose of a 3x3 is its cofactor matrix over its determinant: the columns are the cross
+	// products of the other two columns
+	void normalGroup(size_t first)
+	{
+		const __m128 ax = load(0, first), ay = load(1, first), az = load(2, first);
+		const __m128 bx = load(3, first), by = load(4, first), bz = load(5, first);
+		const __m128 cx = load(6, first), cy = load(7, first), cz = load(8, first);
+		auto cross = [](__m128 ux, __m128 uy, __m128 uz, __m128 vx, __m128 vy, __m128 vz, __m128 out[3]) {
+			out[0] = _mm_sub_ps(_mm_mul_ps(uy, vz), _mm_mul_ps(uz, vy));
+			out[1] = _mm_sub_ps(_mm_mul_ps(uz, vx), _mm_mul_ps(ux, vz));
+			out[2] = _mm_sub_ps(_mm_mul_ps(ux, vy), _mm_mul_ps(uy, vx));
+		};
+		__m128 columns[3][3];
+		cross(bx, by, bz, cx, cy, cz, columns[0]);
+		cross(cx, cy, cz, ax, ay, az, columns[1]);
+		cross(ax, ay, az, bx, by, bz, columns[2]);
+		const __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, columns[0][0]), _mm_mul_ps(ay, columns[0][1])), _mm_mul_ps(az, columns[0][2]));
+		// a singular matrix gets zero normals instead of infinities
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 inverse = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), determinant), _mm_cmpneq_ps(determinant, zero));
+
+		for (unsigned int column = 0; column < 3; column++)
+		{
+			__m128 x = _mm_mul_ps(columns[column][0], inverse), y = _mm_mul_ps(columns[column][1], inverse);
+			__m128 z = _mm_mul_ps(columns[column][2], inverse), w = zero;
+			// four objects' x, y, z rows to one column per object
+			_MM_TRANSPOSE4_PS(x, y, z, w);
+			_mm_storeu_ps(&normals[first][column][0], x);
+			_mm_storeu_ps(&normals[first + 1][column][0], y);
+			_mm_storeu_ps(&normals[first + 2][column][0], z);
+			_mm_storeu_ps(&normals[first + 3][column][0], w);
+		}
+	}
+
+	// column c of viewProjection * model is viewProjection times model's column c, with model's implicit last row
+	void modelViewProjectionGroup(const glm::mat4& viewProjection, size_t first)
+	{
+		for (unsigned int column = 0; column < 4; column++)
+		{
+			const __m128 mx = load(column * 3, first), my = load(column * 3 + 1, first), mz = load(column * 3 + 2, first);
+			__m128 rows[4];
+			for (unsigned int row = 0; row < 4; row++)
+			{
+				__m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(viewProjection[0][row]), mx), _mm_mul_ps(_mm_set1_ps(viewProjection[1][row]), my)),
+					_mm_mul_ps(_mm_set1_ps(viewProjection[2][row]), mz));
+				if (column == 3)
+					sum = _mm_add_ps(sum, _mm_set1_ps(viewProjection[3][row]));
+				rows[row] = sum;
+			}
+			_MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+			for (unsigned int object = 0; object < 4; object++)
+				_mm_storeu_ps(&modelViewProjections[first + object][column][0], rows[object]);
+		}
+	}
+#else
+	void normalGroup(size_t first)
+	{
+		for (size_t i = first; i < first + 4; i++)
+			normals[i] = glm::mat3x4(glm::transpose(glm::inverse(glm::mat3(world(static_cast<unsigned int>(i))))));
+	}
+
+	void modelViewProjectionGroup(const glm::mat4& viewProjection, size_t first)
+	{
+		for (size_t i = first; i < first + 4; i++)
+			modelViewProjections[i] = viewProjection * world(static_cast<unsigned int>(i));
+	}
+#endif
+};
+#endif // !TRANSFORM_STAGE_H
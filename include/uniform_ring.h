@@ -0,0 +1,198 @@
+#ifndef UNIFORM_RING_H
+#define UNIFORM_RING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+// uniform block bindings the shaders declare with layout(binding = N)
+constexpr GLuint FRAME_UNIFORM_BINDING = 0;
+constexpr GLuint OBJECT_UNIFORM_BINDING = 1;
+
+// ObjectConstants::paletteOffset of draws that are not skinned, skinned meshes stay in their bind pose
+constexpr unsigned int NO_BONE_PALETTE = 0xFFFFFFFFu;
+
+// the Frame block, written once a frame
+struct FrameConstants {
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec4 viewPos;				// vec3 in the shaders, std140 pads it to 16 bytes
+	glm::mat4 viewProjection;		// projection * view, for shaders whose per object matrices come without one
+};
+
+// the Object block, written per draw
+struct ObjectConstants {
+	glm::mat4 model;
+	glm::mat4 modelViewProjection;	// projection * view * model, see TransformStage
+	glm::mat3x4 normalMatrix;		// transpose(inverse(mat3(model))), the shaders take its mat3
+	glm::vec4 positionOffset;		// compact vertex layout only, see PositionQuantization
+	glm::vec3 positionScale;
+	unsigned int paletteOffset = NO_BONE_PALETTE;	// first matrix of the draw's bones in the bone palette, see AnimationSystem
+};
+
+struct UniformAllocation {
+	void* data = nullptr;
+	GLintptr offset = 0;
+	GLsizeiptr size = 0;
+};
+
+struct UniformRingStats {
+	GLsizeiptr frameBytes = 0;			// constants written during the last finished frame
+	unsigned int frameAllocations = 0;
+	unsigned int waits = 0;				// frames that found their region still in use by the GPU
+	double waitMilliseconds = 0.0;
+	unsigned int overflows = 0;			// frames that ran out of space and had to glFinish
+};
+
+// Per frame constants without glBufferSubData: one buffer made with glBufferStorage and mapped once, persistent and
+// coherent, split into FRAME_COUNT regions. A frame writes its constants into the next free bytes of its region and
+// binds them with glBindBufferRange, a fence at endFrame() tells when the GPU is done with the region, so it is
+// only reused FRAME_COUNT frames later and the CPU never overwrites what a queued draw still reads.
+class UniformRing {
+public:
+	static constexpr unsigned int FRAME_COUNT = 3;
+
+	UniformRingStats stats;
+
+	explicit UniformRing(GLsizeiptr frameSize = 1 << 20)
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		offsetAlignment = std::max<GLint>(alignment, 1);
+		regionSize = align(frameSize);
+
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferStorage(GL_UNIFORM_BUFFER, regionSize * FRAME_COUNT, nullptr, flags);
+		mapped = static_cast<unsigned char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, regionSize * FRAME_COUNT, flags));
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		if (!mapped)
+			std::cerr << "ERROR::UNIFORM_RING::MAP_BUFFER_FAILED\n";
+	}
+
+	~UniformRing()
+	{
+		for (GLsync& fence : fences)
+			if (fence)
+				glDeleteSync(fence);
+		if (mapped)
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &buffer);
+	}
+
+	UniformRing(const UniformRing&) = delete;
+	UniformRing& operator=(const UniformRing&) = delete;
+
+	// waits until the GPU has finished the frame that last used this region, usually it already has
+	void beginFrame()
+	{
+		GLsync& fence = fences[region];
+		if (fence)
+		{
+			if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			{
+				const auto start = std::chrono::steady_clock::now();
+				while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+					;
+				stats.waits++;
+				stats.waitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+		head = 0;
+		written = 0;
+		allocations = 0;
+	}
+
+	// size bytes in this frame's region, aligned for glBindBufferRange
+	UniformAllocation allocate(GLsizeiptr size)
+	{
+		const GLsizeiptr alignedSize = align(size);
+		if (head + alignedSize > regionSize)
+		{
+			// the region is full: wait for every queued draw so its start can be written again
+			if (stats.overflows++ == 0)
+				std::cerr << "ERROR::UNIFORM_RING::OUT_OF_SPACE: more than " << regionSize << " bytes in one frame\n";
+			glFinish();
+			head = 0;
+		}
+
+		UniformAllocation allocation;
+		allocation.offset = region * regionSize + head;
+		allocation.size = size;
+		allocation.data = mapped + allocation.offset;
+		head += alignedSize;
+		written += size;
+		allocations++;
+		return allocation;
+	}
+
+	template<typename T>
+	UniformAllocation push(const T& value)
+	{
+		UniformAllocation allocation = allocate(sizeof(T));
+		std::memcpy(allocation.data, &value, sizeof(T));
+		return allocation;
+	}
+
+	void bindRange(GLuint binding, const UniformAllocation& allocation) const
+	{
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, allocation.offset, allocation.size);
+	}
+
+	// push and bind in one go
+	template<typename T>
+	UniformAllocation bind(GLuint binding, const T& value)
+	{
+		UniformAllocation allocation = push(value);
+		bindRange(binding, allocation);
+		return allocation;
+	}
+
+	// after the frame's last draw that reads from the ring
+	void endFrame()
+	{
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		stats.frameBytes = written;
+		stats.frameAllocations = allocations;
+		region = (region + 1) % FRAME_COUNT;
+	}
+
+	GLuint bufferID() const
+	{
+		return buffer;
+	}
+
+	GLsizeiptr frameSize() const
+	{
+		return regionSize;
+	}
+
+private:
+	GLuint buffer = 0;
+	unsigned char* mapped = nullptr;
+	GLsizeiptr regionSize = 0;
+	GLint offsetAlignment = 256;
+	GLsync fences[FRAME_COUNT] = {};
+	unsigned int region = 0;
+	GLsizeiptr head = 0;
+	GLsizeiptr written = 0;
+	unsigned int allocations = 0;
+
+	GLsizeiptr align(GLsizeiptr size) const
+	{
+		return (size + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+	}
+};
+#endif // !UNIFORM_RING_H
@@ -0,0 +1,137 @@
+#ifndef VERTEX_COMPRESSION_H
+#define VERTEX_COMPRESSION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Which vertex layout a mesh uploads. The CPU copy in Mesh::vertices is always the full Vertex.
+enum class VertexFormat {
+	Full,		// Vertex, 88 bytes
+	Compact		// CompactVertex, 20 bytes (+12 bytes of BoneVertex when the mesh is skinned)
+};
+
+// 20 bytes instead of 88
+struct CompactVertex {
+	// position quantized to unorm16 inside the mesh bounds, w holds the bitangent sign (0 = -1, 65535 = +1)
+	uint16_t Position[4];
+	// octahedral encoded normal, snorm16
+	int16_t Normal[2];
+	// octahedral encoded tangent, snorm16, bitangent = cross(normal, tangent) * sign
+	int16_t Tangent[2];
+	// unorm16 when every coordinate is inside [0, 1], half float otherwise (see Mesh::texCoordsNormalized)
+	uint16_t TexCoords[2];
+};
+
+// separate stream, only uploaded for meshes that carry skinning data
+struct BoneVertex {
+	uint16_t BoneIDs[4];
+	uint8_t Weights[4];		// unorm8
+};
+
+// dequantization of CompactVertex::Position: position = offset + unorm * scale
+struct PositionQuantization {
+	glm::vec3 offset = glm::vec3(0.0f);
+	glm::vec3 scale = glm::vec3(1.0f);
+};
+
+// largest difference between a decoded CompactVertex and the vertex it was encoded from, see Mesh::compactDecodeError
+struct CompactDecodeError {
+	float position = 0.0f;
+	float direction = 0.0f;		// normals and tangents, radians
+	float texCoord = 0.0f;
+	bool withinTolerance = true;
+};
+
+inline float signNotZero(float v)
+{
+	return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// octahedral mapping of a unit vector onto [-1, 1]^2
+inline glm::vec2 octahedralEncode(glm::vec3 n)
+{
+	n /= (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+	glm::vec2 p(n.x, n.y);
+	if (n.z < 0.0f)
+		p = glm::vec2((1.0f - std::abs(n.y)) * signNotZero(n.x), (1.0f - std::abs(n.x)) * signNotZero(n.y));
+	return p;
+}
+
+inline glm::vec3 octahedralDecode(glm::vec2 p)
+{
+	glm::vec3 n(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+	float t = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+inline int16_t quantizeSnorm16(float v)
+{
+	return static_cast<int16_t>(std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+inline float dequantizeSnorm16(int16_t v)
+{
+	return std::max(static_cast<float>(v) / 32767.0f, -1.0f);
+}
+
+inline uint16_t quantizeUnorm16(float v)
+{
+	return static_cast<uint16_t>(std::lround(std::clamp(v, 0.0f, 1.0f) * 65535.0f));
+}
+
+inline float dequantizeUnorm16(uint16_t v)
+{
+	return static_cast<float>(v) / 65535.0f;
+}
+
+// encodes a unit vector so that decoding the snorm16 pair lands as close as possible to it
+inline void encodeDirection(const glm::vec3& v, int16_t out[2])
+{
+	float length = glm::length(v);
+	glm::vec2 p = length > 0.0f ? octahedralEncode(v / length) : glm::vec2(0.0f);
+	out[0] = quantizeSnorm16(p.x);
+	out[1] = quantizeSnorm16(p.y);
+}
+
+inline glm::vec3 decodeDirection(const int16_t in[2])
+{
+	return octahedralDecode(glm::vec2(dequantizeSnorm16(in[0]), dequantizeSnorm16(in[1])));
+}
+
+// unorm8 weights that add up to exactly 255, so the skin matrix keeps its scale: every weight rounded on its own, the
+// remainder put on the largest. A vertex without weights keeps all four at 0
+inline void quantizeBoneWeights(const float weights[4], uint8_t out[4])
+{
+	float sum = 0.0f;
+	for (int k = 0; k < 4; k++)
+		sum += std::max(weights[k], 0.0f);
+	if (sum <= 0.0f)
+	{
+		std::fill(out, out + 4, uint8_t(0));
+		return;
+	}
+	int total = 0, largest = 0;
+	for (int k = 0; k < 4; k++)
+	{
+		out[k] = static_cast<uint8_t>(std::lround(std::max(weights[k], 0.0f) / sum * 255.0f));
+		total += out[k];
+		if (weights[k] > weights[largest])
+			largest = k;
+	}
+	out[largest] = static_cast<uint8_t>(out[largest] + 255 - total);
+}
+
+inline PositionQuantization quantizationFor(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	PositionQuantization quantization;
+	quantization.offset = boundsMin;
+	quantization.scale = glm::max(boundsMax - boundsMin, glm::vec3(1e-20f));
+	return quantization;
+}
+#endif // !VERTEX_COMPRESSION_H
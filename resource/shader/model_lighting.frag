@@ -1,4 +1,4 @@
-#version 420 core
+#version 430 core
 
 #define MAX_TEXTURE_NUM 6
 
@@ -18,57 +18,185 @@ in VS_OUT {
     vec2 TexCoords;
 } fs_in;
 
-uniform vec3 viewPos;
+// per frame constants, see FrameConstants in uniform_ring.h
+layout(std140, binding = 0) uniform Frame {
+	mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    mat4 viewProjection;
+};
+
 uniform samplerCube skybox;
+// image based lighting, see EnvironmentMap: the skybox prefiltered for rising roughness down its mips and the
+// split sum scale and bias to F0 by NdotV and roughness
+uniform samplerCube prefilteredMap;
+uniform sampler2D brdfLUT;
+uniform float prefilteredMaxLod;
+// the diffuse irradiance over pi as the first 9 spherical harmonics, see EnvironmentPrecompute::projectIrradianceSH
+uniform vec3 irradianceSH[9];
 uniform Material material;
 
+// clustered point and spot lights, see LightManager and LightData in light_clusters.h
+uniform bool clusteredLighting;
+struct Light {
+    vec4 position;      // w = radius
+    vec4 direction;     // w = cutOff
+    vec4 ambient;       // w = outerCutOff
+    vec4 diffuse;       // w = constant
+    vec4 specular;      // w = linear
+    float quadratic;
+    uint type;          // 0 point, 1 spot
+};
+layout(std140, binding = 2) uniform Clusters {
+    uvec4 clusterGrid;  // clusters along x, y and z, w = tile size in pixels
+    vec4 clusterDepth;  // slice = log(view depth) * x + y, z = near, w = far
+};
+layout(std430, binding = 8) readonly buffer Lights {
+    Light lights[];
+};
+layout(std430, binding = 9) readonly buffer LightGrid {
+    uvec2 lightGrid[];  // first index and count of every cluster
+};
+layout(std430, binding = 10) readonly buffer LightIndices {
+    uint lightIndices[];
+};
+
+// the directional light of Shader::setDirLight, shadowed by the cascades of CascadedShadowMap in shadow_map.h
+struct DirLight {
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+uniform DirLight dirLight;
+uniform bool shadowsEnabled;
+uniform sampler2DArrayShadow shadowMap;
+layout(std140, binding = 3) uniform Shadows {
+    mat4 lightSpaceMatrices[4];
+    vec4 cascadeSplits;     // view depth every cascade ends at
+    vec4 texelSizes;        // world size of a texel of every cascade
+    vec4 shadowParams;      // x = cascade count, y = 1 / resolution, z = depth bias
+};
+
+// drawn through InstanceManager, the tint of the instance's material
+#ifdef INSTANCED
+in vec4 InstanceTint;
+#endif
+
 out vec4 FragColor;
 
-void main()
+// the point and spot lights of LearnOpenGL's multiple lights chapter, faded out over the last part of the light's
+// radius so it ends where the clusters stop counting it
+vec3 CalcLight(Light light, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
+{
+    vec3 toLight = light.position.xyz - fs_in.FragPos;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / max(distance, 1e-4);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float attenuation = 1.0 / (light.diffuse.w + light.specular.w * distance + light.quadratic * (distance * distance));
+    float window = clamp(1.0 - pow(distance / light.position.w, 4.0), 0.0, 1.0);
+    attenuation *= window * window;
+    if (light.type == 1u)
+    {
+        float theta = dot(lightDir, normalize(-light.direction.xyz));
+        float epsilon = light.direction.w - light.ambient.w;
+        attenuation *= clamp((theta - light.ambient.w) / epsilon, 0.0, 1.0);
+    }
+    vec3 ambient = light.ambient.rgb * diffuseColor;
+    vec3 diffuse = light.diffuse.rgb * diff * diffuseColor;
+    vec3 specular = light.specular.rgb * spec * specularColor;
+    return (ambient + diffuse + specular) * attenuation;
+}
+
+// the lights of the fragment's cluster
+vec3 CalcClusteredLights(vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
+{
+    float depth = -(view * vec4(fs_in.FragPos, 1.0)).z;
+    uvec3 cluster = uvec3(uvec2(gl_FragCoord.xy) / clusterGrid.w, uint(max(log(depth) * clusterDepth.x + clusterDepth.y, 0.0)));
+    cluster = min(cluster, clusterGrid.xyz - 1u);
+    uvec2 range = lightGrid[(cluster.z * clusterGrid.y + cluster.y) * clusterGrid.x + cluster.x];
+
+    vec3 result = vec3(0.0);
+    for (uint i = range.x; i < range.x + range.y; i++)
+        result += CalcLight(lights[lightIndices[i]], normal, viewDir, diffuseColor, specularColor);
+    return result;
+}
+
+// the cascade by view depth, the position pushed along the normal by a texel so flat surfaces do not shadow
+// themselves, then 3x3 hardware compared taps
+float ShadowFactor(vec3 normal, vec3 lightDir)
 {
-    const float offset = 1.0 / 10.0;  
-
-    vec3 offsets[9] = vec3[](
-        vec3(-offset,  offset,  0.0f),
-        vec3( 0.0f,    offset,  0.0f),
-        vec3( offset,  offset,  0.0f),
-        vec3(-offset,  0.0f,    0.0f),
-        vec3( 0.0f,    0.0f,    offset),
-        vec3( offset,  0.0f,    0.0f),
-        vec3(-offset, -offset,  0.0f),
-        vec3( 0.0f,   -offset,  0.0f),
-        vec3( offset, -offset,  0.0f)
-    );
-
-    float kernel[9] = float[](
-        2.0 / 16, 2.0 / 16, 1.0 / 16,
-        2.0 / 16, 2.0 / 16, 2.0 / 16,
-        1.0 / 16, 2.0 / 16, 2.0 / 16  
-    );
+    float depth = -(view * vec4(fs_in.FragPos, 1.0)).z;
+    int count = int(shadowParams.x);
+    int cascade = 0;
+    while (cascade < count - 1 && depth > cascadeSplits[cascade])
+        cascade++;
+    if (depth > cascadeSplits[count - 1])
+        return 1.0;
 
+    float slope = 1.0 - max(dot(normal, lightDir), 0.0);
+    vec3 position = fs_in.FragPos + normal * texelSizes[cascade] * (1.0 + slope);
+    vec4 lightSpace = lightSpaceMatrices[cascade] * vec4(position, 1.0);
+    vec3 coords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+    float reference = coords.z - shadowParams.z;
+
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * shadowParams.y, float(cascade), reference));
+    return lit / 9.0;
+}
+
+// the light a white Lambertian surface facing the normal reflects from the environment, EnvironmentPrecompute::evaluateSH
+vec3 IrradianceSH(vec3 n)
+{
+    vec3 result = irradianceSH[0] * 0.282095
+        + irradianceSH[1] * (0.488603 * n.y) + irradianceSH[2] * (0.488603 * n.z) + irradianceSH[3] * (0.488603 * n.x)
+        + irradianceSH[4] * (1.092548 * n.x * n.y) + irradianceSH[5] * (1.092548 * n.y * n.z)
+        + irradianceSH[6] * (0.315392 * (3.0 * n.z * n.z - 1.0)) + irradianceSH[7] * (1.092548 * n.x * n.z)
+        + irradianceSH[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+    return max(result, vec3(0.0));
+}
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
+{
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float shadow = shadowsEnabled ? ShadowFactor(normal, lightDir) : 1.0;
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
+    return ambient + (diffuse + specular) * shadow;
+}
+
+void main()
+{
     vec3 diffuse = vec3(0.0, 0.0, 0.0);
     for(int i = 0; i < material.texture_diffuse_num; i++)
     {
         diffuse += texture(material.texture_diffuse[i], fs_in.TexCoords).rgb;
     }
 
+    vec3 N = normalize(fs_in.Normal);
     vec3 I = normalize(fs_in.FragPos - viewPos);
-    vec3 R = reflect(I, normalize(fs_in.Normal));
+    vec3 R = reflect(I, N);
+
+    // the blinn-phong exponent as a GGX roughness, then one prefiltered fetch and one LUT fetch for every specular map
+    float roughness = sqrt(2.0 / (material.shininess + 2.0));
+    vec3 prefiltered = textureLod(prefilteredMap, R, roughness * prefilteredMaxLod).rgb;
+    vec2 brdf = texture(brdfLUT, vec2(max(dot(N, -I), 0.0), roughness)).rg;
 
     vec3 specular = vec3(0.0, 0.0, 0.0);
+    vec3 specularColor = vec3(0.0, 0.0, 0.0);
     for(int i = 0; i < material.texture_specular_num; i++)
     {
-        vec3 skyboxcolor[9];
-        for(int i = 0; i < 9; i++)
-        {
-            skyboxcolor[i] = texture(skybox, R + offsets[i]).rgb;
-        }
-
-        vec3 color = vec3(0.0f);
-        for(int i = 0; i < 9; i++)
-            color += skyboxcolor[i] * kernel[i];
-
-        specular += color * texture(material.texture_specular[i], fs_in.TexCoords).rgb;
+        vec3 F0 = texture(material.texture_specular[i], fs_in.TexCoords).rgb;
+        specular += prefiltered * (F0 * brdf.x + brdf.y);
+        specularColor += F0;
     }
 
     vec3 reflection = vec3(0.0, 0.0, 0.0);
@@ -79,7 +207,14 @@ void main()
             reflection += texture(skybox, R).rgb * texture(material.texture_reflection[i], fs_in.TexCoords).rgb;
     }
 
-    vec3 result = diffuse + specular * 0.4 + reflection * 0.6;
+    // the diffuse maps lit by the environment's irradiance, next to its prefiltered specular
+    vec3 result = diffuse * IrradianceSH(N) + specular * 0.4 + reflection * 0.6;
+    result += CalcDirLight(dirLight, N, -I, diffuse, specularColor);
+    if (clusteredLighting)
+        result += CalcClusteredLights(N, -I, diffuse, specularColor);
+#ifdef INSTANCED
+    result *= InstanceTint.rgb;
+#endif
     
     FragColor = vec4(result, 1.0f);
 }
\ No newline at end of file
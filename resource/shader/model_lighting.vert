@@ -1,16 +1,33 @@
-#version 420 core
+#version 430 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 layout (location = 3) in vec3 aTangent;
 layout (location = 4) in vec3 aBitangent;
-layout (location = 5) in int aBoneID;
-layout (location = 6) in float aWeight;
+layout (location = 5) in ivec4 aBoneIDs;
+layout (location = 6) in vec4 aWeights;
 
-// transform matrix
-layout(std140, binding = 0) uniform Matrices {
+// per frame constants, see FrameConstants in uniform_ring.h
+layout(std140, binding = 0) uniform Frame {
 	mat4 projection;
     mat4 view;
+    vec3 viewPos;
+    mat4 viewProjection;
+};
+
+// per draw constants, see ObjectConstants in uniform_ring.h
+layout(std140, binding = 1) uniform Object {
+    mat4 model;
+    mat4 modelViewProjection;   // computed once per object, see TransformStage
+    mat3x4 normalMatrix;
+    vec3 positionOffset;    // compact vertex layout only
+    vec3 positionScale;
+    uint paletteOffset;     // 0xFFFFFFFF for draws that aren't skinned
+};
+
+// skinning matrices of every animated character, see AnimationSystem
+layout(std430, binding = 7) readonly buffer BonePalette {
+    mat4 bones[];
 };
 
 out VS_OUT {
@@ -18,13 +35,27 @@ out VS_OUT {
     vec3 Normal;
     vec2 TexCoords;
 } vs_out;
-uniform mat4 model;
+
+// blend of up to four bone matrices, the identity for meshes drawn in bind pose
+mat4 skinning()
+{
+    if (paletteOffset == 0xFFFFFFFFu || dot(aWeights, vec4(1.0)) <= 0.0)
+        return mat4(1.0);
+    mat4 skin = mat4(0.0);
+    for (int i = 0; i < 4; i++)
+        if (aWeights[i] > 0.0)
+            skin += bones[paletteOffset + uint(aBoneIDs[i])] * aWeights[i];
+    return skin;
+}
 
 void main()
 {
+    mat4 skin = skinning();
+    vec4 position = skin * vec4(aPos, 1.0);
+
     vs_out.TexCoords = aTexCoords;
-    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));
-    vs_out.Normal = mat3(transpose(inverse(model))) * aNormal;
+    vs_out.FragPos = vec3(model * position);
+    vs_out.Normal = mat3(normalMatrix) * mat3(skin) * aNormal;
 
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = modelViewProjection * position;
 }
\ No newline at end of file
@@ -0,0 +1,72 @@
+#version 430 core
+// compact vertex layout, see CompactVertex in vertex_compression.h
+layout (location = 0) in vec4 aPosition;    // unorm16 inside the mesh bounds, w = bitangent sign
+layout (location = 1) in vec2 aNormal;      // octahedral, snorm16
+layout (location = 2) in vec2 aTexCoords;   // unorm16 or half float
+layout (location = 3) in vec2 aTangent;     // octahedral, snorm16
+layout (location = 5) in ivec4 aBoneIDs;
+layout (location = 6) in vec4 aWeights;
+
+// per frame constants, see FrameConstants in uniform_ring.h
+layout(std140, binding = 0) uniform Frame {
+	mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    mat4 viewProjection;
+};
+
+// per draw constants, see ObjectConstants in uniform_ring.h
+layout(std140, binding = 1) uniform Object {
+    mat4 model;
+    mat4 modelViewProjection;   // computed once per object, see TransformStage
+    mat3x4 normalMatrix;
+    vec3 positionOffset;    // compact vertex layout only
+    vec3 positionScale;
+    uint paletteOffset;     // 0xFFFFFFFF for draws that aren't skinned
+};
+
+// skinning matrices of every animated character, see AnimationSystem
+layout(std430, binding = 7) readonly buffer BonePalette {
+    mat4 bones[];
+};
+
+out VS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec2 TexCoords;
+} vs_out;
+
+// position = positionOffset + aPosition.xyz * positionScale
+
+vec3 octahedralDecode(vec2 p)
+{
+    vec3 n = vec3(p.x, p.y, 1.0 - abs(p.x) - abs(p.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// blend of up to four bone matrices, the identity for meshes drawn in bind pose
+mat4 skinning()
+{
+    if (paletteOffset == 0xFFFFFFFFu || dot(aWeights, vec4(1.0)) <= 0.0)
+        return mat4(1.0);
+    mat4 skin = mat4(0.0);
+    for (int i = 0; i < 4; i++)
+        if (aWeights[i] > 0.0)
+            skin += bones[paletteOffset + uint(aBoneIDs[i])] * aWeights[i];
+    return skin;
+}
+
+void main()
+{
+    mat4 skin = skinning();
+    vec4 position = skin * vec4(positionOffset + aPosition.xyz * positionScale, 1.0);
+
+    vs_out.TexCoords = aTexCoords;
+    vs_out.FragPos = vec3(model * position);
+    vs_out.Normal = mat3(normalMatrix) * mat3(skin) * octahedralDecode(aNormal);
+
+    gl_Position = modelViewProjection * position;
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec3 aTangent;
+layout (location = 4) in vec3 aBitangent;
+layout (location = 5) in ivec4 aBoneIDs;
+layout (location = 6) in vec4 aWeights;
+
+// per frame constants, see FrameConstants in uniform_ring.h
+layout(std140, binding = 0) uniform Frame {
+	mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    mat4 viewProjection;
+};
+
+// see InstanceData and InstanceMaterial in instance_manager.h
+struct Instance {
+    mat4 model;
+    mat3x4 normalMatrix;
+    uint material;
+};
+layout(std430, binding = 3) readonly buffer Instances {
+    Instance instances[];
+};
+// written by instance_cull.comp, instance i of the draw is visibleInstances[i]
+layout(std430, binding = 4) readonly buffer VisibleInstances {
+    uint visibleCount;
+    uint visibleInstances[];
+};
+layout(std430, binding = 5) readonly buffer InstanceMaterials {
+    vec4 materialTints[];
+};
+
+out VS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec2 TexCoords;
+} vs_out;
+out vec4 InstanceTint;
+
+void main()
+{
+    Instance instance = instances[visibleInstances[gl_InstanceID]];
+    mat4 model = instance.model;
+
+    vs_out.TexCoords = aTexCoords;
+    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));
+    vs_out.Normal = mat3(instance.normalMatrix) * aNormal;
+    InstanceTint = materialTints[instance.material];
+
+    gl_Position = viewProjection * model * vec4(aPos, 1.0);
+}
\ No newline at end of file
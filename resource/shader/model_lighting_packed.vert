@@ -0,0 +1,48 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec3 aTangent;
+layout (location = 4) in vec3 aBitangent;
+layout (location = 5) in ivec4 aBoneIDs;
+layout (location = 6) in vec4 aWeights;
+// index of the draw in the multi draw, comes from the baseInstance of the indirect command
+layout (location = 7) in uint aDrawID;
+
+// per frame constants, see FrameConstants in uniform_ring.h
+layout(std140, binding = 0) uniform Frame {
+	mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    mat4 viewProjection;
+};
+
+// per draw transform index and per model matrices, see PackedGeometry and ObjectTransform
+layout(std430, binding = 1) readonly buffer DrawTransforms {
+    uint drawTransform[];
+};
+struct Transform {
+    mat4 model;
+    mat3x4 normalMatrix;
+};
+layout(std430, binding = 2) readonly buffer Transforms {
+    Transform transforms[];
+};
+
+out VS_OUT {
+    vec3 FragPos;
+    vec3 Normal;
+    vec2 TexCoords;
+} vs_out;
+
+void main()
+{
+    Transform transform = transforms[drawTransform[aDrawID]];
+    mat4 model = transform.model;
+
+    vs_out.TexCoords = aTexCoords;
+    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));
+    vs_out.Normal = mat3(transform.normalMatrix) * aNormal;
+
+    gl_Position = viewProjection * model * vec4(aPos, 1.0);
+}
\ No newline at end of file
@@ -3,7 +3,14 @@
 in vec3 Normal;
 in vec3 FragPos;
 
-uniform vec3 viewPos;
+// per frame constants, see FrameConstants in uniform_ring.h
+layout(std140, binding = 0) uniform Frame {
+	mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    mat4 viewProjection;
+};
+
 uniform samplerCube skybox;
 
 out vec4 FragColor;
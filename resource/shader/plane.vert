@@ -2,12 +2,22 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 
-layout(std140, binding = 0) uniform Matrices {
+// per frame constants, see FrameConstants in uniform_ring.h
+layout(std140, binding = 0) uniform Frame {
 	mat4 projection;
     mat4 view;
+    vec3 viewPos;
+    mat4 viewProjection;
 };
 
-uniform mat4 model;
+// per draw constants, see ObjectConstants in uniform_ring.h
+layout(std140, binding = 1) uniform Object {
+    mat4 model;
+    mat4 modelViewProjection;   // computed once per object, see TransformStage
+    mat3x4 normalMatrix;
+    vec3 positionOffset;    // compact vertex layout only
+    vec3 positionScale;
+};
 
 out vec3 FragPos;
 out vec3 Normal;
@@ -15,7 +25,7 @@ out vec3 Normal;
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = mat3(normalMatrix) * aNormal;
 
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = modelViewProjection * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,6 @@
+#version 420 core
+
+// depth only, the shadow map has no color attachment
+void main()
+{
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#version 420 core
+// compact meshes read their unorm16 positions here too, CascadedShadowMap folds the dequantization into the matrix
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 lightModelViewProjection;
+
+void main()
+{
+	gl_Position = lightModelViewProjection * vec4(aPos, 1.0);
+}
\ No newline at end of file
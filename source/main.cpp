@@ -2,32 +2,53 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <nlohmann/json.hpp>
+#include <imgui.h>
+#include <imgui_impl_glfw.h>
+#include <imgui_impl_opengl3.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/constants.hpp>
 
 #include <shader.h>
 #include <model.h>
 #include <camera.h>
 #include <skybox.h>
+#include <environment_map.h>
+#include <light_manager.h>
+#include <shadow_map.h>
+#include <packed_geometry.h>
+#include <instance_manager.h>
+#include <animation_system.h>
+#include <scene.h>
+#include <render_queue.h>
+#include <frame_pipeline.h>
+#include <uniform_ring.h>
+#include <benchmark.h>
+#include <texture_baker.h>
+#include <frame_benchmark.h>
+#include <profiler.h>
+#include <profiler_overlay.h>
 
-#include <Windows.h>
 #include <iostream>
+#include <memory>
+#include <random>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow* window);
-void showFPS(GLFWwindow* pWindow);
+void showFPS(GLFWwindow* pWindow, const CullingStats& culling, const LODStats& lod, const TextureStreamingStats* streaming, const UniformRingStats& uniforms, const StateCacheStats& state, const LightClusterStats& lighting, const CascadedShadowMap& shadows);
 
 // settings
 constexpr unsigned int SCR_WIDTH = 1600;
 constexpr unsigned int SCR_HEIGHT = 1600;
 
-// camera
-Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+// input, read on the render thread and handed to the update step, which moves the camera
+InputState input;
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
@@ -40,40 +61,201 @@ float lastFrame = 0.0f;
 int framesNumber = 0;
 float lastTime = 0.0f;
 
+// picking, the cursor is captured so a click picks what is under the screen center
+bool pickRequested = false;
+
+// camera track recording for the frame benchmark, F5 starts and stops
+bool recordToggleRequested = false;
+
+// profiler, F6 shows and hides the overlay and F7 writes a Chrome trace
+bool profilerOverlayToggleRequested = false;
+bool traceDumpRequested = false;
+
 // lighting
 glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
 
+// everything a frame is drawn from, written by the update step and only read by the render thread
+struct SceneState {
+	Camera camera;
+	glm::mat4 nanosuitTransform = glm::mat4(1.0f);
+	glm::mat4 zeldaTransform = glm::mat4(1.0f);
+	vector<glm::mat4> bones;		// the animation system's palette
+};
 
-inline GLFWwindow* initOpenGL(const std::string& path);
 
-int main()
+inline nlohmann::json loadConfiguration(const std::string& filename);
+inline GLFWwindow* initOpenGL(const nlohmann::json& config, bool headless = false, int contextAPI = GLFW_NATIVE_CONTEXT_API);
+
+int main(int argc, char* argv[])
 {
-	GLFWwindow* window = initOpenGL(R"(global.json)");
+	nlohmann::json config = loadConfiguration(R"(global.json)");
+
+	const char* nanosuitPath = R"(resource/model/nanosuit/nanosuit.obj)";
+	const char* zeldaPath = R"(resource/model/zelda/Zelda.dae)";
+	vector<std::string> faces
+	{
+		R"(resource/texture/skybox/px.png)",
+			R"(resource/texture/skybox/nx.png)",
+			R"(resource/texture/skybox/py.png)",
+			R"(resource/texture/skybox/ny.png)",
+			R"(resource/texture/skybox/pz.png)",
+			R"(resource/texture/skybox/nz.png)"
+	};
+
+	// bake mode: TryOpenGL --bake, compresses the model and skybox textures to KTX2 next to the sources, needs no window
+	if (argc > 1 && std::string(argv[1]) == "--bake")
+	{
+		TextureBaker baker;
+		baker.bakeModel(nanosuitPath);
+		baker.bakeModel(zeldaPath);
+		for (const std::string& face : faces)
+			baker.bake(face, TextureRole::Diffuse);
+		return baker.finish() ? 0 : 1;
+	}
+
+	// frame benchmark mode: TryOpenGL --benchmark [track.json], replays a camera track offscreen and exits with its status
+	const FrameBenchmarkSettings benchmarkSettings = FrameBenchmarkSettings::from(config, argc, argv);
+	GLFWwindow* window = initOpenGL(config, benchmarkSettings.enabled && benchmarkSettings.headless, benchmarkSettings.glfwContextAPI());
+
+	// let the driver compile shaders on its own threads when it can
+	ShaderCache::shared().enableParallelCompile((GLADloadproc)glfwGetProcAddress);
+
+	// benchmark mode: TryOpenGL --bench <name>
+	if (argc > 2 && std::string(argv[1]) == "--bench")
+	{
+		int status = runBenchmark(argv[2]);
+		glfwTerminate();
+		return status;
+	}
+
+	Profiler::instance().setThreadName("main");
+
+	// the profiler overlay is drawn with ImGui, the GLFW backend chains the callbacks installed above
+	const bool imgui = !benchmarkSettings.enabled;
+	bool showProfiler = config.value("profiler_overlay", false);
+	unsigned int traceCount = 0;
+	if (imgui)
+	{
+		IMGUI_CHECKVERSION();
+		ImGui::CreateContext();
+		ImGui::StyleColorsDark();
+		ImGui_ImplGlfw_InitForOpenGL(window, true);
+		ImGui_ImplOpenGL3_Init("#version 330");
+	}
 
 	// build and compile our shader program
 	// ------------------------------------
-	Shader modelShader(R"(resource\shader\model_lighting.vert)", R"(resource\shader\model_lighting.frag)");
-	Shader planeShader(R"(resource\shader\plane.vert)", R"(resource\shader\plane.frag)");
+	// linked programs are cached on disk, the ones that miss compile on the driver's threads while the models load,
+	// every Shader is finalized on its first use
+	ShaderCache::shared().setDirectory(config.value("shader_cache", std::string("shader_cache")));
+	// the compact vertex layout needs its own vertex shader to decode the quantized attributes
+	const bool compactVertices = config.value("compact_vertex_format", false);
+	const VertexFormat vertexFormat = compactVertices ? VertexFormat::Compact : VertexFormat::Full;
+	// packed mode draws every model from shared arenas with multi draw indirect, it only takes full vertices
+	const bool packedGeometry = config.value("packed_geometry", false) && !compactVertices;
+	const char* modelVertexShader = packedGeometry ? R"(resource/shader/model_lighting_packed.vert)"
+		: compactVertices ? R"(resource/shader/model_lighting_compact.vert)" : R"(resource/shader/model_lighting.vert)";
+	Shader modelShader(modelVertexShader, R"(resource/shader/model_lighting.frag)");
+	Shader planeShader(R"(resource/shader/plane.vert)", R"(resource/shader/plane.frag)");
+
+	// with streaming on, model textures load their mip tails and refine under a memory budget while drawn
+	TextureStreamer& textureStreamer = TextureStreamer::shared();
+	textureStreamer.setEnabled(config.value("texture_streaming", false));
+	textureStreamer.setBudget(config.value("texture_budget_mb", 256ull) * 1024 * 1024);
+
+	Skybox skybox(faces, R"(resource/shader/skybox.vert)", R"(resource/shader/skybox.frag)");
+
+	unsigned int cubemapTexture = skybox.cubemapTexture();
+
+	// the skybox convolved for image based lighting, read from environment.envmap next to the faces after the first start
+	EnvironmentMap environment(faces);
 
 	// load models
 	// -----------
-	Model nanosuit(R"(resource\model\nanosuit\nanosuit.obj)");
-	Model zelda(R"(resource\model\zelda\Zelda.dae)");
-	//Model nahida(R"(resource\model\nahida\nahida.pmx)");
-	//Model creeper(R"(resource\model\\creeper\source\creeper.fbx)");
+	Model nanosuit(nanosuitPath, false, true, vertexFormat);
+	Model zelda(zeldaPath, false, true, vertexFormat);
+
+	// the scene BVH culls and picks mesh instances, the transforms are set every frame
+	Scene scene;
+	unsigned int nanosuitInstance = scene.add(nanosuit, glm::mat4(1.0f));
+	unsigned int zeldaInstance = scene.add(zelda, glm::mat4(1.0f));
+
+	// skeletal animation: zelda plays her first clip if the file has any, skinned in the vertex shader from the bone palette.
+	// Packed mode draws her in the bind pose
+	AnimationSystem animationSystem;
+	if (!zelda.skeleton.empty())
+	{
+		const unsigned int zeldaCharacter = animationSystem.add(zelda);
+		animationSystem.animator(zeldaCharacter).play(0);
+		scene.setBonePalette(zeldaInstance, animationSystem.paletteOffset(zeldaCharacter));
+	}
 
-	vector<std::string> faces
+	// cascaded shadows of the directional light: nanosuit and the props are static casters drawn into the cache,
+	// zelda moves with her animation so she is drawn every frame, in the bind pose
+	ShadowSettings shadowSettings;
+	shadowSettings.resolution = config.value("shadow_map_size", shadowSettings.resolution);
+	shadowSettings.distance = config.value("shadow_distance", shadowSettings.distance);
+	CascadedShadowMap shadows(shadowSettings);
+	const glm::vec3 sunDirection(-0.4f, -1.0f, -0.3f);
+	shadows.setLight(sunDirection);
+	const unsigned int nanosuitCaster = shadows.addCaster(nanosuit, glm::scale(glm::mat4(1.0f), glm::vec3(nanosuit.getScalingY())), true);
+	const unsigned int zeldaCaster = shadows.addCaster(zelda, glm::mat4(1.0f), false);
+
+	PackedGeometry packedModels;
+	unsigned int nanosuitSlot = 0, zeldaSlot = 0;
+	if (packedGeometry)
 	{
-		R"(resource\texture\skybox\px.png)",
-			R"(resource\texture\skybox\nx.png)",
-			R"(resource\texture\skybox\py.png)",
-			R"(resource\texture\skybox\ny.png)",
-			R"(resource\texture\skybox\pz.png)",
-			R"(resource\texture\skybox\nz.png)"
-	};
-	Skybox skybox(faces, R"(resource\shader\skybox.vert)", R"(resource\shader\skybox.frag)");
+		nanosuitSlot = packedModels.add(nanosuit);
+		zeldaSlot = packedModels.add(zelda);
+		packedModels.build();
+	}
 
-	unsigned int cubemapTexture = skybox.cubemapTexture();
+	// instanced props: a field of small nanosuits around the scene, culled by a compute pass and drawn with one indirect
+	// draw per mesh however many there are. Like packed mode it only takes full vertices
+	const unsigned int propCount = compactVertices ? 0 : config.value("instanced_props", 0u);
+	std::unique_ptr<InstanceManager> props;
+	std::unique_ptr<Shader> propShader;
+	if (propCount > 0)
+	{
+		props = std::make_unique<InstanceManager>(nanosuit);
+		propShader = std::make_unique<Shader>(R"(resource/shader/model_lighting_instanced.vert)", R"(resource/shader/model_lighting.frag)", nullptr, vector<std::string>{ "INSTANCED" });
+
+		const unsigned int tints[] = {
+			0, props->addMaterial(glm::vec4(1.0f, 0.6f, 0.6f, 1.0f)), props->addMaterial(glm::vec4(0.6f, 1.0f, 0.6f, 1.0f)), props->addMaterial(glm::vec4(0.6f, 0.6f, 1.0f, 1.0f))
+		};
+		const int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(propCount))));
+		const float spacing = 0.5f;
+		std::mt19937 random(5);
+		std::uniform_real_distribution<float> jitter(-0.2f, 0.2f), angle(0.0f, glm::two_pi<float>());
+		props->reserve(propCount);
+		for (unsigned int i = 0; i < propCount; i++)
+		{
+			const int x = static_cast<int>(i) % side - side / 2, z = static_cast<int>(i) / side - side / 2;
+			const glm::vec3 position(x * spacing + jitter(random), 0.0f, z * spacing + jitter(random));
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+			transform = glm::rotate(transform, angle(random), glm::vec3(0.0f, 1.0f, 0.0f));
+			transform = glm::scale(transform, glm::vec3(nanosuit.getScalingY() * 0.25f));
+			props->add(transform, tints[i % 4]);
+			shadows.addCaster(nanosuit, transform, true);
+		}
+	}
+
+	FrameBenchmark frameBenchmark(benchmarkSettings);
+	if (benchmarkSettings.enabled && !frameBenchmark.begin(SCR_WIDTH, SCR_HEIGHT))
+	{
+		glfwTerminate();
+		return FrameBenchmark::STATUS_ERROR;
+	}
+	CameraTrack recordedTrack;
+	bool recordingTrack = false;
+	float recordingStart = 0.0f;
+
+	// meshes outside the view frustum are never submitted
+	FrustumCuller culler;
+	// triangles drawn per LOD, distant meshes use their simplified index buffers
+	LODStats lodStats;
+	// scene draws are sorted by program, material and vertex array, then submitted through a state cache
+	RenderQueue renderQueue;
 
 	float plane_vertices[] = {
 		 2.0f,  0.0f,  -2.0f, 0.0f, 1.0f, 0.0f,
@@ -104,38 +286,175 @@ int main()
 	glBindVertexArray(0);
 
 	// uniform buffer
-	unsigned int uboTransformMatrices;
-	glGenBuffers(1, &uboTransformMatrices);
-	glBindBuffer(GL_UNIFORM_BUFFER, uboTransformMatrices);
-	glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), NULL, GL_STATIC_DRAW);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, uboTransformMatrices, 0, 2 * sizeof(glm::mat4));
+	// the Frame and Object constants are written into a persistently mapped ring, three frames deep
+	UniformRing uniformRing;
+
+	// clustered lights: small colored point lights bobbing over the plane, binned into the camera's clusters every frame.
+	// off unless global.json asks for some, the light bench measures the large counts
+	LightManager lights;
+	const unsigned int lightCount = config.value("clustered_lights", 0u);
+	vector<glm::vec3> lightOrigins(lightCount);
+	vector<float> lightPhases(lightCount);
+	{
+		std::mt19937 random(24);
+		std::uniform_real_distribution<float> spread(-2.0f, 2.0f), height(0.1f, 1.5f), hue(0.2f, 1.0f), phase(0.0f, glm::two_pi<float>());
+		for (unsigned int i = 0; i < lightCount; i++)
+		{
+			lightOrigins[i] = glm::vec3(spread(random), height(random), spread(random));
+			lightPhases[i] = phase(random);
+			const glm::vec3 color(hue(random), hue(random), hue(random));
+			lights.addPointLight(lightOrigins[i], color * 0.05f, color * 0.5f, color * 0.5f, 1.0f, 2.0f, 20.0f);
+		}
+	}
+	float lightTime = 0.0f;
 
 	// shader configuration
 	// --------------------
 	modelShader.use();
 	modelShader.setInt("skybox", 10);
+	environment.setUniforms(modelShader);
+	lights.setUniforms(modelShader);
+	modelShader.setDirLight(sunDirection, glm::vec3(0.05f), glm::vec3(0.4f), glm::vec3(0.5f));
+	shadows.setUniforms(modelShader);
 	modelShader.setFloat("material.shininess", 64.0f);
 
 	planeShader.use();
 	planeShader.setInt("skybox", 10);
 
+	if (propShader)
+	{
+		propShader->use();
+		propShader->setInt("skybox", 10);
+		environment.setUniforms(*propShader);
+		lights.setUniforms(*propShader);
+		propShader->setDirLight(sunDirection, glm::vec3(0.05f), glm::vec3(0.4f), glm::vec3(0.5f));
+		shadows.setUniforms(*propShader);
+		propShader->setFloat("material.shininess", 64.0f);
+	}
+
+#ifdef _DEBUG
+	const ShaderCacheStats& shaderCacheStats = ShaderCache::shared().stats;
+	std::cout << "SUCCESSFULLY::SHADER_CACHE::STARTUP\n"
+		<< "    HITS: " << shaderCacheStats.hits << " MISSES: " << shaderCacheStats.misses << " REJECTED: " << shaderCacheStats.rejected << "\n"
+		<< "    PARALLEL_COMPILE: " << (ShaderCache::shared().parallelCompile() ? "true" : "false") << "\n";
+#endif
+
+	// update step: moves the camera by the input, places the models and poses the animated ones. With
+	// threaded_update it runs on its own thread one frame ahead, while the render thread draws the last state
+	const float nanosuitScale = nanosuit.getScalingY(), zeldaScale = zelda.getScalingY();
+	Camera simulatedCamera(glm::vec3(0.0f, 0.0f, 3.0f));
+	InputState consumedInput;
+	auto updateScene = [&](const InputState& frameInput, float frameDelta, SceneState& state) {
+		if (frameInput.posed)
+			simulatedCamera.SetPose(frameInput.position, frameInput.yaw, frameInput.pitch, frameInput.zoom);
+		else
+		{
+			if (frameInput.forward)
+				simulatedCamera.ProcessKeyboard(FORWARD, frameDelta);
+			if (frameInput.backward)
+				simulatedCamera.ProcessKeyboard(BACKWARD, frameDelta);
+			if (frameInput.left)
+				simulatedCamera.ProcessKeyboard(LEFT, frameDelta);
+			if (frameInput.right)
+				simulatedCamera.ProcessKeyboard(RIGHT, frameDelta);
+			if (frameInput.up)
+				simulatedCamera.ProcessKeyboard(UP, frameDelta);
+			if (frameInput.down)
+				simulatedCamera.ProcessKeyboard(DOWN, frameDelta);
+			if (frameInput.mouseX != consumedInput.mouseX || frameInput.mouseY != consumedInput.mouseY)
+				simulatedCamera.ProcessMouseMovement(static_cast<float>(frameInput.mouseX - consumedInput.mouseX), static_cast<float>(frameInput.mouseY - consumedInput.mouseY));
+			if (frameInput.scroll != consumedInput.scroll)
+				simulatedCamera.ProcessMouseScroll(static_cast<float>(frameInput.scroll - consumedInput.scroll));
+		}
+		consumedInput = frameInput;
+		state.camera = simulatedCamera;
+
+		// nanosuit at the center, zelda next to her, both too big for our scene so scaled down
+		state.nanosuitTransform = glm::scale(glm::mat4(1.0f), glm::vec3(nanosuitScale));
+		state.zeldaTransform = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 0.0f, 0.0f)), glm::vec3(zeldaScale));
+
+		if (animationSystem.size())
+		{
+			PROFILE_SCOPE("animation");
+			animationSystem.update(frameDelta);
+			state.bones = animationSystem.bones();
+		}
+	};
+	FramePipeline<SceneState> pipeline(updateScene, config.value("threaded_update", true));
+	// benchmark mode: the track poses this camera, the pose reaches the update step with the input
+	Camera trackCamera(glm::vec3(0.0f, 0.0f, 3.0f));
+
 	// render loop
 	// -----------
 	while (!glfwWindowShouldClose(window))
 	{
-		// per-frame time logic
-		// --------------------
-		float currentFrame = static_cast<float>(glfwGetTime());
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
-
-		// show fps in window title 
-		showFPS(window);
-
-		// input
-		// -----
-		processInput(window);
+		Profiler::instance().beginFrame();
+		PROFILE_SCOPE("frame");
+
+		// the state the update step finished for this frame, the next one starts below once the input is read
+		const SceneState& frame = pipeline.acquire();
+		Camera camera = frame.camera;
+
+		// GL work the jobs handed back to this thread
+		JobSystem::shared().pumpMainThread();
+
+		if (benchmarkSettings.enabled)
+		{
+			// the track poses the camera and the timestep is fixed, so every run renders the same frames
+			if (!frameBenchmark.running())
+				break;
+			deltaTime = frameBenchmark.beginFrame(trackCamera);
+			input.posed = true;
+			input.position = trackCamera.Position;
+			input.yaw = trackCamera.Yaw;
+			input.pitch = trackCamera.Pitch;
+			input.zoom = trackCamera.Zoom;
+		}
+		else
+		{
+			// per-frame time logic
+			// --------------------
+			float currentFrame = static_cast<float>(glfwGetTime());
+			deltaTime = currentFrame - lastFrame;
+			lastFrame = currentFrame;
+
+			// show fps in window title 
+			const TextureStreamingStats streamingStats = textureStreamer.stats();
+			showFPS(window, culler.stats, lodStats, textureStreamer.enabled() ? &streamingStats : nullptr, uniformRing.stats, renderQueue.state.stats, lights.stats(), shadows);
+
+			// input
+			// -----
+			PROFILE_SCOPE("input");
+			processInput(window);
+
+			if (recordToggleRequested)
+			{
+				recordToggleRequested = false;
+				if (recordingTrack && recordedTrack.save(benchmarkSettings.track))
+					std::cout << "CAMERA_TRACK::SAVED: " << benchmarkSettings.track << " (" << recordedTrack.keys.size() << " keys)\n";
+				recordingTrack = !recordingTrack;
+				recordedTrack.keys.clear();
+				recordingStart = currentFrame;
+			}
+			if (recordingTrack)
+				recordedTrack.record(currentFrame - recordingStart, camera);
+
+			if (profilerOverlayToggleRequested)
+			{
+				profilerOverlayToggleRequested = false;
+				showProfiler = !showProfiler;
+			}
+			if (traceDumpRequested)
+			{
+				traceDumpRequested = false;
+				const std::string tracePath = "profile_trace_" + std::to_string(traceCount++) + ".json";
+				if (Profiler::instance().writeChromeTrace(tracePath))
+					std::cout << "PROFILER::TRACE_SAVED: " << tracePath << "\n";
+			}
+		}
+		pipeline.kick(input, deltaTime);
+		culler.resetStats();
+		lodStats.reset();
 
 		// render
 		// ------
@@ -147,81 +466,170 @@ int main()
 
 		glActiveTexture(GL_TEXTURE10);
 		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-
-		modelShader.setVec3("viewPos", camera.Position);
+		environment.bind();
 
 		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 		glm::mat4 view = camera.GetViewMatrix();
 		glm::mat4 model = glm::mat4(1.0f);
 
-		// buffer transformation matrices
-		glBindBuffer(GL_UNIFORM_BUFFER, uboTransformMatrices);
-		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(projection));
-		glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(view));
-
-		// draw nanosuit
-		model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f)); // translate it down so it's at the center of the scene
-		model = glm::scale(model, glm::vec3(nanosuit.getScalingY()));	// it's a bit too big for our scene, so scale it down
-		modelShader.setMat4("model", model);
-
-		nanosuit.render(modelShader);
-
-		// draw zelda
-		model = glm::mat4(1.0f);
-		model = glm::translate(model, glm::vec3(1.0f, 0.0f, 0.0f));
-		model = glm::scale(model, glm::vec3(zelda.getScalingY()));	// it's a bit too big for our scene, so scale it down
-		modelShader.setMat4("model", model);
-
-		zelda.render(modelShader);
-
-		//// draw nahida
-		//model = glm::mat4(1.0f);
-		//model = glm::translate(model, glm::vec3(-1.0f, 0.0f, 0.0f));
-		//model = glm::scale(model, glm::vec3(nahida.getScalingY()));	// it's a bit too big for our scene, so scale it down
-		//modelShader.setMat4("model", model);
-
-		//nahida.render(modelShader);
-
-		//// draw creeper
-		//model = glm::mat4(1.0f);
-		//model = glm::translate(model, glm::vec3(-2.0f, 0.0f, 0.0f));
-		//model = glm::scale(model, glm::vec3(creeper.getScalingZ()));	// it's a bit too big for our scene, so scale it down
-		//model = glm::rotate(model, glm::radians(90.0f), glm::vec3(-2.0f, 0.0f, 0.0f));
-		//modelShader.setMat4("model", model);
-
-		//creeper.render(modelShader);
-
-		// draw skybox
-		view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
-
-		skybox.draw(projection, view);
-
-		planeShader.use();
-		glActiveTexture(GL_TEXTURE10);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-
-		planeShader.setVec3("viewPos", camera.Position);
-		model = glm::mat4(1.0f);
-		planeShader.setMat4("model", model);
-		glBindVertexArray(planeVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+		// per frame constants: camera matrices and position
+		uniformRing.beginFrame();
+		FrameConstants frameConstants;
+		frameConstants.projection = projection;
+		frameConstants.view = view;
+		frameConstants.viewPos = glm::vec4(camera.Position, 1.0f);
+		frameConstants.viewProjection = projection * view;
+		uniformRing.bind(FRAME_UNIFORM_BINDING, frameConstants);
+
+		culler.setFrustum(Frustum::fromMatrix(projection * view));
+
+		// move the lights, then bin them into the clusters of this frame's camera
+		lightTime += deltaTime;
+		for (unsigned int i = 0; i < lightCount; i++)
+			lights.setPosition(i, lightOrigins[i] + glm::vec3(0.0f, 0.3f * std::sin(lightTime + lightPhases[i]), 0.0f));
+		lights.update(view, camera.Zoom, (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f, SCR_WIDTH, SCR_HEIGHT);
+		lights.bind();
+		const LODSelection lodSelection = LODSelection::perspective(camera.Position, camera.Zoom, static_cast<float>(SCR_HEIGHT));
+
+		// draw nanosuit and zelda where the update step placed them
+		scene.setTransform(nanosuitInstance, frame.nanosuitTransform);
+		scene.setTransform(zeldaInstance, frame.zeldaTransform);
+		if (packedGeometry)
+		{
+			packedModels.setTransform(nanosuitSlot, frame.nanosuitTransform);
+			packedModels.setTransform(zeldaSlot, frame.zeldaTransform);
+		}
+
+		if (!frame.bones.empty())
+		{
+			animationSystem.upload(frame.bones);
+			animationSystem.bind();
+		}
+
+		// the static casters only redraw when a cascade moved, so an unchanged nanosuit transform costs nothing
+		shadows.setTransform(nanosuitCaster, frame.nanosuitTransform);
+		shadows.setTransform(zeldaCaster, frame.zeldaTransform);
+		shadows.update(view, camera.Zoom, (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f);
+		{
+			PROFILE_SCOPE("shadow pass");
+			PROFILE_GPU_SCOPE("shadow pass");
+			shadows.render();
+		}
+		shadows.bind();
+		modelShader.use();
 
-		// ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		{
+			PROFILE_SCOPE("scene pass");
+			PROFILE_GPU_SCOPE("scene pass");
+			if (packedGeometry)
+				packedModels.render(modelShader, &culler);
+			else
+			{
+				renderQueue.clear();
+				renderQueue.setView(camera.Position, 100.0f);
+				scene.enqueue(renderQueue, modelShader, uniformRing, culler, frameConstants.viewProjection, &lodSelection, &lodStats);
+				renderQueue.sort();
+				renderQueue.submit(uniformRing);
+			}
+		}
+
+		if (props)
+		{
+			PROFILE_SCOPE("instance pass");
+			PROFILE_GPU_SCOPE("instance pass");
+			props->cull(culler.frustum());
+			propShader->use();
+			props->render(*propShader);
+		}
+
+		if (textureStreamer.enabled())
+		{
+			PROFILE_SCOPE("texture streaming");
+			scene.requestTextures(textureStreamer, culler.frustum(), lodSelection);
+			textureStreamer.update();
+		}
+
+		if (pickRequested)
+		{
+			pickRequested = false;
+			ScenePick pick;
+			if (scene.pick(camera.GetPickingRay(0.0f, 0.0f, (float)SCR_WIDTH / (float)SCR_HEIGHT), pick))
+				std::cout << "PICK::INSTANCE: " << pick.instance << " MESH: " << pick.mesh << " TRIANGLE: " << pick.triangle
+					<< " DISTANCE: " << pick.distance << "\n";
+			else
+				std::cout << "PICK::NOTHING\n";
+		}
+
+		// draw skybox, its vertex shader removes the translation from the view matrix
+		{
+			PROFILE_SCOPE("skybox pass");
+			PROFILE_GPU_SCOPE("skybox pass");
+			skybox.draw();
+		}
+
+		{
+			PROFILE_SCOPE("plane pass");
+			PROFILE_GPU_SCOPE("plane pass");
+			planeShader.use();
+			glActiveTexture(GL_TEXTURE10);
+			glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+
+			model = glm::mat4(1.0f);
+			ObjectConstants planeConstants{};
+			planeConstants.model = model;
+			planeConstants.modelViewProjection = frameConstants.viewProjection * model;
+			planeConstants.normalMatrix = glm::mat3x4(1.0f);
+			uniformRing.bind(OBJECT_UNIFORM_BINDING, planeConstants);
+			glBindVertexArray(planeVAO);
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+		}
+
+		if (imgui)
+		{
+			PROFILE_SCOPE("imgui");
+			PROFILE_GPU_SCOPE("imgui");
+			ImGui_ImplOpenGL3_NewFrame();
+			ImGui_ImplGlfw_NewFrame();
+			ImGui::NewFrame();
+			if (showProfiler)
+				drawProfilerOverlay(Profiler::instance());
+			ImGui::Render();
+			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		}
+
+		// the GPU is done with this frame's constants once the fence behind its last draw signals
+		uniformRing.endFrame();
 
 		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 		// -------------------------------------------------------------------------------
-		glfwSwapBuffers(window);
+		{
+			PROFILE_SCOPE("swap");
+			if (benchmarkSettings.enabled)
+				frameBenchmark.endFrame();
+			else
+				glfwSwapBuffers(window);
+		}
 		glfwPollEvents();
 	}
 
+	int status = 0;
+	if (benchmarkSettings.enabled)
+		status = frameBenchmark.finish();
+
 	// optional: de-allocate all resources once they've outlived their purpose:
 	// ------------------------------------------------------------------------
-	glDeleteBuffers(1, &uboTransformMatrices);
+	if (imgui)
+	{
+		ImGui_ImplOpenGL3_Shutdown();
+		ImGui_ImplGlfw_Shutdown();
+		ImGui::DestroyContext();
+	}
+	Profiler::instance().shutdown();
 
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
 	glfwTerminate();
-	return 0;
+	return status;
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -231,18 +639,13 @@ inline void processInput(GLFWwindow* window)
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, true);
 
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
-		camera.ProcessKeyboard(FORWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
-		camera.ProcessKeyboard(BACKWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-		camera.ProcessKeyboard(LEFT, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-		camera.ProcessKeyboard(RIGHT, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-		camera.ProcessKeyboard(UP, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
-		camera.ProcessKeyboard(DOWN, deltaTime);
+	// the update step moves the camera while they are held
+	input.forward = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS;
+	input.backward = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS;
+	input.left = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS;
+	input.right = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS;
+	input.up = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+	input.down = glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -274,24 +677,42 @@ void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 	lastX = xpos;
 	lastY = ypos;
 
-	camera.ProcessMouseMovement(xoffset, yoffset);
+	input.mouseX += xoffset;
+	input.mouseY += yoffset;
 }
 
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
-	camera.ProcessMouseScroll(static_cast<float>(yoffset));
+	input.scroll += yoffset;
+}
+
+// glfw: left click requests a pick for the next frame
+// --------------------------------------------------
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+		pickRequested = true;
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
 		glfwSetWindowShouldClose(window, GLFW_TRUE);
 	}
+	if (key == GLFW_KEY_F5 && action == GLFW_PRESS) {
+		recordToggleRequested = true;
+	}
+	if (key == GLFW_KEY_F6 && action == GLFW_PRESS) {
+		profilerOverlayToggleRequested = true;
+	}
+	if (key == GLFW_KEY_F7 && action == GLFW_PRESS) {
+		traceDumpRequested = true;
+	}
 }
 
 
-inline void showFPS(GLFWwindow* pWindow)
+inline void showFPS(GLFWwindow* pWindow, const CullingStats& culling, const LODStats& lod, const TextureStreamingStats* streaming, const UniformRingStats& uniforms, const StateCacheStats& state, const LightClusterStats& lighting, const CascadedShadowMap& shadows)
 {
 	// Measure speed
 	float currentTime = static_cast<float>(glfwGetTime());
@@ -304,7 +725,22 @@ inline void showFPS(GLFWwindow* pWindow)
 		float fps = static_cast<float>(framesNumber) / deltaTime;
 
 		std::stringstream sstream;
-		sstream << "HaiBooLang     " << "[ " << fps << " FPS ]";
+		sstream << "HaiBooLang     " << "[ " << fps << " FPS ]" << "     [ " << culling.visible << " / " << culling.tested << " meshes ]" << "     [ LOD triangles";
+		for (unsigned int i = 0; i < MAX_LOD_COUNT; i++)
+			sstream << " " << lod.triangles[i];
+		sstream << " ]";
+		sstream << "     [ uniforms " << uniforms.frameBytes << " B/frame ]";
+		sstream << "     [ binds " << state.submitted() << ", " << state.filtered() << " filtered ]";
+		if (lighting.lights)
+			sstream << "     [ lights " << lighting.visibleLights << " / " << lighting.lights << ", " << lighting.indices << " in clusters, " << lighting.milliseconds << " ms ]";
+		// draws per cascade as static + dynamic, static only in frames that rebuilt the cache
+		sstream << "     [ shadows";
+		for (unsigned int i = 0; i < shadows.cascadeCount(); i++)
+			sstream << " " << shadows.stats[i].staticDraws << "+" << shadows.stats[i].dynamicDraws << " " << shadows.stats[i].gpuMilliseconds << " ms";
+		sstream << " ]";
+		if (streaming)
+			sstream << "     [ textures " << streaming->residentBytes / (1024 * 1024) << " / " << streaming->budgetBytes / (1024 * 1024) << " MB, "
+				<< streaming->fullyResident << " / " << streaming->textures << " full, " << streaming->pendingLoads << " loading ]";
 
 		glfwSetWindowTitle(pWindow, sstream.str().c_str());
 
@@ -334,12 +770,10 @@ inline nlohmann::json loadConfiguration(const std::string& filename)
 	return std::move(config);
 }
 
-inline GLFWwindow* initOpenGL(const std::string& path)
+inline GLFWwindow* initOpenGL(const nlohmann::json& config, bool headless, int contextAPI)
 {
 	GLFWwindow* window = nullptr;
 
-	nlohmann::json config = loadConfiguration(path);
-
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
@@ -351,6 +785,10 @@ inline GLFWwindow* initOpenGL(const std::string& path)
 		glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, GLFW_TRUE);
 	if (config["multiple_sample"] == true)
 		glfwWindowHint(GLFW_SAMPLES, config["multiple_sample_level"]);
+	// headless runs render offscreen, EGL or OSMesa contexts also work on Mesa llvmpipe without a GPU
+	glfwWindowHint(GLFW_CONTEXT_CREATION_API, contextAPI);
+	if (headless)
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
 	// glfw window creation
 	// -------------------- 
@@ -365,13 +803,16 @@ inline GLFWwindow* initOpenGL(const std::string& path)
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	glfwSetCursorPosCallback(window, mouse_callback);
 	glfwSetScrollCallback(window, scroll_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
+	glfwSetKeyCallback(window, key_callback);
 	if (config["swap_interval"] == false)
 		glfwSwapInterval(0);
 	if (config["glfw_decorated"] == false)
 		glfwSetWindowAttrib(window, GLFW_DECORATED, GLFW_FALSE);
 
 	// tell GLFW to capture our mouse
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	if (!headless)
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 	// GLAD: load all OpenGL function pointers
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))